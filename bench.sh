@@ -0,0 +1,197 @@
+#!/usr/bin/env bash
+
+# Compiles generated programs of growing size with -t json and reports how
+# the time of every phase grows, so quadratic paths show up before a real
+# program hits them.
+#
+#   ./bench.sh [-n SIZE] [-f FACTOR] [-r RUNS] [-e ENGINE] [SHAPE ...]
+#
+# Every shape is compiled with SIZE and FACTOR * SIZE statements (or levels,
+# terms, ...), keeping the fastest of RUNS runs. ENGINE is the flag passed to
+# lcc and defaults to -b. The shapes are listed by ./bench.sh -l.
+
+SHELL_GREEN="\033[0;32m"
+SHELL_RED="\033[0;31m"
+SHELL_WHITE="\033[0;0m"
+
+SIZE=20000
+FACTOR=4
+RUNS=3
+ENGINE=-b
+
+SHAPES=(variables nesting expression accesses elif print)
+
+# Each shape writes a program of size $1 to stdout
+
+# Many declarations, each one looked up by the next
+function gen_variables {
+    awk -v n=$1 'BEGIN {
+        print "int v0 ; 0 ;"
+        for (i = 1; i < n; i++)
+            printf "int v%d ; v%d + 1 ;\n", i, i - 1
+        printf "print \"[v%d]\\n\" ;\n", n - 1
+    }'
+}
+
+# if and while nested $1 levels deep, the innermost body runs once
+function gen_nesting {
+    awk -v n=$1 'BEGIN {
+        print "int x ; 0 ;"
+        for (i = 0; i < n; i++)
+            print (i % 2 ? "while x == 0" : "if x == 0")
+        print "add x ; 1 ;"
+        for (i = 0; i < n; i++)
+            print "end"
+        print "print \"[x]\\n\" ;"
+    }'
+}
+
+# One assignment with $1 terms
+function gen_expression {
+    awk -v n=$1 'BEGIN {
+        split("+ - * +", ops, " ")
+        print "int x ; 1 ;"
+        printf "set x ; x"
+        for (i = 1; i < n; i++)
+            printf " %s %d", ops[i % 4 + 1], i % 7 + 1
+        print " ;"
+        print "print \"[x]\\n\" ;"
+    }'
+}
+
+# $1 reads of array elements, like scaling_test in tests.sh
+function gen_accesses {
+    awk -v n=$1 'BEGIN {
+        print "array a ; 10 ;"
+        print "int i ; 0 ;"
+        for (k = 0; k < n; k++)
+            printf "add i ; a{%d} ;\n", k % 10
+    }'
+}
+
+# An if with $1 elif arms, where the last one is taken
+function gen_elif {
+    awk -v n=$1 'BEGIN {
+        printf "int x ; %d ;\n", n
+        print "int y ; 0 ;"
+        print "if x == 0"
+        print "set y ; 0 ;"
+        for (i = 1; i <= n; i++) {
+            printf "elif x == %d\n", i
+            printf "set y ; %d ;\n", i
+        }
+        print "else"
+        print "set y ; 0 - 1 ;"
+        print "end"
+        print "print \"[y]\\n\" ;"
+    }'
+}
+
+# $1 prints of formatted strings
+function gen_print {
+    awk -v n=$1 'BEGIN {
+        print "int i ; 0 ;"
+        print "double d ; 0.5f ;"
+        for (k = 0; k < n; k++) {
+            print "add i ; 1 ;"
+            print "print \"line [i] of the benchmark, d is [d]\\n\" ;"
+        }
+    }'
+}
+
+# Prints "phase wall_ms" for every phase of a -t json report, and the total
+function phase_times {
+    sed -n 's/^ *"\([a-z]*\)": { "entered": [0-9]*, "wall_ms": \([0-9.]*\).*/\1 \2/p' "$1"
+}
+
+# Compiles shape $1 at size $2 and prints the fastest time of every phase
+function measure {
+    local file=$(mktemp --suffix=.least)
+    local json="${file%.least}.time.json"
+    local times=""
+
+    gen_$1 $2 > "$file"
+
+    for (( run = 0; run < RUNS; run++ )); do
+        if ! ./lcc -q $ENGINE -t json "$file" > /dev/null; then
+            echo -e "${SHELL_RED}lcc failed on $1 with size $2${SHELL_WHITE}" >&2
+            rm -f "$file" "$json"
+            exit 1
+        fi
+        times+="$(phase_times "$json")"$'\n'
+    done
+
+    rm -f "$file" "$json" "${file%.least}" "${file%.least}.asm"
+
+    echo -n "$times" | awk '!($1 in best) { order[n++] = $1; best[$1] = $2 }
+        $2 < best[$1] { best[$1] = $2 }
+        END { for (i = 0; i < n; i++) print order[i], best[order[i]] }'
+}
+
+while getopts "n:f:r:e:lh" opt; do
+    case $opt in
+    n) SIZE=$OPTARG ;;
+    f) FACTOR=$OPTARG ;;
+    r) RUNS=$OPTARG ;;
+    e) ENGINE=$OPTARG ;;
+    l)
+        echo "${SHAPES[@]}"
+        exit
+        ;;
+    *)
+        sed -n '3,11s/^# \{0,1\}//p' "$0"
+        exit
+        ;;
+    esac
+done
+shift $(( OPTIND - 1 ))
+
+for shape in "$@"; do
+    if [ "$(type -t gen_$shape)" != "function" ]; then
+        echo "Unknown shape $shape, try one of: ${SHAPES[*]}"
+        exit 1
+    fi
+done
+
+if (( $# > 0 )); then
+    SHAPES=("$@")
+fi
+
+./build.sh > /dev/null || exit 1
+
+FAIL=0
+LARGE=$(( SIZE * FACTOR ))
+
+printf "%-12s%-12s%12s%12s%10s\n" "shape" "phase" "$SIZE" "$LARGE" "growth"
+
+for shape in "${SHAPES[@]}"; do
+    small=$(measure $shape $SIZE) || exit 1
+    large=$(measure $shape $LARGE) || exit 1
+
+    # FACTOR times the input may take FACTOR times as long, with twice that
+    # for noise and 5ms for phases too short to measure, but no more
+    flagged=$(awk -v shape=$shape -v factor=$FACTOR 'NR == FNR { small[$1] = $2; next }
+        {
+            growth = small[$1] > 0 ? $2 / small[$1] : 0
+            bad = $2 > 2 * factor * small[$1] + 5
+            printf "%-12s%-12s%10.2fms%10.2fms%9.1fx%s\n", shape, $1, small[$1], $2, growth, bad ? " super-linear" : ""
+            flagged += bad
+        }
+        END { exit flagged > 0 }' <(echo "$small") <(echo "$large"))
+    status=$?
+
+    if (( status != 0 )); then
+        echo -e "${SHELL_RED}${flagged}${SHELL_WHITE}"
+        FAIL=1
+    else
+        echo "$flagged"
+    fi
+done
+
+if (( FAIL == 1 )); then
+    echo -e "\n${SHELL_RED}Some phases grow faster than their input${SHELL_WHITE}"
+    exit 1
+else
+    echo -e "\n${SHELL_GREEN}Every phase grows linearly${SHELL_WHITE}"
+    exit 0
+fi
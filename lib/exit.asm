@@ -0,0 +1,13 @@
+section .text
+extern program_exit
+
+extern outbuf_flush
+
+; void program_exit(int status);
+; Write out what is still buffered and terminate
+program_exit:
+    push rdi
+    call outbuf_flush
+    pop rdi
+    mov rax, 60
+    syscall
@@ -1,45 +1,266 @@
 section .text
 
 extern fprint
+extern fprintp
+extern fprintw
 
-extern uprint
-extern putchar
+extern utoa_back
+extern outbuf_write
+extern pow10
+
+DEFAULT_PRECISION equ 6
+MAX_PRECISION equ 18
+LIMB equ 1000000000
+FRAME equ 688 ; the number's buffer, width, fill and the 36 limbs of .huge
 
 ; void fprint(double f);
 fprint:
-    cvttsd2si r8, xmm0 ; rax = (int) xmm0
+    mov rdi, DEFAULT_PRECISION
+
+; void fprintp(double f, unsigned long precision);
+fprintp:
+    xor rsi, rsi
+
+; void fprintw(double f, unsigned long precision, unsigned long width, char fill);
+; The number is put together in a buffer on the stack and written out at once.
+; It is padded with fill to at least width (<= 255) characters, zeros go after the sign.
+; All digits are exact, rounded to nearest with ties to even like printf.
+fprintw:
+    enter FRAME,0 ; sign, up to 309 integer digits, '.', MAX_PRECISION digits
+    mov [rbp - 392], rsi ; width
+    mov [rbp - 400], rdx ; fill
+    push rbx
+    push r12
+    push r13
+    push r14
+
+    cmp rdi, MAX_PRECISION
+    jbe .precision_ok
+    mov rdi, MAX_PRECISION
+.precision_ok:
+    mov r12, rdi
+    xor r14, r14 ; limbs of a huge integer part, none
 
-    mov rdi, r8
-    call uprint ; print integer part of number
+    ; Split off the sign
+    movq rax, xmm0
+    mov r13, rax
+    btr rax, 63
+    movq xmm0, rax
 
-    mov rdi, 46
-    call putchar ; putchar('.')
+    ucomisd xmm0, xmm0
+    jp .nan
+    ucomisd xmm0, [two63]
+    jae .huge
 
-    ; xmm2 = f - (int) f
-    movsd xmm2, xmm0
-    cvtsi2sd xmm1, r8
-    subsd xmm2, xmm1
+    ; Integer part, exact below 2^63
+    cvttsd2si rbx, xmm0
 
-    ; for (int i = 0; i < 6; i++)
-    mov r9, 0
-.loop:
-    mulsd xmm2, [ten] ; xmm2 *= 10
+    ; The fraction is F / 2^s, F being the mantissa bits below the binary point
+    movq rax, xmm0
+    mov rcx, rax
+    shr rcx, 52
+    mov rdx, 0x000FFFFFFFFFFFFF
+    and rax, rdx
+    test rcx, rcx
+    jz .subnormal
+    bts rax, 52
+    dec rcx
+.subnormal:
+    neg rcx
+    add rcx, 1074
+    jle .no_fraction
+    cmp rcx, 64
+    jae .scale
+    mov rdx, -1
+    shl rdx, cl
+    not rdx
+    and rax, rdx
 
-    cvttsd2si rdi, xmm2 ; rdi = (int) f
-    mov r8, rdi
+    ; Scale it exactly: rdx:rax = F * 10^precision < 2^113. Then move the
+    ; binary point between rdx and rax, bits shifted out make rax odd.
+.scale:
+    mul qword [pow10 + r12 * 8]
+    cmp rcx, 128
+    jae .no_fraction
+    sub rcx, 64
+    ja .shift_right
+    neg rcx
+    shld rdx, rax, cl
+    shl rax, cl
+    jmp .round
+.shift_right:
+    mov r8, rax
+    shrd rax, rdx, cl
+    shr rdx, cl
+    neg rcx
+    shl r8, cl
+    jz .round
+    or rax, 1
 
-    or dil, '0'
-    call putchar
+    ; Round to nearest, a tie to the even fraction or, without one, integer
+.round:
+    mov r8, rdx
+    test r12, r12
+    cmovz r8, rbx
+    and r8d, 1
+    mov rcx, 0x7FFFFFFFFFFFFFFF
+    add rcx, r8
+    add rax, rcx
+    adc rdx, 0
+    mov rax, rdx
+    cmp rax, [pow10 + r12 * 8]
+    jb .format
+    sub rax, [pow10 + r12 * 8] ; rounding carried into the integer part
+    inc rbx
+    jmp .format
 
-    ; xmm2 = f - (int) f
-    cvtsi2sd xmm0, r8
-    subsd xmm2, xmm0
+.no_fraction:
+    xor eax, eax
 
-    inc r9
-    cmp r9, 6
-    jl .loop
+.format:
+    mov rsi, rbp
+    test r12, r12
+    jz .integer_part
+    mov rdi, rax
+    mov rdx, r12
+    call utoa_back
+    dec rax
+    mov byte [rax], '.'
+    mov rsi, rax
+.integer_part:
+    test r14, r14
+    jnz .limbs
+    mov rdi, rbx
+    xor rdx, rdx
+    call utoa_back
+    jmp .pad
 
+    ; Nine digits per limb, the most significant without leading zeros
+.limbs:
+    xor ebx, ebx
+.next_limb:
+    mov rdi, [rbp - FRAME + rbx * 8]
+    inc rbx
+    mov edx, 9
+    xor ecx, ecx
+    cmp rbx, r14
+    cmove rdx, rcx
+    call utoa_back
+    mov rsi, rax
+    cmp rbx, r14
+    jb .next_limb
+
+.pad:
+    mov rdx, rbp
+    sub rdx, [rbp - 392] ; where the padded number has to start
+    cmp byte [rbp - 400], '0'
+    jne .sign
+    mov rcx, r13
+    shr rcx, 63
+    add rcx, rdx
+.zero_fill:
+    cmp rax, rcx
+    jbe .sign
+    dec rax
+    mov byte [rax], '0'
+    jmp .zero_fill
+.sign:
+    test r13, r13
+    jns .fill
+    dec rax
+    mov byte [rax], '-'
+.fill:
+    mov cl, [rbp - 400]
+.fill_next:
+    cmp rax, rdx
+    jbe .write
+    dec rax
+    mov [rax], cl
+    jmp .fill_next
+.write:
+    mov rdi, rax
+    mov rsi, rbp
+    sub rsi, rax
+    call outbuf_write
+.done:
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    leave
     ret
 
-section .data
-ten: dq 10.0
+    ; Too large for an integer register, but an integer: M * 2^e with e >= 11.
+    ; It is multiplied out exactly in limbs of base 10^9 at the bottom of the
+    ; frame, least significant first, r14 of them.
+.huge:
+    movq rax, xmm0
+    mov rcx, 0x7FF0000000000000
+    cmp rax, rcx
+    je .inf
+    mov r9, rax
+    shr r9, 52
+    sub r9, 1075
+    mov rdx, 0x000FFFFFFFFFFFFF
+    and rax, rdx
+    bts rax, 52
+    mov r8, LIMB
+    xor edx, edx
+    div r8
+    mov [rbp - FRAME], rdx
+    mov [rbp - FRAME + 8], rax
+    mov r14, 2
+.shift:
+    ; Up to 32 bits at a time, a limb shifted by that still fits
+    mov ecx, 32
+    cmp r9, rcx
+    cmovb rcx, r9
+    sub r9, rcx
+    xor r10, r10 ; carry
+    xor r11, r11
+.shift_limb:
+    mov rax, [rbp - FRAME + r11 * 8]
+    shl rax, cl
+    add rax, r10
+    xor edx, edx
+    div r8
+    mov [rbp - FRAME + r11 * 8], rdx
+    mov r10, rax
+    inc r11
+    cmp r11, r14
+    jb .shift_limb
+.carry:
+    test r10, r10
+    jz .shifted
+    mov rax, r10
+    xor edx, edx
+    div r8
+    mov [rbp - FRAME + r14 * 8], rdx
+    inc r14
+    mov r10, rax
+    jmp .carry
+.shifted:
+    test r9, r9
+    jnz .shift
+    jmp .no_fraction
+
+.inf:
+    mov rsi, inf_str
+    jmp .special
+.nan:
+    xor r13, r13 ; printed without a sign
+    mov rsi, nan_str
+    ; Padded like the digits, but zeros would make it look like a number
+.special:
+    mov ax, [rsi]
+    mov [rbp - 3], ax
+    mov al, [rsi + 2]
+    mov [rbp - 1], al
+    lea rax, [rbp - 3]
+    mov byte [rbp - 400], ' '
+    jmp .pad
+
+section .rodata
+nan_str: db "nan"
+inf_str: db "inf"
+two63: dq 9223372036854775808.0
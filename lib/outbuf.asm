@@ -0,0 +1,133 @@
+section .text
+
+extern outbuf_write
+extern outbuf_flush
+extern outbuf_reserve
+
+OUTBUF_SIZE equ 65536
+
+MODE_UNKNOWN equ 0
+MODE_FULL equ 1
+MODE_LINE equ 2
+
+; void outbuf_flush(void);
+outbuf_flush:
+    mov rdx, [outbuf_len]
+    test rdx, rdx
+    jz .done
+    mov rsi, outbuf
+.write:
+    mov rax, 1
+    mov rdi, 1
+    syscall
+    test rax, rax
+    jle .drop ; error: there is nobody left to complain to
+    add rsi, rax
+    sub rdx, rax
+    jnz .write
+.drop:
+    mov qword [outbuf_len], 0
+.done:
+    ret
+
+; void outbuf_write(const char *s, size_t len);
+outbuf_write:
+    cmp byte [outbuf_mode], MODE_UNKNOWN
+    jne .mode_known
+    push rdi
+    push rsi
+    call outbuf_detect_mode
+    pop rsi
+    pop rdi
+.mode_known:
+    mov rax, [outbuf_len]
+    lea rcx, [rax + rsi]
+    cmp rcx, OUTBUF_SIZE
+    jbe .append
+
+    ; Does not fit: make room
+    push rdi
+    push rsi
+    call outbuf_flush
+    pop rsi
+    pop rdi
+    xor rax, rax
+    cmp rsi, OUTBUF_SIZE
+    jbe .append
+
+    ; Larger than the whole buffer: bypass it
+    mov rdx, rsi
+    mov rsi, rdi
+.direct:
+    mov rax, 1
+    mov rdi, 1
+    syscall
+    test rax, rax
+    jle .done
+    add rsi, rax
+    sub rdx, rax
+    jnz .direct
+    ret
+
+.append:
+    mov rdx, rsi
+    mov rcx, rsi
+    mov rsi, rdi
+    lea rdi, [outbuf + rax]
+    add rax, rcx
+    mov [outbuf_len], rax
+    rep movsb
+
+    cmp byte [outbuf_mode], MODE_LINE
+    jne .done
+    test rdx, rdx
+    jz .done
+
+    ; Line buffered: flush if we just appended a newline
+    mov rcx, rdx
+    sub rdi, rdx
+    mov al, 10
+    repne scasb
+    jne .done
+    jmp outbuf_flush
+.done:
+    ret
+
+; char *outbuf_reserve(size_t len);
+; Claim len (<= OUTBUF_SIZE) bytes at the end of the buffer for the caller to
+; fill in and return their address
+outbuf_reserve:
+    mov rax, [outbuf_len]
+    lea rcx, [rax + rdi]
+    cmp rcx, OUTBUF_SIZE
+    jbe .claim
+    push rdi
+    call outbuf_flush
+    pop rdi
+    xor rax, rax
+    mov rcx, rdi
+.claim:
+    mov [outbuf_len], rcx
+    lea rax, [outbuf + rax]
+    ret
+
+; Stdout is line buffered if it is a terminal and fully buffered otherwise
+outbuf_detect_mode:
+    enter 64,0 ; struct termios
+    mov rax, 16 ; ioctl
+    mov rdi, 1
+    mov rsi, 0x5401 ; TCGETS
+    mov rdx, rsp
+    syscall
+    mov byte [outbuf_mode], MODE_FULL
+    test rax, rax
+    jnz .done
+    mov byte [outbuf_mode], MODE_LINE
+.done:
+    leave
+    ret
+
+section .bss
+outbuf: resb OUTBUF_SIZE
+outbuf_len: resq 1
+outbuf_mode: resb 1
@@ -1,14 +1,14 @@
 section .text
 extern putchar
 
+extern outbuf_write
+
 ; void putchar(char c);
 putchar:
-    enter 1,0
+    enter 16,0
     mov byte [rsp], dil
-    mov rsi, rsp
-    mov rax, 1
-    mov rdi, 1
-    mov rdx, 1
-    syscall
+    mov rdi, rsp
+    mov rsi, 1
+    call outbuf_write
     leave
     ret
@@ -0,0 +1,83 @@
+section .text
+
+extern print_template
+
+extern outbuf_write
+extern iprintw
+extern fprintw
+
+; Kinds of template pieces, see TemplatePiece in src/x86_64.cpp
+TP_LITERAL equ 0
+TP_INT equ 1
+TP_DOUBLE equ 2
+TP_STRVAR equ 3
+
+PIECE_SIZE equ 40
+
+; struct template {
+;     long n_pieces;
+;     struct { long kind, a, b, width, fill; } pieces[n_pieces];
+; };
+;
+; TP_LITERAL: a = string, b = length
+; TP_INT:     a = index into args
+; TP_DOUBLE:  a = index into args, b = precision
+; TP_STRVAR:  a = string, b = address of the length
+; Numbers are padded with fill to be at least width characters long
+
+; void print_template(const struct template *t, const long *args);
+print_template:
+    push rbx
+    push r12
+    push r13
+    mov rbx, [rdi]
+    lea r12, [rdi + 8]
+    mov r13, rsi
+
+.next:
+    test rbx, rbx
+    jz .done
+    mov rax, [r12]
+    cmp rax, TP_LITERAL
+    je .literal
+    cmp rax, TP_INT
+    je .int
+    cmp rax, TP_DOUBLE
+    je .double
+
+    ; TP_STRVAR
+    mov rdi, [r12 + 8]
+    mov rsi, [r12 + 16]
+    mov rsi, [rsi]
+    call outbuf_write
+    jmp .advance
+.literal:
+    mov rdi, [r12 + 8]
+    mov rsi, [r12 + 16]
+    call outbuf_write
+    jmp .advance
+.int:
+    mov rax, [r12 + 8]
+    mov rdi, [r13 + rax * 8]
+    mov rsi, [r12 + 24]
+    mov rdx, [r12 + 32]
+    call iprintw
+    jmp .advance
+.double:
+    mov rax, [r12 + 8]
+    movq xmm0, [r13 + rax * 8]
+    mov rdi, [r12 + 16]
+    mov rsi, [r12 + 24]
+    mov rdx, [r12 + 32]
+    call fprintw
+
+.advance:
+    add r12, PIECE_SIZE
+    dec rbx
+    jmp .next
+
+.done:
+    pop r13
+    pop r12
+    pop rbx
+    ret
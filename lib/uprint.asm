@@ -1,28 +1,171 @@
 section .text
 extern uprint
+extern iprint
+extern iprintw
+extern utoa_back
+extern pow10
 
-; void uprint(unsigned int n);
+extern outbuf_reserve
+
+; void iprint(long n);
+iprint:
+	xor rsi, rsi
+
+; void iprintw(long n, unsigned long width, char fill);
+; Pad n with fill to at least width characters. Zeros go after the sign.
+iprintw:
+	mov r8, rdi
+	test rdi, rdi
+	jns uprint_core
+	neg rdi
+	jmp uprint_core
+
+; void uprint(unsigned long n);
 uprint:
-	enter 32,0
+	xor rsi, rsi
+	xor r8, r8
+
+; rdi: magnitude to print, r8: negative if it needs a '-' in front,
+; rsi: width, dl: fill
+uprint_core:
+	push rbx
+	push r12
+	push r13
+	push r14
+	push r15
+	mov rbx, rdi
+	mov r13, r8
+	mov r14, rsi
+	mov r15, rdx
+
+	; Number of digits: approximate log10 from log2 and correct it
+	; with a table of powers of ten
 	mov rax, rdi
-	mov rdi, rbp
-	mov rcx, 10
+	or rax, 1
+	bsr rcx, rax
+	inc rcx
+	imul rcx, rcx, 1233 ; 1233 / 4096 ~ log10(2)
+	shr rcx, 12
+	cmp rax, [pow10 + rcx * 8]
+	sbb rcx, -1
 
-.div:
+	; Room for the sign and the padding
+	mov r12, r13
+	shr r12, 63
+	add r12, rcx
+	cmp r12, r14
+	cmovb r12, r14
+
+	mov rdi, r12
+	call outbuf_reserve
+
+	lea rsi, [rax + r12]
+	mov r12, rax
+	mov rdi, rbx
 	xor rdx, rdx
-	div rcx
-	or dl, '0'
+
+	cmp r15b, '0'
+	jne .digits
+	mov rdx, rsi
+	sub rdx, r12
+	mov rcx, r13
+	shr rcx, 63
+	sub rdx, rcx
+.digits:
+	call utoa_back
+
+	test r13, r13
+	jns .fill
+	dec rax
+	mov byte [rax], '-'
+.fill:
+	cmp rax, r12
+	jbe .done
+	dec rax
+	mov [rax], r15b
+	jmp .fill
+.done:
+	pop r15
+	pop r14
+	pop r13
+	pop r12
+	pop rbx
+	ret
+
+; char *utoa_back(unsigned long n, char *end, size_t min_digits);
+; Write the digits of n so that they end right before end, padded with
+; leading zeros to at least min_digits, and return where they begin
+utoa_back:
+	mov rax, rdi
+	mov rdi, rsi
+	mov r10, rdx
+	mov r9, 0x28F5C28F5C28F5C3 ; n / 100 == ((n >> 2) * r9) >> 66
+
+	; Two digits per iteration from the back
+.two_digits:
+	cmp rax, 100
+	jb .last_digits
+	mov rcx, rax
+	shr rax, 2
+	mul r9
+	mov rax, rdx
+	shr rax, 2
+	imul rdx, rax, 100
+	sub rcx, rdx
+	movzx ecx, word [digit_pairs + rcx * 2]
+	sub rdi, 2
+	mov [rdi], cx
+	jmp .two_digits
+
+.last_digits:
+	cmp rax, 10
+	jb .one_digit
+	movzx ecx, word [digit_pairs + rax * 2]
+	sub rdi, 2
+	mov [rdi], cx
+	jmp .pad
+.one_digit:
+	add al, '0'
 	dec rdi
-	mov [rdi], dl
-	test rax, rax
-	jnz .div
-
-	mov rsi, rdi
-	mov rax, 1
-	mov rdi, 1
-	mov rdx, rbp
-	sub rdx, rsi
-	syscall
-	
-	leave
+	mov [rdi], al
+
+.pad:
+	sub rsi, r10
+.pad_zero:
+	cmp rdi, rsi
+	jbe .done
+	dec rdi
+	mov byte [rdi], '0'
+	jmp .pad_zero
+.done:
+	mov rax, rdi
 	ret
+
+section .rodata
+digit_pairs:
+	db "0001020304050607080910111213141516171819"
+	db "2021222324252627282930313233343536373839"
+	db "4041424344454647484950515253545556575859"
+	db "6061626364656667686970717273747576777879"
+	db "8081828384858687888990919293949596979899"
+pow10:
+	dq 1
+	dq 10
+	dq 100
+	dq 1000
+	dq 10000
+	dq 100000
+	dq 1000000
+	dq 10000000
+	dq 100000000
+	dq 1000000000
+	dq 10000000000
+	dq 100000000000
+	dq 1000000000000
+	dq 10000000000000
+	dq 100000000000000
+	dq 1000000000000000
+	dq 10000000000000000
+	dq 100000000000000000
+	dq 1000000000000000000
+	dq 10000000000000000000
@@ -0,0 +1,1232 @@
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <optional>
+
+#include <fmt/core.h>
+
+#include "assembler.hpp"
+#include "util.hpp"
+
+namespace assembler {
+
+static const uint64_t PAGE_SIZE = 4096;
+static const uint64_t SECTION_ALIGN = 16;
+
+static const std::string_view reg64_names[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+static const std::string_view reg32_names[16] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+static const std::string_view reg16_names[16] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+static const std::string_view reg8_names[16] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+
+/* The number in the ModRM reg field of the 'op r/m, imm' and 'op r/m, r' forms */
+static const std::map<std::string_view, int> alu_ops {
+    { "add", 0 }, { "or", 1 }, { "adc", 2 }, { "sbb", 3 },
+    { "and", 4 }, { "sub", 5 }, { "xor", 6 }, { "cmp", 7 },
+};
+
+static const std::map<std::string_view, int> unary_ops {
+    { "not", 2 }, { "neg", 3 }, { "mul", 4 }, { "imul", 5 }, { "div", 6 }, { "idiv", 7 },
+};
+
+static const std::map<std::string_view, int> shift_ops {
+    { "rol", 0 }, { "ror", 1 }, { "shl", 4 }, { "sal", 4 }, { "shr", 5 }, { "sar", 7 },
+};
+
+/* Double precision shifts: the opcode after 0x0F of the imm8 form, the cl form is one more */
+static const std::map<std::string_view, uint8_t> double_shift_ops {
+    { "shld", 0xA4 }, { "shrd", 0xAC },
+};
+
+static const std::map<std::string_view, int> bit_test_ops {
+    { "bt", 4 }, { "bts", 5 }, { "btr", 6 }, { "btc", 7 },
+};
+
+static const std::map<std::string_view, int> cond_codes {
+    { "o", 0x0 }, { "no", 0x1 }, { "b", 0x2 }, { "c", 0x2 }, { "nae", 0x2 }, { "ae", 0x3 },
+    { "nb", 0x3 }, { "nc", 0x3 }, { "e", 0x4 }, { "z", 0x4 }, { "ne", 0x5 }, { "nz", 0x5 },
+    { "be", 0x6 }, { "na", 0x6 }, { "a", 0x7 }, { "nbe", 0x7 }, { "s", 0x8 }, { "ns", 0x9 },
+    { "p", 0xA }, { "pe", 0xA }, { "np", 0xB }, { "po", 0xB }, { "l", 0xC }, { "nge", 0xC },
+    { "ge", 0xD }, { "nl", 0xD }, { "le", 0xE }, { "ng", 0xE }, { "g", 0xF }, { "nle", 0xF },
+};
+
+/* Scalar double instructions: mandatory prefix and opcode after 0x0F */
+static const std::map<std::string_view, std::pair<uint8_t, uint8_t>> sse_ops {
+    { "addsd", { 0xF2, 0x58 } }, { "mulsd", { 0xF2, 0x59 } }, { "subsd", { 0xF2, 0x5C } },
+    { "divsd", { 0xF2, 0x5E } }, { "sqrtsd", { 0xF2, 0x51 } }, { "minsd", { 0xF2, 0x5D } },
+    { "maxsd", { 0xF2, 0x5F } }, { "comisd", { 0x66, 0x2F } }, { "ucomisd", { 0x66, 0x2E } },
+    { "andpd", { 0x66, 0x54 } }, { "orpd", { 0x66, 0x56 } }, { "xorpd", { 0x66, 0x57 } },
+    { "pxor", { 0x66, 0xEF } },
+};
+
+static const std::map<std::string_view, std::vector<uint8_t>> no_operand_insns {
+    { "ret", { 0xC3 } }, { "syscall", { 0x0F, 0x05 } }, { "leave", { 0xC9 } },
+    { "cqo", { 0x48, 0x99 } }, { "cdq", { 0x99 } }, { "nop", { 0x90 } }, { "int3", { 0xCC } },
+    { "ud2", { 0x0F, 0x0B } }, { "movsb", { 0xA4 } }, { "movsq", { 0x48, 0xA5 } },
+    { "stosb", { 0xAA } }, { "stosq", { 0x48, 0xAB } }, { "scasb", { 0xAE } }, { "cmpsb", { 0xA6 } },
+};
+
+/* The instructions which can have a rep prefix */
+static const std::vector<std::string_view> string_insns {
+    "movsb", "movsq", "stosb", "stosq", "scasb", "cmpsb",
+};
+
+static const std::pair<std::string_view, int> size_keywords[] = {
+    { "byte", 1 }, { "word", 2 }, { "dword", 4 }, { "qword", 8 },
+};
+
+static std::string_view trim(std::string_view s)
+{
+    size_t start = s.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos)
+        return {};
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(start, end - start + 1);
+}
+
+static bool is_ident_start(char c)
+{
+    return std::isalpha((unsigned char)c) || c == '_' || c == '.' || c == '?' || c == '@';
+}
+
+static bool is_ident_char(char c)
+{
+    return is_ident_start(c) || std::isdigit((unsigned char)c) || c == '$' || c == '#' || c == '~';
+}
+
+static bool is_quote(char c)
+{
+    return c == '"' || c == '\'' || c == '`';
+}
+
+static bool fits_int8(int64_t v)
+{
+    return v >= INT8_MIN && v <= INT8_MAX;
+}
+
+static bool fits_int32(int64_t v)
+{
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+static uint64_t align_up(uint64_t v, uint64_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+static void put_le(uint8_t* p, uint64_t v, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        p[i] = (v >> (i * 8)) & 0xFF;
+}
+
+/* Split at commas which are not inside quotes or brackets */
+static std::vector<std::string_view> split_operands(std::string_view s)
+{
+    std::vector<std::string_view> res;
+    if (trim(s).empty())
+        return res;
+
+    char quote = 0;
+    int depth = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+        } else if (is_quote(c)) {
+            quote = c;
+        } else if (c == '[' || c == '(') {
+            depth++;
+        } else if (c == ']' || c == ')') {
+            depth--;
+        } else if (c == ',' && depth == 0) {
+            res.push_back(trim(s.substr(start, i - start)));
+            start = i + 1;
+        }
+    }
+    res.push_back(trim(s.substr(start)));
+
+    return res;
+}
+
+static std::optional<Assembler::Register> parse_register(std::string_view s)
+{
+    if (s.size() < 2 || s.size() > 5)
+        return std::nullopt;
+
+    for (int i = 0; i < 16; i++) {
+        if (s == reg64_names[i])
+            return Assembler::Register { i, 8, false, false };
+        if (s == reg32_names[i])
+            return Assembler::Register { i, 4, false, false };
+        if (s == reg16_names[i])
+            return Assembler::Register { i, 2, false, false };
+        if (s == reg8_names[i])
+            return Assembler::Register { i, 1, false, i >= 4 && i < 8 };
+    }
+
+    if (s.starts_with("xmm")) {
+        int n;
+        auto [ptr, ec] = std::from_chars(s.data() + 3, s.data() + s.size(), n);
+        if (ec == std::errc() && ptr == s.data() + s.size() && n >= 0 && n < 16)
+            return Assembler::Register { n, 16, true, false };
+    }
+
+    return std::nullopt;
+}
+
+static Assembler::Value number(int64_t n)
+{
+    Assembler::Value v;
+    v.constant = n;
+    return v;
+}
+
+/* Add or subtract b from a. Only the difference of two labels in the same
+ * section can be folded, everything else needs at most one symbol. */
+static bool combine(Assembler::Value& a, const Assembler::Value& b, bool subtract)
+{
+    if (b.is_constant()) {
+        a.constant += subtract ? -b.constant : b.constant;
+        return true;
+    }
+
+    if (subtract) {
+        if (a.known && b.known && a.section == b.section) {
+            a = number((int64_t)(a.offset - b.offset) + a.constant - b.constant);
+            return true;
+        }
+        return false;
+    }
+
+    if (a.is_constant()) {
+        int64_t c = a.constant;
+        a = b;
+        a.constant += c;
+        return true;
+    }
+
+    return false;
+}
+
+/* A decimal number with a fraction or exponent, only allowed in dq */
+static bool is_float_literal(std::string_view s)
+{
+    if (!s.empty() && (s[0] == '-' || s[0] == '+'))
+        s.remove_prefix(1);
+    if (s.empty() || !std::isdigit((unsigned char)s[0]) || s.starts_with("0x") || s.starts_with("0X"))
+        return false;
+    return s.find_first_of(".eE") != std::string_view::npos;
+}
+
+template<typename... args>
+void Assembler::error(std::string_view format, args&&... fargs)
+{
+    m_c_info.err.set_file(m_modules[m_module].name);
+    m_c_info.err.set_line(m_line - 1);
+    m_c_info.err.error(format, std::forward<args>(fargs)...);
+}
+
+void Assembler::add_module(std::string_view source, std::string_view name)
+{
+    m_modules.push_back({ std::string(name), {}, {} });
+    m_module = m_modules.size() - 1;
+    m_section = S_TEXT;
+    m_last_label.clear();
+    m_line = 0;
+
+    /* Every module starts aligned in every section */
+    m_sections[S_TEXT].resize(align_up(m_sections[S_TEXT].size(), SECTION_ALIGN), 0x90);
+    m_sections[S_RODATA].resize(align_up(m_sections[S_RODATA].size(), SECTION_ALIGN), 0);
+    m_sections[S_DATA].resize(align_up(m_sections[S_DATA].size(), SECTION_ALIGN), 0);
+    m_bss_size = align_up(m_bss_size, SECTION_ALIGN);
+
+    size_t start = 0;
+    while (start <= source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == std::string_view::npos)
+            end = source.size();
+
+        m_line++;
+        assemble_line(source.substr(start, end - start));
+        start = end + 1;
+    }
+
+    /* Make the labels this module declared visible to the others */
+    Module& mod = m_modules.back();
+    for (const auto& declared : mod.declared) {
+        auto sym = mod.symbols.find(declared);
+        if (sym == mod.symbols.end())
+            continue;
+
+        auto [global, inserted] = m_globals.try_emplace(declared, m_module, sym->second);
+        if (!inserted)
+            error("Symbol '{}' is already defined in '{}'", declared, m_modules[global->second.first].name);
+    }
+}
+
+std::string Assembler::full_name(std::string_view name) const
+{
+    if (name.starts_with('.'))
+        return m_last_label + std::string(name);
+    return std::string(name);
+}
+
+size_t Assembler::section_size() const
+{
+    return m_section == S_BSS ? m_bss_size : m_sections[m_section].size();
+}
+
+const Assembler::Symbol* Assembler::lookup(size_t module, std::string_view name) const
+{
+    const Module& mod = m_modules[module];
+    if (auto local = mod.symbols.find(name); local != mod.symbols.end())
+        return &local->second;
+    if (auto global = m_globals.find(name); global != m_globals.end())
+        return &global->second.second;
+    return nullptr;
+}
+
+void Assembler::define_label(std::string_view name, Symbol sym)
+{
+    std::string full = full_name(name);
+    if (!m_modules.back().symbols.emplace(full, sym).second)
+        error("Symbol '{}' is already defined", full);
+}
+
+void Assembler::assemble_line(std::string_view line)
+{
+    /* Strip the comment */
+    char quote = 0;
+    size_t comment = 0;
+    for (; comment < line.size(); comment++) {
+        char c = line[comment];
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+        } else if (is_quote(c)) {
+            quote = c;
+        } else if (c == ';') {
+            break;
+        }
+    }
+    line = trim(line.substr(0, comment));
+    if (line.empty())
+        return;
+
+    size_t ident_end = 0;
+    while (ident_end < line.size() && is_ident_char(line[ident_end]))
+        ident_end++;
+    std::string_view first = line.substr(0, ident_end);
+    std::string_view rest = trim(line.substr(ident_end));
+
+    bool is_label = !first.empty() && rest.starts_with(':');
+    if (is_label)
+        rest = trim(rest.substr(1));
+
+    /* 'name equ value' and 'name: equ value' */
+    if (!first.empty() && rest.starts_with("equ") && (rest.size() == 3 || std::isspace((unsigned char)rest[3]))) {
+        Value v = evaluate(rest.substr(3));
+        if (!v.is_constant())
+            error("'{}' is not a constant", first);
+        define_label(first, { Symbol::Constant, S_TEXT, (uint64_t)v.constant });
+        return;
+    }
+
+    if (is_label) {
+        define_label(first, { Symbol::Label, m_section, section_size() });
+        if (!first.starts_with('.'))
+            m_last_label = first;
+
+        line = rest;
+        if (line.empty())
+            return;
+    }
+
+    size_t space = line.find_first_of(" \t");
+    std::string_view mnemonic = line.substr(0, space);
+    std::string_view operands = space == std::string_view::npos ? "" : trim(line.substr(space));
+
+    if (mnemonic == "section") {
+        if (operands == ".text")
+            m_section = S_TEXT;
+        else if (operands == ".rodata")
+            m_section = S_RODATA;
+        else if (operands == ".data")
+            m_section = S_DATA;
+        else if (operands == ".bss")
+            m_section = S_BSS;
+        else
+            error("Unknown section '{}'", operands);
+    } else if (mnemonic == "global" || mnemonic == "extern") {
+        for (auto name : split_operands(operands))
+            m_modules.back().declared.emplace(name);
+    } else if (mnemonic == "db") {
+        directive_data(operands, 1);
+    } else if (mnemonic == "dw") {
+        directive_data(operands, 2);
+    } else if (mnemonic == "dd") {
+        directive_data(operands, 4);
+    } else if (mnemonic == "dq") {
+        directive_data(operands, 8);
+    } else if (mnemonic.size() == 4 && mnemonic.starts_with("res")) {
+        static const std::string_view units = "b_w_d___q";
+        size_t unit = units.find(mnemonic[3]) + 1;
+        Value count = evaluate(operands);
+        if (unit == 0 || mnemonic[3] == '_')
+            error("Unknown directive '{}'", mnemonic);
+        if (!count.is_constant() || count.constant < 0)
+            error("'{}' needs a constant size", mnemonic);
+
+        if (m_section == S_BSS)
+            m_bss_size += count.constant * unit;
+        else
+            bytes().resize(bytes().size() + count.constant * unit, 0);
+    } else if (mnemonic == "align") {
+        Value alignment = evaluate(operands);
+        if (!alignment.is_constant() || !std::has_single_bit((uint64_t)alignment.constant))
+            error("Alignment has to be a power of two");
+
+        if (m_section == S_BSS)
+            m_bss_size = align_up(m_bss_size, alignment.constant);
+        else
+            bytes().resize(align_up(bytes().size(), alignment.constant), m_section == S_TEXT ? 0x90 : 0);
+    } else {
+        uint8_t rep_prefix = 0;
+        if (mnemonic == "rep" || mnemonic == "repe" || mnemonic == "repz")
+            rep_prefix = 0xF3;
+        else if (mnemonic == "repne" || mnemonic == "repnz")
+            rep_prefix = 0xF2;
+
+        if (rep_prefix) {
+            space = operands.find_first_of(" \t");
+            mnemonic = operands.substr(0, space);
+            operands = space == std::string_view::npos ? "" : trim(operands.substr(space));
+        }
+
+        std::vector<Operand> ops;
+        for (auto op : split_operands(operands))
+            ops.push_back(parse_operand(op));
+
+        instruction(mnemonic, ops, rep_prefix);
+    }
+}
+
+void Assembler::directive_data(std::string_view operands, size_t unit)
+{
+    for (auto item : split_operands(operands)) {
+        if (item.empty())
+            error("Empty value in data definition");
+
+        if (is_quote(item[0])) {
+            if (item.size() < 2 || item.back() != item[0])
+                error("Unterminated string {}", item);
+            auto str = item.substr(1, item.size() - 2);
+            bytes().insert(bytes().end(), str.begin(), str.end());
+            bytes().resize(align_up(bytes().size(), unit), 0);
+        } else if (unit == 8 && is_float_literal(item)) {
+            emit_le(std::bit_cast<uint64_t>(std::strtod(std::string(item).c_str(), nullptr)), 8);
+        } else {
+            emit_value(evaluate(item), unit, unit == 8 ? Fixup::Abs64 : Fixup::Abs32);
+        }
+    }
+}
+
+Assembler::Operand Assembler::parse_operand(std::string_view text)
+{
+    Operand op;
+
+    for (const auto& [keyword, size] : size_keywords) {
+        if (text.starts_with(keyword) && text.size() > keyword.size() && (text[keyword.size()] == ' ' || text[keyword.size()] == '[')) {
+            op.size = size;
+            text = trim(text.substr(keyword.size()));
+            break;
+        }
+    }
+
+    if (!text.starts_with('[')) {
+        if (auto reg = parse_register(text)) {
+            op.kind = Operand::Reg;
+            op.reg = *reg;
+            op.size = reg->size;
+        } else {
+            op.kind = Operand::Imm;
+            op.value = evaluate(text);
+        }
+        return op;
+    }
+
+    if (!text.ends_with(']'))
+        error("Missing ']' in '{}'", text);
+    op.kind = Operand::Mem;
+
+    /* Sum of registers, scaled registers and values */
+    std::string_view inner = text.substr(1, text.size() - 2);
+    bool subtract = false;
+    size_t start = 0;
+    while (start <= inner.size()) {
+        size_t end = start;
+        while (end < inner.size() && (end == start || (inner[end] != '+' && inner[end] != '-')))
+            end++;
+        std::string_view term = trim(inner.substr(start, end - start));
+
+        std::optional<Register> reg;
+        int64_t scale = 1;
+        if (size_t star = term.find('*'); star != std::string_view::npos) {
+            std::string_view left = trim(term.substr(0, star));
+            std::string_view right = trim(term.substr(star + 1));
+            if ((reg = parse_register(left))) {
+                scale = evaluate(right).constant;
+            } else if ((reg = parse_register(right))) {
+                scale = evaluate(left).constant;
+            }
+        } else {
+            reg = parse_register(term);
+        }
+
+        if (reg) {
+            if (subtract || reg->size != 8 || reg->xmm)
+                error("Invalid address '{}'", text);
+
+            if (scale == 1 && op.base == -1) {
+                op.base = reg->num;
+            } else if (op.index == -1 && (scale == 1 || scale == 2 || scale == 4 || scale == 8)) {
+                op.index = reg->num;
+                op.scale = scale;
+            } else {
+                error("Invalid address '{}'", text);
+            }
+        } else if (!combine(op.value, evaluate(term), subtract)) {
+            error("Invalid address '{}'", text);
+        }
+
+        if (end >= inner.size())
+            break;
+        subtract = inner[end] == '-';
+        start = end + 1;
+    }
+
+    /* rsp can only be a base */
+    if (op.index == 4) {
+        if (op.scale != 1 || op.base == 4)
+            error("Invalid address '{}'", text);
+        std::swap(op.base, op.index);
+    }
+
+    return op;
+}
+
+Assembler::Value Assembler::evaluate(std::string_view expr)
+{
+    std::string_view s = trim(expr);
+    Value v = parse_sum(s);
+    if (!trim(s).empty())
+        error("Unexpected '{}' in expression '{}'", trim(s), expr);
+    return v;
+}
+
+Assembler::Value Assembler::parse_sum(std::string_view& s)
+{
+    Value v = parse_product(s);
+    while (true) {
+        s = trim(s);
+        if (s.empty() || (s[0] != '+' && s[0] != '-'))
+            return v;
+
+        bool subtract = s[0] == '-';
+        s.remove_prefix(1);
+        if (!combine(v, parse_product(s), subtract))
+            error("Invalid use of symbols in expression");
+    }
+}
+
+Assembler::Value Assembler::parse_product(std::string_view& s)
+{
+    Value v = parse_primary(s);
+    while (true) {
+        s = trim(s);
+        if (s.empty() || (s[0] != '*' && s[0] != '/'))
+            return v;
+
+        char op = s[0];
+        s.remove_prefix(1);
+        Value right = parse_primary(s);
+        if (!v.is_constant() || !right.is_constant())
+            error("Only numbers can be multiplied or divided");
+
+        if (op == '*') {
+            v.constant *= right.constant;
+        } else {
+            if (right.constant == 0)
+                error("Division by zero in expression");
+            v.constant /= right.constant;
+        }
+    }
+}
+
+Assembler::Value Assembler::parse_primary(std::string_view& s)
+{
+    s = trim(s);
+    if (s.empty())
+        error("Expected a value");
+
+    char c = s[0];
+
+    if (c == '-' || c == '+') {
+        s.remove_prefix(1);
+        Value v = parse_primary(s);
+        if (c == '-') {
+            if (!v.is_constant())
+                error("Cannot negate a symbol");
+            v.constant = -v.constant;
+        }
+        return v;
+    }
+
+    if (c == '(') {
+        s.remove_prefix(1);
+        Value v = parse_sum(s);
+        s = trim(s);
+        if (!s.starts_with(')'))
+            error("Missing ')' in expression");
+        s.remove_prefix(1);
+        return v;
+    }
+
+    /* Character constants are little endian */
+    if (is_quote(c)) {
+        size_t end = s.find(c, 1);
+        if (end == std::string_view::npos || end > 9)
+            error("Invalid character constant {}", s);
+        Value v;
+        for (size_t i = 1; i < end; i++)
+            v.constant |= (int64_t)(uint8_t)s[i] << ((i - 1) * 8);
+        s.remove_prefix(end + 1);
+        return v;
+    }
+
+    if (std::isdigit((unsigned char)c)) {
+        int base = 10;
+        if (s.starts_with("0x") || s.starts_with("0X")) {
+            base = 16;
+            s.remove_prefix(2);
+        }
+
+        uint64_t n;
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), n, base);
+        if (ec != std::errc() || (ptr < s.data() + s.size() && is_ident_char(*ptr)))
+            error("Invalid number '{}'", s);
+        s.remove_prefix(ptr - s.data());
+        return number(n);
+    }
+
+    if (c == '$' && (s.size() == 1 || !is_ident_char(s[1]))) {
+        s.remove_prefix(1);
+        return Value { 0, "$", true, m_section, section_size() };
+    }
+
+    if (is_ident_start(c)) {
+        size_t end = 1;
+        while (end < s.size() && is_ident_char(s[end]))
+            end++;
+        std::string name = full_name(s.substr(0, end));
+        s.remove_prefix(end);
+
+        auto sym = m_modules.back().symbols.find(name);
+        if (sym == m_modules.back().symbols.end())
+            return Value { 0, name, false, S_TEXT, 0 };
+        if (sym->second.kind == Symbol::Constant)
+            return number(sym->second.value);
+        return Value { 0, name, true, sym->second.section, sym->second.value };
+    }
+
+    error("Unexpected '{}' in expression", s);
+}
+
+std::vector<uint8_t>& Assembler::bytes()
+{
+    if (m_section == S_BSS)
+        error("Only space can be reserved in .bss");
+    return m_sections[m_section];
+}
+
+void Assembler::emit_le(uint64_t v, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        emit((v >> (i * 8)) & 0xFF);
+}
+
+/* Emit n bytes of v, or a placeholder that is filled in by link() */
+void Assembler::emit_value(const Value& v, size_t n, Fixup::Kind kind)
+{
+    if (v.is_constant()) {
+        bool fits = n == 8 || (v.constant >= -(1LL << (n * 8 - 1)) && v.constant < (1LL << (n * 8)));
+        if (kind == Fixup::Abs32S)
+            fits = fits_int32(v.constant);
+        if (!fits)
+            error("Value {} does not fit into {} bytes", v.constant, n);
+        emit_le(v.constant, n);
+        return;
+    }
+
+    if (v.symbol == "$")
+        error("'$' can only be used in differences");
+    if (n != 4 && n != 8)
+        error("Symbol '{}' does not fit into {} bytes", v.symbol, n);
+
+    m_fixups.push_back({ kind, m_section, bytes().size(), v.symbol, v.constant, m_module, m_line });
+    emit_le(0, n);
+}
+
+void Assembler::emit_rel32(const Value& target)
+{
+    if (target.is_constant() || target.symbol == "$")
+        error("Jump target has to be a label");
+
+    /* Relative to the end of the instruction */
+    m_fixups.push_back({ Fixup::Rel32, m_section, bytes().size(), target.symbol, target.constant - 4, m_module, m_line });
+    emit_le(0, 4);
+}
+
+/* [prefixes] [REX] opcode ModRM [SIB] [displacement]
+ * reg is the register or opcode extension in ModRM.reg, rm a register or memory operand */
+void Assembler::emit_modrm_insn(std::initializer_list<uint8_t> prefixes, bool rex_w, std::initializer_list<uint8_t> opcode,
+    int reg, bool reg_needs_rex, const Operand& rm)
+{
+    if (rm.kind == Operand::Imm)
+        error("Expected a register or memory operand");
+
+    for (auto p : prefixes)
+        emit(p);
+
+    int rex = (rex_w ? 8 : 0) | ((reg & 8) ? 4 : 0);
+    bool force_rex = reg_needs_rex;
+    if (rm.kind == Operand::Reg) {
+        rex |= (rm.reg.num & 8) ? 1 : 0;
+        force_rex |= rm.reg.needs_rex;
+    } else {
+        rex |= (rm.index != -1 && (rm.index & 8)) ? 2 : 0;
+        rex |= (rm.base != -1 && (rm.base & 8)) ? 1 : 0;
+    }
+    if (rex || force_rex)
+        emit(0x40 | rex);
+
+    for (auto o : opcode)
+        emit(o);
+
+    int reg_bits = (reg & 7) << 3;
+    if (rm.kind == Operand::Reg) {
+        emit(0xC0 | reg_bits | (rm.reg.num & 7));
+        return;
+    }
+
+    int scale_bits = std::countr_zero((unsigned)rm.scale) << 6;
+
+    /* Absolute address, always through a SIB byte: mod 00 with rm 101 would be rip-relative */
+    if (rm.base == -1) {
+        emit(0x04 | reg_bits);
+        emit(rm.index == -1 ? 0x25 : (scale_bits | (rm.index & 7) << 3 | 5));
+        emit_value(rm.value, 4, Fixup::Abs32S);
+        return;
+    }
+
+    int mod;
+    if (!rm.value.is_constant() || !fits_int8(rm.value.constant))
+        mod = 2;
+    else if (rm.value.constant == 0 && (rm.base & 7) != 5) /* rbp and r13 always need a displacement */
+        mod = 0;
+    else
+        mod = 1;
+
+    if (rm.index == -1 && (rm.base & 7) != 4) {
+        emit(mod << 6 | reg_bits | (rm.base & 7));
+    } else {
+        /* rsp and r12 as base need a SIB byte */
+        emit(mod << 6 | reg_bits | 4);
+        emit(scale_bits | (rm.index == -1 ? 4 : rm.index & 7) << 3 | (rm.base & 7));
+    }
+
+    if (mod == 1)
+        emit_le(rm.value.constant, 1);
+    else if (mod == 2)
+        emit_value(rm.value, 4, Fixup::Abs32S);
+}
+
+void Assembler::instruction(std::string_view mn, const std::vector<Operand>& ops, uint8_t rep_prefix)
+{
+    auto invalid = [&]() {
+        error("Invalid operands for '{}'", mn);
+    };
+
+    auto is_gpr = [](const Operand& op) { return op.kind == Operand::Reg && !op.reg.xmm; };
+    auto is_xmm = [](const Operand& op) { return op.kind == Operand::Reg && op.reg.xmm; };
+    auto is_rm = [](const Operand& op) { return op.kind == Operand::Mem || (op.kind == Operand::Reg && !op.reg.xmm); };
+    auto is_xmm_or_mem = [](const Operand& op) { return op.kind == Operand::Mem || (op.kind == Operand::Reg && op.reg.xmm); };
+
+    /* The size all non-immediate operands agree on */
+    auto op_size = [&]() {
+        int size = 0;
+        for (const auto& op : ops) {
+            if (op.kind == Operand::Imm || op.size == 0)
+                continue;
+            if (size != 0 && size != op.size)
+                error("Mismatched operand sizes for '{}'", mn);
+            size = op.size;
+        }
+        if (size == 0)
+            error("Operation size not specified for '{}'", mn);
+        return size;
+    };
+
+    /* ModRM instruction with 16, 32 or 64-bit operands */
+    auto sized = [&](int size, std::initializer_list<uint8_t> opcode, int reg, bool reg_needs_rex, const Operand& rm) {
+        if (size == 1)
+            error("'{}' does not take byte operands", mn);
+        if (size == 2)
+            emit_modrm_insn({ 0x66 }, false, opcode, reg, reg_needs_rex, rm);
+        else
+            emit_modrm_insn({}, size == 8, opcode, reg, reg_needs_rex, rm);
+    };
+
+    /* Integer instruction whose byte variant has its own opcode */
+    auto rm_insn = [&](int size, uint8_t opcode8, uint8_t opcode, int reg, bool reg_needs_rex, const Operand& rm) {
+        if (size == 1)
+            emit_modrm_insn({}, false, { opcode8 }, reg, reg_needs_rex, rm);
+        else
+            sized(size, { opcode }, reg, reg_needs_rex, rm);
+    };
+
+    /* Immediates are at most 32 bits and sign extended to 64 */
+    auto imm_value = [&](int size, const Value& v) {
+        emit_value(v, size == 8 ? 4 : size, size == 8 ? Fixup::Abs32S : Fixup::Abs32);
+    };
+
+    if (rep_prefix) {
+        if (!ops.empty() || !HAS(string_insns, mn))
+            error("'{}' can not be repeated", mn);
+        emit(rep_prefix);
+    }
+
+    if (auto insn = no_operand_insns.find(mn); insn != no_operand_insns.end()) {
+        if (!ops.empty())
+            invalid();
+        for (auto b : insn->second)
+            emit(b);
+        return;
+    }
+
+    if (mn == "mov") {
+        if (ops.size() != 2)
+            invalid();
+        const Operand& dst = ops[0];
+        const Operand& src = ops[1];
+
+        if (is_gpr(dst) && src.kind == Operand::Imm) {
+            int r = dst.reg.num;
+            const Value& v = src.value;
+
+            /* mov r, imm with the register in the opcode */
+            auto short_form = [&](bool rex_w, uint8_t opcode) {
+                if (dst.size == 2)
+                    emit(0x66);
+                if (rex_w || (r & 8) || dst.reg.needs_rex)
+                    emit(0x40 | (rex_w ? 8 : 0) | ((r & 8) ? 1 : 0));
+                emit(opcode + (r & 7));
+            };
+
+            if (dst.size == 8 && v.is_constant() && (v.constant < 0 || v.constant > UINT32_MAX)) {
+                if (fits_int32(v.constant)) {
+                    emit_modrm_insn({}, true, { 0xC7 }, 0, false, dst);
+                    emit_le(v.constant, 4);
+                } else {
+                    short_form(true, 0xB8);
+                    emit_le(v.constant, 8);
+                }
+            } else if (dst.size == 1) {
+                short_form(false, 0xB0);
+                emit_value(v, 1, Fixup::Abs32);
+            } else {
+                /* Writing the 32-bit register clears the upper half */
+                short_form(false, 0xB8);
+                emit_value(v, dst.size == 2 ? 2 : 4, Fixup::Abs32);
+            }
+        } else if (dst.kind == Operand::Mem && src.kind == Operand::Imm) {
+            int size = op_size();
+            rm_insn(size, 0xC6, 0xC7, 0, false, dst);
+            imm_value(size, src.value);
+        } else if (is_gpr(src) && is_rm(dst)) {
+            rm_insn(op_size(), 0x88, 0x89, src.reg.num, src.reg.needs_rex, dst);
+        } else if (is_gpr(dst) && src.kind == Operand::Mem) {
+            rm_insn(op_size(), 0x8A, 0x8B, dst.reg.num, dst.reg.needs_rex, src);
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (auto alu = alu_ops.find(mn); alu != alu_ops.end()) {
+        int n = alu->second;
+        if (ops.size() != 2)
+            invalid();
+        const Operand& dst = ops[0];
+        const Operand& src = ops[1];
+
+        if (is_rm(dst) && src.kind == Operand::Imm) {
+            int size = op_size();
+            if (size == 1) {
+                rm_insn(size, 0x80, 0x80, n, false, dst);
+                emit_value(src.value, 1, Fixup::Abs32);
+            } else if (src.value.is_constant() && fits_int8(src.value.constant)) {
+                sized(size, { 0x83 }, n, false, dst);
+                emit_le(src.value.constant, 1);
+            } else {
+                sized(size, { 0x81 }, n, false, dst);
+                imm_value(size, src.value);
+            }
+        } else if (is_rm(dst) && is_gpr(src)) {
+            rm_insn(op_size(), n * 8, n * 8 + 1, src.reg.num, src.reg.needs_rex, dst);
+        } else if (is_gpr(dst) && src.kind == Operand::Mem) {
+            rm_insn(op_size(), n * 8 + 2, n * 8 + 3, dst.reg.num, dst.reg.needs_rex, src);
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (mn == "test") {
+        if (ops.size() != 2)
+            invalid();
+        const Operand& dst = ops[0];
+        const Operand& src = ops[1];
+
+        if (is_rm(dst) && src.kind == Operand::Imm) {
+            int size = op_size();
+            rm_insn(size, 0xF6, 0xF7, 0, false, dst);
+            imm_value(size, src.value);
+        } else if (is_rm(dst) && is_gpr(src)) {
+            rm_insn(op_size(), 0x84, 0x85, src.reg.num, src.reg.needs_rex, dst);
+        } else if (is_gpr(dst) && src.kind == Operand::Mem) {
+            rm_insn(op_size(), 0x84, 0x85, dst.reg.num, dst.reg.needs_rex, src);
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (auto unary = unary_ops.find(mn); unary != unary_ops.end() && ops.size() == 1) {
+        if (!is_rm(ops[0]))
+            invalid();
+        rm_insn(op_size(), 0xF6, 0xF7, unary->second, false, ops[0]);
+        return;
+    }
+
+    if (mn == "inc" || mn == "dec") {
+        if (ops.size() != 1 || !is_rm(ops[0]))
+            invalid();
+        rm_insn(op_size(), 0xFE, 0xFF, mn == "dec", false, ops[0]);
+        return;
+    }
+
+    if (mn == "imul") {
+        if (ops.size() < 2 || ops.size() > 3 || !is_gpr(ops[0]) || !is_rm(ops[1]))
+            invalid();
+        const Operand& dst = ops[0];
+
+        if (ops.size() == 2) {
+            sized(op_size(), { 0x0F, 0xAF }, dst.reg.num, false, ops[1]);
+        } else if (ops[2].kind != Operand::Imm) {
+            invalid();
+        } else if (ops[2].value.is_constant() && fits_int8(ops[2].value.constant)) {
+            sized(op_size(), { 0x6B }, dst.reg.num, false, ops[1]);
+            emit_le(ops[2].value.constant, 1);
+        } else {
+            sized(op_size(), { 0x69 }, dst.reg.num, false, ops[1]);
+            imm_value(dst.size, ops[2].value);
+        }
+        return;
+    }
+
+    if (auto shift = shift_ops.find(mn); shift != shift_ops.end()) {
+        if (ops.size() != 2 || !is_rm(ops[0]) || ops[0].size == 0)
+            invalid();
+        const Operand& count = ops[1];
+        int size = ops[0].size;
+
+        if (is_gpr(count) && count.reg.num == 1 && count.size == 1) {
+            rm_insn(size, 0xD2, 0xD3, shift->second, false, ops[0]);
+        } else if (count.kind == Operand::Imm && count.value.is_constant()) {
+            if (count.value.constant == 1) {
+                rm_insn(size, 0xD0, 0xD1, shift->second, false, ops[0]);
+            } else {
+                rm_insn(size, 0xC0, 0xC1, shift->second, false, ops[0]);
+                emit_value(count.value, 1, Fixup::Abs32);
+            }
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (auto shift = double_shift_ops.find(mn); shift != double_shift_ops.end()) {
+        if (ops.size() != 3 || !is_rm(ops[0]) || !is_gpr(ops[1]))
+            invalid();
+        const Operand& count = ops[2];
+        int size = ops[1].size;
+        if (ops[0].size != 0 && ops[0].size != size)
+            error("Mismatched operand sizes for '{}'", mn);
+
+        if (is_gpr(count) && count.reg.num == 1 && count.size == 1) {
+            sized(size, { 0x0F, (uint8_t)(shift->second + 1) }, ops[1].reg.num, ops[1].reg.needs_rex, ops[0]);
+        } else if (count.kind == Operand::Imm && count.value.is_constant()) {
+            sized(size, { 0x0F, shift->second }, ops[1].reg.num, ops[1].reg.needs_rex, ops[0]);
+            emit_value(count.value, 1, Fixup::Abs32);
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (mn == "lea") {
+        if (ops.size() != 2 || !is_gpr(ops[0]) || ops[1].kind != Operand::Mem)
+            invalid();
+        sized(ops[0].size, { 0x8D }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    if (mn == "movzx" || mn == "movsx") {
+        if (ops.size() != 2 || !is_gpr(ops[0]) || !is_rm(ops[1]) || (ops[1].size != 1 && ops[1].size != 2) || ops[1].size >= ops[0].size)
+            invalid();
+        uint8_t opcode = (mn == "movzx" ? 0xB6 : 0xBE) + (ops[1].size == 2);
+        sized(ops[0].size, { 0x0F, opcode }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    if (mn == "bsr" || mn == "bsf") {
+        if (ops.size() != 2 || !is_gpr(ops[0]) || !is_rm(ops[1]))
+            invalid();
+        sized(op_size(), { 0x0F, (uint8_t)(mn == "bsr" ? 0xBD : 0xBC) }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    if (auto bit_test = bit_test_ops.find(mn); bit_test != bit_test_ops.end()) {
+        if (ops.size() != 2 || !is_rm(ops[0]))
+            invalid();
+        int n = bit_test->second;
+
+        if (ops[1].kind == Operand::Imm) {
+            sized(op_size(), { 0x0F, 0xBA }, n, false, ops[0]);
+            emit_value(ops[1].value, 1, Fixup::Abs32);
+        } else if (is_gpr(ops[1])) {
+            sized(op_size(), { 0x0F, (uint8_t)(0xA3 + (n - 4) * 8) }, ops[1].reg.num, false, ops[0]);
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (mn.starts_with("cmov") && cond_codes.contains(mn.substr(4))) {
+        if (ops.size() != 2 || !is_gpr(ops[0]) || !is_rm(ops[1]))
+            invalid();
+        sized(op_size(), { 0x0F, (uint8_t)(0x40 + cond_codes.at(mn.substr(4))) }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    if (mn.starts_with("set") && cond_codes.contains(mn.substr(3))) {
+        if (ops.size() != 1 || !is_rm(ops[0]) || op_size() != 1)
+            invalid();
+        emit_modrm_insn({}, false, { 0x0F, (uint8_t)(0x90 + cond_codes.at(mn.substr(3))) }, 0, false, ops[0]);
+        return;
+    }
+
+    if (mn == "push" || mn == "pop") {
+        if (ops.size() != 1)
+            invalid();
+        const Operand& op = ops[0];
+        bool push = mn == "push";
+
+        if (is_gpr(op) && op.size == 8) {
+            if (op.reg.num & 8)
+                emit(0x41);
+            emit((push ? 0x50 : 0x58) + (op.reg.num & 7));
+        } else if (op.kind == Operand::Mem) {
+            emit_modrm_insn({}, false, { (uint8_t)(push ? 0xFF : 0x8F) }, push ? 6 : 0, false, op);
+        } else if (push && op.kind == Operand::Imm) {
+            if (op.value.is_constant() && fits_int8(op.value.constant)) {
+                emit(0x6A);
+                emit_le(op.value.constant, 1);
+            } else {
+                emit(0x68);
+                emit_value(op.value, 4, Fixup::Abs32S);
+            }
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (mn == "jmp" || mn == "call") {
+        if (ops.size() != 1)
+            invalid();
+
+        if (ops[0].kind == Operand::Imm) {
+            emit(mn == "jmp" ? 0xE9 : 0xE8);
+            emit_rel32(ops[0].value);
+        } else if (ops[0].kind == Operand::Mem || (is_gpr(ops[0]) && ops[0].size == 8)) {
+            emit_modrm_insn({}, false, { 0xFF }, mn == "jmp" ? 4 : 2, false, ops[0]);
+        } else {
+            invalid();
+        }
+        return;
+    }
+
+    if (mn.starts_with('j') && cond_codes.contains(mn.substr(1))) {
+        if (ops.size() != 1 || ops[0].kind != Operand::Imm)
+            invalid();
+        emit(0x0F);
+        emit(0x80 + cond_codes.at(mn.substr(1)));
+        emit_rel32(ops[0].value);
+        return;
+    }
+
+    if (mn == "enter") {
+        if (ops.size() != 2 || ops[0].kind != Operand::Imm || ops[1].kind != Operand::Imm)
+            invalid();
+        emit(0xC8);
+        emit_value(ops[0].value, 2, Fixup::Abs32);
+        emit_value(ops[1].value, 1, Fixup::Abs32);
+        return;
+    }
+
+    if (auto sse = sse_ops.find(mn); sse != sse_ops.end()) {
+        if (ops.size() != 2 || !is_xmm(ops[0]) || !is_xmm_or_mem(ops[1]))
+            invalid();
+        emit_modrm_insn({ sse->second.first }, false, { 0x0F, sse->second.second }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    if (mn == "movsd") {
+        if (ops.size() == 2 && is_xmm(ops[0]) && is_xmm_or_mem(ops[1]))
+            emit_modrm_insn({ 0xF2 }, false, { 0x0F, 0x10 }, ops[0].reg.num, false, ops[1]);
+        else if (ops.size() == 2 && ops[0].kind == Operand::Mem && is_xmm(ops[1]))
+            emit_modrm_insn({ 0xF2 }, false, { 0x0F, 0x11 }, ops[1].reg.num, false, ops[0]);
+        else
+            invalid();
+        return;
+    }
+
+    if (mn == "movq") {
+        if (ops.size() != 2)
+            invalid();
+        const Operand& dst = ops[0];
+        const Operand& src = ops[1];
+
+        if (is_xmm(dst) && is_gpr(src) && src.size == 8)
+            emit_modrm_insn({ 0x66 }, true, { 0x0F, 0x6E }, dst.reg.num, false, src);
+        else if (is_gpr(dst) && dst.size == 8 && is_xmm(src))
+            emit_modrm_insn({ 0x66 }, true, { 0x0F, 0x7E }, src.reg.num, false, dst);
+        else if (is_xmm(dst) && is_xmm_or_mem(src))
+            emit_modrm_insn({ 0xF3 }, false, { 0x0F, 0x7E }, dst.reg.num, false, src);
+        else if (dst.kind == Operand::Mem && is_xmm(src))
+            emit_modrm_insn({ 0x66 }, false, { 0x0F, 0xD6 }, src.reg.num, false, dst);
+        else
+            invalid();
+        return;
+    }
+
+    if (mn == "cvtsi2sd") {
+        if (ops.size() != 2 || !is_xmm(ops[0]) || !is_rm(ops[1]))
+            invalid();
+        emit_modrm_insn({ 0xF2 }, ops[1].size != 4, { 0x0F, 0x2A }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    if (mn == "cvttsd2si" || mn == "cvtsd2si") {
+        if (ops.size() != 2 || !is_gpr(ops[0]) || ops[0].size < 4 || !is_xmm_or_mem(ops[1]))
+            invalid();
+        emit_modrm_insn({ 0xF2 }, ops[0].size == 8, { 0x0F, (uint8_t)(mn == "cvtsd2si" ? 0x2D : 0x2C) }, ops[0].reg.num, false, ops[1]);
+        return;
+    }
+
+    error("Unknown instruction '{}'", mn);
+}
+
+void Assembler::layout(uint64_t base, uint64_t addresses[SECTION_ENUM_END]) const
+{
+    addresses[S_TEXT] = base;
+    addresses[S_RODATA] = align_up(addresses[S_TEXT] + m_sections[S_TEXT].size(), SECTION_ALIGN);
+    addresses[S_DATA] = align_up(addresses[S_RODATA] + m_sections[S_RODATA].size(), PAGE_SIZE);
+    addresses[S_BSS] = align_up(addresses[S_DATA] + m_sections[S_DATA].size(), SECTION_ALIGN);
+}
+
+size_t Assembler::image_size() const
+{
+    uint64_t addresses[SECTION_ENUM_END];
+    layout(0, addresses);
+    return addresses[S_BSS] + m_bss_size;
+}
+
+Image Assembler::link(uint64_t base, std::string_view entry)
+{
+    uint64_t addresses[SECTION_ENUM_END];
+    layout(base, addresses);
+
+    for (const auto& fixup : m_fixups) {
+        m_module = fixup.module;
+        m_line = fixup.line;
+
+        const Symbol* sym = lookup(fixup.module, fixup.symbol);
+        if (!sym)
+            error("Undefined symbol '{}'", fixup.symbol);
+
+        uint64_t value = (sym->kind == Symbol::Label ? addresses[sym->section] : 0) + sym->value + fixup.addend;
+        uint8_t* place = &m_sections[fixup.section][fixup.offset];
+
+        switch (fixup.kind) {
+        case Fixup::Abs32:
+            if (value > UINT32_MAX)
+                error("Address of '{}' does not fit into 32 bits", fixup.symbol);
+            put_le(place, value, 4);
+            break;
+        case Fixup::Abs32S:
+            if (!fits_int32(value))
+                error("Address of '{}' does not fit into 32 bits", fixup.symbol);
+            put_le(place, value, 4);
+            break;
+        case Fixup::Abs64:
+            put_le(place, value, 8);
+            break;
+        case Fixup::Rel32: {
+            int64_t rel = value - (addresses[fixup.section] + fixup.offset);
+            if (!fits_int32(rel))
+                error("Jump to '{}' is too far", fixup.symbol);
+            put_le(place, rel, 4);
+            break;
+        }
+        }
+    }
+
+    auto start = m_globals.find(entry);
+    if (start == m_globals.end() || start->second.second.kind != Symbol::Label)
+        m_c_info.err.error("Entry point '{}' is not a global label", entry);
+
+    Image image;
+    image.text_address = addresses[S_TEXT];
+    image.text = m_sections[S_TEXT];
+    image.text.resize(addresses[S_RODATA] - addresses[S_TEXT], 0);
+    image.text.insert(image.text.end(), m_sections[S_RODATA].begin(), m_sections[S_RODATA].end());
+    image.data_address = addresses[S_DATA];
+    image.data = m_sections[S_DATA];
+    image.bss_size = addresses[S_BSS] + m_bss_size - (addresses[S_DATA] + image.data.size());
+    image.entry = addresses[S_TEXT] + start->second.second.value;
+
+    return image;
+}
+
+} // namespace assembler
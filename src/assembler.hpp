@@ -0,0 +1,178 @@
+#ifndef ASSEMBLER_H_
+#define ASSEMBLER_H_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CompileInfo;
+
+namespace assembler {
+
+enum section_id : int {
+    S_TEXT,
+    S_RODATA,
+    S_DATA,
+    S_BSS,
+    SECTION_ENUM_END,
+};
+
+/* A linked program, ready to be mapped at the addresses it was linked for */
+struct Image {
+    uint64_t text_address;
+    std::vector<uint8_t> text; /* .text followed by .rodata: read and execute */
+    uint64_t data_address;     /* Page aligned */
+    std::vector<uint8_t> data; /* .data: read and write */
+    size_t bss_size;           /* Zeroed memory after data */
+    uint64_t entry;
+};
+
+/*
+ * Assembler and linker for the subset of NASM syntax that lcc generates and
+ * that the runtime in lib/ is written in.
+ *
+ * All modules are assembled into the same four sections. Like with nasm and ld,
+ * labels are private to their module unless it declares them global or extern.
+ * Branches always use 32-bit displacements and addresses are absolute, so the
+ * program has to be linked below 2GiB.
+ */
+class Assembler {
+public:
+    /* Assemble one translation unit; name is only used in error messages */
+    void add_module(std::string_view source, std::string_view name);
+
+    /* Place .text at base (page aligned), the other sections after it and
+     * resolve all references. entry has to be a global label. */
+    Image link(uint64_t base, std::string_view entry);
+
+    /* Memory needed from .text to the end of .bss once linked */
+    size_t image_size() const;
+
+    Assembler(CompileInfo& c_info)
+        : m_c_info(c_info)
+    {
+    }
+
+    struct Register {
+        int num;
+        int size; /* In bytes, 16 for xmm registers */
+        bool xmm;
+        bool needs_rex; /* spl, bpl, sil and dil */
+    };
+
+    /* A number, or a symbol plus a number that is known once linked */
+    struct Value {
+        int64_t constant = 0;
+        std::string symbol;
+
+        /* Location of the symbol, if it is a label already defined in the
+         * current module. Used to fold differences like '$ - str0'. */
+        bool known = false;
+        section_id section = S_TEXT;
+        uint64_t offset = 0;
+
+        bool is_constant() const { return symbol.empty(); }
+    };
+
+    struct Operand {
+        enum Kind {
+            Reg,
+            Mem,
+            Imm,
+        };
+
+        Kind kind;
+        int size = 0; /* Operand size in bytes, 0 if a memory operand does not say */
+        Register reg = {};
+
+        /* Memory: [base + index * scale + disp], -1 if there is no base/index */
+        int base = -1;
+        int index = -1;
+        int scale = 1;
+        Value value; /* Displacement or immediate */
+    };
+
+private:
+    struct Symbol {
+        enum Kind {
+            Label,
+            Constant,
+        };
+
+        Kind kind;
+        section_id section;
+        uint64_t value; /* Offset into section or the constant */
+    };
+
+    struct Module {
+        std::string name;
+        std::map<std::string, Symbol, std::less<>> symbols;
+        std::set<std::string, std::less<>> declared; /* global and extern */
+    };
+
+    struct Fixup {
+        enum Kind {
+            Abs32,  /* Zero extended */
+            Abs32S, /* Sign extended */
+            Abs64,
+            Rel32,
+        };
+
+        Kind kind;
+        section_id section;
+        size_t offset;
+        std::string symbol;
+        int64_t addend;
+        size_t module;
+        int line;
+    };
+
+    void layout(uint64_t base, uint64_t addresses[SECTION_ENUM_END]) const;
+    void assemble_line(std::string_view line);
+    void define_label(std::string_view name, Symbol sym);
+    void directive_data(std::string_view operands, size_t unit);
+    void instruction(std::string_view mnemonic, const std::vector<Operand>& ops, uint8_t rep_prefix);
+
+    std::string full_name(std::string_view name) const;
+    size_t section_size() const;
+    const Symbol* lookup(size_t module, std::string_view name) const;
+    Operand parse_operand(std::string_view text);
+    Value evaluate(std::string_view expr);
+    Value parse_sum(std::string_view& s);
+    Value parse_product(std::string_view& s);
+    Value parse_primary(std::string_view& s);
+
+    /* Encoding */
+    std::vector<uint8_t>& bytes();
+    void emit(uint8_t b) { bytes().push_back(b); }
+    void emit_le(uint64_t v, size_t n);
+    void emit_value(const Value& v, size_t n, Fixup::Kind kind);
+    void emit_rel32(const Value& target);
+    void emit_modrm_insn(std::initializer_list<uint8_t> prefixes, bool rex_w, std::initializer_list<uint8_t> opcode,
+        int reg, bool reg_needs_rex, const Operand& rm);
+
+    template<typename... args>
+    [[noreturn]] void error(std::string_view format, args&&... fargs);
+
+    CompileInfo& m_c_info;
+
+    std::vector<uint8_t> m_sections[SECTION_ENUM_END]; /* .bss only counts its size */
+    size_t m_bss_size = 0;
+
+    std::vector<Module> m_modules;
+    std::map<std::string, std::pair<size_t, Symbol>, std::less<>> m_globals;
+    std::vector<Fixup> m_fixups;
+
+    /* State while assembling a module, m_module and m_line also for errors */
+    size_t m_module = 0;
+    section_id m_section = S_TEXT;
+    std::string m_last_label; /* Scope of local '.labels' */
+    int m_line = 0;
+};
+
+} // namespace assembler
+
+#endif // ASSEMBLER_H_
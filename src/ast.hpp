@@ -4,9 +4,11 @@
 #include <cassert>
 #include <fmt/ostream.h>
 #include <iostream>
+#include <cstdint>
 #include <map>
-#include <memory>
+#include <span>
 #include <string_view>
+#include <tuple>
 #include <vector>
 
 #include "dictionary.hpp"
@@ -16,7 +18,8 @@
 class CompileInfo;
 
 namespace lexer {
-class Token;
+struct Token;
+class TokenList;
 }
 
 namespace ast {
@@ -44,378 +47,228 @@ enum ts_class : int {
     T_IN_MEMORY,
 };
 
-class Cmp;
-class Arit;
+/* Index of a node in an Ast */
+using NodeId = uint32_t;
 
-class Node {
-public:
-    int get_line() const { return m_line; };
-    virtual ts_class get_type() const { return m_type; };
-
-    Node(int line)
-        : m_line(line)
-    {
-    }
-
-private:
-    int m_line;
-    static const ts_class m_type = T_BASE;
-};
+/* Stands for a missing child, e.g. the right side of a Cmp without operator */
+static constexpr NodeId NO_NODE = UINT32_MAX;
 
-class Body : public Node {
-public:
-    std::shared_ptr<Body> parent;
-
-    std::vector<std::shared_ptr<Node>> children;
-
-    ts_class get_type() const override { return m_type; };
-    int get_body_id() const { return m_body_id; };
-
-    Body(int line, std::shared_ptr<Body> t_parent, int body_id)
-        : Node(line)
-        , parent(t_parent)
-        , m_body_id(body_id)
-    {}
+/*
+ * The payloads of the different kinds of nodes. The type and line of a node
+ * are kept by the Ast, children are referenced by their index.
+ */
 
+struct Body {
+    static constexpr ts_class tag = T_BODY;
 
-private:
-    static const ts_class m_type = T_BODY;
-    int m_body_id;
+    NodeId parent;
+    int body_id;
+    std::vector<NodeId> children {};
 };
 
-class If : public Node {
-public:
-    std::shared_ptr<Node> condition;
-    std::shared_ptr<Body> body;
-    std::shared_ptr<Node> elif;
-    bool has_elif() const { return elif != nullptr; }
-    bool is_elif() const { return m_is_elif; }
-
-    ts_class get_type() const override { return m_type; };
-
-    If(int line, std::shared_ptr<Node> t_condition, std::shared_ptr<Body> t_body, bool is_elif)
-        : Node(line)
-        , condition(t_condition)
-        , body(t_body)
-        , elif (nullptr)
-        , m_is_elif(is_elif)
-    {
-    }
+struct If {
+    static constexpr ts_class tag = T_IF;
 
-private:
-    static const ts_class m_type = T_IF;
-    bool m_is_elif;
+    NodeId condition;
+    NodeId body;
+    bool is_elif;
+    NodeId elif = NO_NODE; /* Next elif or else */
 };
 
-class Else : public Node {
-public:
-    std::shared_ptr<Body> body;
-
-    ts_class get_type() const override { return m_type; };
-
-    Else(int line, std::shared_ptr<Body> t_body)
-        : Node(line)
-        , body(t_body)
-    {
-    }
+struct Else {
+    static constexpr ts_class tag = T_ELSE;
 
-private:
-    static const ts_class m_type = T_ELSE;
+    NodeId body;
 };
 
-class While : public Node {
-public:
-    std::shared_ptr<Node> condition;
-    std::shared_ptr<Body> body;
-
-    ts_class get_type() const override { return m_type; };
-
-    While(int line, std::shared_ptr<Node> t_condition, std::shared_ptr<Body> t_body)
-        : Node(line)
-        , condition(t_condition)
-        , body(t_body)
-    {
-    }
+struct While {
+    static constexpr ts_class tag = T_WHILE;
 
-private:
-    static const ts_class m_type = T_WHILE;
+    NodeId condition;
+    NodeId body;
 };
 
-class Const : public Node {
-public:
-    int get_value() const { return m_value; };
-
-    ts_class get_type() const override { return m_type; };
+struct Const {
+    static constexpr ts_class tag = T_CONST;
 
-    Const(int line, int value)
-        : Node(line)
-        , m_value(value)
-    {
-    }
-
-private:
-    int m_value;
-    static const ts_class m_type = T_CONST;
+    int value;
 };
 
-class DoubleConst : public Node {
-public:
-    double get_value() const { return m_value; };
-
-    ts_class get_type() const override { return m_type; };
+struct DoubleConst {
+    static constexpr ts_class tag = T_DOUBLE_CONST;
 
-    DoubleConst(int line, double value)
-        : Node(line)
-        , m_value(value)
-    {
-    }
-
-private:
-    double m_value;
-    static const ts_class m_type = T_DOUBLE_CONST;
+    double value;
 };
 
-class Cmp : public Node {
-public:
-    std::shared_ptr<Node> left;
-    std::shared_ptr<Node> right;
-
-    ts_class get_type() const override { return m_type; };
-    cmp_op get_cmp() const { return m_cmp; };
+struct Cmp {
+    static constexpr ts_class tag = T_CMP;
 
-    Cmp(int line, std::shared_ptr<Node> t_left, std::shared_ptr<Node> t_right, cmp_op t_cmp)
-        : Node(line)
-        , left(t_left)
-        , right(t_right)
-        , m_cmp(t_cmp)
-    {
-    }
-
-private:
-    cmp_op m_cmp;
-    static const ts_class m_type = T_CMP;
+    NodeId left;
+    NodeId right;
+    cmp_op cmp;
 };
 
-class Log : public Node {
-public:
-    std::shared_ptr<Node> left;
-    std::shared_ptr<Node> right;
+struct Log {
+    static constexpr ts_class tag = T_LOG;
 
-    ts_class get_type() const override { return m_type; };
-    log_op get_log() const { return m_log; };
+    NodeId left;
+    NodeId right;
+    log_op log;
+};
 
-    Log(int line, std::shared_ptr<Node> t_left, std::shared_ptr<Node> t_right, log_op t_log)
-        : Node(line)
-        , left(t_left)
-        , right(t_right)
-        , m_log(t_log)
-    {
-    }
+struct Func {
+    static constexpr ts_class tag = T_FUNC;
 
-private:
-    log_op m_log;
-    static const ts_class m_type = T_LOG;
+    func_id func;
+    std::vector<NodeId> args {};
 };
 
-class Func : public Node {
-public:
-    std::vector<std::shared_ptr<Node>> args;
+struct VFunc {
+    static constexpr ts_class tag = T_VFUNC;
 
-    ts_class get_type() const override { return m_type; };
-    func_id get_func() const { return m_func; };
+    value_func_id vfunc;
+    var_type return_type;
+};
 
-    Func(int line, func_id t_func)
-        : Node(line)
-        , m_func(t_func)
-    {
-    }
+struct Var {
+    static constexpr ts_class tag = T_VAR;
 
-private:
-    func_id m_func;
-    static const ts_class m_type = T_FUNC;
+    int var_id;
 };
 
-class VFunc : public Node {
-public:
-    // TODO: args?
+struct Access {
+    static constexpr ts_class tag = T_ACCESS;
 
-    ts_class get_type() const override { return m_type; };
-    value_func_id get_value_func() const { return m_vfunc; };
-    var_type get_return_type() const { return m_return_type; };
+    int array_id;
+    NodeId index;
+};
 
-    VFunc(int line, value_func_id t_vfunc, var_type t_ret)
-        : Node(line)
-        , m_vfunc(t_vfunc)
-        , m_return_type(t_ret)
-    {
-    }
+struct Str {
+    static constexpr ts_class tag = T_STR;
 
-private:
-    value_func_id m_vfunc;
-    var_type m_return_type;
-    static const ts_class m_type = T_VFUNC;
+    int str_id;
 };
 
-class Var : public Node {
-public:
-    ts_class get_type() const override { return m_type; };
+struct Lstr {
+    static constexpr ts_class tag = T_LSTR;
 
-    int get_var_id() const { return m_var_id; };
+    std::vector<NodeId> format;
+    std::vector<FormatSpec> specs; /* One for each node in format */
+};
 
-    Var(int line, int var_id)
-        : Node(line)
-        , m_var_id(var_id)
-    {
-    }
+struct Arit {
+    static constexpr ts_class tag = T_ARIT;
 
-private:
-    int m_var_id;
-    static const ts_class m_type = T_VAR;
+    NodeId left;
+    NodeId right;
+    arit_op arit;
 };
 
-class Access : public Node {
+/*
+ * Owns all nodes of a program. Every kind of node has its own array that
+ * only grows, a node is found through its entry in the table of all nodes.
+ * References returned by get() are invalidated by adding a node of the
+ * same kind.
+ */
+class Ast {
 public:
-    ts_class get_type() const override { return m_type; };
-
-    int get_array_id() const { return m_array_id; };
-    std::shared_ptr<Node> index;
+    NodeId root = NO_NODE;
 
-    Access(int line, int array_id, std::shared_ptr<Node> p_index)
-        : Node(line)
-        , index(p_index)
-        , m_array_id(array_id)
-    {
-    }
+    ts_class type(NodeId id) const { return m_nodes[id].type; }
+    int line(NodeId id) const { return m_nodes[id].line; }
+    size_t size() const { return m_nodes.size(); }
 
-    /* TODO: types for arrays */
+    /* Type of the value of a number, V_UNSURE until semantic analysis resolved it */
+    var_type num_type(NodeId id) const { return m_nodes[id].num_type; }
+    void set_num_type(NodeId id, var_type type) { m_nodes[id].num_type = type; }
 
-private:
-    int m_array_id;
-    static const ts_class m_type = T_ACCESS;
-};
+    template<typename T>
+    NodeId add(int line, T node)
+    {
+        auto& nodes = pool<T>();
+        nodes.push_back(std::move(node));
+        m_nodes.push_back({ T::tag, line, (uint32_t)nodes.size() - 1, V_UNSURE });
 
-class Str : public Node {
-public:
-    ts_class get_type() const override { return m_type; };
-    int get_str_id() const { return m_str_id; };
+        return m_nodes.size() - 1;
+    }
 
-    Str(int line, int str_id)
-        : Node(line)
-        , m_str_id(str_id)
+    template<typename T>
+    T& get(NodeId id)
     {
+        assert(id < m_nodes.size() && m_nodes[id].type == T::tag);
+        return pool<T>()[m_nodes[id].index];
     }
 
-private:
-    int m_str_id;
-    static const ts_class m_type = T_STR;
-};
-
-class Lstr : public Node {
-public:
-    ts_class get_type() const override { return m_type; };
-    std::vector<std::shared_ptr<Node>> format;
-
-    Lstr(int line, std::vector<std::shared_ptr<Node>> p_format)
-        : Node(line)
-        , format(p_format)
-    {}
-
-private:
-    static const ts_class m_type = T_LSTR;
-};
-
-class Arit : public Node {
-public:
-    std::shared_ptr<Node> left;
-    std::shared_ptr<Node> right;
-
-    ts_class get_type() const override { return m_type; };
-    arit_op get_arit() const { return m_arit; };
-
-    Arit(int line, std::shared_ptr<Node> t_left, std::shared_ptr<Node> t_right, arit_op t_arit)
-        : Node(line)
-        , left(t_left)
-        , right(t_right)
-        , m_arit(t_arit)
+    template<typename T>
+    const T& get(NodeId id) const
     {
+        return const_cast<Ast*>(this)->get<T>(id);
     }
 
 private:
-    arit_op m_arit;
-    static const ts_class m_type = T_ARIT;
+    struct Entry {
+        ts_class type;
+        int line;
+        uint32_t index; /* Into the array of its kind */
+        var_type num_type;
+    };
+
+    template<typename T>
+    std::vector<T>& pool() { return std::get<std::vector<T>>(m_pools); }
+
+    std::vector<Entry> m_nodes;
+    std::tuple<std::vector<Body>, std::vector<If>, std::vector<Else>, std::vector<While>,
+        std::vector<Const>, std::vector<DoubleConst>, std::vector<Cmp>, std::vector<Log>,
+        std::vector<Func>, std::vector<VFunc>, std::vector<Var>, std::vector<Access>,
+        std::vector<Str>, std::vector<Lstr>, std::vector<Arit>>
+        m_pools;
 };
 
-
 class AstContext {
 public:
 
-    /* Generate an abstract syntax tree from tokens and return the root */
-    std::shared_ptr<Body> gen_ast();
+    /* Generate an abstract syntax tree from tokens */
+    Ast gen_ast();
 
-    // NOTE: should root be saved internally
-    /* Write a graphviz representation of the AST in root to fn */
-    void tree_to_dot(std::shared_ptr<Body> root, std::string_view fn);
+    /* Write a graphviz representation of tree to fn */
+    void tree_to_dot(const Ast& tree, std::string_view fn);
 
-    AstContext(const std::vector<std::shared_ptr<lexer::Token>>& tokens, CompileInfo &c_info)
-        : m_tokens(tokens)
-        , m_c_info(c_info)
-    {}
+    AstContext(const lexer::TokenList& list, CompileInfo &c_info);
 
 private:
-    std::shared_ptr<ast::Node> node_from_numeric_token(std::shared_ptr<lexer::Token> tk);
+    NodeId node_from_numeric_token(const lexer::Token& tk);
 
-    void ensure_arit_correctness(const std::vector<std::shared_ptr<lexer::Token>>& ts);
-    std::shared_ptr<Node> parse_arit_expr(const std::vector<std::shared_ptr<lexer::Token>>& ts);
-    std::shared_ptr<Node> parse_logical(size_t& i);
-    std::shared_ptr<Cmp> parse_condition(const std::vector<std::shared_ptr<lexer::Token>>& ts);
-    std::shared_ptr<If> parse_condition_to_if(size_t& i, std::shared_ptr<Body> root, bool is_elif);
-    std::shared_ptr<While> parse_condition_to_while(size_t& i, std::shared_ptr<Body> root);
+    NodeId parse_arit_expr(std::span<const lexer::Token> ts);
+    NodeId parse_arit_binary(std::span<const lexer::Token> ts, size_t& i, int min_power);
+    NodeId parse_arit_operand(std::span<const lexer::Token> ts, size_t& i);
+    NodeId parse_logical(size_t& i);
+    NodeId parse_condition(std::span<const lexer::Token> ts);
+    NodeId parse_condition_to_if(size_t& i, NodeId root, bool is_elif);
+    NodeId parse_condition_to_while(size_t& i, NodeId root);
 
     // Constructors require additional information/calculations
-    std::shared_ptr<Lstr> make_lstr(int line, const std::vector<std::shared_ptr<lexer::Token>>& ts);
-    std::shared_ptr<Body> make_body(int line, std::shared_ptr<Body> t_parent);
+    NodeId make_lstr(const lexer::Token& lstr);
+    NodeId make_body(int line, NodeId parent);
 
-    void tree_to_dot_core(std::shared_ptr<Node> root, int& node, int& tbody_id, int parent_body_id, std::ofstream& dot);
+    void tree_to_dot_core(const Ast& tree, NodeId root, int& node, int& tbody_id, int parent_body_id, std::ofstream& dot);
 
-    const std::vector<std::shared_ptr<lexer::Token>>& m_tokens;
+    const lexer::TokenList& m_list;
+    const std::vector<lexer::Token>& m_tokens;
     CompileInfo& m_c_info;
+    Ast m_tree;
 };
 
 /*
-* Traverse the pointers to elifs/elses on if_node until the
-* last one
+* Traverse the elifs/elses of if_node until the last one
 */
-std::shared_ptr<Node> get_last_if(std::shared_ptr<If> if_node);
-
-#define AST_SAFE_CAST(type, tk) ast::safe_cast_core<type>((tk), __FILE__, __LINE__)
-
-/*
- * Cast tree_node to desired polymorphic subtype
- * Ensures that tk was declared as a type T originally
- */
-template<typename T>
-std::shared_ptr<T> safe_cast_core(std::shared_ptr<Node> nd, std::string_view file, int line)
-{
-    try {
-        if (tree_type_enum_map.at(typeid(T).hash_code()) != nd->get_type()) {
-            fmt::print(std::cerr, "{}:{}: Invalid type-match: {}\nIn call: {}\n", file, line, typeid(T).name(), __PRETTY_FUNCTION__);
-            std::exit(1);
-        }
-    } catch (std::out_of_range& e) {
-        fmt::print(std::cerr, "Type '{}' not in map in lexer::safe_cast()\n", typeid(T).name());
-        std::exit(1);
-    }
-    return std::dynamic_pointer_cast<T>(nd);
-}
+NodeId get_last_if(const Ast& tree, NodeId if_node);
 
 /*
- * Cast a subclass tree node back to Node
+ * Fold constant arithmetic, comparisons and conditions of a tree that
+ * passed semantic analysis and simplify identities like x * 1, so that
+ * e.g. 'while 2 > 1' is decided like 'while 1'
  */
-template<typename T>
-std::shared_ptr<Node> to_base(std::shared_ptr<T> nd)
-{
-    return std::dynamic_pointer_cast<Node>(nd);
-}
+void fold_constants(Ast& tree);
 
 inline bool has_precedence(arit_op op)
 {
@@ -0,0 +1,572 @@
+#include <bit>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "maps.hpp"
+#include "util.hpp"
+
+namespace bytecode {
+
+/* The jump for the opposite of a comparison, also for doubles (see OP_FJEQ) */
+static const cmp_op opposite_cmp[CMP_OPERATION_ENUM_END] = {
+    NOT_EQUAL,
+    EQUAL,
+    GREATER_OR_EQ,
+    GREATER,
+    LESS_OR_EQ,
+    LESS,
+};
+
+/* One of the branches OP_JEQ..OP_JGE, OP_JEQI.. or OP_FJEQ.. */
+static opcode branch(opcode first, cmp_op op)
+{
+    return (opcode)(first + (int)op);
+}
+
+class Compiler {
+public:
+    Program compile();
+
+    Compiler(const ast::Ast& tree, CompileInfo& c_info)
+        : m_tree(tree)
+        , m_c_info(c_info)
+    {
+    }
+
+private:
+    /* Jumps to be pointed at the loop's condition or the code after it */
+    struct Loop {
+        std::vector<size_t> continues;
+        std::vector<size_t> breaks;
+    };
+
+    void statement(ast::NodeId nd);
+    void body(ast::NodeId body);
+    void function(const ast::Func& func);
+    void if_chain(ast::NodeId t_if);
+    void while_loop(ast::NodeId t_while);
+    void print(ast::NodeId ls);
+
+    /* Emit code which jumps if nd evaluates to jump_if and add the jumps to
+     * jumps, to be patched once the target is known */
+    void condition(ast::NodeId nd, bool jump_if, std::vector<size_t>& jumps);
+
+    /* Evaluate nd into dest, or into any register if dest is -1. Returns the
+     * register holding the value. */
+    int number(ast::NodeId nd, int dest);
+    int arithmetic(ast::NodeId nd, int dest);
+
+    /* Register of an array element with a constant index, -1 if the index
+     * is not constant or out of bounds */
+    int element_register(const ast::Access& access);
+    int array(int var_id);
+    int str_var(int var_id);
+    int variable(int var_id) { return m_c_info.known_vars[var_id].stack_offset; }
+
+    int int_constant(int64_t value);
+    int double_constant(double value);
+    int temporary();
+    int dest_or_temporary(int dest) { return dest == -1 ? temporary() : dest; }
+    int move_if_req(int dest, int src);
+
+    size_t emit(opcode op, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+    size_t here() const { return m_program.code.size(); }
+    void patch(const std::vector<size_t>& jumps, size_t target);
+
+    const ast::Ast& m_tree;
+    CompileInfo& m_c_info;
+    Program m_program;
+
+    std::vector<Loop> m_loops;
+    int m_line = 0;
+
+    std::vector<int> m_arrays;   /* Array number of each variable or -1 */
+    std::vector<int> m_str_vars; /* String variable number of each variable or -1 */
+
+    /* Temporaries are given back after each statement */
+    std::vector<int> m_free_temporaries;
+    std::vector<int> m_used_temporaries;
+};
+
+Program compile(const ast::Ast& tree, CompileInfo& c_info)
+{
+    return Compiler(tree, c_info).compile();
+}
+
+Program Compiler::compile()
+{
+    m_arrays.assign(m_c_info.known_vars.size(), -1);
+    m_str_vars.assign(m_c_info.known_vars.size(), -1);
+
+    /* Register 0 is unused, stack slots start at one */
+    m_program.registers.assign(m_c_info.get_stack_size() + 1, 0);
+
+    body(m_tree.root);
+    emit(OP_HALT);
+
+    /* Printing may have added string constants */
+    for (const auto& str : m_c_info.known_strings)
+        m_program.strings.push_back(string_constant_bytes(str));
+
+    return std::move(m_program);
+}
+
+size_t Compiler::emit(opcode op, int32_t a, int32_t b, int32_t c)
+{
+    m_program.code.push_back({ op, a, b, c });
+    m_program.lines.push_back(m_line);
+    return m_program.code.size() - 1;
+}
+
+void Compiler::patch(const std::vector<size_t>& jumps, size_t target)
+{
+    for (size_t jump : jumps)
+        m_program.code[jump].c = target;
+}
+
+int Compiler::int_constant(int64_t value)
+{
+    int reg = m_program.registers.size();
+    m_program.registers.push_back(value);
+    return reg;
+}
+
+int Compiler::double_constant(double value)
+{
+    return int_constant(std::bit_cast<int64_t>(value));
+}
+
+int Compiler::temporary()
+{
+    int reg;
+    if (m_free_temporaries.empty()) {
+        reg = m_program.registers.size();
+        m_program.registers.push_back(0);
+    } else {
+        reg = m_free_temporaries.back();
+        m_free_temporaries.pop_back();
+    }
+
+    m_used_temporaries.push_back(reg);
+    return reg;
+}
+
+int Compiler::move_if_req(int dest, int src)
+{
+    if (dest == -1 || dest == src)
+        return src;
+
+    emit(OP_MOV, dest, src);
+    return dest;
+}
+
+int Compiler::array(int var_id)
+{
+    if (m_arrays[var_id] == -1) {
+        const VarInfo& v_info = m_c_info.known_vars[var_id];
+
+        m_arrays[var_id] = m_program.arrays.size();
+        m_program.arrays.push_back({ (int32_t)v_info.stack_offset, (int32_t)v_info.stack_units });
+    }
+
+    return m_arrays[var_id];
+}
+
+int Compiler::str_var(int var_id)
+{
+    if (m_str_vars[var_id] == -1)
+        m_str_vars[var_id] = m_program.str_vars++;
+
+    return m_str_vars[var_id];
+}
+
+int Compiler::element_register(const ast::Access& access)
+{
+    if (m_tree.type(access.index) != ast::T_CONST)
+        return -1;
+
+    const VarInfo& v_info = m_c_info.known_vars[access.array_id];
+    int index = m_tree.get<ast::Const>(access.index).value;
+
+    /* Out of bounds is reported when it is executed */
+    if (index < 0 || (size_t)index >= v_info.stack_units)
+        return -1;
+
+    return v_info.stack_offset - index;
+}
+
+void Compiler::body(ast::NodeId body)
+{
+    for (ast::NodeId child : m_tree.get<ast::Body>(body).children)
+        statement(child);
+}
+
+void Compiler::statement(ast::NodeId nd)
+{
+    m_line = m_tree.line(nd);
+    m_c_info.err.set_line(m_line);
+
+    switch (m_tree.type(nd)) {
+    case ast::T_IF:
+        if_chain(nd);
+        break;
+    case ast::T_WHILE:
+        while_loop(nd);
+        break;
+    case ast::T_FUNC:
+        function(m_tree.get<ast::Func>(nd));
+        break;
+    default:
+        UNREACHABLE();
+        break;
+    }
+
+    m_free_temporaries.insert(m_free_temporaries.end(), m_used_temporaries.begin(), m_used_temporaries.end());
+    m_used_temporaries.clear();
+}
+
+void Compiler::if_chain(ast::NodeId nd)
+{
+    std::vector<size_t> end_jumps;
+
+    for (;;) {
+        const ast::If& t_if = m_tree.get<ast::If>(nd);
+
+        std::vector<size_t> next;
+        condition(t_if.condition, false, next);
+        body(t_if.body);
+
+        if (t_if.elif == ast::NO_NODE) {
+            patch(next, here());
+            break;
+        }
+
+        end_jumps.push_back(emit(OP_JMP));
+        patch(next, here());
+
+        if (m_tree.type(t_if.elif) == ast::T_ELSE) {
+            body(m_tree.get<ast::Else>(t_if.elif).body);
+            break;
+        }
+        nd = t_if.elif;
+    }
+
+    patch(end_jumps, here());
+}
+
+/* The condition is tested at the bottom of the loop so an iteration only
+ * takes one jump */
+void Compiler::while_loop(ast::NodeId nd)
+{
+    const ast::While& t_while = m_tree.get<ast::While>(nd);
+
+    size_t enter = emit(OP_JMP);
+    size_t top = here();
+
+    m_loops.emplace_back();
+    body(t_while.body);
+    Loop loop = std::move(m_loops.back());
+    m_loops.pop_back();
+
+    m_line = m_tree.line(nd);
+    m_c_info.err.set_line(m_line);
+
+    size_t test = here();
+    patch({ enter }, test);
+    patch(loop.continues, test);
+
+    std::vector<size_t> back;
+    condition(t_while.condition, true, back);
+    patch(back, top);
+
+    patch(loop.breaks, here());
+}
+
+void Compiler::condition(ast::NodeId nd, bool jump_if, std::vector<size_t>& jumps)
+{
+    if (m_tree.type(nd) == ast::T_LOG) {
+        const ast::Log& log = m_tree.get<ast::Log>(nd);
+
+        /* Jump if the left side decides the outcome, skip the right side
+         * if it decides the opposite */
+        bool decides = log.log == OR;
+        if (decides == jump_if) {
+            condition(log.left, jump_if, jumps);
+            condition(log.right, jump_if, jumps);
+        } else {
+            std::vector<size_t> skip;
+            condition(log.left, decides, skip);
+            condition(log.right, jump_if, jumps);
+            patch(skip, here());
+        }
+        return;
+    }
+
+    const ast::Cmp& cmp = m_tree.get<ast::Cmp>(nd);
+    bool has_right = cmp.right != ast::NO_NODE;
+
+    /* Semantic analysis made sure both sides have the same type */
+    var_type type = m_tree.num_type(cmp.left);
+
+    /* 'if 1' and 'while 0' are decided now */
+    if (!has_right && (m_tree.type(cmp.left) == ast::T_CONST || m_tree.type(cmp.left) == ast::T_DOUBLE_CONST)) {
+        bool value = m_tree.type(cmp.left) == ast::T_CONST ? m_tree.get<ast::Const>(cmp.left).value != 0
+                                                           : m_tree.get<ast::DoubleConst>(cmp.left).value != 0.0;
+        if (value == jump_if)
+            jumps.push_back(emit(OP_JMP));
+        return;
+    }
+
+    /* Without a right side: compare against zero */
+    cmp_op op = has_right ? cmp.cmp : NOT_EQUAL;
+    if (!jump_if)
+        op = opposite_cmp[op];
+
+    int left = number(cmp.left, -1);
+
+    if (type == V_INT) {
+        if (!has_right || m_tree.type(cmp.right) == ast::T_CONST) {
+            int value = has_right ? m_tree.get<ast::Const>(cmp.right).value : 0;
+            jumps.push_back(emit(branch(OP_JEQI, op), left, value));
+        } else {
+            jumps.push_back(emit(branch(OP_JEQ, op), left, number(cmp.right, -1)));
+        }
+    } else if (type == V_DOUBLE) {
+        int right = has_right ? number(cmp.right, -1) : double_constant(0.0);
+        jumps.push_back(emit(branch(OP_FJEQ, op), left, right));
+    } else {
+        UNREACHABLE();
+    }
+}
+
+int Compiler::number(ast::NodeId nd, int dest)
+{
+    assert(ast::could_be_num(m_tree.type(nd)));
+
+    switch (m_tree.type(nd)) {
+    case ast::T_CONST:
+        return move_if_req(dest, int_constant(m_tree.get<ast::Const>(nd).value));
+    case ast::T_DOUBLE_CONST:
+        return move_if_req(dest, double_constant(m_tree.get<ast::DoubleConst>(nd).value));
+    case ast::T_VAR: {
+        int var_id = m_tree.get<ast::Var>(nd).var_id;
+        m_c_info.error_on_undefined(var_id);
+
+        return move_if_req(dest, variable(var_id));
+    }
+    case ast::T_ACCESS: {
+        const ast::Access& access = m_tree.get<ast::Access>(nd);
+
+        if (int reg = element_register(access); reg != -1)
+            return move_if_req(dest, reg);
+
+        int index = number(access.index, -1);
+        dest = dest_or_temporary(dest);
+        emit(OP_LOAD, dest, array(access.array_id), index);
+        return dest;
+    }
+    case ast::T_VFUNC: {
+        const ast::VFunc& vfunc = m_tree.get<ast::VFunc>(nd);
+        m_c_info.err.on_false(vfunc.return_type == V_INT,
+            "'{}' has wrong return type '{}'",
+            vfunc_str_map.at(vfunc.vfunc),
+            var_type_str_map.at(vfunc.return_type));
+
+        dest = dest_or_temporary(dest);
+        emit(vfunc.vfunc == VF_TIME ? OP_TIME : OP_GETUID, dest);
+        return dest;
+    }
+    case ast::T_ARIT:
+        return arithmetic(nd, dest);
+    default:
+        UNREACHABLE();
+        return -1;
+    }
+}
+
+int Compiler::arithmetic(ast::NodeId nd, int dest)
+{
+    const ast::Arit& arit = m_tree.get<ast::Arit>(nd);
+    var_type type = m_tree.num_type(nd);
+
+    /* Only written after both sides are read, so dest may be one of them */
+    int left = number(arit.left, -1);
+
+    if (type == V_INT && (arit.arit == ADD || arit.arit == SUB) && m_tree.type(arit.right) == ast::T_CONST) {
+        dest = dest_or_temporary(dest);
+        emit(arit.arit == ADD ? OP_ADDI : OP_SUBI, dest, left, m_tree.get<ast::Const>(arit.right).value);
+        return dest;
+    }
+
+    int right = number(arit.right, -1);
+    opcode op;
+
+    if (type == V_INT) {
+        switch (arit.arit) {
+        case ADD:
+            op = OP_ADD;
+            break;
+        case SUB:
+            op = OP_SUB;
+            break;
+        case MUL:
+            op = OP_MUL;
+            break;
+        case DIV:
+            op = OP_DIV;
+            break;
+        case MOD:
+            op = OP_MOD;
+            break;
+        default:
+            UNREACHABLE();
+            return -1;
+        }
+    } else if (type == V_DOUBLE) {
+        switch (arit.arit) {
+        case ADD:
+            op = OP_FADD;
+            break;
+        case SUB:
+            op = OP_FSUB;
+            break;
+        case MUL:
+            op = OP_FMUL;
+            break;
+        case DIV:
+            op = OP_FDIV;
+            break;
+        case MOD:
+            m_c_info.err.error("'{}' not allowed in floating point operations", arit_str_map.at(arit.arit));
+        default:
+            UNREACHABLE();
+            return -1;
+        }
+    } else {
+        UNREACHABLE();
+        return -1;
+    }
+
+    dest = dest_or_temporary(dest);
+    emit(op, dest, left, right);
+    return dest;
+}
+
+void Compiler::function(const ast::Func& func)
+{
+    const auto& args = func.args;
+
+    switch (func.func) {
+    case F_EXIT:
+        emit(OP_EXIT, number(args[0], -1));
+        break;
+    case F_PUTCHAR:
+        emit(OP_PUTCHAR, number(args[0], -1));
+        break;
+    case F_ARRAY:
+    case F_STR:
+        /* check_correct_function_call defines the variable */
+        break;
+    case F_INT:
+    case F_DOUBLE:
+        number(args[1], variable(m_tree.get<ast::Var>(args[0]).var_id));
+        break;
+    case F_PRINT:
+        print(args[0]);
+        break;
+    case F_SET:
+    case F_SETD: {
+        if (m_tree.type(args[0]) == ast::T_VAR) {
+            number(args[1], variable(m_tree.get<ast::Var>(args[0]).var_id));
+            break;
+        }
+
+        const ast::Access& access = m_tree.get<ast::Access>(args[0]);
+        if (int reg = element_register(access); reg != -1) {
+            number(args[1], reg);
+        } else {
+            int value = number(args[1], -1);
+            emit(OP_STORE, array(access.array_id), number(access.index, -1), value);
+        }
+        break;
+    }
+    case F_ADD:
+    case F_SUB: {
+        bool add = func.func == F_ADD;
+        int reg, arr = -1, index = -1;
+
+        if (m_tree.type(args[0]) == ast::T_VAR) {
+            reg = variable(m_tree.get<ast::Var>(args[0]).var_id);
+        } else {
+            const ast::Access& access = m_tree.get<ast::Access>(args[0]);
+            reg = element_register(access);
+            if (reg == -1) {
+                arr = array(access.array_id);
+                index = number(access.index, -1);
+                reg = temporary();
+                emit(OP_LOAD, reg, arr, index);
+            }
+        }
+
+        if (m_tree.type(args[1]) == ast::T_CONST)
+            emit(add ? OP_ADDI : OP_SUBI, reg, reg, m_tree.get<ast::Const>(args[1]).value);
+        else
+            emit(add ? OP_ADD : OP_SUB, reg, reg, number(args[1], -1));
+
+        /* The element was loaded into a temporary */
+        if (arr != -1)
+            emit(OP_STORE, arr, index, reg);
+        break;
+    }
+    case F_READ:
+        emit(OP_READ, str_var(m_tree.get<ast::Var>(args[0]).var_id));
+        break;
+    case F_BREAK:
+    case F_CONT: {
+        m_c_info.err.on_true(m_loops.empty(), "'{}' outside of loop", func_str_map.at(func.func));
+
+        auto& jumps = func.func == F_BREAK ? m_loops.back().breaks : m_loops.back().continues;
+        jumps.push_back(emit(OP_JMP));
+        break;
+    }
+    default:
+        UNREACHABLE();
+        break;
+    }
+}
+
+void Compiler::print(ast::NodeId ls)
+{
+    std::vector<ast::NodeId> args;
+    std::vector<TemplatePiece> pieces = lower_print(m_tree, ls, args, m_c_info);
+
+    if (pieces.size() == 1 && pieces[0].kind == TemplatePiece::Literal) {
+        emit(OP_WRITE, pieces[0].id);
+        return;
+    }
+
+    std::vector<int> arg_registers;
+    for (ast::NodeId arg : args)
+        arg_registers.push_back(number(arg, -1));
+
+    std::vector<PrintPiece> resolved;
+    for (const auto& piece : pieces) {
+        switch (piece.kind) {
+        case TemplatePiece::Literal:
+            resolved.push_back({ piece.kind, piece.id, piece.spec });
+            break;
+        case TemplatePiece::Int:
+        case TemplatePiece::Double:
+            resolved.push_back({ piece.kind, arg_registers[piece.id], piece.spec });
+            break;
+        case TemplatePiece::StrVar:
+            resolved.push_back({ piece.kind, str_var(piece.id), piece.spec });
+            break;
+        }
+    }
+
+    emit(OP_PRINT, m_program.templates.size());
+    m_program.templates.push_back(std::move(resolved));
+}
+
+} // namespace bytecode
@@ -0,0 +1,125 @@
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "print_template.hpp"
+
+class CompileInfo;
+
+namespace ast {
+class Ast;
+}
+
+namespace bytecode {
+
+/*
+ * Instructions of the register machine run by vm_run. Registers hold an
+ * integer or the bits of a double. Every variable lives in the register
+ * numbered like its stack slot in the native code, constants and temporaries
+ * get registers after them.
+ *
+ * Unless noted, operands are registers: 'r[a] = r[b] + r[c]'.
+ * Branches jump to the instruction c.
+ */
+enum opcode : uint32_t {
+    OP_MOV, /* r[a] = r[b] */
+
+    /* Integer arithmetic, division is unsigned like in the native code */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+
+    /* r[a] = r[b] +/- c, e.g. 'add i ; 1' */
+    OP_ADDI,
+    OP_SUBI,
+
+    OP_FADD,
+    OP_FSUB,
+    OP_FMUL,
+    OP_FDIV,
+
+    OP_LOAD,  /* r[a] = array b at index r[c] */
+    OP_STORE, /* array a at index r[b] = r[c] */
+
+    OP_JMP,
+
+    /* Jump if r[a] cmp r[b], in the order of cmp_op */
+    OP_JEQ,
+    OP_JNE,
+    OP_JLT,
+    OP_JLE,
+    OP_JGT,
+    OP_JGE,
+
+    /* Jump if r[a] cmp b, e.g. the test of 'while i < 100' */
+    OP_JEQI,
+    OP_JNEI,
+    OP_JLTI,
+    OP_JLEI,
+    OP_JGTI,
+    OP_JGEI,
+
+    /* Jump if double r[a] cmp r[b]. Like comisd and the jumps the native code
+     * uses, unordered operands count as both equal and less. */
+    OP_FJEQ,
+    OP_FJNE,
+    OP_FJLT,
+    OP_FJLE,
+    OP_FJGT,
+    OP_FJGE,
+
+    OP_PRINT,   /* Print template a */
+    OP_WRITE,   /* Write string constant a */
+    OP_PUTCHAR, /* Write the character r[a] */
+    OP_READ,    /* Read a line into string variable a */
+    OP_TIME,    /* r[a] = time(NULL) */
+    OP_GETUID,  /* r[a] = getuid() */
+    OP_EXIT,    /* Exit with status r[a] */
+    OP_HALT,    /* Exit with status 0 */
+
+    OPCODE_ENUM_END,
+};
+
+struct Insn {
+    opcode op;
+    int32_t a, b, c;
+};
+
+/* Element i of an array is in register base - i, like on the native stack */
+struct Array {
+    int32_t base;
+    int32_t units;
+};
+
+/* A TemplatePiece with the operand resolved: string constant for Literal,
+ * register for Int and Double, string variable for StrVar */
+struct PrintPiece {
+    TemplatePiece::Kind kind;
+    int32_t operand;
+    FormatSpec spec;
+};
+
+struct Program {
+    std::vector<Insn> code;
+    std::vector<int> lines; /* Source line of every instruction */
+
+    std::vector<int64_t> registers; /* Initial contents: constants, everything else zero */
+    std::vector<Array> arrays;
+    size_t str_vars = 0;
+
+    std::vector<std::string> strings; /* The bytes of the string constants */
+    std::vector<std::vector<PrintPiece>> templates;
+};
+
+/* Lower a program that passed semantic analysis to bytecode */
+Program compile(const ast::Ast& tree, CompileInfo& c_info);
+
+} // namespace bytecode
+
+#endif // BYTECODE_H_
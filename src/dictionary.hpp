@@ -19,11 +19,13 @@ enum func_id {
     F_DOUBLE,
     F_ARRAY,
     F_STR,
+    FUNC_ENUM_END,
 };
 
 enum value_func_id {
     VF_TIME,
     VF_GETUID,
+    VALUE_FUNC_ENUM_END,
 };
 
 enum conditional {
@@ -94,4 +96,16 @@ enum var_type {
     V_UNSURE,
 };
 
+#define FORMAT_MAX_WIDTH 255
+#define FORMAT_MAX_PRECISION 18
+#define FORMAT_DEFAULT_PRECISION 6
+
+/* How a format parameter is printed: '[x:08.3]' is padded with zeros to a
+ * width of 8 and printed with 3 decimals. */
+struct FormatSpec {
+    int width = 0;
+    char fill = ' ';
+    int precision = -1; /* -1: default, only for doubles */
+};
+
 #endif // DICTIONARY_H_
@@ -0,0 +1,85 @@
+#include <cstring>
+#include <elf.h>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "assembler.hpp"
+#include "elf.hpp"
+#include "util.hpp"
+
+/* File offsets equal the distance from ELF_LOAD_ADDRESS, so every segment is
+ * congruent to its address modulo the page size like the kernel wants it */
+void write_elf_executable(const assembler::Image& image, std::string_view fn, CompileInfo& c_info)
+{
+    std::vector<Elf64_Phdr> segments;
+
+    /* Headers, .text and .rodata */
+    segments.push_back({
+        .p_type = PT_LOAD,
+        .p_flags = PF_R | PF_X,
+        .p_offset = 0,
+        .p_vaddr = ELF_LOAD_ADDRESS,
+        .p_paddr = ELF_LOAD_ADDRESS,
+        .p_filesz = image.text_address - ELF_LOAD_ADDRESS + image.text.size(),
+        .p_memsz = image.text_address - ELF_LOAD_ADDRESS + image.text.size(),
+        .p_align = 0x1000,
+    });
+
+    /* .data and .bss */
+    if (!image.data.empty() || image.bss_size != 0) {
+        segments.push_back({
+            .p_type = PT_LOAD,
+            .p_flags = PF_R | PF_W,
+            .p_offset = image.data_address - ELF_LOAD_ADDRESS,
+            .p_vaddr = image.data_address,
+            .p_paddr = image.data_address,
+            .p_filesz = image.data.size(),
+            .p_memsz = image.data.size() + image.bss_size,
+            .p_align = 0x1000,
+        });
+    }
+
+    /* Non-executable stack */
+    segments.push_back({
+        .p_type = PT_GNU_STACK,
+        .p_flags = PF_R | PF_W,
+        .p_offset = 0,
+        .p_vaddr = 0,
+        .p_paddr = 0,
+        .p_filesz = 0,
+        .p_memsz = 0,
+        .p_align = 16,
+    });
+
+    Elf64_Ehdr header = {};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_entry = image.entry;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = segments.size();
+
+    std::vector<char> file(image.text_address - ELF_LOAD_ADDRESS, 0);
+    std::memcpy(file.data(), &header, sizeof(header));
+    std::memcpy(file.data() + sizeof(header), segments.data(), segments.size() * sizeof(Elf64_Phdr));
+    file.insert(file.end(), image.text.begin(), image.text.end());
+    if (!image.data.empty()) {
+        file.resize(image.data_address - ELF_LOAD_ADDRESS, 0);
+        file.insert(file.end(), image.data.begin(), image.data.end());
+    }
+
+    std::ofstream out(fn.data(), std::ios::binary | std::ios::trunc);
+    c_info.err.on_false(out.is_open(), "{}: {}", fn, std::strerror(errno));
+    out.write(file.data(), file.size());
+    out.close();
+
+    std::filesystem::permissions(fn, std::filesystem::perms::owner_all | std::filesystem::perms::group_read | std::filesystem::perms::group_exec | std::filesystem::perms::others_read | std::filesystem::perms::others_exec);
+}
@@ -0,0 +1,23 @@
+#ifndef ELF_H_
+#define ELF_H_
+
+#include <cstdint>
+#include <string_view>
+
+class CompileInfo;
+
+namespace assembler {
+struct Image;
+}
+
+/* Where the ELF headers are mapped, .text starts on the page after them */
+#define ELF_LOAD_ADDRESS 0x400000
+#define ELF_TEXT_ADDRESS (ELF_LOAD_ADDRESS + 0x1000)
+
+/*
+ * Write a statically linked x86_64 executable containing image to fn.
+ * image has to be linked at ELF_TEXT_ADDRESS.
+ */
+void write_elf_executable(const assembler::Image& image, std::string_view fn, CompileInfo& c_info);
+
+#endif // ELF_H_
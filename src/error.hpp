@@ -17,7 +17,7 @@ public:
     void on_true(bool eval, T&& format, args&&... fargs);
 
     template<typename T, typename... args>
-    void error(T&& format, args&&... fargs);
+    [[noreturn]] void error(T&& format, args&&... fargs);
 
     void set_file(std::string_view file) { m_file = file; };
     void set_line(int line) { m_line = line; };
@@ -0,0 +1,443 @@
+#include <cmath>
+#include <cstdint>
+#include <optional>
+
+#include "ast.hpp"
+
+namespace ast {
+
+template<typename T>
+static bool compare(cmp_op cmp, T a, T b)
+{
+    switch (cmp) {
+    case EQUAL:
+        return a == b;
+    case NOT_EQUAL:
+        return a != b;
+    case LESS:
+        return a < b;
+    case LESS_OR_EQ:
+        return a <= b;
+    case GREATER:
+        return a > b;
+    case GREATER_OR_EQ:
+        return a >= b;
+    default:
+        UNREACHABLE();
+        return false;
+    }
+}
+
+/*
+ * Folds constants and simplifies arithmetic, comparisons and logical
+ * conditions in place. Integers are computed like the generated code does,
+ * 64 bits wrapping around with unsigned division, and only replaced by a
+ * constant that fits into Const. Doubles are only folded where the result
+ * is exactly what the machine would compute, so nothing is reassociated.
+ * A subtree is only dropped if evaluating it cannot fail.
+ */
+class Folder {
+public:
+    explicit Folder(Ast& tree)
+        : m_tree(tree)
+    {
+    }
+
+    void statement(NodeId nd);
+
+private:
+    NodeId operand(NodeId nd);
+    NodeId arithmetic(NodeId nd);
+    NodeId int_arithmetic(NodeId nd);
+    NodeId double_arithmetic(NodeId nd);
+    NodeId condition(NodeId nd);
+
+    std::optional<int64_t> int_value(NodeId nd) const;
+    std::optional<double> double_value(NodeId nd) const;
+    /* Whether a condition is a constant, and which */
+    std::optional<bool> decided(NodeId nd) const;
+    /* Whether evaluating nd can stop the program: an access out of bounds
+     * or a division by zero */
+    bool may_fail(NodeId nd) const;
+
+    /* A constant of the value or NO_NODE if Const cannot hold it */
+    NodeId int_const(int line, uint64_t value);
+    NodeId double_const(int line, double value);
+
+    Ast& m_tree;
+};
+
+void Folder::statement(NodeId nd)
+{
+    switch (m_tree.type(nd)) {
+    case T_BODY: {
+        /* No bodies are added while folding, the reference stays valid */
+        for (NodeId child : m_tree.get<Body>(nd).children)
+            statement(child);
+        break;
+    }
+    case T_IF: {
+        NodeId cond = condition(m_tree.get<If>(nd).condition);
+        If& t_if = m_tree.get<If>(nd);
+        t_if.condition = cond;
+
+        statement(t_if.body);
+        if (t_if.elif != NO_NODE)
+            statement(t_if.elif);
+        break;
+    }
+    case T_ELSE:
+        statement(m_tree.get<Else>(nd).body);
+        break;
+    case T_WHILE: {
+        NodeId cond = condition(m_tree.get<While>(nd).condition);
+        While& t_while = m_tree.get<While>(nd);
+        t_while.condition = cond;
+
+        statement(t_while.body);
+        break;
+    }
+    case T_FUNC: {
+        Func& func = m_tree.get<Func>(nd);
+        for (NodeId& arg : func.args)
+            arg = operand(arg);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Fold an argument, returning what replaces it. Only numbers are replaced,
+ * variables and accesses written to keep their node. */
+NodeId Folder::operand(NodeId nd)
+{
+    switch (m_tree.type(nd)) {
+    case T_ARIT:
+        return arithmetic(nd);
+    case T_ACCESS: {
+        NodeId index = operand(m_tree.get<Access>(nd).index);
+        m_tree.get<Access>(nd).index = index;
+        return nd;
+    }
+    case T_LSTR: {
+        for (NodeId format : m_tree.get<Lstr>(nd).format)
+            operand(format);
+        return nd;
+    }
+    default:
+        return nd;
+    }
+}
+
+NodeId Folder::arithmetic(NodeId nd)
+{
+    NodeId left = operand(m_tree.get<Arit>(nd).left);
+    NodeId right = operand(m_tree.get<Arit>(nd).right);
+
+    Arit& arit = m_tree.get<Arit>(nd);
+    arit.left = left;
+    arit.right = right;
+
+    /* Semantic analysis made sure both sides have the type of the node */
+    if (m_tree.num_type(nd) == V_DOUBLE)
+        return double_arithmetic(nd);
+
+    return int_arithmetic(nd);
+}
+
+NodeId Folder::int_arithmetic(NodeId nd)
+{
+    int line = m_tree.line(nd);
+    Arit arit = m_tree.get<Arit>(nd);
+    std::optional<int64_t> left = int_value(arit.left);
+    std::optional<int64_t> right = int_value(arit.right);
+
+    if (left && right) {
+        uint64_t a = *left, b = *right;
+        std::optional<uint64_t> result;
+
+        switch (arit.arit) {
+        case ADD:
+            result = a + b;
+            break;
+        case SUB:
+            result = a - b;
+            break;
+        case MUL:
+            result = a * b;
+            break;
+        case DIV:
+            if (b != 0)
+                result = a / b;
+            break;
+        case MOD:
+            if (b != 0)
+                result = a % b;
+            break;
+        default:
+            UNREACHABLE();
+            break;
+        }
+
+        NodeId folded = result ? int_const(line, *result) : NO_NODE;
+        if (folded != NO_NODE)
+            return folded;
+        return nd;
+    }
+
+    /* Constants go to the right, where the rules below look for them */
+    if (left && (arit.arit == ADD || arit.arit == MUL)) {
+        std::swap(arit.left, arit.right);
+        std::swap(left, right);
+        m_tree.get<Arit>(nd) = arit;
+    }
+
+    if (!right)
+        return nd;
+
+    int64_t c = *right;
+
+    switch (arit.arit) {
+    case ADD:
+    case SUB:
+        if (c == 0)
+            return arit.left;
+        break;
+    case MUL:
+        if (c == 1)
+            return arit.left;
+        if (c == 0 && !may_fail(arit.left))
+            return int_const(line, 0);
+        break;
+    case DIV:
+        if (c == 1)
+            return arit.left;
+        break;
+    case MOD:
+        if (c == 1 && !may_fail(arit.left))
+            return int_const(line, 0);
+        break;
+    default:
+        break;
+    }
+
+    /* (x op c1) op c2 is x op (c1 op' c2) where that is a constant too */
+    if (m_tree.type(arit.left) != T_ARIT)
+        return nd;
+
+    const Arit& inner = m_tree.get<Arit>(arit.left);
+    std::optional<int64_t> inner_right = int_value(inner.right);
+    if (!inner_right)
+        return nd;
+
+    uint64_t c1 = *inner_right, c2 = c;
+    bool additive = arit.arit == ADD || arit.arit == SUB;
+    bool inner_additive = inner.arit == ADD || inner.arit == SUB;
+    NodeId x = inner.left;
+    arit_op op;
+    uint64_t combined;
+
+    if (additive && inner_additive) {
+        uint64_t sum = (inner.arit == ADD ? c1 : -c1) + (arit.arit == ADD ? c2 : -c2);
+        if (sum == 0)
+            return x;
+
+        /* x - 3 rather than x + -3 */
+        op = (int64_t)sum < 0 ? SUB : ADD;
+        combined = op == SUB ? -sum : sum;
+    } else if (arit.arit == MUL && inner.arit == MUL) {
+        op = MUL;
+        combined = c1 * c2;
+    } else if (arit.arit == DIV && inner.arit == DIV && *inner_right > 0 && c > 0) {
+        /* Unsigned division, the product of two ints cannot overflow */
+        op = DIV;
+        combined = c1 * c2;
+    } else {
+        return nd;
+    }
+
+    NodeId constant = int_const(line, combined);
+    if (constant == NO_NODE)
+        return nd;
+
+    Arit& folded = m_tree.get<Arit>(nd);
+    folded.left = x;
+    folded.right = constant;
+    folded.arit = op;
+
+    /* The new constant may make it an identity */
+    return int_arithmetic(nd);
+}
+
+NodeId Folder::double_arithmetic(NodeId nd)
+{
+    const Arit& arit = m_tree.get<Arit>(nd);
+    std::optional<double> left = double_value(arit.left);
+    std::optional<double> right = double_value(arit.right);
+
+    /* Doubles have no remainder, lowering reports it */
+    if (arit.arit == MOD)
+        return nd;
+
+    if (left && right) {
+        switch (arit.arit) {
+        case ADD:
+            return double_const(m_tree.line(nd), *left + *right);
+        case SUB:
+            return double_const(m_tree.line(nd), *left - *right);
+        case MUL:
+            return double_const(m_tree.line(nd), *left * *right);
+        case DIV:
+            return double_const(m_tree.line(nd), *left / *right);
+        default:
+            UNREACHABLE();
+            return nd;
+        }
+    }
+
+    /* Only what holds for every double, NaN and -0.0 included: x + 0.0 is
+     * 0.0 for x = -0.0 */
+    if (right && *right == 1.0 && (arit.arit == MUL || arit.arit == DIV))
+        return arit.left;
+    if (left && *left == 1.0 && arit.arit == MUL)
+        return arit.right;
+    if (right && *right == 0.0 && !std::signbit(*right) && arit.arit == SUB)
+        return arit.left;
+
+    return nd;
+}
+
+NodeId Folder::condition(NodeId nd)
+{
+    if (m_tree.type(nd) == T_LOG) {
+        NodeId left = condition(m_tree.get<Log>(nd).left);
+        NodeId right = condition(m_tree.get<Log>(nd).right);
+
+        Log& log = m_tree.get<Log>(nd);
+        log.left = left;
+        log.right = right;
+
+        /* The value of the side deciding the outcome of the operator */
+        bool decides = log.log == OR;
+        std::optional<bool> left_value = decided(left);
+        std::optional<bool> right_value = decided(right);
+
+        if (left_value)
+            return *left_value == decides ? left : right;
+        if (right_value && *right_value != decides)
+            return left;
+        if (right_value && !may_fail(left))
+            return right;
+
+        return nd;
+    }
+
+    /* No comparisons are added while folding, the reference stays valid */
+    Cmp& cmp = m_tree.get<Cmp>(nd);
+    cmp.left = operand(cmp.left);
+    if (cmp.right == NO_NODE)
+        return nd;
+    cmp.right = operand(cmp.right);
+
+    /* Both sides constant: the comparison becomes the constant without
+     * one, like 'if 1' */
+    std::optional<bool> holds;
+    std::optional<int64_t> a = int_value(cmp.left), b = int_value(cmp.right);
+    std::optional<double> x = double_value(cmp.left), y = double_value(cmp.right);
+
+    /* NaN is left to the back ends, which do not agree on it */
+    if (a && b)
+        holds = compare(cmp.cmp, *a, *b);
+    else if (x && y && !std::isnan(*x) && !std::isnan(*y))
+        holds = compare(cmp.cmp, *x, *y);
+
+    if (holds) {
+        cmp.left = int_const(m_tree.line(nd), *holds);
+        cmp.right = NO_NODE;
+    }
+
+    return nd;
+}
+
+std::optional<int64_t> Folder::int_value(NodeId nd) const
+{
+    if (m_tree.type(nd) != T_CONST)
+        return std::nullopt;
+
+    return m_tree.get<Const>(nd).value;
+}
+
+std::optional<double> Folder::double_value(NodeId nd) const
+{
+    if (m_tree.type(nd) != T_DOUBLE_CONST)
+        return std::nullopt;
+
+    return m_tree.get<DoubleConst>(nd).value;
+}
+
+std::optional<bool> Folder::decided(NodeId nd) const
+{
+    if (m_tree.type(nd) != T_CMP || m_tree.get<Cmp>(nd).right != NO_NODE)
+        return std::nullopt;
+
+    NodeId value = m_tree.get<Cmp>(nd).left;
+    if (auto i = int_value(value))
+        return *i != 0;
+    if (auto d = double_value(value))
+        return *d != 0.0;
+
+    return std::nullopt;
+}
+
+bool Folder::may_fail(NodeId nd) const
+{
+    switch (m_tree.type(nd)) {
+    case T_ACCESS:
+        return true;
+    case T_ARIT: {
+        const Arit& arit = m_tree.get<Arit>(nd);
+        if (arit.arit == DIV || arit.arit == MOD) {
+            std::optional<int64_t> divisor = int_value(arit.right);
+            if (m_tree.num_type(nd) == V_INT && (!divisor || *divisor == 0))
+                return true;
+        }
+        return may_fail(arit.left) || may_fail(arit.right);
+    }
+    case T_CMP: {
+        const Cmp& cmp = m_tree.get<Cmp>(nd);
+        return may_fail(cmp.left) || (cmp.right != NO_NODE && may_fail(cmp.right));
+    }
+    case T_LOG: {
+        const Log& log = m_tree.get<Log>(nd);
+        return may_fail(log.left) || may_fail(log.right);
+    }
+    default:
+        return false;
+    }
+}
+
+NodeId Folder::int_const(int line, uint64_t value)
+{
+    int64_t v = value;
+    if (v < INT32_MIN || v > INT32_MAX)
+        return NO_NODE;
+
+    NodeId nd = m_tree.add(line, Const { (int)v });
+    m_tree.set_num_type(nd, V_INT);
+    return nd;
+}
+
+NodeId Folder::double_const(int line, double value)
+{
+    NodeId nd = m_tree.add(line, DoubleConst { value });
+    m_tree.set_num_type(nd, V_DOUBLE);
+    return nd;
+}
+
+void fold_constants(Ast& tree)
+{
+    Folder(tree).statement(tree.root);
+}
+
+} // namespace ast
@@ -0,0 +1,1183 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include <fmt/ostream.h>
+
+#include "ast.hpp"
+#include "ir.hpp"
+#include "maps.hpp"
+#include "util.hpp"
+
+namespace ir {
+
+static constexpr auto opcode_str_map = make_table<opcode, std::string_view, OPCODE_ENUM_END>({
+    { OP_MOV, "mov" },
+    { OP_PHI, "phi" },
+    { OP_ADD, "add" },
+    { OP_SUB, "sub" },
+    { OP_MUL, "mul" },
+    { OP_DIV, "div" },
+    { OP_MOD, "mod" },
+    { OP_FADD, "fadd" },
+    { OP_FSUB, "fsub" },
+    { OP_FMUL, "fmul" },
+    { OP_FDIV, "fdiv" },
+    { OP_LDV, "ldv" },
+    { OP_STV, "stv" },
+    { OP_LDA, "lda" },
+    { OP_STA, "sta" },
+    { OP_TIME, "time" },
+    { OP_GETUID, "getuid" },
+    { OP_PRINT, "print" },
+    { OP_WRITE, "write" },
+    { OP_PUTCHAR, "putchar" },
+    { OP_READ, "read" },
+    { OP_EXIT, "exit" },
+    { OP_JMP, "jmp" },
+    { OP_BR, "br" },
+    { OP_END, "end" },
+});
+
+static_assert(is_complete(opcode_str_map));
+
+static constexpr auto cmp_name_map = make_table<cmp_op, std::string_view, CMP_OPERATION_ENUM_END>({
+    { EQUAL, "eq" },
+    { NOT_EQUAL, "ne" },
+    { LESS, "lt" },
+    { LESS_OR_EQ, "le" },
+    { GREATER, "gt" },
+    { GREATER_OR_EQ, "ge" },
+});
+
+/* The instruction for an arithmetic operator on integers and on doubles */
+static constexpr auto int_arit_map = make_table<arit_op, opcode, ARIT_OPERATION_ENUM_END>({
+    { ADD, OP_ADD },
+    { SUB, OP_SUB },
+    { MUL, OP_MUL },
+    { DIV, OP_DIV },
+    { MOD, OP_MOD },
+});
+
+static constexpr auto double_arit_map = make_table<arit_op, opcode, ARIT_OPERATION_ENUM_END>({
+    { ADD, OP_FADD },
+    { SUB, OP_FSUB },
+    { MUL, OP_FMUL },
+    { DIV, OP_FDIV },
+}, OPCODE_ENUM_END);
+
+bool is_terminator(opcode op)
+{
+    return op == OP_JMP || op == OP_BR || op == OP_END;
+}
+
+bool has_dst(opcode op)
+{
+    return (op >= OP_MOV && op <= OP_FDIV) || op == OP_LDV || op == OP_LDA || op == OP_TIME || op == OP_GETUID;
+}
+
+bool evaluate(cmp_op cmp, const Operand& a, const Operand& b)
+{
+    if (a.kind == Operand::Int) {
+        int64_t x = a.int_value(), y = b.int_value();
+        switch (cmp) {
+        case EQUAL:
+            return x == y;
+        case NOT_EQUAL:
+            return x != y;
+        case LESS:
+            return x < y;
+        case LESS_OR_EQ:
+            return x <= y;
+        case GREATER:
+            return x > y;
+        case GREATER_OR_EQ:
+            return x >= y;
+        default:
+            UNREACHABLE();
+            return false;
+        }
+    }
+
+    /* comisd sets the flags of both less and equal for NaN */
+    double x = a.double_value(), y = b.double_value();
+    bool less = x < y || std::isunordered(x, y);
+    bool equal = x == y || std::isunordered(x, y);
+
+    switch (cmp) {
+    case EQUAL:
+        return equal;
+    case NOT_EQUAL:
+        return !equal;
+    case LESS:
+        return less;
+    case LESS_OR_EQ:
+        return less || equal;
+    case GREATER:
+        return !less && !equal;
+    case GREATER_OR_EQ:
+        return !less;
+    default:
+        UNREACHABLE();
+        return false;
+    }
+}
+
+size_t Block::phi_count() const
+{
+    size_t n = 0;
+    while (n < insns.size() && insns[n].op == OP_PHI)
+        n++;
+    return n;
+}
+
+Reg Function::new_reg(var_type type)
+{
+    regs.push_back(type);
+    return regs.size() - 1;
+}
+
+BlockId Function::new_block()
+{
+    blocks.emplace_back();
+    return blocks.size() - 1;
+}
+
+var_type Function::type(const Operand& op) const
+{
+    switch (op.kind) {
+    case Operand::Register:
+        return regs[op.reg()];
+    case Operand::Int:
+        return V_INT;
+    case Operand::Double:
+        return V_DOUBLE;
+    default:
+        return V_UNSURE;
+    }
+}
+
+void Function::compute_preds()
+{
+    for (auto& block : blocks)
+        block.preds.clear();
+
+    for (BlockId b = 0; b < blocks.size(); b++) {
+        for (BlockId succ : blocks[b].succs)
+            blocks[succ].preds.push_back(b);
+    }
+}
+
+void Function::renumber(const std::vector<BlockId>& order)
+{
+    std::vector<BlockId> new_id(blocks.size(), UINT32_MAX);
+    for (BlockId i = 0; i < order.size(); i++)
+        new_id[order[i]] = i;
+
+    std::vector<Block> renumbered;
+    renumbered.reserve(order.size());
+
+    for (BlockId b : order) {
+        Block& block = blocks[b];
+
+        for (BlockId& succ : block.succs) {
+            assert(new_id[succ] != UINT32_MAX);
+            succ = new_id[succ];
+        }
+
+        /* Phi operands follow the predecessors they come from */
+        size_t phis = block.phi_count();
+        size_t kept = 0;
+        for (size_t i = 0; i < block.preds.size(); i++) {
+            if (new_id[block.preds[i]] == UINT32_MAX)
+                continue;
+
+            block.preds[kept] = new_id[block.preds[i]];
+            for (size_t p = 0; p < phis; p++)
+                block.insns[p].args[kept] = block.insns[p].args[i];
+            kept++;
+        }
+
+        block.preds.resize(kept);
+        for (size_t p = 0; p < phis; p++)
+            block.insns[p].args.resize(kept);
+
+        renumbered.push_back(std::move(block));
+    }
+
+    blocks = std::move(renumbered);
+}
+
+/* The simple version of "A Fast Algorithm for Finding Dominators in a
+ * Flowgraph" by Lengauer and Tarjan, with path compression but without
+ * balancing. Iterative dataflow would take quadratic time on the join of
+ * a long elif chain. */
+Dominators::Dominators(const Function& fn)
+    : m_idom(fn.blocks.size(), NO_BLOCK)
+    , m_children(fn.blocks.size())
+    , m_enter(fn.blocks.size(), 0)
+    , m_leave(fn.blocks.size(), 0)
+{
+    size_t blocks = fn.blocks.size();
+
+    /* Depth first numbering and the tree of the search */
+    std::vector<BlockId> vertex;
+    std::vector<uint32_t> dfnum(blocks, UINT32_MAX);
+    std::vector<BlockId> parent(blocks, NO_BLOCK);
+
+    std::vector<std::pair<BlockId, size_t>> stack = { { 0, 0 } };
+    dfnum[0] = 0;
+    vertex.push_back(0);
+
+    while (!stack.empty()) {
+        auto& [b, next] = stack.back();
+
+        if (next < fn.blocks[b].succs.size()) {
+            BlockId succ = fn.blocks[b].succs[next++];
+            if (dfnum[succ] == UINT32_MAX) {
+                dfnum[succ] = vertex.size();
+                vertex.push_back(succ);
+                parent[succ] = b;
+                stack.push_back({ succ, 0 });
+            }
+        } else {
+            stack.pop_back();
+        }
+    }
+
+    /* Semidominators as depth first numbers, the forest linked so far and
+     * the block with the smallest semidominator on the way up to its root */
+    std::vector<uint32_t> semi(dfnum);
+    std::vector<BlockId> ancestor(blocks, NO_BLOCK);
+    std::vector<BlockId> label(blocks);
+    std::vector<std::vector<BlockId>> bucket(blocks);
+    for (BlockId b = 0; b < blocks; b++)
+        label[b] = b;
+
+    std::vector<BlockId> path;
+    auto eval = [&](BlockId v) {
+        if (ancestor[v] == NO_BLOCK)
+            return v;
+
+        /* Compress the path to the root, from its top down */
+        for (BlockId x = v; ancestor[ancestor[x]] != NO_BLOCK; x = ancestor[x])
+            path.push_back(x);
+
+        for (auto it = path.rbegin(); it != path.rend(); it++) {
+            BlockId x = *it, a = ancestor[x];
+            if (semi[label[a]] < semi[label[x]])
+                label[x] = label[a];
+            ancestor[x] = ancestor[a];
+        }
+        path.clear();
+
+        return label[v];
+    };
+
+    for (size_t i = vertex.size() - 1; i > 0; i--) {
+        BlockId w = vertex[i];
+
+        for (BlockId pred : fn.blocks[w].preds) {
+            if (dfnum[pred] != UINT32_MAX)
+                semi[w] = std::min(semi[w], semi[eval(pred)]);
+        }
+
+        bucket[vertex[semi[w]]].push_back(w);
+        ancestor[w] = parent[w];
+
+        for (BlockId v : bucket[parent[w]]) {
+            BlockId u = eval(v);
+            m_idom[v] = semi[u] < semi[v] ? u : parent[w];
+        }
+        bucket[parent[w]].clear();
+    }
+
+    for (size_t i = 1; i < vertex.size(); i++) {
+        BlockId w = vertex[i];
+        if (m_idom[w] != vertex[semi[w]])
+            m_idom[w] = m_idom[m_idom[w]];
+    }
+    m_idom[0] = 0;
+
+    for (size_t i = 1; i < vertex.size(); i++)
+        m_children[m_idom[vertex[i]]].push_back(vertex[i]);
+
+    uint32_t number = 0;
+    stack = { { 0, 0 } };
+    m_enter[0] = number++;
+
+    while (!stack.empty()) {
+        auto& [b, next] = stack.back();
+
+        if (next < m_children[b].size()) {
+            BlockId child = m_children[b][next++];
+            m_enter[child] = number++;
+            stack.push_back({ child, 0 });
+        } else {
+            m_leave[b] = number - 1;
+            stack.pop_back();
+        }
+    }
+}
+
+bool Dominators::dominates(BlockId a, BlockId b) const
+{
+    return reachable(a) && reachable(b) && m_enter[a] <= m_enter[b] && m_enter[b] <= m_leave[a];
+}
+
+class Lowering {
+public:
+    Function lower();
+
+    Lowering(const ast::Ast& tree, CompileInfo& c_info)
+        : m_tree(tree)
+        , m_c_info(c_info)
+    {
+    }
+
+private:
+    /* Where break and continue go */
+    struct Loop {
+        BlockId head;
+        BlockId exit;
+    };
+
+    void statement(ast::NodeId nd);
+    void body(ast::NodeId body);
+    void function(const ast::Func& func);
+    void if_chain(ast::NodeId nd);
+    void while_loop(ast::NodeId nd);
+    void print(ast::NodeId ls);
+
+    /* Branch to on_true if nd holds, to on_false otherwise */
+    void condition(ast::NodeId nd, BlockId on_true, BlockId on_false);
+
+    /* The value of a number, a constant or the register it was computed into */
+    Operand value(ast::NodeId nd);
+    Operand arithmetic(ast::NodeId nd);
+
+    /* Add an instruction to the current block, code after a jump starts a
+     * new block nothing jumps to */
+    void emit(Insn insn);
+    Reg define(opcode op, var_type type, Operand a = {}, Operand b = {}, int var = -1);
+    void jump(BlockId to);
+    void branch(cmp_op cmp, Operand a, Operand b, BlockId on_true, BlockId on_false);
+    void start(BlockId block);
+
+    void set_line(ast::NodeId nd);
+
+    const ast::Ast& m_tree;
+    CompileInfo& m_c_info;
+    Function m_fn;
+
+    std::vector<Loop> m_loops;
+    std::vector<BlockId> m_order; /* The blocks in the order they were started */
+    BlockId m_current = 0;
+    bool m_open = false; /* Whether m_current has no terminator yet */
+    int m_line = 0;
+};
+
+Function lower(const ast::Ast& tree, CompileInfo& c_info)
+{
+    return Lowering(tree, c_info).lower();
+}
+
+Function Lowering::lower()
+{
+    start(m_fn.new_block());
+    body(m_tree.root);
+    emit({ OP_END });
+    m_open = false;
+
+    /* Lay the blocks out in the order of the source and drop the code after
+     * break, continue and the like */
+    std::vector<bool> reachable(m_fn.blocks.size(), false);
+    std::vector<BlockId> work = { 0 };
+    reachable[0] = true;
+
+    while (!work.empty()) {
+        BlockId b = work.back();
+        work.pop_back();
+
+        for (BlockId succ : m_fn.blocks[b].succs) {
+            if (!reachable[succ]) {
+                reachable[succ] = true;
+                work.push_back(succ);
+            }
+        }
+    }
+
+    std::erase_if(m_order, [&reachable](BlockId b) { return !reachable[b]; });
+    m_fn.compute_preds();
+    m_fn.renumber(m_order);
+
+    return std::move(m_fn);
+}
+
+void Lowering::set_line(ast::NodeId nd)
+{
+    m_line = m_tree.line(nd);
+    m_c_info.err.set_line(m_line);
+}
+
+void Lowering::start(BlockId block)
+{
+    m_current = block;
+    m_open = true;
+    m_order.push_back(block);
+}
+
+void Lowering::emit(Insn insn)
+{
+    if (!m_open)
+        start(m_fn.new_block());
+
+    insn.line = m_line;
+    m_fn.blocks[m_current].insns.push_back(std::move(insn));
+}
+
+Reg Lowering::define(opcode op, var_type type, Operand a, Operand b, int var)
+{
+    Reg dst = m_fn.new_reg(type);
+    emit({ .op = op, .dst = dst, .a = a, .b = b, .var = var });
+    return dst;
+}
+
+void Lowering::jump(BlockId to)
+{
+    emit({ OP_JMP });
+    m_fn.blocks[m_current].succs = { to };
+    m_open = false;
+}
+
+void Lowering::branch(cmp_op cmp, Operand a, Operand b, BlockId on_true, BlockId on_false)
+{
+    emit({ .op = OP_BR, .cmp = cmp, .a = a, .b = b });
+    m_fn.blocks[m_current].succs = { on_true, on_false };
+    m_open = false;
+}
+
+void Lowering::body(ast::NodeId body)
+{
+    for (ast::NodeId child : m_tree.get<ast::Body>(body).children)
+        statement(child);
+}
+
+void Lowering::statement(ast::NodeId nd)
+{
+    set_line(nd);
+
+    switch (m_tree.type(nd)) {
+    case ast::T_IF:
+        if_chain(nd);
+        break;
+    case ast::T_WHILE:
+        while_loop(nd);
+        break;
+    case ast::T_FUNC:
+        function(m_tree.get<ast::Func>(nd));
+        break;
+    default:
+        UNREACHABLE();
+        break;
+    }
+}
+
+void Lowering::if_chain(ast::NodeId nd)
+{
+    BlockId end = m_fn.new_block();
+
+    for (;;) {
+        const ast::If& t_if = m_tree.get<ast::If>(nd);
+        set_line(nd);
+
+        BlockId then = m_fn.new_block();
+        BlockId next = t_if.elif == ast::NO_NODE ? end : m_fn.new_block();
+
+        condition(t_if.condition, then, next);
+
+        start(then);
+        body(t_if.body);
+        jump(end);
+
+        if (t_if.elif == ast::NO_NODE)
+            break;
+
+        start(next);
+
+        if (m_tree.type(t_if.elif) == ast::T_ELSE) {
+            body(m_tree.get<ast::Else>(t_if.elif).body);
+            jump(end);
+            break;
+        }
+        nd = t_if.elif;
+    }
+
+    start(end);
+}
+
+void Lowering::while_loop(ast::NodeId nd)
+{
+    const ast::While& t_while = m_tree.get<ast::While>(nd);
+
+    BlockId head = m_fn.new_block();
+    BlockId loop_body = m_fn.new_block();
+    BlockId exit = m_fn.new_block();
+
+    jump(head);
+    start(head);
+    condition(t_while.condition, loop_body, exit);
+
+    start(loop_body);
+    m_loops.push_back({ head, exit });
+    body(t_while.body);
+    m_loops.pop_back();
+
+    set_line(nd);
+    jump(head);
+
+    start(exit);
+}
+
+void Lowering::condition(ast::NodeId nd, BlockId on_true, BlockId on_false)
+{
+    if (m_tree.type(nd) == ast::T_LOG) {
+        const ast::Log& log = m_tree.get<ast::Log>(nd);
+        BlockId right = m_fn.new_block();
+
+        /* The right side is only looked at if the left one does not decide */
+        if (log.log == AND)
+            condition(log.left, right, on_false);
+        else
+            condition(log.left, on_true, right);
+
+        start(right);
+        condition(log.right, on_true, on_false);
+        return;
+    }
+
+    const ast::Cmp& cmp = m_tree.get<ast::Cmp>(nd);
+    bool has_right = cmp.right != ast::NO_NODE;
+
+    /* Semantic analysis made sure both sides have the same type */
+    var_type type = m_tree.num_type(cmp.left);
+
+    /* 'if 1' and 'while 0' are decided now */
+    if (!has_right && (m_tree.type(cmp.left) == ast::T_CONST || m_tree.type(cmp.left) == ast::T_DOUBLE_CONST)) {
+        bool holds = m_tree.type(cmp.left) == ast::T_CONST ? m_tree.get<ast::Const>(cmp.left).value != 0
+                                                           : m_tree.get<ast::DoubleConst>(cmp.left).value != 0.0;
+        jump(holds ? on_true : on_false);
+        return;
+    }
+
+    Operand left = value(cmp.left);
+
+    /* Without a right side: compare against zero */
+    if (!has_right) {
+        branch(NOT_EQUAL, left, type == V_DOUBLE ? Operand::of_double(0.0) : Operand::of_int(0), on_true, on_false);
+        return;
+    }
+
+    branch(cmp.cmp, left, value(cmp.right), on_true, on_false);
+}
+
+Operand Lowering::value(ast::NodeId nd)
+{
+    assert(ast::could_be_num(m_tree.type(nd)));
+
+    switch (m_tree.type(nd)) {
+    case ast::T_CONST:
+        return Operand::of_int(m_tree.get<ast::Const>(nd).value);
+    case ast::T_DOUBLE_CONST:
+        return Operand::of_double(m_tree.get<ast::DoubleConst>(nd).value);
+    case ast::T_VAR: {
+        int var_id = m_tree.get<ast::Var>(nd).var_id;
+        m_c_info.error_on_undefined(var_id);
+
+        return Operand::of_reg(define(OP_LDV, m_c_info.known_vars[var_id].type, {}, {}, var_id));
+    }
+    case ast::T_ACCESS: {
+        const ast::Access& access = m_tree.get<ast::Access>(nd);
+        Operand index = value(access.index);
+
+        return Operand::of_reg(define(OP_LDA, V_INT, index, {}, access.array_id));
+    }
+    case ast::T_VFUNC: {
+        const ast::VFunc& vfunc = m_tree.get<ast::VFunc>(nd);
+        m_c_info.err.on_false(vfunc.return_type == V_INT,
+            "'{}' has wrong return type '{}'",
+            vfunc_str_map.at(vfunc.vfunc),
+            var_type_str_map.at(vfunc.return_type));
+
+        return Operand::of_reg(define(vfunc.vfunc == VF_TIME ? OP_TIME : OP_GETUID, V_INT));
+    }
+    case ast::T_ARIT:
+        return arithmetic(nd);
+    default:
+        UNREACHABLE();
+        return {};
+    }
+}
+
+Operand Lowering::arithmetic(ast::NodeId nd)
+{
+    const ast::Arit& arit = m_tree.get<ast::Arit>(nd);
+    var_type type = m_tree.num_type(nd);
+
+    Operand left = value(arit.left);
+    Operand right = value(arit.right);
+
+    if (type == V_DOUBLE) {
+        m_c_info.err.on_true(arit.arit == MOD, "'{}' not allowed in floating point operations", arit_str_map.at(arit.arit));
+        return Operand::of_reg(define(double_arit_map[arit.arit], V_DOUBLE, left, right));
+    }
+
+    assert(type == V_INT);
+    return Operand::of_reg(define(int_arit_map[arit.arit], V_INT, left, right));
+}
+
+void Lowering::function(const ast::Func& func)
+{
+    const auto& args = func.args;
+
+    switch (func.func) {
+    case F_EXIT:
+        emit({ .op = OP_EXIT, .a = value(args[0]) });
+        break;
+    case F_PUTCHAR:
+        emit({ .op = OP_PUTCHAR, .a = value(args[0]) });
+        break;
+    case F_ARRAY:
+    case F_STR:
+        /* check_correct_function_call defines the variable */
+        break;
+    case F_PRINT:
+        print(args[0]);
+        break;
+    case F_INT:
+    case F_DOUBLE:
+    case F_SET:
+    case F_SETD: {
+        Operand input = value(args[1]);
+
+        if (m_tree.type(args[0]) == ast::T_VAR) {
+            emit({ .op = OP_STV, .a = input, .var = m_tree.get<ast::Var>(args[0]).var_id });
+            break;
+        }
+
+        const ast::Access& access = m_tree.get<ast::Access>(args[0]);
+        m_c_info.err.on_true(func.func == F_SETD, "double arrays are not implemented yet");
+
+        emit({ .op = OP_STA, .a = value(access.index), .b = input, .var = access.array_id });
+        break;
+    }
+    case F_ADD:
+    case F_SUB: {
+        opcode op = func.func == F_ADD ? OP_ADD : OP_SUB;
+
+        if (m_tree.type(args[0]) == ast::T_VAR) {
+            int var_id = m_tree.get<ast::Var>(args[0]).var_id;
+            m_c_info.error_on_wrong_type(var_id, V_INT);
+
+            Reg old_value = define(OP_LDV, V_INT, {}, {}, var_id);
+            Reg new_value = define(op, V_INT, Operand::of_reg(old_value), value(args[1]));
+            emit({ .op = OP_STV, .a = Operand::of_reg(new_value), .var = var_id });
+            break;
+        }
+
+        const ast::Access& access = m_tree.get<ast::Access>(args[0]);
+        Operand index = value(access.index);
+
+        Reg old_value = define(OP_LDA, V_INT, index, {}, access.array_id);
+        Reg new_value = define(op, V_INT, Operand::of_reg(old_value), value(args[1]));
+        emit({ .op = OP_STA, .a = index, .b = Operand::of_reg(new_value), .var = access.array_id });
+        break;
+    }
+    case F_READ:
+        emit({ .op = OP_READ, .var = m_tree.get<ast::Var>(args[0]).var_id });
+        break;
+    case F_BREAK:
+    case F_CONT: {
+        m_c_info.err.on_true(m_loops.empty(), "'{}' outside of loop", func_str_map.at(func.func));
+
+        jump(func.func == F_BREAK ? m_loops.back().exit : m_loops.back().head);
+        break;
+    }
+    default:
+        UNREACHABLE();
+        break;
+    }
+}
+
+void Lowering::print(ast::NodeId ls)
+{
+    std::vector<ast::NodeId> args;
+    std::vector<TemplatePiece> pieces = lower_print(m_tree, ls, args, m_c_info);
+
+    if (pieces.size() == 1 && pieces[0].kind == TemplatePiece::Literal) {
+        emit({ .op = OP_WRITE, .var = pieces[0].id });
+        return;
+    }
+
+    std::vector<Operand> values;
+    for (ast::NodeId arg : args)
+        values.push_back(value(arg));
+
+    emit({ .op = OP_PRINT, .var = (int)m_fn.templates.size(), .args = std::move(values) });
+    m_fn.templates.push_back(std::move(pieces));
+}
+
+static std::string operand_str(const Operand& op)
+{
+    switch (op.kind) {
+    case Operand::Register:
+        return fmt::format("%{}", op.reg());
+    case Operand::Int:
+        return fmt::format("{}", op.int_value());
+    case Operand::Double:
+        return fmt::format("{}f", op.double_value());
+    default:
+        return "?";
+    }
+}
+
+static std::string insn_str(const Insn& insn, const Block& block, const CompileInfo& c_info)
+{
+    auto var_name = [&c_info](int var) {
+        return var >= 0 && (size_t)var < c_info.known_vars.size() ? fmt::format("${}", c_info.known_vars[var].name)
+                                                                     : fmt::format("$?{}", var);
+    };
+
+    std::string res = insn.dst != NO_REG ? fmt::format("%{} = ", insn.dst) : "";
+    res += opcode_str_map[insn.op];
+
+    switch (insn.op) {
+    case OP_LDV:
+    case OP_READ:
+        res += fmt::format(" {}", var_name(insn.var));
+        break;
+    case OP_STV:
+    case OP_LDA:
+        res += fmt::format(" {}, {}", var_name(insn.var), operand_str(insn.a));
+        break;
+    case OP_STA:
+        res += fmt::format(" {}, {}, {}", var_name(insn.var), operand_str(insn.a), operand_str(insn.b));
+        break;
+    case OP_PHI:
+        for (size_t i = 0; i < insn.args.size(); i++) {
+            res += fmt::format("{} [{}, b{}]", i ? "," : "", operand_str(insn.args[i]),
+                i < block.preds.size() ? (int)block.preds[i] : -1);
+        }
+        break;
+    case OP_PRINT:
+        res += fmt::format(" tmpl{}", insn.var);
+        for (const auto& arg : insn.args)
+            res += fmt::format(", {}", operand_str(arg));
+        break;
+    case OP_WRITE:
+        res += fmt::format(" str{}", insn.var);
+        break;
+    case OP_JMP:
+        res += fmt::format(" b{}", block.succs.empty() ? -1 : (int)block.succs[0]);
+        break;
+    case OP_BR:
+        res += fmt::format(" {} {}, {}, b{}, b{}", cmp_name_map[insn.cmp], operand_str(insn.a), operand_str(insn.b),
+            block.succs.size() > 0 ? (int)block.succs[0] : -1, block.succs.size() > 1 ? (int)block.succs[1] : -1);
+        break;
+    default:
+        if (insn.a.kind != Operand::None)
+            res += " " + operand_str(insn.a);
+        if (insn.b.kind != Operand::None)
+            res += ", " + operand_str(insn.b);
+        break;
+    }
+
+    return res;
+}
+
+void dump(const Function& fn, std::ostream& out, const CompileInfo& c_info)
+{
+    for (size_t i = 0; i < fn.templates.size(); i++) {
+        fmt::print(out, "tmpl{}:", i);
+        for (const auto& piece : fn.templates[i]) {
+            switch (piece.kind) {
+            case TemplatePiece::Literal:
+                fmt::print(out, " str{}", piece.id);
+                break;
+            case TemplatePiece::Int:
+                fmt::print(out, " int[{}]", piece.id);
+                break;
+            case TemplatePiece::Double:
+                fmt::print(out, " double[{}]", piece.id);
+                break;
+            case TemplatePiece::StrVar:
+                fmt::print(out, " ${}", c_info.known_vars[piece.id].name);
+                break;
+            }
+        }
+        fmt::print(out, "\n");
+    }
+
+    int line = -1;
+
+    for (BlockId b = 0; b < fn.blocks.size(); b++) {
+        const Block& block = fn.blocks[b];
+
+        std::string label = fmt::format("b{}:", b);
+        if (block.preds.empty()) {
+            fmt::print(out, "{}\n", label);
+        } else {
+            std::string preds;
+            for (BlockId pred : block.preds)
+                preds += fmt::format("{}b{}", preds.empty() ? "" : ", ", pred);
+            fmt::print(out, "{:<40}; preds: {}\n", label, preds);
+        }
+
+        for (const Insn& insn : block.insns) {
+            if (insn.line != line) {
+                line = insn.line;
+                fmt::print(out, "    ; line {}\n", line + 1);
+            }
+            fmt::print(out, "    {}\n", insn_str(insn, block, c_info));
+        }
+    }
+}
+
+class Verifier {
+public:
+    bool verify();
+
+    Verifier(const Function& fn, std::ostream& errors, const CompileInfo& c_info)
+        : m_fn(fn)
+        , m_errors(errors)
+        , m_c_info(c_info)
+        , m_dominators(fn)
+    {
+    }
+
+private:
+    void definitions();
+    void block(BlockId b);
+    void insn(const Insn& insn);
+    void phi(const Insn& insn);
+
+    /* Where a register is defined, .block is UINT32_MAX if nowhere */
+    struct Def {
+        BlockId block = UINT32_MAX;
+        size_t index = 0;
+    };
+
+    /* Check the type of an operand and that it is defined before the
+     * instruction at index of block, SIZE_MAX meaning its end */
+    void operand(const Operand& op, var_type expected, BlockId block, size_t index);
+    void operand(const Operand& op, var_type expected) { operand(op, expected, m_block, m_index); }
+    void variable(int var, var_type expected);
+
+    template<typename... Args>
+    void fail(fmt::format_string<Args...> format, Args&&... args);
+
+    const Function& m_fn;
+    std::ostream& m_errors;
+    const CompileInfo& m_c_info;
+    Dominators m_dominators;
+
+    std::vector<Def> m_defs;
+    BlockId m_block = 0;
+    size_t m_index = 0;
+    bool m_ok = true;
+};
+
+bool verify(const Function& fn, std::ostream& errors, const CompileInfo& c_info)
+{
+    if (fn.blocks.empty()) {
+        fmt::print(errors, "IR error: no entry block\n");
+        return false;
+    }
+
+    return Verifier(fn, errors, c_info).verify();
+}
+
+template<typename... Args>
+void Verifier::fail(fmt::format_string<Args...> format, Args&&... args)
+{
+    const Block& block = m_fn.blocks[m_block];
+    std::string where = m_index < block.insns.size()
+        ? fmt::format("b{}, '{}'", m_block, insn_str(block.insns[m_index], block, m_c_info))
+        : fmt::format("b{}", m_block);
+
+    fmt::print(m_errors, "IR error in {}: {}\n", where, fmt::format(format, std::forward<Args>(args)...));
+    m_ok = false;
+}
+
+bool Verifier::verify()
+{
+    /* Uses are checked against the definitions, which can come later in
+     * the order of the blocks */
+    definitions();
+
+    for (BlockId b = 0; b < m_fn.blocks.size(); b++)
+        block(b);
+
+    /* The predecessors have to match the successors */
+    std::vector<std::vector<BlockId>> preds(m_fn.blocks.size());
+    for (BlockId b = 0; b < m_fn.blocks.size(); b++) {
+        for (BlockId succ : m_fn.blocks[b].succs) {
+            if (succ < m_fn.blocks.size())
+                preds[succ].push_back(b);
+        }
+    }
+
+    for (m_block = 0; m_block < m_fn.blocks.size(); m_block++) {
+        m_index = SIZE_MAX;
+
+        auto stored = m_fn.blocks[m_block].preds;
+        std::sort(stored.begin(), stored.end());
+        if (stored != preds[m_block])
+            fail("predecessors do not match the successors of other blocks");
+    }
+
+    for (Reg r = 0; r < m_fn.regs.size(); r++) {
+        if (m_fn.regs[r] != V_INT && m_fn.regs[r] != V_DOUBLE) {
+            m_block = 0;
+            m_index = SIZE_MAX;
+            fail("%{} is neither int nor double", r);
+        }
+    }
+
+    return m_ok;
+}
+
+void Verifier::definitions()
+{
+    m_defs.assign(m_fn.regs.size(), {});
+
+    for (m_block = 0; m_block < m_fn.blocks.size(); m_block++) {
+        const Block& block = m_fn.blocks[m_block];
+
+        for (m_index = 0; m_index < block.insns.size(); m_index++) {
+            Reg dst = block.insns[m_index].dst;
+            if (dst == NO_REG)
+                continue;
+
+            if (dst >= m_fn.regs.size())
+                fail("%{} does not exist", dst);
+            else if (m_defs[dst].block != UINT32_MAX)
+                fail("%{} is defined twice", dst);
+            else
+                m_defs[dst] = { m_block, m_index };
+        }
+    }
+}
+
+void Verifier::block(BlockId b)
+{
+    const Block& block = m_fn.blocks[b];
+    m_block = b;
+    m_index = SIZE_MAX;
+
+    if (!m_dominators.reachable(b))
+        fail("unreachable block");
+
+    if (block.insns.empty()) {
+        fail("empty block");
+        return;
+    }
+
+    size_t phis = block.phi_count();
+
+    for (m_index = 0; m_index < block.insns.size(); m_index++) {
+        const Insn& i = block.insns[m_index];
+
+        bool last = m_index + 1 == block.insns.size();
+        if (is_terminator(i.op) && !last)
+            fail("terminator before the end of the block");
+        else if (!is_terminator(i.op) && last)
+            fail("block does not end with a terminator");
+
+        if (i.op == OP_PHI && m_index >= phis)
+            fail("phi after other instructions");
+
+        insn(i);
+    }
+
+    m_index = block.insns.size() - 1;
+
+    size_t succs = 0;
+    switch (block.terminator().op) {
+    case OP_JMP:
+        succs = 1;
+        break;
+    case OP_BR:
+        succs = 2;
+        break;
+    default:
+        break;
+    }
+
+    if (block.succs.size() != succs)
+        fail("{} successors instead of {}", block.succs.size(), succs);
+
+    for (BlockId succ : block.succs) {
+        if (succ >= m_fn.blocks.size())
+            fail("successor b{} does not exist", succ);
+    }
+}
+
+void Verifier::operand(const Operand& op, var_type expected, BlockId block, size_t index)
+{
+    if (op.kind == Operand::None) {
+        fail("missing operand");
+        return;
+    }
+
+    if (op.is_reg()) {
+        if (op.reg() >= m_fn.regs.size()) {
+            fail("%{} does not exist", op.reg());
+            return;
+        }
+
+        const Def& def = m_defs[op.reg()];
+        if (def.block == UINT32_MAX)
+            fail("%{} is never defined", op.reg());
+        else if (def.block == block ? def.index >= index : !m_dominators.dominates(def.block, block))
+            fail("%{} is used where its definition does not dominate", op.reg());
+    }
+
+    if (m_fn.type(op) != expected)
+        fail("{} is not {}", operand_str(op), var_type_str_map[expected]);
+}
+
+void Verifier::variable(int var, var_type expected)
+{
+    if (var < 0 || (size_t)var >= m_c_info.known_vars.size()) {
+        fail("variable {} does not exist", var);
+        return;
+    }
+
+    if (m_c_info.known_vars[var].type != expected)
+        fail("${} is not {}", m_c_info.known_vars[var].name, var_type_str_map[expected]);
+}
+
+void Verifier::insn(const Insn& i)
+{
+    if (has_dst(i.op) != (i.dst != NO_REG)) {
+        fail("{}", has_dst(i.op) ? "no destination" : "unexpected destination");
+        return;
+    }
+
+    /* A missing register was reported with the definitions */
+    if (i.dst != NO_REG && i.dst >= m_fn.regs.size())
+        return;
+
+    var_type dst_type = i.dst != NO_REG ? m_fn.regs[i.dst] : V_UNSURE;
+
+    auto expect_dst = [&](var_type expected) {
+        if (dst_type != expected)
+            fail("%{} is not {}", i.dst, var_type_str_map[expected]);
+    };
+
+    switch (i.op) {
+    case OP_MOV:
+        operand(i.a, dst_type);
+        break;
+    case OP_PHI:
+        phi(i);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+        operand(i.a, V_INT);
+        operand(i.b, V_INT);
+        expect_dst(V_INT);
+        break;
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+        operand(i.a, V_DOUBLE);
+        operand(i.b, V_DOUBLE);
+        expect_dst(V_DOUBLE);
+        break;
+    case OP_LDV:
+        if (i.var >= 0 && (size_t)i.var < m_c_info.known_vars.size())
+            variable(i.var, dst_type);
+        else
+            fail("variable {} does not exist", i.var);
+        break;
+    case OP_STV:
+        operand(i.a, m_fn.type(i.a) == V_DOUBLE ? V_DOUBLE : V_INT);
+        variable(i.var, m_fn.type(i.a));
+        break;
+    case OP_LDA:
+        variable(i.var, V_ARR);
+        operand(i.a, V_INT);
+        expect_dst(V_INT);
+        break;
+    case OP_STA:
+        variable(i.var, V_ARR);
+        operand(i.a, V_INT);
+        operand(i.b, V_INT);
+        break;
+    case OP_TIME:
+    case OP_GETUID:
+        expect_dst(V_INT);
+        break;
+    case OP_PRINT: {
+        if (i.var < 0 || (size_t)i.var >= m_fn.templates.size()) {
+            fail("template {} does not exist", i.var);
+            break;
+        }
+
+        for (const auto& piece : m_fn.templates[i.var]) {
+            if (piece.kind != TemplatePiece::Int && piece.kind != TemplatePiece::Double)
+                continue;
+
+            if (piece.id < 0 || (size_t)piece.id >= i.args.size())
+                fail("template {} refers to missing value {}", i.var, piece.id);
+            else
+                operand(i.args[piece.id], piece.kind == TemplatePiece::Int ? V_INT : V_DOUBLE);
+        }
+        break;
+    }
+    case OP_WRITE:
+        if (i.var < 0 || (size_t)i.var >= m_c_info.known_strings.size())
+            fail("string {} does not exist", i.var);
+        break;
+    case OP_PUTCHAR:
+    case OP_EXIT:
+        operand(i.a, V_INT);
+        break;
+    case OP_READ:
+        variable(i.var, V_STR);
+        break;
+    case OP_BR:
+        operand(i.a, m_fn.type(i.a) == V_DOUBLE ? V_DOUBLE : V_INT);
+        operand(i.b, m_fn.type(i.a) == V_DOUBLE ? V_DOUBLE : V_INT);
+        break;
+    case OP_JMP:
+    case OP_END:
+        break;
+    default:
+        fail("unknown opcode {}", (int)i.op);
+        break;
+    }
+
+}
+
+void Verifier::phi(const Insn& i)
+{
+    const Block& block = m_fn.blocks[m_block];
+
+    if (i.args.size() != block.preds.size()) {
+        fail("{} operands for {} predecessors", i.args.size(), block.preds.size());
+        return;
+    }
+
+    /* Each operand is read at the end of the block it comes from */
+    for (size_t p = 0; p < i.args.size(); p++)
+        operand(i.args[p], m_fn.regs[i.dst], block.preds[p], SIZE_MAX);
+}
+
+} // namespace ir
@@ -0,0 +1,201 @@
+#ifndef IR_H_
+#define IR_H_
+
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "print_template.hpp"
+
+class CompileInfo;
+
+namespace ast {
+class Ast;
+}
+
+/*
+ * Three-address code in basic blocks, between the tree and the native code.
+ *
+ * Values are held in virtual registers, each of which is assigned by exactly
+ * one instruction that dominates all its uses (SSA form). Right after
+ * lowering variables are in memory and read and written with OP_LDV and
+ * OP_STV; promote_variables moves int and double variables into registers,
+ * joined by OP_PHI where control flow meets.
+ */
+namespace ir {
+
+/* A virtual register, an index into Function::regs */
+using Reg = uint32_t;
+/* An index into Function::blocks */
+using BlockId = uint32_t;
+
+static constexpr Reg NO_REG = UINT32_MAX;
+
+enum opcode : uint8_t {
+    OP_MOV, /* dst = a */
+    OP_PHI, /* dst = args[i] when entered from preds[i], only at the start of a block */
+
+    /* dst = a op b, division is unsigned like in the rest of lcc */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_FADD,
+    OP_FSUB,
+    OP_FMUL,
+    OP_FDIV,
+
+    OP_LDV, /* dst = variable var */
+    OP_STV, /* variable var = a */
+    OP_LDA, /* dst = element a of array var */
+    OP_STA, /* element a of array var = b */
+
+    OP_TIME,    /* dst = time(NULL) */
+    OP_GETUID,  /* dst = getuid() */
+    OP_PRINT,   /* Print template var with the values args */
+    OP_WRITE,   /* Write string constant var */
+    OP_PUTCHAR, /* Write the character a */
+    OP_READ,    /* Read a line into string variable var */
+    OP_EXIT,    /* Exit with status a */
+
+    /* Terminators, the last instruction of every block and nowhere else */
+    OP_JMP, /* To succs[0] */
+    OP_BR,  /* To succs[0] if a cmp b, to succs[1] otherwise */
+    OP_END, /* Leave the code of the function */
+
+    OPCODE_ENUM_END,
+};
+
+/* An input of an instruction: nothing, a register or a constant */
+struct Operand {
+    enum Kind : uint8_t {
+        None,
+        Register,
+        Int,
+        Double,
+    };
+
+    Kind kind = None;
+    int64_t bits = 0; /* Register number, integer or the bits of the double */
+
+    static Operand of_reg(Reg r) { return { Register, r }; }
+    static Operand of_int(int64_t value) { return { Int, value }; }
+    static Operand of_double(double value) { return { Double, std::bit_cast<int64_t>(value) }; }
+
+    bool is_reg() const { return kind == Register; }
+    bool is_const() const { return kind == Int || kind == Double; }
+    Reg reg() const { return bits; }
+    int64_t int_value() const { return bits; }
+    double double_value() const { return std::bit_cast<double>(bits); }
+
+    bool operator==(const Operand&) const = default;
+};
+
+struct Insn {
+    opcode op;
+    cmp_op cmp = EQUAL; /* Of BR */
+    Reg dst = NO_REG;
+    Operand a = {};
+    Operand b = {};
+    int var = -1; /* Variable, string or template, see opcode */
+    int line = 0;
+    std::vector<Operand> args = {}; /* Of PRINT, of PHI in the order of Block::preds */
+};
+
+struct Block {
+    std::vector<Insn> insns; /* The last one is the terminator */
+    std::vector<BlockId> succs;
+    std::vector<BlockId> preds; /* See Function::compute_preds */
+
+    const Insn& terminator() const { return insns.back(); }
+
+    /* Number of phis at the start of the block */
+    size_t phi_count() const;
+};
+
+/* The code of a program or of one statement of it, entered at blocks[0] */
+class Function {
+public:
+    std::vector<Block> blocks;
+    std::vector<var_type> regs; /* V_INT or V_DOUBLE for every register */
+    std::vector<std::vector<TemplatePiece>> templates; /* Referenced by PRINT */
+
+    Reg new_reg(var_type type);
+    BlockId new_block();
+
+    /* Type of what an operand holds */
+    var_type type(const Operand& op) const;
+
+    /* Recompute the predecessors from the successors, only before there are phis */
+    void compute_preds();
+
+    /* Keep only the blocks in order, numbered in that order. Edges from
+     * dropped blocks are removed together with their phi operands. */
+    void renumber(const std::vector<BlockId>& order);
+};
+
+/* The dominator tree of a function, numbered so that a query takes
+ * constant time */
+class Dominators {
+public:
+    explicit Dominators(const Function& fn);
+
+    bool reachable(BlockId b) const { return m_idom[b] != NO_BLOCK; }
+
+    /* The closest block every path to b goes through, blocks[0] for itself */
+    BlockId idom(BlockId b) const { return m_idom[b]; }
+    const std::vector<BlockId>& children(BlockId b) const { return m_children[b]; }
+
+    /* Whether every path from blocks[0] to b goes through a, true for a == b */
+    bool dominates(BlockId a, BlockId b) const;
+
+    static constexpr BlockId NO_BLOCK = UINT32_MAX;
+
+private:
+    std::vector<BlockId> m_idom;
+    std::vector<std::vector<BlockId>> m_children;
+    /* Preorder number of a block and the largest number in its subtree */
+    std::vector<uint32_t> m_enter;
+    std::vector<uint32_t> m_leave;
+};
+
+bool is_terminator(opcode op);
+
+/* Whether the instruction writes dst */
+bool has_dst(opcode op);
+
+/* Whether a cmp b holds for two constants, doubles compared like comisd */
+bool evaluate(cmp_op cmp, const Operand& a, const Operand& b);
+
+/* Lower a program, or one statement of it, that passed semantic analysis */
+Function lower(const ast::Ast& tree, CompileInfo& c_info);
+
+/* Keep the int and double variables of fn in registers, with phis where
+ * control flow meets. Their values on entry are loaded from memory; with
+ * store_variables the final ones are written back before OP_END, for
+ * code compiled after fn (-s). */
+void promote_variables(Function& fn, const CompileInfo& c_info, bool store_variables);
+
+/* Sparse conditional constant propagation on code in SSA form. Registers
+ * known to be constant or copies of others are replaced by them,
+ * branches decided by constants become jumps, and blocks no longer
+ * reached and instructions whose results are unused are removed. */
+void propagate_constants(Function& fn);
+
+/* Give every edge into a block with phis that comes from a block with
+ * several successors a block of its own, so code for the phis can be
+ * placed on the edge */
+void split_critical_edges(Function& fn);
+
+/* Write fn in a readable form, one instruction per line */
+void dump(const Function& fn, std::ostream& out, const CompileInfo& c_info);
+
+/* Check that fn is well formed, describing every problem found in errors */
+bool verify(const Function& fn, std::ostream& errors, const CompileInfo& c_info);
+
+} // namespace ir
+
+#endif // IR_H_
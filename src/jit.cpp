@@ -0,0 +1,117 @@
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+
+#include <fmt/core.h>
+
+#include "assembler.hpp"
+#include "jit.hpp"
+#include "runtime.hpp"
+#include "timing.hpp"
+#include "util.hpp"
+
+/* Where the runtime routines of lib/ are found in lcc */
+static const std::pair<std::string_view, uintptr_t> host_functions[] = {
+    { "outbuf_write", reinterpret_cast<uintptr_t>(&runtime::outbuf_write) },
+    { "outbuf_flush", reinterpret_cast<uintptr_t>(&runtime::outbuf_flush) },
+    { "uprint", reinterpret_cast<uintptr_t>(&runtime::uprint) },
+    { "iprint", reinterpret_cast<uintptr_t>(&runtime::iprint) },
+    { "fprint", reinterpret_cast<uintptr_t>(&runtime::fprint) },
+    { "putchar", reinterpret_cast<uintptr_t>(&runtime::putchar) },
+    { "print_template", reinterpret_cast<uintptr_t>(&runtime::print_template) },
+};
+
+/* The program's stack, the default stack limit of an executable */
+static const size_t STACK_SIZE = 8 << 20;
+static const size_t PAGE_SIZE = 4096;
+
+/* Glue between lcc and the program: jit_enter saves our registers and starts
+ * the program on the stack whose top it gets, program_exit returns from
+ * jit_enter with the exit status.
+ * The runtime routines are thunks which align the stack for the C++ functions;
+ * the registers they may clobber are the same in both calling conventions. */
+static std::string jit_runtime_module()
+{
+    std::string src = "section .text\n"
+                      "global jit_enter\n"
+                      "global program_exit\n"
+                      "jit_enter:\n"
+                      "push rbx\n"
+                      "push rbp\n"
+                      "push r12\n"
+                      "push r13\n"
+                      "push r14\n"
+                      "push r15\n"
+                      "mov [jit_saved_rsp], rsp\n"
+                      "mov rsp, rdi\n"
+                      "jmp _start\n"
+                      "program_exit:\n"
+                      "mov rax, rdi\n"
+                      "mov rsp, [jit_saved_rsp]\n"
+                      "pop r15\n"
+                      "pop r14\n"
+                      "pop r13\n"
+                      "pop r12\n"
+                      "pop rbp\n"
+                      "pop rbx\n"
+                      "ret\n";
+
+    for (const auto& [name, address] : host_functions) {
+        fmt::format_to(std::back_inserter(src), "global {0}\n"
+                                                "{0}:\n"
+                                                "push rbp\n"
+                                                "mov rbp, rsp\n"
+                                                "and rsp, -16\n"
+                                                "mov rax, {1:#x}\n"
+                                                "call rax\n"
+                                                "leave\n"
+                                                "ret\n",
+            name, address);
+    }
+
+    src += "section .bss\n"
+           "jit_saved_rsp: resq 1\n";
+
+    return src;
+}
+
+int jit_run(std::string_view asm_source, std::string_view name, CompileInfo& c_info)
+{
+    assembler::Assembler as(c_info);
+    std::optional<timing::Scope> scope(timing::PH_ASSEMBLY);
+    as.add_module(asm_source, name);
+    as.add_module(jit_runtime_module(), "<jit runtime>");
+
+    /* Addresses in the code are absolute 32-bit values */
+    size_t size = as.image_size();
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    c_info.err.on_true(memory == MAP_FAILED, "mmap: {}", std::strerror(errno));
+
+    scope.emplace(timing::PH_LINK);
+    assembler::Image image = as.link(reinterpret_cast<uint64_t>(memory), "jit_enter");
+    std::memcpy(memory, image.text.data(), image.text.size());
+    std::memcpy(reinterpret_cast<void*>(image.data_address), image.data.data(), image.data.size());
+    c_info.err.on_true(mprotect(memory, image.data_address - image.text_address, PROT_READ | PROT_EXEC) != 0,
+        "mprotect: {}", std::strerror(errno));
+
+    /* A fresh stack like an executable gets, the program reads whatever it
+     * did not write as zero. The page below it catches overflows. */
+    void* stack = mmap(nullptr, STACK_SIZE + PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    c_info.err.on_true(stack == MAP_FAILED, "mmap: {}", std::strerror(errno));
+    c_info.err.on_true(mprotect(stack, PAGE_SIZE, PROT_NONE) != 0, "mprotect: {}", std::strerror(errno));
+
+    scope.emplace(timing::PH_RUN);
+    runtime::reset_output();
+
+    auto enter = reinterpret_cast<int (*)(void*)>(image.entry);
+    int status = enter(static_cast<char*>(stack) + PAGE_SIZE + STACK_SIZE) & 0xFF;
+
+    runtime::outbuf_flush();
+    munmap(stack, STACK_SIZE + PAGE_SIZE);
+    munmap(memory, size);
+
+    return status;
+}
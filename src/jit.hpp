@@ -0,0 +1,15 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <string_view>
+
+class CompileInfo;
+
+/*
+ * Assemble the program in asm_source (as generated by ast_to_x86_64) into
+ * executable memory and run it inside this process. The runtime routines are
+ * provided by lcc itself instead of lib/. Returns the exit status of the program.
+ */
+int jit_run(std::string_view asm_source, std::string_view name, CompileInfo& c_info);
+
+#endif // JIT_H_
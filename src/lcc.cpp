@@ -1,40 +1,83 @@
 #include <fmt/color.h>
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
 #include <fmt/core.h>
+#include <fstream>
 #include <getopt.h>
 #include <iostream>
+#include <optional>
+#include <sstream>
 
+#include "assembler.hpp"
 #include "ast.hpp"
+#include "bytecode.hpp"
 #include "dictionary.hpp"
+#include "elf.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
 #include "lexer.hpp"
 #include "macros.hpp"
 #include "semantics.hpp"
+#include "timing.hpp"
 #include "util.hpp"
+#include "vm.hpp"
 #include "x86_64.hpp"
 
-#define LIBSTDLEAST "lib/libstdleast.a"
+#define LIBSTDLEAST "libstdleast.a"
+#define LIBSTDLEAST_DIRECTORY "lib"
+
+/* The runtime's directory next to the lcc binary, or else the one in the
+ * current directory */
+static std::filesystem::path libstdleast_directory()
+{
+    std::error_code ec;
+    std::filesystem::path exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+    if (!ec) {
+        std::filesystem::path lib = exe.parent_path() / LIBSTDLEAST_DIRECTORY;
+        if (std::filesystem::is_directory(lib, ec))
+            return lib;
+    }
+
+    return LIBSTDLEAST_DIRECTORY;
+}
 
 /* TODO: add more *const* to project */
 /* TODO: observe blocks when looking at variable definitions */
 int main(int argc, char** argv)
 {
-    assert_map_sizes();
-
     bool run_after_compile = false;
     bool output_dot = false;
     bool print_info = true;
+    bool direct_elf = false;
+    bool run_in_process = false;
+    bool interpret = false;
+    bool streaming = false;
+    bool dump_ir = false;
+    std::optional<timing::Format> time_report;
 
     /* Handle command line input with getopt */
     int flag;
-    while ((flag = getopt(argc, argv, "hrdq")) != -1) {
+    while ((flag = getopt(argc, argv, "hrdqejbsit:")) != -1) {
         switch (flag) {
         case 'h':
             fmt::print("Least Complicated Compiler - lcc\n"
                        "Copyright (C) 2021-2022 - theeyeofcthulhu on GitHub\n\n"
-                       "usage: {} [-hrdq] FILE\n\n"
+                       "usage: {} [-hrdqejbsi] [-t FORMAT] FILE\n\n"
                        "-h: display this message and exit\n"
                        "-r: run program after compilation\n"
                        "-d: output graphical (SVG) representation of AST via Graphviz\n"
-                       "-q: do not print information about program activity\n",
+                       "-q: do not print information about program activity\n"
+                       "-e: write the executable directly instead of calling nasm and ld\n"
+                       "-j: run program inside the compiler without writing any files\n"
+                       "-b: run program in the bytecode interpreter\n"
+                       "-s: compile one top-level statement at a time, in memory bounded by the\n"
+                       "    largest statement instead of the whole program\n"
+                       "-i: write the intermediate code the assembly is generated from to FILE.ir\n"
+                       "-t: report time and memory of each phase, FORMAT is one of\n"
+                       "    text: a table on stderr\n"
+                       "    json: the same numbers in FILE.time.json\n"
+                       "    trace: Chrome trace events in FILE.trace.json\n",
                 argv[0]);
             return 0;
         case 'r':
@@ -46,6 +89,33 @@ int main(int argc, char** argv)
         case 'q':
             print_info = false;
             break;
+        case 'e':
+            direct_elf = true;
+            break;
+        case 'j':
+            run_in_process = true;
+            break;
+        case 'b':
+            interpret = true;
+            break;
+        case 's':
+            streaming = true;
+            break;
+        case 'i':
+            dump_ir = true;
+            break;
+        case 't':
+            if (std::string_view(optarg) == "text") {
+                time_report = timing::Format::Text;
+            } else if (std::string_view(optarg) == "json") {
+                time_report = timing::Format::Json;
+            } else if (std::string_view(optarg) == "trace") {
+                time_report = timing::Format::Trace;
+            } else {
+                fmt::print(std::cerr, "{}: unknown report format '{}'\n", argv[0], optarg);
+                return 1;
+            }
+            break;
         case '?':
         default:
             return 1;
@@ -62,59 +132,238 @@ int main(int argc, char** argv)
     Filename fn(argv[argc - 1]);
     CompileInfo c_info(fn.base());
 
+    if (time_report)
+        timing::enable(*time_report);
+
+    /* Every way out after compiling goes through here */
+    auto finish = [&](int status) {
+        if (!time_report)
+            return status;
+
+        if (*time_report == timing::Format::Text) {
+            timing::report(std::cerr);
+        } else {
+            std::string report_filename = fn.extension(*time_report == timing::Format::Json ? ".time.json" : ".trace.json");
+            info(fmt::format("[INFO] Writing time report to: {}\n", GREEN_ARG(report_filename)));
+
+            std::ofstream report_out(report_filename);
+            timing::report(report_out);
+        }
+
+        return status;
+    };
+
     c_info.err.on_false(argc >= 2, "No input file provided");
 
     c_info.err.set_file(fn.base());
 
-    /* Map contents of file into a std::string via mmap */
+    /* Map the file into memory, names in the tokens and the tree view into it */
     info(fmt::format("[INFO] Input file: {}\n", GREEN_ARG(fn.base())));
-    std::string input_source = read_source_code(fn.base(), c_info);
+    MappedFile input_source(fn.base(), c_info);
+
+    lexer::LexContext lex_context(input_source.contents(), c_info);
+    ast::Ast tree;
+
+    /* The whole program is needed to draw or interpret it */
+    c_info.err.on_true(streaming && (output_dot || interpret), "-s does not work with -d and -b");
+    c_info.err.on_true(dump_ir && interpret, "-b does not use the intermediate code of -i");
+
+    if (!streaming) {
+        /* Lex file into tokens */
+        info(fmt::format("[INFO] Lexical analysis\n"));
+        lexer::TokenList ts;
+        {
+            timing::Scope scope(timing::PH_LEX);
+            ts = lex_context.lex_and_get_tokens();
+        }
+        timing::count(timing::C_TOKENS, ts.tokens.size());
 
-    /* Lex file into tokens */
-    info(fmt::format("[INFO] Lexical analysis\n"));
-    lexer::LexContext lex_context(input_source, c_info);
-    auto ts = lex_context.lex_and_get_tokens();
+        info(fmt::format("[INFO] Generating abstract syntax tree\n"));
+        /* Convert tokens to abstract syntax tree */
+        ast::AstContext ast_context(ts, c_info);
+        {
+            timing::Scope scope(timing::PH_AST);
+            tree = ast_context.gen_ast();
+        }
+        timing::count(timing::C_NODES, tree.size());
 
-    info(fmt::format("[INFO] Generating abstract syntax tree\n"));
-    /* Convert tokens to abstract syntax tree */
-    ast::AstContext ast_context(ts, c_info);
-    std::shared_ptr<ast::Body> ast_root = ast_context.gen_ast();
+        std::string dot_filename = fn.extension(".dot");
 
-    std::string dot_filename = fn.extension(".dot");
+        if (output_dot) {
+            /* Generate graphviz diagram from abstract syntax tree */
+            info(fmt::format("[INFO] Generating tree diagram to: {}\n", GREEN_ARG(dot_filename)));
+            ast_context.tree_to_dot(tree, dot_filename);
 
-    if (output_dot) {
-        /* Generate graphviz diagram from abstract syntax tree */
-        info(fmt::format("[INFO] Generating tree diagram to: {}\n", GREEN_ARG(dot_filename)));
-        ast_context.tree_to_dot(ast_root, dot_filename);
+            std::string svg_filename = fn.extension(".svg");
 
-        std::string svg_filename = fn.extension(".svg");
+            info(COLOR_CMD("dot -Tsvg -o {} {}", GREEN_ARG(svg_filename), RED_ARG(dot_filename)));
+            RUN_CMD("dot -Tsvg -o {} {}", svg_filename, dot_filename);
+        }
 
-        info(COLOR_CMD("dot -Tsvg -o {} {}", GREEN_ARG(svg_filename), RED_ARG(dot_filename)));
-        RUN_CMD("dot -Tsvg -o {} {}", svg_filename, dot_filename);
+        info(fmt::format("[INFO] Semantical analysis\n"));
+        {
+            timing::Scope scope(timing::PH_SEMANTICS);
+            semantic::semantic_analysis(tree, c_info);
+        }
+
+        timing::Scope scope(timing::PH_FOLD);
+        ast::fold_constants(tree);
     }
 
     std::string asm_filename = fn.extension(".asm");
 
-    info(fmt::format("[INFO] Semantical analysis\n"));
-    semantic::semantic_analysis(ast_root, c_info);
+    std::string ir_filename = fn.extension(".ir");
+    std::ofstream ir_out;
+    if (dump_ir) {
+        info(fmt::format("[INFO] Writing intermediate code to: {}\n", GREEN_ARG(ir_filename)));
+        ir_out.open(ir_filename);
+    }
 
-    info(fmt::format("[INFO] Generating assembly to: {}\n", GREEN_ARG(asm_filename)));
-    ast_to_x86_64(ast_root, asm_filename, c_info);
+    /* Lower a program or a statement to the code the assembly is generated from */
+    auto lower = [&](const ast::Ast& t) {
+        std::optional<timing::Scope> scope(timing::PH_LOWER);
+        ir::Function code = ir::lower(t, c_info);
+        assert(ir::verify(code, std::cerr, c_info));
 
-    std::string object_filename = fn.extension(".o");
+        /* With -s the variables have to be in memory for the next statement */
+        scope.emplace(timing::PH_OPTIMIZE);
+        ir::promote_variables(code, c_info, streaming);
+        ir::propagate_constants(code);
+        ir::split_critical_edges(code);
+        assert(ir::verify(code, std::cerr, c_info));
 
-    info(COLOR_CMD("nasm -g -felf64 -o {} {}", GREEN_ARG(object_filename), RED_ARG(asm_filename)));
-    RUN_CMD("nasm -g -felf64 -o {} {}", object_filename, asm_filename);
+        if (dump_ir)
+            ir::dump(code, ir_out, c_info);
+
+        return code;
+    };
+
+    /* With -s every statement is lexed, parsed, analysed and written out
+     * before the next one is read, only c_info grows with the program */
+    auto generate_asm = [&](std::ostream& out) {
+        if (!streaming) {
+            ir::Function code = lower(tree);
+            timing::Scope scope(timing::PH_CODEGEN);
+            ir_to_x86_64(code, out, c_info);
+            return;
+        }
+
+        auto lex_statement = [&lex_context]() {
+            timing::Scope scope(timing::PH_LEX);
+            return lex_context.lex_next_statement();
+        };
+
+        x86_64_begin(out);
+        while (lex_statement()) {
+            timing::count(timing::C_TOKENS, lex_context.tokens().tokens.size());
+
+            ast::AstContext statement_context(lex_context.tokens(), c_info);
+            ast::Ast statement;
+            {
+                timing::Scope scope(timing::PH_AST);
+                statement = statement_context.gen_ast();
+            }
+            timing::count(timing::C_NODES, statement.size());
+            {
+                timing::Scope scope(timing::PH_SEMANTICS);
+                semantic::semantic_analysis(statement, c_info);
+            }
+            {
+                timing::Scope scope(timing::PH_FOLD);
+                ast::fold_constants(statement);
+            }
+            ir::Function code = lower(statement);
+            timing::Scope scope(timing::PH_CODEGEN);
+            x86_64_statement(code, out, c_info);
+        }
+
+        timing::Scope scope(timing::PH_CODEGEN);
+        x86_64_end(out, c_info);
+    };
+
+    if (interpret) {
+        info(fmt::format("[INFO] Compiling to bytecode\n"));
+        bytecode::Program program;
+        {
+            timing::Scope scope(timing::PH_CODEGEN);
+            program = bytecode::compile(tree, c_info);
+        }
+
+        info(fmt::format("[INFO] Interpreting {}\n", GREEN_ARG(fn.base())));
+        std::cout.flush();
+
+        int status;
+        {
+            timing::Scope scope(timing::PH_RUN);
+            status = vm_run(program, fn.base());
+        }
+        return finish(status);
+    }
+
+    if (run_in_process) {
+        info(fmt::format("[INFO] Generating assembly\n"));
+        std::ostringstream asm_out;
+        generate_asm(asm_out);
+
+        info(fmt::format("[INFO] Running {} in-process\n", GREEN_ARG(fn.base())));
+        std::cout.flush();
+        return finish(jit_run(asm_out.str(), asm_filename, c_info));
+    }
 
     std::string exe_filename = fn.extension("");
 
-    info(COLOR_CMD("ld -o {} {} {}", GREEN_ARG(exe_filename), RED_ARG(object_filename), LIBSTDLEAST));
-    RUN_CMD("ld -o {} {} {}", exe_filename, object_filename, LIBSTDLEAST);
+    if (direct_elf) {
+        /* Assemble the program together with the sources of the runtime
+         * and link them into an executable ourselves */
+        info(fmt::format("[INFO] Generating assembly\n"));
+        std::ostringstream asm_out;
+        generate_asm(asm_out);
+
+        info(fmt::format("[INFO] Assembling and linking to: {}\n", GREEN_ARG(exe_filename)));
+        assembler::Assembler as(c_info);
+        std::optional<timing::Scope> scope(timing::PH_ASSEMBLY);
+        as.add_module(asm_out.str(), asm_filename);
+
+        std::filesystem::path lib = libstdleast_directory();
+        std::vector<std::filesystem::path> runtime;
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(lib, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() == ".asm")
+                runtime.push_back(it->path());
+        }
+        c_info.err.on_true(ec || runtime.empty(), "Cannot find the runtime sources in {}/", lib.native());
+        std::sort(runtime.begin(), runtime.end());
+
+        for (const auto& path : runtime) {
+            MappedFile module(path.native(), c_info);
+            as.add_module(module.contents(), path.native());
+        }
+
+        scope.emplace(timing::PH_LINK);
+        write_elf_executable(as.link(ELF_TEXT_ADDRESS, "_start"), exe_filename, c_info);
+    } else {
+        info(fmt::format("[INFO] Generating assembly to: {}\n", GREEN_ARG(asm_filename)));
+        std::ofstream asm_out(asm_filename);
+        generate_asm(asm_out);
+        asm_out.close();
+
+        std::string object_filename = fn.extension(".o");
+
+        info(COLOR_CMD("nasm -g -felf64 -o {} {}", GREEN_ARG(object_filename), RED_ARG(asm_filename)));
+        std::optional<timing::Scope> scope(timing::PH_ASSEMBLY);
+        RUN_CMD("nasm -g -felf64 -o {} {}", object_filename, asm_filename);
+
+        std::string libstdleast = (libstdleast_directory() / LIBSTDLEAST).native();
+        info(COLOR_CMD("ld -o {} {} {}", GREEN_ARG(exe_filename), RED_ARG(object_filename), libstdleast));
+        scope.emplace(timing::PH_LINK);
+        RUN_CMD("ld -o {} {} {}", exe_filename, object_filename, libstdleast);
+    }
 
     if (run_after_compile) {
         info(COLOR_CMD("./{}", GREEN_ARG(exe_filename)));
+        timing::Scope scope(timing::PH_RUN);
         RUN_CMD("./{}", exe_filename);
     }
 
-    return 0;
+    return finish(0);
 }
@@ -1,18 +1,17 @@
 #include <iostream>
 #include <map>
-#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <algorithm>
 #include <optional>
 #include <charconv>
-#include <sstream>
 
 #include "dictionary.hpp"
 #include "error.hpp"
 #include "lexer.hpp"
 #include "maps.hpp"
+#include "scan.hpp"
 #include "util.hpp"
 
 /* TODO: better alertion of wrong termination of function calls, along the lines
@@ -20,15 +19,100 @@
 
 namespace lexer {
 
-Bracket::Bracket(int line, BracketTemplate templ) : Token(line), m_purpose(templ.purpose), m_kind(templ.kind)
+keyword TokenList::key(const Token& tk) const
 {
+    assert(tk.type == TK_KEY);
+    return (keyword)tk.data;
 }
 
-void debug_tokens(const std::vector<std::shared_ptr<Token>>& ts)
+arit_op TokenList::arit(const Token& tk) const
+{
+    assert(tk.type == TK_ARIT);
+    return (arit_op)tk.data;
+}
+
+cmp_op TokenList::cmp(const Token& tk) const
+{
+    assert(tk.type == TK_CMP);
+    return (cmp_op)tk.data;
+}
+
+log_op TokenList::log(const Token& tk) const
+{
+    assert(tk.type == TK_LOG);
+    return (log_op)tk.data;
+}
+
+int TokenList::num(const Token& tk) const
+{
+    assert(tk.type == TK_NUM);
+    return (int)tk.data;
+}
+
+double TokenList::double_num(const Token& tk) const
+{
+    assert(tk.type == TK_DOUBLE_NUM);
+    return m_doubles[tk.data];
+}
+
+value_func_id TokenList::vfunc(const Token& tk) const
+{
+    assert(tk.type == TK_COM_CALL);
+    return (value_func_id)tk.data;
+}
+
+Bracket TokenList::bracket(const Token& tk) const
+{
+    assert(tk.type == TK_BRACKET);
+    return { (Bracket::Purpose)(tk.data >> 1), (Bracket::Kind)(tk.data & 1) };
+}
+
+std::string_view TokenList::str(const Token& tk) const
+{
+    assert(tk.type == TK_STR);
+    TokenRange range = m_strs[tk.data];
+    return std::string_view(m_text).substr(range.begin, range.end - range.begin);
+}
+
+std::string_view TokenList::name(const Token& tk) const
+{
+    assert(tk.type == TK_VAR || tk.type == TK_ACCESS);
+    return tk.type == TK_VAR ? m_names[tk.data] : m_accesses[tk.data].name;
+}
+
+std::span<const Token> TokenList::nested_tokens(const Token& tk) const
+{
+    assert(tk.type == TK_LSTR || tk.type == TK_ACCESS);
+    TokenRange range = tk.type == TK_LSTR ? m_lstrs[tk.data].range : m_accesses[tk.data].range;
+    return std::span(m_nested).subspan(range.begin, range.end - range.begin);
+}
+
+std::vector<FormatSpec> TokenList::specs(const Token& tk) const
+{
+    assert(tk.type == TK_LSTR);
+    const LstrData& lstr = m_lstrs[tk.data];
+    auto begin = m_specs.begin() + lstr.specs;
+    return std::vector<FormatSpec>(begin, begin + (lstr.range.end - lstr.range.begin));
+}
+
+void TokenList::clear()
+{
+    tokens.clear();
+    m_nested.clear();
+    m_specs.clear();
+    m_lstrs.clear();
+    m_accesses.clear();
+    m_names.clear();
+    m_doubles.clear();
+    m_strs.clear();
+    m_text.clear();
+}
+
+void debug_tokens(const std::vector<Token>& ts)
 {
     fmt::print("----- DEBUG INFO FOR TOKENS -----\n");
     for (const auto& tk : ts) {
-        fmt::print("{}: {}\n", tk->get_line(), token_str_map.at(tk->get_type()));
+        fmt::print("{}: {}\n", tk.line, token_str_map.at(tk.type));
     }
     fmt::print("---------------------------------\n");
 }
@@ -50,48 +134,26 @@ void LexContext::check_correct_var_name(std::string_view s)
 
 size_t LexContext::find_next_word_ending_char(std::string_view line)
 {
-    auto index = std::find_if(line.begin(), line.end(), [](char c) {
-        return HAS(word_ending_chars, c);
-    });
-
-    if (index == line.end()) {
-        return std::string_view::npos;
-    } else {
-        return index - line.begin();
-    }
+    return scan::word_end(line);
 }
 
 void LexContext::remove_leading_space(std::string_view& sv)
 {
-    auto index_it = std::find_if(sv.begin(), sv.end(), [](char c) {
-        return !isspace(c);
-    });
-
-    if (index_it == sv.begin())
-        return;
-
-    size_t index = index_it - sv.begin();
-    sv.remove_prefix(index);
+    sv.remove_prefix(std::min(scan::non_space(sv), sv.size()));
 }
 
 std::pair<std::string_view, size_t> LexContext::extract_string(std::string_view line)
 {
     assert(line.starts_with('"'));
 
-    char last_char = '\0';
+    size_t end = scan::string_end(line.substr(1));
 
-    auto begin = line.begin() + 1;
+    c_info.err.on_true(end == std::string_view::npos, "Unterminated string-literal: '{}'", line);
 
-    auto it = std::find_if(begin, line.end(), [&last_char](char c) mutable {
-        bool ret = c == '"' && last_char != '\\';
+    /* Up to and including the closing '"' */
+    size_t length = end + 2;
 
-        last_char = c;
-        return ret;
-    });
-
-    c_info.err.on_true(it == line.end(), "Unterminated string-literal: '{}'", line);
-
-    return std::make_pair(line.substr(0, (it + 1) - (begin - 1)), (it - line.begin() + 1));
+    return std::make_pair(line.substr(0, length), length);
 }
 
 std::optional<std::pair<std::string_view, size_t>> LexContext::extract_symbol_beginning(std::string_view sv)
@@ -99,9 +161,15 @@ std::optional<std::pair<std::string_view, size_t>> LexContext::extract_symbol_be
     auto length1 = sv.substr(0, 1);
     auto length2 = sv.substr(0, 2);
 
-    if (str_symbol_map.find(length1) != str_symbol_map.end()) {
+    /* Brackets and '->' end a word, other operators need spaces around them */
+    auto is_symbol = [](std::string_view word) {
+        auto reserved = find_reserved_word(word);
+        return reserved && (reserved->type == TK_BRACKET || reserved->type == TK_CALL);
+    };
+
+    if (is_symbol(length1)) {
         return std::make_optional(std::make_pair(length1, 1));
-    } else if (str_symbol_map.find(length2) != str_symbol_map.end()) {
+    } else if (is_symbol(length2)) {
         return std::make_optional(std::make_pair(length2, 2));
     }
 
@@ -140,18 +208,50 @@ std::optional<std::string_view> LexContext::next_word(std::string_view& line)
     return word;
 }
 
+Token LexContext::make_str(int line, std::string_view text)
+{
+    size_t begin = m_list.m_text.size();
+    m_list.m_text += text;
+    m_list.m_strs.push_back({ (uint32_t)begin, (uint32_t)m_list.m_text.size() });
+
+    return { TK_STR, line, (uint32_t)m_list.m_strs.size() - 1 };
+}
+
+TokenRange LexContext::move_to_nested(std::vector<Token>::const_iterator begin, std::vector<Token>::const_iterator end)
+{
+    auto& nested = m_list.m_nested;
+    uint32_t start = nested.size();
+    nested.insert(nested.end(), begin, end);
+
+    return { start, (uint32_t)nested.size() };
+}
+
 /* Check validity of string and insert escape sequences */
 /* Also parse any '[var]' blocks and insert variable tokens */
-std::shared_ptr<Lstr> LexContext::parse_string(std::string_view string, int line)
+Token LexContext::parse_string(std::string_view string, int line)
 {
-    std::shared_ptr<Lstr> res = std::make_shared<Lstr>(line);
-
     int string_len = string.length();
 
     c_info.err.on_false(string_len > 2, "String is empty");
     assert(string[0] == '\"' && string[string_len - 1] == '\"');
 
-    std::stringstream ss;
+    /* Contents and specifiers of the string, moved to the token list at the end */
+    m_parts.clear();
+    uint32_t first_spec = m_list.m_specs.size();
+
+    /* The literal parts are built at the end of the text buffer */
+    std::string& text = m_list.m_text;
+    size_t part_begin = text.size();
+
+    auto end_part = [&]() {
+        if (text.size() == part_begin)
+            return;
+
+        m_list.m_strs.push_back({ (uint32_t)part_begin, (uint32_t)text.size() });
+        m_parts.push_back({ TK_STR, line, (uint32_t)m_list.m_strs.size() - 1 });
+        m_list.m_specs.emplace_back();
+        part_begin = text.size();
+    };
 
     /* Parse string that comes after the instruction */
     for (int i = 1; i < string_len - 1; i++) {
@@ -162,20 +262,15 @@ std::shared_ptr<Lstr> LexContext::parse_string(std::string_view string, int line
             c_info.err.on_true(i >= string_len - 1,
                 "Reached end of line while trying to parse escape sequence");
 
-            try {
-                ss << str_tokens.at(string[i]);
-            } catch (std::out_of_range& e) {
-                c_info.err.error("Could not parse escape sequence: '\\{}'", string[i]);
-            }
+            std::string_view escaped = str_tokens[(unsigned char)string[i]];
+            c_info.err.on_true(escaped.empty(), "Could not parse escape sequence: '\\{}'", string[i]);
+
+            text += escaped;
             break;
         }
         /* We found a format parameter: parse the tokens in it */
         case '[': {
-            std::string part = ss.str();
-            ss.str(std::string()); /* Clear stringstream */
-
-            if (!part.empty())
-                res->ts.push_back(std::make_shared<Str>(line, part));
+            end_part();
 
             std::string_view string_end = string.substr(i, std::string_view::npos);
             size_t next_bracket = string_end.find(']');
@@ -187,20 +282,27 @@ std::shared_ptr<Lstr> LexContext::parse_string(std::string_view string, int line
             c_info.err.on_true(inside.find('[') != std::string_view::npos,
                 "Found '[' inside format argument");
 
-            LexContext lexer_inside(inside, c_info, true);
-            auto parsed_inside = lexer_inside.lex_and_get_tokens();
+            FormatSpec spec;
+            if (size_t colon = inside.find(':'); colon != std::string_view::npos) {
+                spec = parse_format_spec(inside.substr(colon + 1));
+                inside = inside.substr(0, colon);
+            }
+
+            m_inside.clear();
+            lex_line(inside, line, m_inside);
+            consolidate(m_inside);
 
-            c_info.err.on_true(parsed_inside.empty(),
+            c_info.err.on_true(m_inside.empty(),
                 "Could not parse format parameter to tokens");
 
-            /* Remove eol from end */
-            assert(parsed_inside.back()->get_type() == TK_EOL);
-            parsed_inside.pop_back();
+            c_info.err.on_true(m_inside.size() > 1 && (spec.width != 0 || spec.precision != -1),
+                "Format specifier applied to more than one value");
 
-            for (const auto& tk : parsed_inside) {
-                c_info.err.on_false(lexer::could_be_num(tk->get_type()),
+            for (const auto& tk : m_inside) {
+                c_info.err.on_false(lexer::could_be_num(tk.type),
                     "Only variables, numbers and operators are allowed inside a format parameter");
-                res->ts.push_back(tk);
+                m_parts.push_back(tk);
+                m_list.m_specs.push_back(spec);
             }
 
             i += next_bracket;
@@ -212,43 +314,63 @@ std::shared_ptr<Lstr> LexContext::parse_string(std::string_view string, int line
             break;
         }
         default: {
-            ss << string[i];
+            text += string[i];
             break;
         }
         }
     }
-    std::string final_str = ss.str();
+    end_part();
 
-    if (!final_str.empty())
-        res->ts.push_back(std::make_shared<Str>(line, final_str));
+    c_info.err.on_true(m_parts.empty(), "lstring format has no contents after parse_string");
 
-    c_info.err.on_true(res->ts.empty(), "lstring format has no contents after parse_string");
+    m_list.m_lstrs.push_back({ move_to_nested(m_parts.begin(), m_parts.end()), first_spec });
 
-    return res;
+    return { TK_LSTR, line, (uint32_t)m_list.m_lstrs.size() - 1 };
 }
 
-size_t LexContext::find_closing_bracket(Bracket::Purpose purp, size_t after_open)
+/* Parse what follows the ':' in a format parameter:
+ * an optional '0' to pad with zeros instead of spaces, the minimum width and
+ * '.' followed by the number of decimals */
+FormatSpec LexContext::parse_format_spec(std::string_view spec)
 {
-    size_t count, i;
-
-    for (count = 1, i = after_open; i < tokens.size() && count >= 1 && tokens[i]->get_type() != TK_EOL; i++) {
-        if (tokens[i]->get_type() == TK_BRACKET) {
-            auto brack = LEXER_SAFE_CAST(Bracket, tokens[i]);
-            if (brack->get_purpose() == purp) {
-                if (brack->get_kind() == Bracket::Kind::Open)
-                    count++;
-                else
-                    count--;
-            }
-        }
+    FormatSpec res;
+
+    /* Only digits, from_chars would also take a sign */
+    auto parse_number = [this, spec](std::string_view& sv) {
+        c_info.err.on_false(!sv.empty() && std::isdigit(sv[0]), "Could not parse format specifier '{}'", spec);
+
+        int result = 0;
+        auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), result);
+
+        c_info.err.on_true(ec != std::errc(), "Could not parse format specifier '{}'", spec);
+        sv.remove_prefix(ptr - sv.data());
+
+        return result;
+    };
+
+    std::string_view rest = spec;
+
+    if (rest.starts_with('0')) {
+        res.fill = '0';
+        rest.remove_prefix(1);
     }
 
-    c_info.err.on_false(count == 0, "Unclosed bracket");
+    if (!rest.empty() && std::isdigit(rest[0]))
+        res.width = parse_number(rest);
 
-    return i;
+    if (rest.starts_with('.')) {
+        rest.remove_prefix(1);
+        res.precision = parse_number(rest);
+    }
+
+    c_info.err.on_false(rest.empty(), "Could not parse format specifier '{}'", spec);
+    c_info.err.on_true(res.width > FORMAT_MAX_WIDTH, "Format width {} is larger than {}", res.width, FORMAT_MAX_WIDTH);
+    c_info.err.on_true(res.precision > FORMAT_MAX_PRECISION, "Format precision {} is larger than {}", res.precision, FORMAT_MAX_PRECISION);
+
+    return res;
 }
 
-std::shared_ptr<Num> LexContext::parse_char(std::string_view string, int line)
+Token LexContext::parse_char(std::string_view string, int line)
 {
     char parsed_char;
 
@@ -261,21 +383,18 @@ std::shared_ptr<Num> LexContext::parse_char(std::string_view string, int line)
 
     if (string[1] == '\\') {
         c_info.err.on_false(string_len == 4, "Expected another character after '\\'");
-        try {
-            parsed_char = str_tokens_char.at(string[2]);
-        } catch (std::out_of_range& e) {
-            c_info.err.error("Could not parse escape sequence '\\{}'", string[2]);
-        }
+        parsed_char = str_tokens_char[(unsigned char)string[2]];
+        c_info.err.on_true(parsed_char == '\0', "Could not parse escape sequence '\\{}'", string[2]);
     } else {
         c_info.err.on_false(string_len == 3, "Too many symbols in character constant {}", string);
 
         parsed_char = string[1];
     }
 
-    return std::make_shared<Num>(line, (int)parsed_char);
+    return { TK_NUM, line, (uint32_t)(int)parsed_char };
 }
 
-std::shared_ptr<Token> LexContext::token_from_word(std::string_view word, int line)
+Token LexContext::token_from_word(std::string_view word, int line)
 {
     if (word.starts_with('"')) {
         return parse_string(word, line);
@@ -293,7 +412,8 @@ std::shared_ptr<Token> LexContext::token_from_word(std::string_view word, int li
                                || ec == std::errc::result_out_of_range
                                || ptr != last, "Could not convert '{}' to a double", word);
 
-            return std::make_shared<DoubleNum>(line, result);
+            m_list.m_doubles.push_back(result);
+            return { TK_DOUBLE_NUM, line, (uint32_t)m_list.m_doubles.size() - 1 };
         } else {
             int result;
             const char* last = word.data() + word.size();
@@ -306,116 +426,161 @@ std::shared_ptr<Token> LexContext::token_from_word(std::string_view word, int li
                             || ec == std::errc::result_out_of_range
                             || ptr != last, "Could not convert '{}' to an integer", word);
 
-            return std::make_shared<Num>(line, result);
+            return { TK_NUM, line, (uint32_t)result };
         }
-    } else if (word == ";") {
-        return std::make_shared<Sep>(line);
-    } else if (word == "->") {
-        return std::make_shared<Call>(line);
-    } else if (cmp_map.find(word) != cmp_map.end()) {
-        return std::make_shared<Cmp>(line, cmp_map.at(word));
-    } else if (str_key_map.find(word) != str_key_map.end()) {
-        return std::make_shared<Key>(line, str_key_map.at(word));
-    } else if (arit_map.find(word) != arit_map.end()) {
-        return std::make_shared<Arit>(line, arit_map.at(word));
-    } else if (log_map.find(word) != log_map.end()) {
-        return std::make_shared<Log>(line, log_map.at(word));
-    } else if (bracket_map.find(word) != bracket_map.end()) {
-        return std::make_shared<Bracket>(line, bracket_map.at(word));
+    } else if (auto reserved = find_reserved_word(word)) {
+        return { reserved->type, line, reserved->data };
     } else {
         check_correct_var_name(word);
-        return std::make_shared<Var>(line, word);
+        m_list.m_names.push_back(word);
+        return { TK_VAR, line, (uint32_t)m_list.m_names.size() - 1 };
     }
 }
 
-void LexContext::consolidate()
-{
-    consolidate(tokens);
-}
-
-/* Consolidates array accesses and VFunc calls into those respective objects.
- * Tail recursive, because after modifying the vector,
- * the indexes are going to get messed up. */
-void LexContext::consolidate(std::vector<std::shared_ptr<Token>>& p_tokens)
+/* Consolidates array accesses and VFunc calls into those respective tokens.
+ * One pass over the tokens: the result is written over the tokens already
+ * read, every '{' pushes the start of its contents onto a stack and the
+ * matching '}' moves them to the nested tokens of a new access. */
+void LexContext::consolidate(std::vector<Token>& p_tokens)
 {
+    /* An access whose '}' has not been read yet */
+    struct OpenAccess {
+        std::string_view name;
+        int line;
+        size_t start; /* Index of its first token in the result */
+    };
+    std::vector<OpenAccess> open;
+
+    size_t w = 0;
     for (size_t i = 0; i < p_tokens.size(); i++) {
-        const auto& tk = p_tokens[i];
+        const Token tk = p_tokens[i];
 
-        c_info.err.set_line(tk->get_line());
+        c_info.err.set_line(tk.line);
 
-        if (tk->get_type() == TK_BRACKET) {
-            auto brack = LEXER_SAFE_CAST(Bracket, tk);
-            if (brack->get_purpose() == Bracket::Purpose::Access) {
-                c_info.err.on_true(i == 0 || p_tokens[i - 1]->get_type() != TK_VAR, "'{' not following variable");
-                auto var = LEXER_SAFE_CAST(Var, p_tokens[i - 1]);
+        if (tk.type == TK_BRACKET && m_list.bracket(tk).purpose == Bracket::Purpose::Access) {
+            if (m_list.bracket(tk).kind == Bracket::Kind::Open) {
+                /* The variable has to be part of the same access contents */
+                size_t floor = open.empty() ? 0 : open.back().start;
+                c_info.err.on_true(w == floor || p_tokens[w - 1].type != TK_VAR, "'{{' not following variable");
 
-                c_info.err.on_true(brack->get_kind() == Bracket::Kind::Close, "Unexpected closing '}'");
+                w--;
+                open.push_back({ m_list.m_names[p_tokens[w].data], tk.line, w });
+            } else {
+                c_info.err.on_true(open.empty(), "Unexpected closing '}}'");
 
-                size_t index = find_closing_bracket(Bracket::Purpose::Access, i + 1);
+                OpenAccess access = open.back();
+                open.pop_back();
 
-                /* NOTE: is there a better way to extract a range of tokens from the original
-                 * vector and move it into the new vector? */
-                std::vector<std::shared_ptr<Token>> extract(p_tokens.begin() + i + 1, p_tokens.begin() + index - 1);
-                consolidate(extract); /* Make sure nested accesses don't get overlooked */
+                m_list.m_accesses.push_back({ access.name, move_to_nested(p_tokens.begin() + access.start, p_tokens.begin() + w) });
 
-                p_tokens.erase(p_tokens.begin() + i - 1, p_tokens.begin() + index);
-                p_tokens.insert(p_tokens.begin() + i - 1, std::make_shared<Access>(brack->get_line(), var->get_name(), extract));
-
-                consolidate();
-                return;
-            }
-        } else if (tk->get_type() == TK_CALL) {
-            c_info.err.on_true(i == p_tokens.size() - 1, "No more p_tokens after '->'");
-            c_info.err.on_false(p_tokens[i + 1]->get_type() == TK_KEY, "No key after '->'");
-
-            auto key = LEXER_SAFE_CAST(Key, p_tokens[i + 1]);
-            value_func_id vfunc;
-            try {
-                vfunc = key_vfunc_map.at(key->get_key());
-            } catch (std::out_of_range& e) {
-                c_info.err.error("Key '{}' not convertible to evaluable function", key_str_map.at(key->get_key()));
+                w = access.start;
+                p_tokens[w++] = { TK_ACCESS, access.line, (uint32_t)m_list.m_accesses.size() - 1 };
             }
+        } else if (tk.type == TK_CALL) {
+            c_info.err.on_true(i == p_tokens.size() - 1, "No more tokens after '->'");
+            c_info.err.on_false(p_tokens[i + 1].type == TK_KEY, "No key after '->'");
 
-            p_tokens.erase(p_tokens.begin() + i, p_tokens.begin() + i + 2);
-            p_tokens.insert(p_tokens.begin() + i, std::make_shared<CompleteCall>(key->get_line(), vfunc));
+            Token key = p_tokens[++i];
+            value_func_id vfunc = key_vfunc_map.at(m_list.key(key));
+            c_info.err.on_true(vfunc == VALUE_FUNC_ENUM_END,
+                "Key '{}' not convertible to evaluable function", key_str_map.at(m_list.key(key)));
 
-            consolidate();
-            return;
+            p_tokens[w++] = { TK_COM_CALL, key.line, (uint32_t)vfunc };
+        } else {
+            /* Accesses end on their line */
+            c_info.err.on_true(tk.type == TK_EOL && !open.empty(), "Unclosed bracket");
+
+            p_tokens[w++] = tk;
         }
     }
+
+    c_info.err.on_false(open.empty(), "Unclosed bracket");
+
+    p_tokens.resize(w);
+}
+
+void LexContext::lex_line(std::string_view line, int line_number, std::vector<Token>& ts)
+{
+    std::optional<std::string_view> word;
+
+    while ((word = next_word(line))) {
+        ts.push_back(token_from_word(*word, line_number));
+    }
 }
 
-std::vector<std::shared_ptr<Token>> LexContext::lex_and_get_tokens()
+/* Lex the next line which is not empty and append its tokens.
+ * The lines are cut off the source one by one, every view points into it. */
+bool LexContext::lex_next_line()
 {
-    auto lines = split(source_code, '\n');
+    while (!m_rest.empty()) {
+        int i = m_line++;
+
+        size_t line_end = m_rest.find('\n');
+        std::string_view line = m_rest.substr(0, line_end);
+        m_rest.remove_prefix(line_end == std::string_view::npos ? m_rest.size() : line_end + 1);
 
-    for (size_t i = 0; i < lines.size(); i++) {
-        auto line = lines[i];
         if (line.empty())
             continue;
 
-        /* Caller can optionally provide no_set_line; this disables setting the
-         * line on the error object when only calling to extract tokens from a
-         * single line */
-        if (!m_no_set_line)
-            c_info.err.set_line(i);
+        c_info.err.set_line(i);
 
         // Ignore comments
-        if (size_t comment_start = line.find("//"); comment_start != std::string_view::npos)
+        if (size_t comment_start = scan::comment(line); comment_start != std::string_view::npos)
             line = line.substr(0, comment_start);
 
-        std::optional<std::string_view> word;
+        lex_line(line, i, m_list.tokens);
 
-        while((word = next_word(line))) {
-            tokens.push_back(token_from_word(*word, i));
-        }
+        m_list.tokens.push_back({ TK_EOL, i, 0 });
+        return true;
+    }
+
+    return false;
+}
 
-        tokens.push_back(std::make_shared<Eol>(i));
+TokenList LexContext::lex_and_get_tokens()
+{
+    /* A rough guess to avoid growing the arrays over and over */
+    m_list.tokens.reserve(source_code.size() / 4);
+    m_list.m_names.reserve(source_code.size() / 8);
+
+    while (lex_next_line()) {
     }
 
-    consolidate();
+    consolidate(m_list.tokens);
+
+    return std::move(m_list);
+}
+
+bool LexContext::lex_next_statement()
+{
+    m_list.clear();
+
+    /* Blocks opened and not yet ended; elif and else stay in their block */
+    int depth = 0;
+
+    do {
+        size_t first = m_list.tokens.size();
+        if (!lex_next_line())
+            break;
+
+        for (size_t i = first; i < m_list.tokens.size(); i++) {
+            if (m_list.tokens[i].type != TK_KEY)
+                continue;
+
+            keyword key = m_list.key(m_list.tokens[i]);
+            if (key == K_IF || key == K_WHILE)
+                depth++;
+            else if (key == K_END)
+                depth--;
+        }
+    } while (depth > 0);
+
+    if (m_list.tokens.empty())
+        return false;
+
+    consolidate(m_list.tokens);
 
-    return tokens;
+    return true;
 }
 
 } // namespace lexer
@@ -4,14 +4,12 @@
 #include <cassert>
 #include <fmt/ostream.h>
 #include <iostream>
-#include <map>
-#include <memory>
+#include <cstdint>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
-#include <typeindex>
-#include <typeinfo>
 #include <vector>
-#include <optional>
 
 #include "dictionary.hpp"
 #include "maps.hpp"
@@ -39,277 +37,138 @@ enum token_type : int {
     TK_INV,
 };
 
-class Token {
-public:
-    Token(int line)
-        : m_line(line)
-    {
-    }
-    int get_line() const { return m_line; };
-    virtual token_type get_type() const { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_INV;
-    int m_line { 0 };
-};
-
-class Key : public Token {
-public:
-    Key(int line, keyword t_key)
-        : Token(line)
-        , m_key(t_key)
-    {
-    }
-    keyword get_key() const { return m_key; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_KEY;
-    keyword m_key;
-};
-
-class Arit : public Token {
-public:
-    Arit(int line, arit_op op)
-        : Token(line)
-        , m_op(op)
-    {
-    }
-    arit_op get_op() const { return m_op; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_ARIT;
-    arit_op m_op;
-};
-
-class Cmp : public Token {
-public:
-    Cmp(int line, cmp_op t_cmp)
-        : Token(line)
-        , m_cmp(t_cmp)
-    {
-    }
-    cmp_op get_cmp() const { return m_cmp; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_CMP;
-    cmp_op m_cmp;
-};
-
-class Log : public Token {
-public:
-    Log(int line, log_op t_log)
-        : Token(line)
-        , m_log(t_log)
-    {
-    }
-    log_op get_log() const { return m_log; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_LOG;
-    log_op m_log;
-};
-
-class Str : public Token {
-public:
-    Str(int line, const std::string& t_str)
-        : Token(line)
-        , m_str(t_str)
-    {
-    }
-    std::string_view get_str() const { return m_str; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_STR;
-    std::string m_str;
-};
-
-class Lstr : public Token {
-public:
-    Lstr(int line)
-        : Token(line)
-    {
-    }
-    std::vector<std::shared_ptr<Token>> ts;
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_LSTR;
-};
+inline constexpr auto token_str_map = make_table<token_type, std::string_view, TK_INV>({
+    { TK_KEY, "key" },
+    { TK_ARIT, "arit" },
+    { TK_CMP, "cmp" },
+    { TK_LOG, "log" },
+    { TK_STR, "str" },
+    { TK_LSTR, "lstr" },
+    { TK_NUM, "num" },
+    { TK_DOUBLE_NUM, "double num" },
+    { TK_VAR, "var" },
+    { TK_ACCESS, "access" },
+    { TK_SEP, "sep" },
+    { TK_BRACKET, "bracket" },
+    { TK_CALL, "call" },
+    { TK_COM_CALL, "complete call" },
+    { TK_EOL, "eol" },
+});
+
+/* Brackets: '{' and '}' for array accesses, '(' and ')' in arithmetic */
+struct Bracket {
+    enum class Purpose {
+        Access,
+        Math,
+    };
+    enum class Kind {
+        Open,
+        Close,
+    };
 
-class Num : public Token {
-public:
-    Num(int line, int t_num)
-        : Token(line)
-        , m_num(t_num)
-    {
-    }
-    int get_num() const { return m_num; };
-    token_type get_type() const override { return m_type; };
+    Purpose purpose;
+    Kind kind;
 
-private:
-    static const token_type m_type = lexer::TK_NUM;
-    int m_num;
+    /* Packed into the data of a token, see TokenList::bracket */
+    constexpr uint32_t pack() const { return (uint32_t)purpose << 1 | (uint32_t)kind; }
 };
 
-class DoubleNum : public Token {
-public:
-    DoubleNum(int line, double t_num)
-        : Token(line)
-        , m_num(t_num)
-    {
-    }
-    double get_num() const { return m_num; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_DOUBLE_NUM;
-    double m_num;
-};
-
-class Var : public Token {
-public:
-    Var(int line, const std::string_view name)
-        : Token(line)
-        , m_name(name)
-    {
-    }
-    std::string_view get_name() const { return m_name; };
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_VAR;
-    std::string_view m_name;
+/*
+ * A token is a tag and one word of data. What the data means depends on the
+ * type and is decoded by the accessors of TokenList:
+ * the enum value for keys, operators, brackets and complete calls, the value
+ * of integers and otherwise an index into one of the tables of the TokenList.
+ */
+struct Token {
+    token_type type;
+    int line;
+    uint32_t data;
 };
 
-class Access : public Token {
-public:
-    Access(int line, std::string_view array_name, const std::vector<std::shared_ptr<Token>>& p_expr)
-        : Token(line)
-        , expr(p_expr)
-        , m_array_name(array_name)
-    {
-    }
-    std::string_view get_array_name() const { return m_array_name; };
-    token_type get_type() const override { return m_type; };
-    std::vector<std::shared_ptr<Token>> expr;
-
-private:
-    static const token_type m_type = lexer::TK_ACCESS;
-    std::string_view m_array_name;
+/* A range of one of the arrays of a TokenList */
+struct TokenRange {
+    uint32_t begin;
+    uint32_t end;
 };
 
-class Call : public Token {
+/*
+ * The tokens of a program and everything they refer to. All tokens are stored
+ * by value in two arrays: the top level stream and the tokens nested in
+ * format strings and array accesses, which are referenced as ranges.
+ */
+class TokenList {
 public:
-    Call(int line)
-        : Token(line)
-    {
-    }
-    token_type get_type() const override { return m_type; };
+    std::vector<Token> tokens;
 
-private:
-    static const token_type m_type = lexer::TK_CALL;
-};
+    keyword key(const Token& tk) const;
+    arit_op arit(const Token& tk) const;
+    cmp_op cmp(const Token& tk) const;
+    log_op log(const Token& tk) const;
+    int num(const Token& tk) const;
+    double double_num(const Token& tk) const;
+    value_func_id vfunc(const Token& tk) const;
+    Bracket bracket(const Token& tk) const;
 
-class CompleteCall : public Token {
-public:
-    CompleteCall(int line, value_func_id vfunc_id)
-        : Token(line)
-        , m_vfunc(vfunc_id)
-    {
-    }
+    /* Text of a TK_STR with escape sequences in NASM syntax */
+    std::string_view str(const Token& tk) const;
+    /* Name of a TK_VAR or the array of a TK_ACCESS */
+    std::string_view name(const Token& tk) const;
 
-    token_type get_type() const override { return m_type; };
-    value_func_id get_vfunc() const { return m_vfunc; };
+    /* Contents of a TK_LSTR or the index expression of a TK_ACCESS */
+    std::span<const Token> nested_tokens(const Token& tk) const;
+    /* Format specifiers of a TK_LSTR, one for each nested token */
+    std::vector<FormatSpec> specs(const Token& tk) const;
 
 private:
-    static const token_type m_type = lexer::TK_COM_CALL;
-    value_func_id m_vfunc;
-};
+    friend class LexContext;
 
-class Sep : public Token {
-public:
-    Sep(int line)
-        : Token(line)
-    {
-    }
+    /* Empty every array but keep the memory */
+    void clear();
 
-    token_type get_type() const override { return m_type; };
-
-private:
-    static const token_type m_type = lexer::TK_SEP;
-};
-
-class Bracket : public Token {
-public:
-    enum class Purpose {
-        Access,
-        Math,
-    };
-    enum class Kind {
-        Open,
-        Close,
+    struct LstrData {
+        TokenRange range;
+        uint32_t specs; /* Index of the first specifier */
     };
 
-    Bracket(int line, Purpose purpose, Kind kind)
-        : Token(line)
-        , m_purpose(purpose)
-        , m_kind(kind)
-    {
-    }
-    Bracket(int line, BracketTemplate templ);
-
-    token_type get_type() const override { return m_type; };
-    Purpose get_purpose() const { return m_purpose; };
-    Kind get_kind() const { return m_kind; };
-
-private:
-    static const token_type m_type = lexer::TK_BRACKET;
-
-    Purpose m_purpose;
-    Kind m_kind;
-};
-
-struct BracketTemplate {
-    Bracket::Purpose purpose;
-    Bracket::Kind kind;
-};
-
-class Eol : public Token {
-public:
-    Eol(int line)
-        : Token(line)
-    {
-    }
-    token_type get_type() const override { return m_type; };
+    struct AccessData {
+        std::string_view name;
+        TokenRange range;
+    };
 
-private:
-    static const token_type m_type = lexer::TK_EOL;
+    std::vector<Token> m_nested;
+    std::vector<FormatSpec> m_specs;
+    std::vector<LstrData> m_lstrs;
+    std::vector<AccessData> m_accesses;
+    std::vector<std::string_view> m_names; /* Views into the source code */
+    std::vector<double> m_doubles;
+    std::vector<TokenRange> m_strs; /* Ranges of m_text */
+    std::string m_text;
 };
 
 /* Provides a context to lexically analyse a string of source code
- * and generate a list (vector) of 'tokens' from it */
+ * and generate a list of 'tokens' from it */
 class LexContext {
 public:
-/* Lexes the source code in source to list of tokens */
-std::vector<std::shared_ptr<Token>> lex_and_get_tokens();
+    /* Lexes the source code in source to list of tokens */
+    TokenList lex_and_get_tokens();
 
-LexContext(std::string_view p_source_code, CompileInfo& p_c_info, bool no_set_line = false)
-    : source_code(p_source_code)
-    , c_info(p_c_info)
-    , m_no_set_line(no_set_line)
-{
-}
+    /* Lexes the lines of the next top-level statement, i.e. up to the end of
+     * an if or while block, into tokens() and drops the tokens before.
+     * Returns false once the source code is used up. */
+    bool lex_next_statement();
+    const TokenList& tokens() const { return m_list; }
+
+    LexContext(std::string_view p_source_code, CompileInfo& p_c_info)
+        : source_code(p_source_code)
+        , c_info(p_c_info)
+        , m_rest(p_source_code)
+    {
+    }
 
 private:
     /* String manipulation */
     void check_correct_var_name(std::string_view s);
     static size_t find_next_word_ending_char(std::string_view line);
-    size_t find_closing_bracket(Bracket::Purpose purp, size_t after_open);
     static void remove_leading_space(std::string_view& sv); // manipulates string
 
     /* Extraction of strings from strings */
@@ -318,46 +177,35 @@ private:
     std::optional<std::string_view> next_word(std::string_view& line);
 
     /* Token generation */
-    std::shared_ptr<Token> token_from_word(std::string_view word, int line);
-    std::shared_ptr<Lstr> parse_string(std::string_view string, int line);
-    std::shared_ptr<Num> parse_char(std::string_view string, int line);
+    bool lex_next_line();
+    void lex_line(std::string_view line, int line_number, std::vector<Token>& ts);
+    Token token_from_word(std::string_view word, int line);
+    Token parse_string(std::string_view string, int line);
+    FormatSpec parse_format_spec(std::string_view spec);
+    Token parse_char(std::string_view string, int line);
+    Token make_str(int line, std::string_view text);
+    TokenRange move_to_nested(std::vector<Token>::const_iterator begin, std::vector<Token>::const_iterator end);
 
     /* Token manipulation */
-    void consolidate();
-    void consolidate(std::vector<std::shared_ptr<Token>>& p_tokens);
+    void consolidate(std::vector<Token>& p_tokens);
 
     std::string_view source_code;
     CompileInfo& c_info;
-    std::vector<std::shared_ptr<Token>> tokens{};
-    bool m_no_set_line;
-};
+    TokenList m_list;
 
-/*
- * Print the type of each token to stdout
- */
-void debug_tokens(const std::vector<std::shared_ptr<Token>>& ts);
+    /* The source code not lexed yet and the number of its first line */
+    std::string_view m_rest;
+    int m_line = 0;
 
-#define LEXER_SAFE_CAST(type, tk) lexer::safe_cast_core<type>((tk), __FILE__, __LINE__)
+    /* Scratch space of parse_string, kept to reuse the memory */
+    std::vector<Token> m_parts;
+    std::vector<Token> m_inside;
+};
 
 /*
- * Cast token to desired polymorphic subtype.
- * Ensures that tk was declared as a type T originally by checking the
- * static method 'get_type()'.
+ * Print the type of each token to stdout
  */
-template<typename T>
-std::shared_ptr<T> safe_cast_core(std::shared_ptr<Token> tk, std::string_view file, int line)
-{
-    try {
-        if (token_type_enum_map.at(typeid(T).hash_code()) != tk->get_type()) {
-            fmt::print(std::cerr, "{}:{}: Invalid type-match: {}\nIn call: {}\n", file, line, typeid(T).name(), __PRETTY_FUNCTION__);
-            std::exit(1);
-        }
-    } catch (std::out_of_range& e) {
-        fmt::print(std::cerr, "Type '{}' not in map in lexer::safe_cast()\n", typeid(T).name());
-        std::exit(1);
-    }
-    return std::dynamic_pointer_cast<T>(tk);
-}
+void debug_tokens(const std::vector<Token>& ts);
 
 inline bool could_be_num(lexer::token_type tt)
 {
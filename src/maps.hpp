@@ -1,56 +1,207 @@
 #ifndef MAPS_H_
 #define MAPS_H_
 
-#include <map>
+#include <array>
+#include <cstdint>
+#include <optional>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 
 #include "dictionary.hpp"
 
-void assert_map_sizes();
-
-namespace lexer {
-enum token_type : int;
-class Bracket;
-struct BracketTemplate;
-
-extern const std::map<const size_t, token_type> token_type_enum_map;
-extern const std::map<token_type, std::string_view> token_str_map;
-
-extern const std::map<std::string_view, BracketTemplate> bracket_map;
-extern const std::map<std::string_view, token_type> str_symbol_map;
-
-/* Declare type-deduced std::array in header */
-extern const std::array<char, 7> word_ending_chars;
+/*
+ * Array indexed by an enum or character, built at compile time from
+ * { key, value } pairs in any order. Keys that are not given are set to
+ * fallback. Fails to compile if a key is out of range or given twice.
+ */
+template <typename Key, typename Value, size_t N, size_t M>
+consteval std::array<Value, N> make_table(const std::pair<Key, Value> (&pairs)[M], Value fallback = {})
+{
+    std::array<Value, N> res;
+    std::array<bool, N> given {};
+
+    res.fill(fallback);
+
+    for (const auto& [key, value] : pairs) {
+        size_t index;
+        if constexpr (std::is_same_v<Key, char>)
+            index = (unsigned char)key;
+        else
+            index = key;
+
+        if (index >= N || given[index])
+            throw "key out of range or given twice";
+
+        given[index] = true;
+        res[index] = value;
+    }
+
+    return res;
 }
 
-namespace ast {
-enum ts_class : int;
+/* True if no entry of table is fallback, i.e. every key was given */
+template <typename Value, size_t N>
+consteval bool is_complete(const std::array<Value, N>& table, Value fallback = {})
+{
+    for (const auto& value : table) {
+        if (value == fallback)
+            return false;
+    }
 
-extern const std::map<const size_t, ts_class> tree_type_enum_map;
+    return true;
 }
 
-extern const std::map<std::string_view, keyword> str_key_map;
-extern const std::map<keyword, std::string_view> key_str_map;
-
-extern const std::map<std::string_view, cmp_op> cmp_map;
-extern const std::map<cmp_op, std::string_view> cmp_str_map;
-
-extern const std::map<std::string_view, arit_op> arit_map;
-extern const std::map<arit_op, std::string_view> arit_str_map;
-
-extern const std::map<std::string_view, log_op> log_map;
-extern const std::map<log_op, std::string_view> log_str_map;
-
-extern const std::map<func_id, std::string_view> func_str_map;
-extern const std::map<keyword, func_id> key_func_map;
-
-extern const std::map<var_type, std::string_view> var_type_str_map;
+namespace lexer {
+enum token_type : int;
 
-extern const std::map<value_func_id, std::string_view> vfunc_str_map;
-extern const std::map<keyword, value_func_id> key_vfunc_map;
-extern const std::map<value_func_id, var_type> vfunc_var_type_map;
+/* What a keyword, operator or symbol is lexed to */
+struct ReservedWord {
+    token_type type;
+    uint32_t data; /* Like Token::data */
+};
+
+/* Look up a word with one hash and one comparison */
+std::optional<ReservedWord> find_reserved_word(std::string_view word);
+
+inline constexpr std::array<char, 7> word_ending_chars {
+    ' ',
+    '{',
+    '}',
+    '[',
+    ']',
+    '(',
+    ')',
+};
+}
 
-extern const std::map<char, std::string_view> str_tokens;
-extern const std::map<char, char> str_tokens_char;
+inline constexpr auto key_str_map = make_table<keyword, std::string_view, K_NOKEY>({
+    { K_PRINT, "print" },
+    { K_EXIT, "exit" },
+    { K_IF, "if" },
+    { K_ELIF, "elif" },
+    { K_ELSE, "else" },
+    { K_WHILE, "while" },
+    { K_END, "end" },
+    { K_INT, "int" },
+    { K_DOUBLE, "double" },
+    { K_STR, "str" },
+    { K_READ, "read" },
+    { K_SET, "set" },
+    { K_SETD, "setd" },
+    { K_PUTCHAR, "putchar" },
+    { K_ADD, "add" },
+    { K_SUB, "sub" },
+    { K_BREAK, "break" },
+    { K_CONT, "continue" },
+    { K_TIME, "time" },
+    { K_GETUID, "getuid" },
+    { K_ARRAY, "array" },
+});
+
+inline constexpr auto cmp_str_map = make_table<cmp_op, std::string_view, CMP_OPERATION_ENUM_END>({
+    { EQUAL, "==" },
+    { GREATER, ">" },
+    { GREATER_OR_EQ, ">=" },
+    { LESS, "<" },
+    { LESS_OR_EQ, "<=" },
+    { NOT_EQUAL, "!=" },
+});
+
+inline constexpr auto arit_str_map = make_table<arit_op, std::string_view, ARIT_OPERATION_ENUM_END>({
+    { ADD, "+" },
+    { DIV, "/" },
+    { MOD, "%" },
+    { MUL, "*" },
+    { SUB, "-" },
+});
+
+inline constexpr auto log_str_map = make_table<log_op, std::string_view, LOGICAL_OPS_END>({
+    { AND, "&&" },
+    { OR, "||" },
+});
+
+inline constexpr auto func_str_map = make_table<func_id, std::string_view, FUNC_ENUM_END>({
+    { F_PRINT, "print" },
+    { F_EXIT, "exit" },
+    { F_READ, "read" },
+    { F_SET, "set" },
+    { F_SETD, "setd" },
+    { F_PUTCHAR, "putchar" },
+    { F_INT, "int" },
+    { F_DOUBLE, "double" },
+    { F_STR, "str" },
+    { F_ADD, "add" },
+    { F_SUB, "sub" },
+    { F_BREAK, "break" },
+    { F_CONT, "continue" },
+    { F_ARRAY, "array" },
+});
+
+/* FUNC_ENUM_END for keywords which are not functions */
+inline constexpr auto key_func_map = make_table<keyword, func_id, K_NOKEY>({
+    { K_PRINT, F_PRINT },
+    { K_EXIT, F_EXIT },
+    { K_READ, F_READ },
+    { K_SET, F_SET },
+    { K_SETD, F_SETD },
+    { K_PUTCHAR, F_PUTCHAR },
+    { K_INT, F_INT },
+    { K_DOUBLE, F_DOUBLE },
+    { K_ARRAY, F_ARRAY },
+    { K_STR, F_STR },
+    { K_ADD, F_ADD },
+    { K_SUB, F_SUB },
+    { K_BREAK, F_BREAK },
+    { K_CONT, F_CONT },
+}, FUNC_ENUM_END);
+
+inline constexpr auto var_type_str_map = make_table<var_type, std::string_view, V_UNSURE + 1>({
+    { V_INT, "int" },
+    { V_DOUBLE, "double" },
+    { V_STR, "str" },
+    { V_ARR, "array" },
+    { V_INT_OR_DOUBLE, "int or double" },
+    { V_UNSURE, "untyped" },
+});
+
+inline constexpr auto vfunc_str_map = make_table<value_func_id, std::string_view, VALUE_FUNC_ENUM_END>({
+    { VF_TIME, "time" },
+    { VF_GETUID, "getuid" },
+});
+
+/* VALUE_FUNC_ENUM_END for keywords which are not evaluable functions */
+inline constexpr auto key_vfunc_map = make_table<keyword, value_func_id, K_NOKEY>({
+    { K_TIME, VF_TIME },
+    { K_GETUID, VF_GETUID },
+}, VALUE_FUNC_ENUM_END);
+
+inline constexpr auto vfunc_var_type_map = make_table<value_func_id, var_type, VALUE_FUNC_ENUM_END>({
+    { VF_TIME, V_INT },
+    { VF_GETUID, V_INT },
+}, V_UNSURE);
+
+/* Escape sequences in NASM syntax, empty if the character does not
+ * form one after '\' */
+inline constexpr auto str_tokens = make_table<char, std::string_view, 256>({
+    { 'n', "\",0xa,\"" },   /* Newline */
+    { 't', "\",0x9,\"" },   /* Tabstop */
+    { '\\', "\\" },         /* The character '\' */
+    { '\"', "\",0x22,\"" }, /* The character '"' */
+    { '\'', "\",0x27,\"" }, /* The character "'" */
+    { '[', "\",0x5B,\"" },  /* The character '[' */
+    { ']', "\",0x5D,\"" },  /* The character ']' */
+});
+
+/* The characters of escape sequences, '\0' if there is none */
+inline constexpr auto str_tokens_char = make_table<char, char, 256>({
+    { 'n', '\n' },  /* Newline */
+    { 't', '\t' },  /* Tabstop */
+    { '\\', '\\' }, /* The character '\' */
+    { '\"', '\"' }, /* The character '"' */
+    { '\'', '\'' }, /* The character ''' */
+    { '[', '[' },   /* The character '[' */
+    { ']', ']' },   /* The character ']' */
+});
 
 #endif // MAPS_H_
@@ -0,0 +1,127 @@
+#include <charconv>
+
+#include <fmt/core.h>
+
+#include "ast.hpp"
+#include "print_template.hpp"
+#include "util.hpp"
+
+std::vector<TemplatePiece> lower_print(const ast::Ast& tree,
+    ast::NodeId lstr,
+    std::vector<ast::NodeId>& args,
+    CompileInfo& c_info)
+{
+    std::vector<TemplatePiece> pieces;
+    std::string literal;
+
+    auto end_literal = [&]() {
+        if (!literal.empty()) {
+            pieces.push_back({ TemplatePiece::Literal, c_info.check_str(literal) });
+            literal.clear();
+        }
+    };
+
+    const ast::Lstr& ls = tree.get<ast::Lstr>(lstr);
+
+    for (size_t i = 0; i < ls.format.size(); i++) {
+        ast::NodeId format = ls.format[i];
+        const FormatSpec& spec = ls.specs[i];
+
+        int precision = spec.precision == -1 ? FORMAT_DEFAULT_PRECISION : spec.precision;
+
+        auto int_piece = [&]() {
+            c_info.err.on_true(spec.precision != -1, "Precision is only allowed for doubles");
+            end_literal();
+            pieces.push_back({ TemplatePiece::Int, (int)args.size(), spec });
+            args.push_back(format);
+        };
+
+        switch (tree.type(format)) {
+        case ast::T_STR:
+            literal += c_info.known_strings[tree.get<ast::Str>(format).str_id];
+            break;
+        case ast::T_CONST: {
+            int value = tree.get<ast::Const>(format).value;
+
+            c_info.err.on_true(spec.precision != -1, "Precision is only allowed for doubles");
+            if (spec.fill == '0')
+                literal += fmt::format("{:0{}}", value, spec.width);
+            else
+                literal += fmt::format("{:>{}}", value, spec.width);
+            break;
+        }
+        case ast::T_DOUBLE_CONST: {
+            double value = tree.get<ast::DoubleConst>(format).value;
+
+            if (spec.fill == '0')
+                literal += fmt::format("{:0{}.{}f}", value, spec.width, precision);
+            else
+                literal += fmt::format("{:>{}.{}f}", value, spec.width, precision);
+            break;
+        }
+        case ast::T_VAR: {
+            int var_id = tree.get<ast::Var>(format).var_id;
+            c_info.error_on_undefined(var_id);
+
+            switch (c_info.known_vars[var_id].type) {
+            case V_INT:
+                int_piece();
+                break;
+            case V_DOUBLE:
+                end_literal();
+                pieces.push_back({ TemplatePiece::Double, (int)args.size(), spec });
+                args.push_back(format);
+                break;
+            case V_STR:
+                c_info.err.on_true(spec.width != 0 || spec.precision != -1, "Format specifiers are not allowed for strings");
+                end_literal();
+                pieces.push_back({ TemplatePiece::StrVar, var_id });
+                break;
+            default:
+                UNREACHABLE();
+                break;
+            }
+            break;
+        }
+        case ast::T_ACCESS:
+        case ast::T_VFUNC:
+            int_piece();
+            break;
+        default:
+            c_info.err.error("Unexpected format token in string");
+            break;
+        }
+    }
+    end_literal();
+
+    return pieces;
+}
+
+std::string string_constant_bytes(std::string_view str)
+{
+    std::string operand = fmt::format("\"{}\"", str);
+    std::string_view s = operand;
+    std::string res;
+
+    while (!s.empty()) {
+        if (s[0] == '"') {
+            size_t close = s.find('"', 1);
+            res += s.substr(1, close - 1);
+            s.remove_prefix(close + 1);
+        } else {
+            std::string_view item = s.substr(0, s.find(','));
+            unsigned value = 0;
+            if (item.starts_with("0x"))
+                std::from_chars(item.data() + 2, item.data() + item.size(), value, 16);
+            else
+                std::from_chars(item.data(), item.data() + item.size(), value);
+            res += (char)value;
+            s.remove_prefix(item.size());
+        }
+
+        if (s.starts_with(','))
+            s.remove_prefix(1);
+    }
+
+    return res;
+}
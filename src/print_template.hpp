@@ -0,0 +1,48 @@
+#ifndef PRINT_TEMPLATE_H_
+#define PRINT_TEMPLATE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dictionary.hpp"
+
+class CompileInfo;
+
+namespace ast {
+class Ast;
+using NodeId = uint32_t;
+}
+
+/* One part of a print statement, see print_template in lib/template.asm.
+ * Literal: a string constant; Int/Double: the arg-th runtime value;
+ * StrVar: the contents of a string variable */
+struct TemplatePiece {
+    enum Kind {
+        Literal,
+        Int,
+        Double,
+        StrVar,
+    };
+
+    Kind kind;
+    int id; /* String id, argument index or variable id */
+    FormatSpec spec = {};
+};
+
+/*
+ * Lower a print statement to a template of literal text and runtime values.
+ * Constant parameters are folded into the surrounding text, the nodes of the
+ * runtime values are appended to args in the order they are referenced.
+ */
+std::vector<TemplatePiece> lower_print(const ast::Ast& tree,
+    ast::NodeId lstr,
+    std::vector<ast::NodeId>& args,
+    CompileInfo& c_info);
+
+/* The bytes of a string constant, which are stored as the operand of a NASM
+ * 'db' without the outer quotes: 'Hi",0xa,"' is "Hi\n" */
+std::string string_constant_bytes(std::string_view str);
+
+#endif // PRINT_TEMPLATE_H_
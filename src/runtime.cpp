@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "runtime.hpp"
+
+namespace runtime {
+
+static const size_t OUTBUF_SIZE = 65536;
+static const unsigned long MAX_PRECISION = 18;
+
+/* Kinds of template pieces, see lib/template.asm */
+enum template_piece : long {
+    TP_LITERAL,
+    TP_INT,
+    TP_DOUBLE,
+    TP_STRVAR,
+};
+
+static const size_t PIECE_LONGS = 5;
+
+static std::string outbuf;
+static bool line_buffered;
+
+void reset_output()
+{
+    outbuf.clear();
+    line_buffered = isatty(1);
+}
+
+void outbuf_flush()
+{
+    size_t written = 0;
+    while (written < outbuf.size()) {
+        ssize_t n = write(1, outbuf.data() + written, outbuf.size() - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    outbuf.clear();
+}
+
+void outbuf_write(const char* s, size_t len)
+{
+    if (outbuf.size() + len > OUTBUF_SIZE)
+        outbuf_flush();
+    outbuf.append(s, len);
+    if (outbuf.size() >= OUTBUF_SIZE || (line_buffered && std::memchr(s, '\n', len)))
+        outbuf_flush();
+}
+
+/* Zeros go after the sign, other fill characters before it */
+static void write_padded(std::string digits, bool negative, unsigned long width, char fill)
+{
+    if (fill == '0' && digits.size() + negative < width)
+        digits.insert(0, width - digits.size() - negative, '0');
+    if (negative)
+        digits.insert(0, 1, '-');
+    if (digits.size() < width)
+        digits.insert(0, width - digits.size(), fill);
+
+    outbuf_write(digits.data(), digits.size());
+}
+
+void uprint(unsigned long n)
+{
+    write_padded(std::to_string(n), false, 0, ' ');
+}
+
+void iprintw(long n, unsigned long width, char fill)
+{
+    unsigned long magnitude = n < 0 ? 0 - (unsigned long)n : n;
+    write_padded(std::to_string(magnitude), n < 0, width, fill);
+}
+
+void iprint(long n)
+{
+    iprintw(n, 0, ' ');
+}
+
+/* Exact digits rounded to nearest with ties to even, like lib/fprint.asm */
+void fprintw(double f, unsigned long precision, unsigned long width, char fill)
+{
+    precision = std::min(precision, MAX_PRECISION);
+
+    bool negative = std::signbit(f);
+    f = std::fabs(f);
+
+    /* Padded with spaces only, zeros would make them look like numbers */
+    if (std::isnan(f)) {
+        write_padded("nan", false, width, ' ');
+        return;
+    }
+    if (std::isinf(f)) {
+        write_padded("inf", negative, width, ' ');
+        return;
+    }
+
+    write_padded(fmt::format("{:.{}f}", f, precision), negative, width, fill);
+}
+
+void fprint(double f)
+{
+    fprintw(f, 6, 0, ' ');
+}
+
+void putchar(char c)
+{
+    outbuf_write(&c, 1);
+}
+
+void print_template(const long* t, const long* args)
+{
+    const long* piece = t + 1;
+    for (long i = 0; i < t[0]; i++, piece += PIECE_LONGS) {
+        switch (piece[0]) {
+        case TP_LITERAL:
+            outbuf_write((const char*)piece[1], piece[2]);
+            break;
+        case TP_INT:
+            iprintw(args[piece[1]], piece[3], piece[4]);
+            break;
+        case TP_DOUBLE:
+            fprintw(std::bit_cast<double>(args[piece[1]]), piece[2], piece[3], piece[4]);
+            break;
+        case TP_STRVAR:
+            outbuf_write((const char*)piece[1], *(const long*)piece[2]);
+            break;
+        }
+    }
+}
+
+} // namespace runtime
@@ -0,0 +1,31 @@
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+
+#include <cstddef>
+
+/*
+ * The runtime of lib/ reimplemented for programs running inside lcc, used by
+ * the JIT and the bytecode interpreter. The output has to be the same byte for
+ * byte as that of an executable.
+ */
+namespace runtime {
+
+/* Start a new program: empty the buffer, line buffered if stdout is a terminal */
+void reset_output();
+
+void outbuf_write(const char* s, size_t len);
+void outbuf_flush();
+
+void uprint(unsigned long n);
+void iprint(long n);
+void iprintw(long n, unsigned long width, char fill);
+void fprint(double f);
+void fprintw(double f, unsigned long precision, unsigned long width, char fill);
+void putchar(char c);
+
+/* Print a template laid out like in lib/template.asm */
+void print_template(const long* t, const long* args);
+
+} // namespace runtime
+
+#endif // RUNTIME_H_
@@ -0,0 +1,209 @@
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "maps.hpp"
+#include "scan.hpp"
+
+namespace scan {
+
+enum class Class {
+    WordEnd,
+    NonSpace,
+    Quote,
+    Comment,
+};
+
+static constexpr std::array<bool, 256> word_end_table()
+{
+    std::array<bool, 256> res {};
+    for (char c : lexer::word_ending_chars)
+        res[(unsigned char)c] = true;
+
+    return res;
+}
+
+static constexpr std::array<bool, 256> is_word_end = word_end_table();
+
+/* Like isspace() in the "C" locale */
+static inline bool is_space(char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+template <Class cls>
+static inline bool matches(std::string_view sv, size_t i)
+{
+    if constexpr (cls == Class::WordEnd)
+        return is_word_end[(unsigned char)sv[i]];
+    else if constexpr (cls == Class::NonSpace)
+        return !is_space(sv[i]);
+    else if constexpr (cls == Class::Quote)
+        return sv[i] == '"';
+    else
+        return sv[i] == '/' && i + 1 < sv.size() && sv[i + 1] == '/';
+}
+
+template <Class cls>
+static size_t find_scalar(std::string_view sv, size_t from)
+{
+    for (size_t i = from; i < sv.size(); i++) {
+        if (matches<cls>(sv, i))
+            return i;
+    }
+
+    return std::string_view::npos;
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Each kernel classifies a block of bytes into a bit mask, one bit per byte.
+ * The blocks are only loaded while a whole one plus the byte after it fits,
+ * so Class::Comment can look one byte ahead; the rest goes to find_scalar.
+ */
+
+template <Class cls>
+static inline uint32_t classify_sse2(const char* p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+
+    if constexpr (cls == Class::WordEnd) {
+        __m128i hit = _mm_setzero_si128();
+        for (char c : lexer::word_ending_chars)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+        return _mm_movemask_epi8(hit);
+    } else if constexpr (cls == Class::NonSpace) {
+        /* '\t' to '\r' are the only bytes for which v - '\t' <= 4 unsigned */
+        __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+        __m128i space = _mm_or_si128(control, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        return ~_mm_movemask_epi8(space) & 0xFFFF;
+    } else if constexpr (cls == Class::Quote) {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    } else {
+        __m128i next = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i slash = _mm_set1_epi8('/');
+        return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(next, slash)));
+    }
+}
+
+template <Class cls>
+static size_t find_sse2(std::string_view sv, size_t from)
+{
+    size_t i = from;
+    for (; i + 16 < sv.size(); i += 16) {
+        if (uint32_t mask = classify_sse2<cls>(sv.data() + i))
+            return i + std::countr_zero(mask);
+    }
+
+    return find_scalar<cls>(sv, i);
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+template <Class cls>
+static inline uint32_t classify_avx2(const char* p)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+
+    if constexpr (cls == Class::WordEnd) {
+        __m256i hit = _mm256_setzero_si256();
+        for (char c : lexer::word_ending_chars)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+        return _mm256_movemask_epi8(hit);
+    } else if constexpr (cls == Class::NonSpace) {
+        __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+        __m256i space = _mm256_or_si256(control, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        return ~_mm256_movemask_epi8(space);
+    } else if constexpr (cls == Class::Quote) {
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    } else {
+        __m256i next = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i slash = _mm256_set1_epi8('/');
+        return _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(next, slash)));
+    }
+}
+
+template <Class cls>
+static size_t find_avx2(std::string_view sv, size_t from)
+{
+    size_t i = from;
+    size_t res = std::string_view::npos;
+    for (; i + 32 < sv.size(); i += 32) {
+        if (uint32_t mask = classify_avx2<cls>(sv.data() + i)) {
+            res = i + std::countr_zero(mask);
+            break;
+        }
+    }
+
+    /* Mixing dirty upper halves with SSE code is slow and GCC only
+     * does this by itself from -O2 on */
+    _mm256_zeroupper();
+
+    /* Finish with 16 bytes at a time before going byte by byte */
+    return res != std::string_view::npos ? res : find_sse2<cls>(sv, i);
+}
+
+#pragma GCC pop_options
+
+/* Asks CPUID once, before main() */
+static const bool has_avx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}();
+
+#endif
+
+/* Words are mostly shorter than a block, those are not worth the call */
+static const size_t SHORT_SCAN = 16;
+
+template <Class cls>
+static size_t find(std::string_view sv, size_t from)
+{
+#if defined(__x86_64__)
+    if (sv.size() - from <= SHORT_SCAN)
+        return find_scalar<cls>(sv, from);
+
+    /* Every x86_64 CPU has SSE2 */
+    return has_avx2 ? find_avx2<cls>(sv, from) : find_sse2<cls>(sv, from);
+#else
+    return find_scalar<cls>(sv, from);
+#endif
+}
+
+size_t word_end(std::string_view sv)
+{
+    return find<Class::WordEnd>(sv, 0);
+}
+
+size_t non_space(std::string_view sv)
+{
+    return find<Class::NonSpace>(sv, 0);
+}
+
+size_t string_end(std::string_view sv)
+{
+    size_t quote = 0;
+
+    while ((quote = find<Class::Quote>(sv, quote)) != std::string_view::npos) {
+        if (quote == 0 || sv[quote - 1] != '\\')
+            return quote;
+        quote++;
+    }
+
+    return std::string_view::npos;
+}
+
+size_t comment(std::string_view sv)
+{
+    return find<Class::Comment>(sv, 0);
+}
+
+} // namespace scan
@@ -0,0 +1,28 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <string_view>
+
+/*
+ * Byte scanning for the lexer. The searches look at 16 (SSE2) or 32 (AVX2)
+ * bytes at a time, picked once at startup from what the CPU supports, and
+ * fall back to one byte at a time elsewhere. All of them return an index
+ * into sv or std::string_view::npos if nothing was found.
+ */
+namespace scan {
+
+/* The first character which ends a word, see word_ending_chars */
+size_t word_end(std::string_view sv);
+
+/* The first character which is not whitespace */
+size_t non_space(std::string_view sv);
+
+/* The first '"' which is not preceded by '\' */
+size_t string_end(std::string_view sv);
+
+/* The start of the first "//" */
+size_t comment(std::string_view sv);
+
+} // namespace scan
+
+#endif // SCAN_H_
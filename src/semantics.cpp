@@ -1,5 +1,4 @@
 #include <cassert>
-#include <memory>
 
 #include "ast.hpp"
 #include "error.hpp"
@@ -9,14 +8,15 @@
 
 namespace semantic {
 
-static inline bool is_single_number(std::shared_ptr<ast::Node> nd);
-static inline bool is_int(std::shared_ptr<ast::Node> nd);
-static inline bool is_double(std::shared_ptr<ast::Node> nd);
+static inline bool is_single_number(ast::ts_class type);
+static inline bool is_int(ast::ts_class type);
+static inline bool is_double(ast::ts_class type);
 /* Check if the supplied args comply with spec */
-void check_correct_function_call(const FunctionSpec& spec,
-    const std::vector<std::shared_ptr<ast::Node>>& args,
+void check_correct_function_call(ast::Ast& tree,
+    const FunctionSpec& spec,
+    const std::vector<ast::NodeId>& args,
     CompileInfo& c_info);
-var_type check_arit_types(std::shared_ptr<ast::Arit> arit, CompileInfo &c_info, var_type type = V_UNSURE);
+static var_type resolve_number_type(ast::Ast& tree, ast::NodeId nd, CompileInfo& c_info);
 
 /* How each function needs to be called */
 const std::map<func_id, FunctionSpec> func_spec_map = {
@@ -37,27 +37,28 @@ const std::map<func_id, FunctionSpec> func_spec_map = {
     std::make_pair<func_id, FunctionSpec>(F_STR, { "str", 1, { ast::T_VAR }, { V_STR }, { { 0, V_STR } } }),
 };
 
-static inline bool is_single_number(std::shared_ptr<ast::Node> nd)
+static inline bool is_single_number(ast::ts_class type)
 {
-    return nd->get_type() == ast::T_CONST || nd->get_type() == ast::T_DOUBLE_CONST || nd->get_type() == ast::T_VAR
-                             || nd->get_type() == ast::T_ACCESS || nd->get_type() == ast::T_VFUNC;
+    return type == ast::T_CONST || type == ast::T_DOUBLE_CONST || type == ast::T_VAR
+                             || type == ast::T_ACCESS || type == ast::T_VFUNC;
 }
 
-static inline bool is_int(std::shared_ptr<ast::Node> nd)
+static inline bool is_int(ast::ts_class type)
 {
-    return nd->get_type() == ast::T_CONST || nd->get_type() == ast::T_VAR || nd->get_type() == ast::T_ACCESS || nd->get_type() == ast::T_VFUNC || nd->get_type() == ast::T_ARIT;
+    return type == ast::T_CONST || type == ast::T_VAR || type == ast::T_ACCESS || type == ast::T_VFUNC || type == ast::T_ARIT;
 }
 
 // TODO: array doubles
-static inline bool is_double(std::shared_ptr<ast::Node> nd)
+static inline bool is_double(ast::ts_class type)
 {
-    return nd->get_type() == ast::T_DOUBLE_CONST || nd->get_type() == ast::T_VAR || nd->get_type() == ast::T_VFUNC || nd->get_type() == ast::T_ARIT;
+    return type == ast::T_DOUBLE_CONST || type == ast::T_VAR || type == ast::T_VFUNC || type == ast::T_ARIT;
 }
 
 /* Give information about how a correct function call looks like and check for
  * it */
-void check_correct_function_call(const FunctionSpec& spec,
-    const std::vector<std::shared_ptr<ast::Node>>& args,
+void check_correct_function_call(ast::Ast& tree,
+    const FunctionSpec& spec,
+    const std::vector<ast::NodeId>& args,
     CompileInfo& c_info)
 {
     c_info.err.on_false(args.size() == spec.exp_arg_len,
@@ -70,17 +71,17 @@ void check_correct_function_call(const FunctionSpec& spec,
         for (const auto& d : spec.define) {
             assert(d.first < spec.exp_arg_len);
 
-            c_info.err.on_false(args[d.first]->get_type() == ast::T_VAR,
+            c_info.err.on_false(tree.type(args[d.first]) == ast::T_VAR,
                 "Argument {} to '{}' expected to be variable", d.first, spec.name);
-            auto t_var = AST_SAFE_CAST(ast::Var, args[d.first]);
+            VarInfo& var = c_info.known_vars[tree.get<ast::Var>(args[d.first]).var_id];
 
-            c_info.err.on_true(c_info.known_vars[t_var->get_var_id()].defined,
+            c_info.err.on_true(var.defined,
                 "Argument {} to '{}' expected to be undefined", d.first, spec.name);
-            c_info.known_vars[t_var->get_var_id()].defined = true;
-            c_info.known_vars[t_var->get_var_id()].type = d.second;
+            var.defined = true;
+            var.type = d.second;
 
             if (d.second == V_ARR) {
-                c_info.known_vars[t_var->get_var_id()].arrayness = VarInfo::Arrayness::Yes;
+                var.arrayness = VarInfo::Arrayness::Yes;
             }
         }
     }
@@ -90,41 +91,41 @@ void check_correct_function_call(const FunctionSpec& spec,
     assert(spec.types.size() == spec.exp_arg_len);
 
     for (size_t i = 0; i < args.size(); i++) {
-        const auto& arg = args[i];
+        ast::NodeId arg = args[i];
+        ast::ts_class arg_type = tree.type(arg);
 
         if (spec.types[i] == ast::T_INT_GENERAL) {
-            c_info.err.on_false(is_int(arg),
+            c_info.err.on_false(is_int(arg_type),
                 "Argument {} to '{}' has to evaluate to an integer", i, spec.name);
 
             /* If we are var: check that we are int */
-            if (arg->get_type() == ast::T_VAR) {
-                auto t_var = AST_SAFE_CAST(ast::Var, args[i]);
-
-                c_info.error_on_undefined(t_var);
-                c_info.error_on_wrong_type(t_var, V_INT);
-            } else if (arg->get_type() == ast::T_VFUNC) {
-                auto vfunc = AST_SAFE_CAST(ast::VFunc, args[i]);
-                c_info.err.on_false(vfunc->get_return_type() == V_INT,
+            if (arg_type == ast::T_VAR) {
+                int var_id = tree.get<ast::Var>(arg).var_id;
+
+                c_info.error_on_undefined(var_id);
+                c_info.error_on_wrong_type(var_id, V_INT);
+            } else if (arg_type == ast::T_VFUNC) {
+                const auto& vfunc = tree.get<ast::VFunc>(arg);
+                c_info.err.on_false(vfunc.return_type == V_INT,
                     "Argument {} to '{}' has to evaluate to an integer"
                     "Got '{}' returning '{}'",
-                    i, spec.name, vfunc_str_map.at(vfunc->get_value_func()),
-                    var_type_str_map.at(vfunc->get_return_type()));
-            } else if (arg->get_type() == ast::T_ARIT) {
-                auto arit = AST_SAFE_CAST(ast::Arit, args[i]);
-                c_info.err.on_false(check_arit_types(arit, c_info) == V_INT,
+                    i, spec.name, vfunc_str_map.at(vfunc.vfunc),
+                    var_type_str_map.at(vfunc.return_type));
+            } else if (arg_type == ast::T_ARIT) {
+                c_info.err.on_false(resolve_number_type(tree, arg, c_info) == V_INT,
                                     "Argument {} to '{}' has to evaluate to an integer", i, spec.name);
             }
         } else if (spec.types[i] == ast::T_DOUBLE_GENERAL) {
-            c_info.err.on_false(is_double(arg),
+            c_info.err.on_false(is_double(arg_type),
                 "Argument {} to '{}' has to evaluate to a double", i, spec.name);
 
             /* If we are var: check that we are double */
-            if (arg->get_type() == ast::T_VAR) {
-                auto t_var = AST_SAFE_CAST(ast::Var, args[i]);
+            if (arg_type == ast::T_VAR) {
+                int var_id = tree.get<ast::Var>(arg).var_id;
 
-                c_info.error_on_undefined(t_var);
-                c_info.error_on_wrong_type(t_var, V_DOUBLE);
-            } else if (arg->get_type() == ast::T_VFUNC) {
+                c_info.error_on_undefined(var_id);
+                c_info.error_on_wrong_type(var_id, V_DOUBLE);
+            } else if (arg_type == ast::T_VFUNC) {
                 assert(false && "double vfuncs not implemented yet");
                 // auto vfunc = AST_SAFE_CAST(ast::VFunc, args[i]);
                 // c_info.err.on_false(vfunc->get_return_type() == V_DOUBLE,
@@ -132,24 +133,21 @@ void check_correct_function_call(const FunctionSpec& spec,
                 //     "Got '{}' returning '{}'",
                 //     i, spec.name, vfunc_str_map.at(vfunc->get_value_func()),
                 //     var_type_str_map.at(vfunc->get_return_type()));
-            } else if (arg->get_type() == ast::T_ARIT) {
-                auto arit = AST_SAFE_CAST(ast::Arit, args[i]);
-                c_info.err.on_false(check_arit_types(arit, c_info) == V_DOUBLE,
+            } else if (arg_type == ast::T_ARIT) {
+                c_info.err.on_false(resolve_number_type(tree, arg, c_info) == V_DOUBLE,
                                     "Argument {} to '{}' has to evaluate to a double", i, spec.name);
             }
         } else if (spec.types[i] == ast::T_IN_MEMORY) {
-            c_info.err.on_false(arg->get_type() == ast::T_VAR || arg->get_type() == ast::T_ACCESS, "Argument {} to '{}' has to have a memory address", i, spec.name);
+            c_info.err.on_false(arg_type == ast::T_VAR || arg_type == ast::T_ACCESS, "Argument {} to '{}' has to have a memory address", i, spec.name);
 
-            if (arg->get_type() == ast::T_VAR) {
-                auto t_var = AST_SAFE_CAST(ast::Var, args[i]);
-                c_info.error_on_undefined(t_var);
+            if (arg_type == ast::T_VAR) {
+                c_info.error_on_undefined(tree.get<ast::Var>(arg).var_id);
                 // TODO: do we need this error check?
                 /* c_info.err.on_false(
                     v_info.type == V_INT, "Argument {} to '{}' has to have type '{}' but has '{}'", i,
                     spec.name, var_type_str_map.at(V_INT), var_type_str_map.at(v_info.type)); */
-            } else if (arg->get_type() == ast::T_ACCESS) {
-                auto access = AST_SAFE_CAST(ast::Access, args[i]);
-                auto v_info = c_info.known_vars[access->get_array_id()];
+            } else if (arg_type == ast::T_ACCESS) {
+                const VarInfo& v_info = c_info.known_vars[tree.get<ast::Access>(arg).array_id];
 
                 c_info.err.on_false(v_info.defined, "Var '{}' is undefined at this time",
                     v_info.name);
@@ -158,20 +156,20 @@ void check_correct_function_call(const FunctionSpec& spec,
                     spec.name, var_type_str_map.at(V_ARR), var_type_str_map.at(v_info.type));
             }
         } else {
-            c_info.err.on_false(arg->get_type() == spec.types[i],
+            c_info.err.on_false(arg_type == spec.types[i],
                 "Argument {} to function '{}' is wrong type", i, spec.name);
         }
 
         /* If we are a var: check the provided 'info' type information if the
          * type is correct */
-        if (arg->get_type() == ast::T_VAR && spec.types[i] != ast::T_INT_GENERAL && spec.types[i] != ast::T_DOUBLE_GENERAL) {
-            auto t_var = AST_SAFE_CAST(ast::Var, args[i]);
+        if (arg_type == ast::T_VAR && spec.types[i] != ast::T_INT_GENERAL && spec.types[i] != ast::T_DOUBLE_GENERAL) {
+            int var_id = tree.get<ast::Var>(arg).var_id;
 
             c_info.err.on_true(info_it == spec.info.end() || spec.info.empty(),
                 "Could not parse arguments to function '{}'", spec.name);
 
-            c_info.error_on_undefined(t_var);
-            c_info.error_on_wrong_type(t_var, *info_it.base());
+            c_info.error_on_undefined(var_id);
+            c_info.error_on_wrong_type(var_id, *info_it.base());
 
             info_it++;
         }
@@ -179,60 +177,52 @@ void check_correct_function_call(const FunctionSpec& spec,
 }
 
 /* Check usage of undefined variables and incorrect function calls, etc. */
-void semantic_analysis(std::shared_ptr<ast::Node> root, CompileInfo& c_info)
+static void semantic_analysis_core(ast::Ast& tree, ast::NodeId root, CompileInfo& c_info)
 {
-    c_info.err.set_line(root->get_line());
+    c_info.err.set_line(tree.line(root));
 
-    switch (root->get_type()) {
+    switch (tree.type(root)) {
     case ast::T_BODY: {
-        std::shared_ptr<ast::Body> body = AST_SAFE_CAST(ast::Body, root);
-
-        for (const auto& child : body->children) {
-            semantic_analysis(child, c_info);
+        for (ast::NodeId child : tree.get<ast::Body>(root).children) {
+            semantic_analysis_core(tree, child, c_info);
         }
         break;
     }
     case ast::T_ELSE: {
-        std::shared_ptr<ast::Else> t_else = AST_SAFE_CAST(ast::Else, root);
-
-        semantic_analysis(t_else->body, c_info);
+        semantic_analysis_core(tree, tree.get<ast::Else>(root).body, c_info);
         break;
     }
     case ast::T_IF: {
-        std::shared_ptr<ast::If> t_if = AST_SAFE_CAST(ast::If, root);
+        const ast::If& t_if = tree.get<ast::If>(root);
 
-        semantic_analysis(t_if->condition, c_info);
-        semantic_analysis(t_if->body, c_info);
+        semantic_analysis_core(tree, t_if.condition, c_info);
+        semantic_analysis_core(tree, t_if.body, c_info);
 
-        if (t_if->elif)
-            semantic_analysis(t_if->elif, c_info);
+        if (t_if.elif != ast::NO_NODE)
+            semantic_analysis_core(tree, t_if.elif, c_info);
         break;
     }
     case ast::T_FUNC: {
-        std::shared_ptr<ast::Func> t_func = AST_SAFE_CAST(ast::Func, root);
+        const ast::Func& t_func = tree.get<ast::Func>(root);
 
-        check_correct_function_call(func_spec_map.at(t_func->get_func()), t_func->args, c_info);
-        for (const auto& arg : t_func->args) {
-            semantic_analysis(arg, c_info);
+        check_correct_function_call(tree, func_spec_map.at(t_func.func), t_func.args, c_info);
+        for (ast::NodeId arg : t_func.args) {
+            semantic_analysis_core(tree, arg, c_info);
         }
 
-        switch (t_func->get_func()) {
-        case F_INT: {
-            auto t_var = AST_SAFE_CAST(ast::Var, t_func->args[0]);
-            c_info.known_vars[t_var->get_var_id()].stack_offset = c_info.get_stack_size_and_append(1);
-            break;
-        }
+        switch (t_func.func) {
+        case F_INT:
         case F_DOUBLE: {
-            auto t_var = AST_SAFE_CAST(ast::Var, t_func->args[0]);
-            c_info.known_vars[t_var->get_var_id()].stack_offset = c_info.get_stack_size_and_append(1);
+            VarInfo& var = c_info.known_vars[tree.get<ast::Var>(t_func.args[0]).var_id];
+            var.stack_offset = c_info.get_stack_size_and_append(1);
             break;
         }
         case F_ARRAY: {
-            auto t_var = AST_SAFE_CAST(ast::Var, t_func->args[0]);
-            auto t_size = AST_SAFE_CAST(ast::Const, t_func->args[1]);
+            VarInfo& var = c_info.known_vars[tree.get<ast::Var>(t_func.args[0]).var_id];
+            int size = tree.get<ast::Const>(t_func.args[1]).value;
 
-            c_info.known_vars[t_var->get_var_id()].stack_offset = c_info.get_stack_size_and_append(t_size->get_value());
-            c_info.known_vars[t_var->get_var_id()].stack_units = t_size->get_value();
+            var.stack_offset = c_info.get_stack_size_and_append(size);
+            var.stack_units = size;
             break;
         }
         default:
@@ -241,29 +231,31 @@ void semantic_analysis(std::shared_ptr<ast::Node> root, CompileInfo& c_info)
         break;
     }
     case ast::T_VFUNC: {
-        std::shared_ptr<ast::VFunc> t_vfunc = AST_SAFE_CAST(ast::VFunc, root);
-
         /* NOTE: do we need to do anything? */
         break;
     }
     case ast::T_CMP: {
-        std::shared_ptr<ast::Cmp> t_cmp = AST_SAFE_CAST(ast::Cmp, root);
+        const ast::Cmp& t_cmp = tree.get<ast::Cmp>(root);
 
-        // TODO: type error checking
+        semantic_analysis_core(tree, t_cmp.left, c_info);
+        var_type type = resolve_number_type(tree, t_cmp.left, c_info);
 
-        if (t_cmp->left)
-            semantic_analysis(t_cmp->left, c_info);
-        if (t_cmp->right)
-            semantic_analysis(t_cmp->right, c_info);
+        if (t_cmp.right != ast::NO_NODE) {
+            semantic_analysis_core(tree, t_cmp.right, c_info);
+            var_type right_type = resolve_number_type(tree, t_cmp.right, c_info);
+
+            c_info.err.on_false(type == right_type, "Mismatched types in comparison: '{}' and '{}'",
+                var_type_str_map.at(type), var_type_str_map.at(right_type));
+        }
         break;
     }
     case ast::T_LOG: {
-        std::shared_ptr<ast::Log> log = AST_SAFE_CAST(ast::Log, root);
+        const ast::Log& log = tree.get<ast::Log>(root);
 
-        if (log->left)
-            semantic_analysis(log->left, c_info);
-        if (log->right)
-            semantic_analysis(log->right, c_info);
+        if (log.left != ast::NO_NODE)
+            semantic_analysis_core(tree, log.left, c_info);
+        if (log.right != ast::NO_NODE)
+            semantic_analysis_core(tree, log.right, c_info);
         break;
     }
     case ast::T_DOUBLE_CONST:
@@ -271,46 +263,44 @@ void semantic_analysis(std::shared_ptr<ast::Node> root, CompileInfo& c_info)
         break;
     }
     case ast::T_VAR: {
-        std::shared_ptr<ast::Var> t_var = AST_SAFE_CAST(ast::Var, root);
+        const VarInfo& var = c_info.known_vars[tree.get<ast::Var>(root).var_id];
 
-        c_info.err.on_false(c_info.known_vars[t_var->get_var_id()].defined, "Variable '{}' is undefined at this time", c_info.known_vars[t_var->get_var_id()].name);
+        c_info.err.on_false(var.defined, "Variable '{}' is undefined at this time", var.name);
         break;
     }
     case ast::T_ACCESS: {
-        std::shared_ptr<ast::Access> t_access = AST_SAFE_CAST(ast::Access, root);
+        const ast::Access& t_access = tree.get<ast::Access>(root);
+        const VarInfo& array = c_info.known_vars[t_access.array_id];
 
-        c_info.err.on_false(c_info.known_vars[t_access->get_array_id()].arrayness == VarInfo::Arrayness::Yes, "Variable '{}' is not an array", c_info.known_vars[t_access->get_array_id()].name);
-        c_info.err.on_false(c_info.known_vars[t_access->get_array_id()].defined, "Array '{}' is undefined at this time", c_info.known_vars[t_access->get_array_id()].name);
+        c_info.err.on_false(array.arrayness == VarInfo::Arrayness::Yes, "Variable '{}' is not an array", array.name);
+        c_info.err.on_false(array.defined, "Array '{}' is undefined at this time", array.name);
 
-        semantic_analysis(t_access->index, c_info);
+        semantic_analysis_core(tree, t_access.index, c_info);
         break;
     }
     case ast::T_STR: {
         break;
     }
     case ast::T_ARIT: {
-        std::shared_ptr<ast::Arit> t_arit = AST_SAFE_CAST(ast::Arit, root);
+        const ast::Arit& t_arit = tree.get<ast::Arit>(root);
 
-        // TODO: do not check arits twice
-        // i.e.: put checked arits into an array
-        check_arit_types(t_arit, c_info);
+        /* Resolves the whole expression at once, the operands are only looked up */
+        resolve_number_type(tree, root, c_info);
 
-        semantic_analysis(t_arit->left, c_info);
-        semantic_analysis(t_arit->right, c_info);
+        semantic_analysis_core(tree, t_arit.left, c_info);
+        semantic_analysis_core(tree, t_arit.right, c_info);
         break;
     }
     case ast::T_WHILE: {
-        std::shared_ptr<ast::While> t_while = AST_SAFE_CAST(ast::While, root);
+        const ast::While& t_while = tree.get<ast::While>(root);
 
-        semantic_analysis(t_while->condition, c_info);
-        semantic_analysis(t_while->body, c_info);
+        semantic_analysis_core(tree, t_while.condition, c_info);
+        semantic_analysis_core(tree, t_while.body, c_info);
         break;
     }
     case ast::T_LSTR: {
-        std::shared_ptr<ast::Lstr> t_lstr = AST_SAFE_CAST(ast::Lstr, root);
-
-        for (const auto& format : t_lstr->format) {
-            semantic_analysis(format, c_info);
+        for (ast::NodeId format : tree.get<ast::Lstr>(root).format) {
+            semantic_analysis_core(tree, format, c_info);
         }
         break;
     }
@@ -324,69 +314,58 @@ void semantic_analysis(std::shared_ptr<ast::Node> root, CompileInfo& c_info)
     }
 }
 
-var_type get_number_type(std::shared_ptr<ast::Node> nd, CompileInfo &c_info)
+void semantic_analysis(ast::Ast& tree, CompileInfo& c_info)
 {
-    if (nd->get_type() == ast::T_CONST) {
-        return V_INT;
-    } else if (nd->get_type() == ast::T_DOUBLE_CONST) {
-        return V_DOUBLE;
-    } else if (nd->get_type() == ast::T_VAR) {
-        const VarInfo &var = c_info.known_vars[AST_SAFE_CAST(ast::Var, nd)->get_var_id()];
+    semantic_analysis_core(tree, tree.root, c_info);
+}
+
+/* Type of a number, stored on the node and all nodes below it so it is only
+ * worked out once */
+static var_type resolve_number_type(ast::Ast& tree, ast::NodeId nd, CompileInfo& c_info)
+{
+    if (tree.num_type(nd) != V_UNSURE)
+        return tree.num_type(nd);
+
+    var_type type = V_UNSURE;
+
+    switch (tree.type(nd)) {
+    case ast::T_CONST:
+        type = V_INT;
+        break;
+    case ast::T_DOUBLE_CONST:
+        type = V_DOUBLE;
+        break;
+    case ast::T_VAR: {
+        const VarInfo &var = c_info.known_vars[tree.get<ast::Var>(nd).var_id];
 
         c_info.err.on_false(var.defined, "Variable '{}' is undefined at this time", var.name);
         c_info.err.on_false(var.type == V_INT || var.type == V_DOUBLE, "Expected int or double");
 
-        return var.type;
-    } else if (nd->get_type() == ast::T_ACCESS) {
+        type = var.type;
+        break;
+    }
+    case ast::T_ACCESS:
         // TODO: implement double arrays here
-        return V_INT;
-    } else if (nd->get_type() == ast::T_VFUNC) {
-        auto vfunc = AST_SAFE_CAST(ast::VFunc, nd);
+        type = V_INT;
+        break;
+    case ast::T_VFUNC:
+        type = vfunc_var_type_map.at(tree.get<ast::VFunc>(nd).vfunc);
+        break;
+    case ast::T_ARIT: {
+        const ast::Arit& arit = tree.get<ast::Arit>(nd);
 
-        return vfunc_var_type_map.at(vfunc->get_value_func());
-    } else if (nd->get_type() == ast::T_ARIT) {
-        auto arit = AST_SAFE_CAST(ast::Arit, nd);
+        type = resolve_number_type(tree, arit.left, c_info);
+        var_type right_type = resolve_number_type(tree, arit.right, c_info);
 
-        return check_arit_types(arit, c_info);
+        c_info.err.on_true(type != right_type, "Type mismatch: '{}' and '{}'", var_type_str_map.at(type), var_type_str_map.at(right_type));
+        break;
     }
-
-    UNREACHABLE();
-    return V_UNSURE;
-}
-
-/* Checks if all types are equal and returns the type */
-
-// TODO: only have this function called once for every expression
-var_type check_arit_types(std::shared_ptr<ast::Arit> arit, CompileInfo &c_info, var_type type)
-{
-    if (type == V_UNSURE) {
-        if (is_single_number(arit->left))
-            type = get_number_type(arit->left, c_info);
-        else if (is_single_number(arit->right))
-            type = get_number_type(arit->right, c_info);
+    default:
+        UNREACHABLE();
+        break;
     }
 
-    if (type != V_UNSURE) {
-        if (is_single_number(arit->left)) {
-            var_type ltype = get_number_type(arit->left, c_info);
-            c_info.err.on_true(ltype != type, "Type mismatch: '{}' and '{}'", var_type_str_map.at(ltype), var_type_str_map.at(type));
-        } else {
-            check_arit_types(AST_SAFE_CAST(ast::Arit, arit->left), c_info, type);
-        }
-        if (is_single_number(arit->right)) {
-            var_type rtype = get_number_type(arit->right, c_info);
-            c_info.err.on_true(rtype != type, "Type mismatch: '{}' and '{}'", var_type_str_map.at(type), var_type_str_map.at(rtype));
-        } else {
-            check_arit_types(AST_SAFE_CAST(ast::Arit, arit->right), c_info, type);
-        }
-    } else {
-        // Try to get the type from recursive call
-        type = check_arit_types(AST_SAFE_CAST(ast::Arit, arit->left), c_info, type);
-        if (type == V_UNSURE)
-            type = check_arit_types(AST_SAFE_CAST(ast::Arit, arit->right), c_info, type);
-        else
-            check_arit_types(AST_SAFE_CAST(ast::Arit, arit->right), c_info, type);
-    }
+    tree.set_num_type(nd, type);
 
     return type;
 }
@@ -1,7 +1,6 @@
 #ifndef SEMANTICS_H_
 #define SEMANTICS_H_
 
-#include <memory>
 #include <vector>
 
 #include "ast.hpp"
@@ -33,8 +32,11 @@ struct FunctionSpec {
     }
 };
 
-void semantic_analysis(std::shared_ptr<ast::Node> root, CompileInfo& c_info);
-var_type get_number_type(std::shared_ptr<ast::Node> nd, CompileInfo &c_info);
+/*
+ * Check the program for errors and store the type of every number in the tree
+ * (see Ast::num_type)
+ */
+void semantic_analysis(ast::Ast& tree, CompileInfo& c_info);
 
 }
 
@@ -0,0 +1,809 @@
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <unordered_map>
+
+#include "dictionary.hpp"
+#include "ir.hpp"
+#include "util.hpp"
+
+namespace ir {
+
+/* Where every block's dominance ends: the blocks it dominates a
+ * predecessor of without dominating the block itself */
+static std::vector<std::vector<BlockId>> dominance_frontiers(const Function& fn, const Dominators& dominators)
+{
+    std::vector<std::vector<BlockId>> frontiers(fn.blocks.size());
+
+    for (BlockId b = 0; b < fn.blocks.size(); b++) {
+        const auto& preds = fn.blocks[b].preds;
+        if (preds.size() < 2 || !dominators.reachable(b))
+            continue;
+
+        for (BlockId pred : preds) {
+            if (!dominators.reachable(pred))
+                continue;
+
+            /* Where b was added already, the walk from another predecessor
+             * went on up from there */
+            for (BlockId runner = pred; runner != dominators.idom(b); runner = dominators.idom(runner)) {
+                auto& frontier = frontiers[runner];
+                if (!frontier.empty() && frontier.back() == b)
+                    break;
+                frontier.push_back(b);
+            }
+        }
+    }
+
+    return frontiers;
+}
+
+/*
+ * SSA construction after Cytron et al.: a variable stored in some block gets
+ * a phi in the dominance frontier of that block, then walking the dominator
+ * tree every load is replaced by the value last stored on the way there.
+ */
+void promote_variables(Function& fn, const CompileInfo& c_info, bool store_variables)
+{
+    assert(fn.blocks[0].preds.empty());
+
+    /* The promoted variables, numbered in the order they are seen */
+    std::unordered_map<int, uint32_t> number;
+    std::vector<int> vars;
+    std::vector<std::vector<BlockId>> stored_in;
+
+    for (BlockId b = 0; b < fn.blocks.size(); b++) {
+        for (const Insn& insn : fn.blocks[b].insns) {
+            if (insn.op != OP_LDV && insn.op != OP_STV)
+                continue;
+
+            auto [it, added] = number.try_emplace(insn.var, vars.size());
+            if (added) {
+                vars.push_back(insn.var);
+                stored_in.emplace_back();
+            }
+
+            auto& blocks = stored_in[it->second];
+            if (insn.op == OP_STV && (blocks.empty() || blocks.back() != b))
+                blocks.push_back(b);
+        }
+    }
+
+    if (vars.empty())
+        return;
+
+    auto var_type_of = [&](uint32_t v) { return c_info.known_vars[vars[v]].type; };
+
+    Dominators dominators(fn);
+    auto frontiers = dominance_frontiers(fn, dominators);
+
+    /* The variable of every phi placed at the start of a block */
+    std::vector<std::vector<uint32_t>> phi_vars(fn.blocks.size());
+    std::vector<uint32_t> has_phi(fn.blocks.size(), UINT32_MAX);
+    std::vector<uint32_t> queued(fn.blocks.size(), UINT32_MAX);
+
+    for (uint32_t v = 0; v < vars.size(); v++) {
+        std::vector<BlockId> work = stored_in[v];
+        for (BlockId b : work)
+            queued[b] = v;
+
+        /* A phi is a store too, so the frontier of its block needs one */
+        while (!work.empty()) {
+            BlockId b = work.back();
+            work.pop_back();
+
+            for (BlockId f : frontiers[b]) {
+                if (has_phi[f] == v)
+                    continue;
+
+                has_phi[f] = v;
+                phi_vars[f].push_back(v);
+                if (queued[f] != v) {
+                    queued[f] = v;
+                    work.push_back(f);
+                }
+            }
+        }
+    }
+
+    for (BlockId b = 0; b < fn.blocks.size(); b++) {
+        if (phi_vars[b].empty())
+            continue;
+
+        Block& block = fn.blocks[b];
+        std::vector<Insn> insns;
+        insns.reserve(phi_vars[b].size() + block.insns.size());
+
+        for (uint32_t v : phi_vars[b]) {
+            insns.push_back({ .op = OP_PHI, .dst = fn.new_reg(var_type_of(v)), .line = block.insns[0].line,
+                .args = std::vector<Operand>(block.preds.size()) });
+        }
+        std::move(block.insns.begin(), block.insns.end(), std::back_inserter(insns));
+        block.insns = std::move(insns);
+    }
+
+    /* The edges into blocks with phis, as the block and which of its
+     * predecessors the edge is, by the block they come from */
+    std::vector<std::vector<std::pair<BlockId, size_t>>> phi_edges(fn.blocks.size());
+    for (BlockId b = 0; b < fn.blocks.size(); b++) {
+        if (phi_vars[b].empty())
+            continue;
+
+        for (size_t p = 0; p < fn.blocks[b].preds.size(); p++)
+            phi_edges[fn.blocks[b].preds[p]].push_back({ b, p });
+    }
+
+    /* The values of the variables on the current path of the dominator
+     * tree, what the loads are replaced with and the value on entry */
+    std::vector<std::vector<Operand>> current(vars.size());
+    std::vector<Operand> replacement(fn.regs.size());
+    std::vector<Reg> entry_value(vars.size(), NO_REG);
+    /* The variables pushed to current, popped again when leaving a block */
+    std::vector<uint32_t> pushed;
+
+    auto value_of = [&](uint32_t v) {
+        if (!current[v].empty())
+            return current[v].back();
+
+        if (entry_value[v] == NO_REG)
+            entry_value[v] = fn.new_reg(var_type_of(v));
+        return Operand::of_reg(entry_value[v]);
+    };
+
+    auto resolve = [&replacement](Operand& op) {
+        if (op.is_reg() && op.reg() < replacement.size() && replacement[op.reg()].kind != Operand::None)
+            op = replacement[op.reg()];
+    };
+
+    auto enter = [&](BlockId b) {
+        Block& block = fn.blocks[b];
+        size_t phis = block.phi_count();
+
+        for (size_t i = 0; i < phis; i++) {
+            current[phi_vars[b][i]].push_back(Operand::of_reg(block.insns[i].dst));
+            pushed.push_back(phi_vars[b][i]);
+        }
+
+        std::vector<Insn> insns(std::make_move_iterator(block.insns.begin()),
+            std::make_move_iterator(block.insns.begin() + phis));
+
+        for (size_t i = phis; i < block.insns.size(); i++) {
+            Insn& insn = block.insns[i];
+            resolve(insn.a);
+            resolve(insn.b);
+            for (auto& arg : insn.args)
+                resolve(arg);
+
+            if (insn.op == OP_LDV) {
+                replacement[insn.dst] = value_of(number.at(insn.var));
+                continue;
+            }
+
+            if (insn.op == OP_STV) {
+                uint32_t v = number.at(insn.var);
+                current[v].push_back(insn.a);
+                pushed.push_back(v);
+                continue;
+            }
+
+            if (insn.op == OP_END && store_variables) {
+                for (uint32_t v = 0; v < vars.size(); v++) {
+                    if (!stored_in[v].empty())
+                        insns.push_back({ .op = OP_STV, .a = value_of(v), .var = vars[v], .line = insn.line });
+                }
+            }
+
+            insns.push_back(std::move(insn));
+        }
+
+        block.insns = std::move(insns);
+
+        for (auto [succ, p] : phi_edges[b]) {
+            for (size_t i = 0; i < phi_vars[succ].size(); i++)
+                fn.blocks[succ].insns[i].args[p] = value_of(phi_vars[succ][i]);
+        }
+    };
+
+    /* Through the dominator tree without recursion, every entry is a block,
+     * the next child to enter and the size of pushed before the block */
+    struct Visit {
+        BlockId block;
+        size_t next;
+        size_t pushed_before;
+    };
+
+    std::vector<Visit> stack = { { 0, 0, 0 } };
+    enter(0);
+
+    while (!stack.empty()) {
+        Visit& visit = stack.back();
+        const auto& children = dominators.children(visit.block);
+
+        if (visit.next < children.size()) {
+            BlockId child = children[visit.next++];
+            stack.push_back({ child, 0, pushed.size() });
+            enter(child);
+            continue;
+        }
+
+        for (size_t i = visit.pushed_before; i < pushed.size(); i++)
+            current[pushed[i]].pop_back();
+        pushed.resize(visit.pushed_before);
+        stack.pop_back();
+    }
+
+    /* The values the variables have on entry are still in memory */
+    std::vector<Insn> loads;
+    for (uint32_t v = 0; v < vars.size(); v++) {
+        if (entry_value[v] != NO_REG)
+            loads.push_back({ .op = OP_LDV, .dst = entry_value[v], .var = vars[v], .line = fn.blocks[0].insns[0].line });
+    }
+
+    auto& entry = fn.blocks[0].insns;
+    entry.insert(entry.begin(), std::make_move_iterator(loads.begin()), std::make_move_iterator(loads.end()));
+}
+
+/* What is known about the value of a register: nothing yet, that it is
+ * always the same constant, or that it varies */
+struct Lattice {
+    enum State : uint8_t {
+        Unknown,
+        Constant,
+        Varying,
+    };
+
+    State state = Unknown;
+    Operand value = {};
+
+    bool operator==(const Lattice&) const = default;
+};
+
+static Lattice meet(const Lattice& a, const Lattice& b)
+{
+    if (a.state == Lattice::Unknown)
+        return b;
+    if (b.state == Lattice::Unknown)
+        return a;
+    if (a.state == Lattice::Varying || b.state == Lattice::Varying || a.value != b.value)
+        return { Lattice::Varying };
+    return a;
+}
+
+/* The result of arithmetic on two constants the way the machine computes
+ * it, nothing for a division by zero, which has to fail at run time */
+static std::optional<Operand> fold(opcode op, const Operand& a, const Operand& b)
+{
+    /* Unsigned, so overflow wraps around instead of being undefined */
+    uint64_t x = a.int_value(), y = b.int_value();
+
+    switch (op) {
+    case OP_ADD:
+        return Operand::of_int(x + y);
+    case OP_SUB:
+        return Operand::of_int(x - y);
+    case OP_MUL:
+        return Operand::of_int(x * y);
+    case OP_DIV:
+        return y == 0 ? std::nullopt : std::optional(Operand::of_int(x / y));
+    case OP_MOD:
+        return y == 0 ? std::nullopt : std::optional(Operand::of_int(x % y));
+    case OP_FADD:
+        return Operand::of_double(a.double_value() + b.double_value());
+    case OP_FSUB:
+        return Operand::of_double(a.double_value() - b.double_value());
+    case OP_FMUL:
+        return Operand::of_double(a.double_value() * b.double_value());
+    case OP_FDIV:
+        return Operand::of_double(a.double_value() / b.double_value());
+    default:
+        UNREACHABLE();
+        return std::nullopt;
+    }
+}
+
+/* Whether removing the instruction would change what the program does if
+ * its result is not used */
+static bool has_effect(const Insn& insn)
+{
+    if (!has_dst(insn.op))
+        return true;
+
+    /* Dividing by zero stops the program */
+    if (insn.op == OP_DIV || insn.op == OP_MOD)
+        return insn.b.kind != Operand::Int || insn.b.int_value() == 0;
+
+    return false;
+}
+
+template<typename F>
+static void for_each_operand(Insn& insn, F f)
+{
+    f(insn.a);
+    f(insn.b);
+    for (auto& arg : insn.args)
+        f(arg);
+}
+
+/* "Constant Propagation with Conditional Branches" by Wegman and Zadeck */
+class Propagation {
+public:
+    Propagation(Function& fn)
+        : m_fn(fn)
+    {
+    }
+
+    void run();
+
+private:
+    void solve();
+    void visit(BlockId b, size_t index);
+    void visit_phi(BlockId b, size_t index, size_t pred);
+    void set(Reg r, Lattice value);
+    Lattice get(const Operand& op) const;
+    /* The edge to the successor of from with index succ becomes executable */
+    void add_edge(BlockId from, size_t succ) { m_edge_work.push_back({ from, succ }); }
+
+    void apply();
+    void propagate_copies();
+    void remove_dead_code();
+    void merge_blocks();
+
+    Function& m_fn;
+
+    std::vector<Lattice> m_values;
+    std::vector<bool> m_block_executable;
+    /* Of every edge into a block, in the order of its predecessors */
+    std::vector<std::vector<bool>> m_edge_executable;
+    /* Which predecessor of each successor of a block the block is */
+    std::vector<std::vector<size_t>> m_pred_index;
+    /* Where every register is used, as the block, the instruction and for
+     * phis which predecessor it comes from */
+    struct Use {
+        BlockId block;
+        uint32_t index;
+        uint32_t pred;
+    };
+    std::vector<std::vector<Use>> m_uses;
+
+    std::vector<std::pair<BlockId, size_t>> m_edge_work;
+    std::vector<Reg> m_reg_work;
+};
+
+void propagate_constants(Function& fn)
+{
+    Propagation(fn).run();
+}
+
+void Propagation::run()
+{
+    solve();
+    apply();
+    propagate_copies();
+    remove_dead_code();
+    merge_blocks();
+}
+
+Lattice Propagation::get(const Operand& op) const
+{
+    if (op.is_reg())
+        return m_values[op.reg()];
+    return { Lattice::Constant, op };
+}
+
+void Propagation::set(Reg r, Lattice value)
+{
+    Lattice lowered = meet(m_values[r], value);
+    if (lowered == m_values[r])
+        return;
+
+    m_values[r] = lowered;
+    m_reg_work.push_back(r);
+}
+
+void Propagation::solve()
+{
+    size_t blocks = m_fn.blocks.size();
+
+    m_values.assign(m_fn.regs.size(), {});
+    m_block_executable.assign(blocks, false);
+    m_edge_executable.resize(blocks);
+    m_pred_index.resize(blocks);
+    m_uses.assign(m_fn.regs.size(), {});
+
+    for (BlockId b = 0; b < blocks; b++)
+        m_pred_index[b].assign(m_fn.blocks[b].succs.size(), SIZE_MAX);
+
+    for (BlockId b = 0; b < blocks; b++) {
+        Block& block = m_fn.blocks[b];
+        m_edge_executable[b].assign(block.preds.size(), false);
+
+        /* A branch with both ways going to b has two predecessors b */
+        for (size_t p = 0; p < block.preds.size(); p++) {
+            const auto& succs = m_fn.blocks[block.preds[p]].succs;
+            auto& index = m_pred_index[block.preds[p]];
+
+            size_t k = 0;
+            while (succs[k] != b || index[k] != SIZE_MAX)
+                k++;
+            index[k] = p;
+        }
+
+        for (uint32_t i = 0; i < block.insns.size(); i++) {
+            const Insn& insn = block.insns[i];
+
+            if (insn.op == OP_PHI) {
+                for (uint32_t p = 0; p < insn.args.size(); p++) {
+                    if (insn.args[p].is_reg())
+                        m_uses[insn.args[p].reg()].push_back({ b, i, p });
+                }
+                continue;
+            }
+
+            for_each_operand(block.insns[i], [&](const Operand& op) {
+                if (op.is_reg())
+                    m_uses[op.reg()].push_back({ b, i, UINT32_MAX });
+            });
+        }
+    }
+
+    m_block_executable[0] = true;
+    for (size_t i = 0; i < m_fn.blocks[0].insns.size(); i++)
+        visit(0, i);
+
+    while (!m_edge_work.empty() || !m_reg_work.empty()) {
+        if (!m_edge_work.empty()) {
+            auto [from, succ] = m_edge_work.back();
+            m_edge_work.pop_back();
+
+            BlockId to = m_fn.blocks[from].succs[succ];
+            const Block& block = m_fn.blocks[to];
+
+            size_t pred = m_pred_index[from][succ];
+            if (m_edge_executable[to][pred])
+                continue;
+            m_edge_executable[to][pred] = true;
+
+            /* The phis see another operand, everything else only has to
+             * be looked at the first time the block is reached */
+            size_t phis = block.phi_count();
+            for (size_t i = 0; i < phis; i++)
+                visit_phi(to, i, pred);
+
+            if (!m_block_executable[to]) {
+                m_block_executable[to] = true;
+                for (size_t i = phis; i < block.insns.size(); i++)
+                    visit(to, i);
+            }
+            continue;
+        }
+
+        Reg r = m_reg_work.back();
+        m_reg_work.pop_back();
+
+        for (auto [b, i, pred] : m_uses[r]) {
+            if (pred != UINT32_MAX)
+                visit_phi(b, i, pred);
+            else if (m_block_executable[b])
+                visit(b, i);
+        }
+    }
+}
+
+void Propagation::visit(BlockId b, size_t index)
+{
+    const Block& block = m_fn.blocks[b];
+    const Insn& insn = block.insns[index];
+
+    switch (insn.op) {
+    case OP_MOV:
+        set(insn.dst, get(insn.a));
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV: {
+        Lattice left = get(insn.a), right = get(insn.b);
+
+        if (left.state == Lattice::Varying || right.state == Lattice::Varying) {
+            set(insn.dst, { Lattice::Varying });
+        } else if (left.state == Lattice::Constant && right.state == Lattice::Constant) {
+            auto result = fold(insn.op, left.value, right.value);
+            set(insn.dst, result ? Lattice { Lattice::Constant, *result } : Lattice { Lattice::Varying });
+        }
+        break;
+    }
+    case OP_JMP:
+        add_edge(b, 0);
+        break;
+    case OP_BR: {
+        Lattice left = get(insn.a), right = get(insn.b);
+
+        if (left.state == Lattice::Constant && right.state == Lattice::Constant) {
+            add_edge(b, evaluate(insn.cmp, left.value, right.value) ? 0 : 1);
+        } else if (left.state == Lattice::Varying || right.state == Lattice::Varying) {
+            add_edge(b, 0);
+            add_edge(b, 1);
+        }
+        break;
+    }
+    default:
+        /* Loads, time and the like */
+        if (insn.dst != NO_REG)
+            set(insn.dst, { Lattice::Varying });
+        break;
+    }
+}
+
+/* A phi is the meet of its operands from the edges taken so far, and the
+ * values only ever go down, so a new or lower operand is met with the
+ * value of the phi instead of all operands again */
+void Propagation::visit_phi(BlockId b, size_t index, size_t pred)
+{
+    const Insn& phi = m_fn.blocks[b].insns[index];
+
+    if (m_edge_executable[b][pred])
+        set(phi.dst, get(phi.args[pred]));
+}
+
+/* Replace constant registers by their value, turn branches with a single
+ * way out into jumps and drop the edges never taken and the blocks never
+ * reached */
+void Propagation::apply()
+{
+    std::vector<BlockId> order;
+
+    for (BlockId b = 0; b < m_fn.blocks.size(); b++) {
+        if (!m_block_executable[b])
+            continue;
+        order.push_back(b);
+
+        Block& block = m_fn.blocks[b];
+        std::erase_if(block.insns, [this](const Insn& insn) {
+            return insn.dst != NO_REG && m_values[insn.dst].state == Lattice::Constant;
+        });
+
+        for (Insn& insn : block.insns) {
+            for_each_operand(insn, [this](Operand& op) {
+                if (op.is_reg() && m_values[op.reg()].state == Lattice::Constant)
+                    op = m_values[op.reg()].value;
+            });
+        }
+
+        Insn& terminator = block.insns.back();
+        if (terminator.op != OP_BR)
+            continue;
+
+        auto taken = [this, &block, b](size_t succ) {
+            return m_edge_executable[block.succs[succ]][m_pred_index[b][succ]];
+        };
+
+        bool true_taken = taken(0), false_taken = taken(1);
+        assert(true_taken || false_taken);
+
+        if (!true_taken || !false_taken) {
+            terminator = { .op = OP_JMP, .line = terminator.line };
+            block.succs = { block.succs[true_taken ? 0 : 1] };
+        }
+    }
+
+    /* Only now, the indices of the edges are needed up to here */
+    for (BlockId b : order) {
+        Block& block = m_fn.blocks[b];
+        const auto& executable = m_edge_executable[b];
+        size_t phis = block.phi_count();
+
+        size_t kept = 0;
+        for (size_t p = 0; p < block.preds.size(); p++) {
+            if (!executable[p])
+                continue;
+
+            block.preds[kept] = block.preds[p];
+            for (size_t i = 0; i < phis; i++)
+                block.insns[i].args[kept] = block.insns[i].args[p];
+            kept++;
+        }
+
+        block.preds.resize(kept);
+        for (size_t i = 0; i < phis; i++)
+            block.insns[i].args.resize(kept);
+    }
+
+    m_fn.renumber(order);
+}
+
+/* Registers that are copies of others, through a mov or a phi whose
+ * operands are all the same, are replaced by what they copy */
+void Propagation::propagate_copies()
+{
+    std::vector<Operand> replacement(m_fn.regs.size());
+
+    auto resolve = [&replacement](Operand op) {
+        while (op.is_reg() && replacement[op.reg()].kind != Operand::None)
+            op = replacement[op.reg()];
+        return op;
+    };
+
+    /* The phis using every register, looked at again when it is replaced */
+    std::vector<std::vector<std::pair<BlockId, uint32_t>>> phi_users(m_fn.regs.size());
+    std::vector<std::pair<BlockId, uint32_t>> work;
+
+    for (BlockId b = 0; b < m_fn.blocks.size(); b++) {
+        Block& block = m_fn.blocks[b];
+
+        for (uint32_t i = 0; i < block.insns.size(); i++) {
+            Insn& insn = block.insns[i];
+
+            if (insn.op == OP_MOV) {
+                replacement[insn.dst] = insn.a;
+            } else if (insn.op == OP_PHI) {
+                work.push_back({ b, i });
+                for (const auto& arg : insn.args) {
+                    if (arg.is_reg())
+                        phi_users[arg.reg()].push_back({ b, i });
+                }
+            }
+        }
+    }
+
+    while (!work.empty()) {
+        auto [b, i] = work.back();
+        work.pop_back();
+
+        const Insn& phi = m_fn.blocks[b].insns[i];
+        if (replacement[phi.dst].kind != Operand::None)
+            continue;
+
+        /* A phi merging one value with itself is a copy of that value */
+        Operand value = {};
+        bool copy = true;
+        for (const auto& arg : phi.args) {
+            Operand resolved = resolve(arg);
+            if (resolved == Operand::of_reg(phi.dst) || resolved == value)
+                continue;
+
+            if (value.kind != Operand::None) {
+                copy = false;
+                break;
+            }
+            value = resolved;
+        }
+
+        if (!copy || value.kind == Operand::None)
+            continue;
+
+        replacement[phi.dst] = value;
+        work.insert(work.end(), phi_users[phi.dst].begin(), phi_users[phi.dst].end());
+    }
+
+    for (auto& block : m_fn.blocks) {
+        std::erase_if(block.insns, [&replacement](const Insn& insn) {
+            return insn.dst != NO_REG && replacement[insn.dst].kind != Operand::None;
+        });
+
+        for (Insn& insn : block.insns)
+            for_each_operand(insn, [&resolve](Operand& op) { op = resolve(op); });
+    }
+}
+
+/* Remove the instructions computing values nothing with an effect needs */
+void Propagation::remove_dead_code()
+{
+    std::vector<bool> live(m_fn.regs.size(), false);
+    std::vector<Insn*> definition(m_fn.regs.size(), nullptr);
+    std::vector<Reg> work;
+
+    auto use = [&](const Operand& op) {
+        if (op.is_reg() && !live[op.reg()]) {
+            live[op.reg()] = true;
+            work.push_back(op.reg());
+        }
+    };
+
+    for (auto& block : m_fn.blocks) {
+        for (Insn& insn : block.insns) {
+            if (insn.dst != NO_REG)
+                definition[insn.dst] = &insn;
+            if (has_effect(insn))
+                for_each_operand(insn, use);
+        }
+    }
+
+    while (!work.empty()) {
+        Reg r = work.back();
+        work.pop_back();
+
+        for_each_operand(*definition[r], use);
+    }
+
+    for (auto& block : m_fn.blocks) {
+        std::erase_if(block.insns, [&live](const Insn& insn) {
+            return insn.dst != NO_REG && !live[insn.dst] && !has_effect(insn);
+        });
+    }
+}
+
+/* Append a block to its only predecessor if it is that block's only
+ * successor, which is what is left of an if decided at compile time */
+void Propagation::merge_blocks()
+{
+    std::vector<bool> merged(m_fn.blocks.size(), false);
+
+    for (BlockId b = 0; b < m_fn.blocks.size(); b++) {
+        if (merged[b])
+            continue;
+
+        for (;;) {
+            Block& block = m_fn.blocks[b];
+            if (block.terminator().op != OP_JMP)
+                break;
+
+            BlockId succ = block.succs[0];
+            Block& next = m_fn.blocks[succ];
+            if (succ == b || succ == 0 || next.preds.size() != 1)
+                break;
+
+            /* A phi with one operand was a copy */
+            assert(next.phi_count() == 0);
+
+            block.insns.pop_back();
+            std::move(next.insns.begin(), next.insns.end(), std::back_inserter(block.insns));
+            block.succs = std::move(next.succs);
+
+            for (BlockId after : block.succs)
+                std::replace(m_fn.blocks[after].preds.begin(), m_fn.blocks[after].preds.end(), succ, b);
+
+            next.insns.clear();
+            next.succs.clear();
+            merged[succ] = true;
+        }
+    }
+
+    std::vector<BlockId> order;
+    for (BlockId b = 0; b < m_fn.blocks.size(); b++) {
+        if (!merged[b])
+            order.push_back(b);
+    }
+
+    if (order.size() < m_fn.blocks.size())
+        m_fn.renumber(order);
+}
+
+void split_critical_edges(Function& fn)
+{
+    std::vector<BlockId> order;
+    size_t blocks = fn.blocks.size();
+
+    for (BlockId b = 0; b < blocks; b++) {
+        order.push_back(b);
+        if (fn.blocks[b].succs.size() < 2)
+            continue;
+
+        for (size_t i = 0; i < fn.blocks[b].succs.size(); i++) {
+            BlockId succ = fn.blocks[b].succs[i];
+            if (fn.blocks[succ].phi_count() == 0)
+                continue;
+
+            BlockId edge = fn.new_block();
+            fn.blocks[edge].insns = { { .op = OP_JMP, .line = fn.blocks[b].terminator().line } };
+            fn.blocks[edge].succs = { succ };
+            fn.blocks[edge].preds = { b };
+
+            fn.blocks[b].succs[i] = edge;
+            auto& preds = fn.blocks[succ].preds;
+            *std::find(preds.begin(), preds.end(), b) = edge;
+
+            /* Right after the branch, which can fall through into it */
+            order.push_back(edge);
+        }
+    }
+
+    if (order.size() > blocks)
+        fn.renumber(order);
+}
+
+} // namespace ir
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <sys/resource.h>
+#include <vector>
+
+#include <fmt/ostream.h>
+
+#include "timing.hpp"
+
+/* The heap as seen through operator new, kept up to date all the time so
+ * the numbers are right whenever measuring starts */
+static size_t heap_live;
+static size_t heap_peak;
+static size_t heap_allocations;
+static size_t heap_allocated;
+
+void* operator new(size_t size)
+{
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+
+    size_t usable = malloc_usable_size(p);
+    heap_live += usable;
+    heap_peak = std::max(heap_peak, heap_live);
+    heap_allocations++;
+    heap_allocated += usable;
+
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (!p)
+        return;
+
+    heap_live -= malloc_usable_size(p);
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+namespace timing {
+
+struct PhaseStats {
+    size_t entered;
+    double wall; /* Milliseconds */
+    double cpu;
+    size_t allocations;
+    size_t allocated; /* Bytes */
+    size_t peak;      /* Most bytes in use at once */
+};
+
+/* One time a phase was entered, for Format::Trace */
+struct Span {
+    phase p;
+    double start; /* Milliseconds since enable() */
+    double duration;
+    size_t allocations;
+};
+
+static bool is_enabled = false;
+static Format report_format;
+
+static std::chrono::steady_clock::time_point start_time;
+static double start_cpu;
+static size_t start_allocations;
+static size_t start_allocated;
+
+static std::array<PhaseStats, PHASE_ENUM_END> stats;
+static std::array<size_t, COUNTER_ENUM_END> counters;
+static std::vector<Span> spans;
+
+static double wall_ms()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+/* User and system time of lcc and of the programs it waited for, like nasm */
+static double cpu_ms()
+{
+    double ms = 0;
+    for (int who : { RUSAGE_SELF, RUSAGE_CHILDREN }) {
+        rusage usage;
+        getrusage(who, &usage);
+        ms += (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+    }
+
+    return ms;
+}
+
+void enable(Format format)
+{
+    is_enabled = true;
+    report_format = format;
+
+    start_time = std::chrono::steady_clock::now();
+    start_cpu = cpu_ms();
+    start_allocations = heap_allocations;
+    start_allocated = heap_allocated;
+    heap_peak = heap_live;
+}
+
+bool enabled()
+{
+    return is_enabled;
+}
+
+Scope::Scope(phase p)
+    : m_phase(p)
+    , m_active(is_enabled)
+{
+    if (!m_active)
+        return;
+
+    m_wall = wall_ms();
+    m_cpu = cpu_ms();
+    m_allocations = heap_allocations;
+    m_allocated = heap_allocated;
+
+    m_outer_peak = heap_peak;
+    heap_peak = heap_live;
+}
+
+Scope::~Scope()
+{
+    if (!m_active)
+        return;
+
+    double wall = wall_ms() - m_wall;
+    PhaseStats& s = stats[m_phase];
+
+    s.entered++;
+    s.wall += wall;
+    s.cpu += cpu_ms() - m_cpu;
+    s.allocations += heap_allocations - m_allocations;
+    s.allocated += heap_allocated - m_allocated;
+    s.peak = std::max(s.peak, heap_peak);
+
+    heap_peak = std::max(m_outer_peak, heap_peak);
+
+    if (report_format == Format::Trace)
+        spans.push_back({ m_phase, m_wall, wall, heap_allocations - m_allocations });
+}
+
+void count(counter c, size_t n)
+{
+    counters[c] += n;
+}
+
+/* The whole run up to now, as if it was one phase */
+static PhaseStats total()
+{
+    return { 1, wall_ms(), cpu_ms() - start_cpu, heap_allocations - start_allocations,
+        heap_allocated - start_allocated, heap_peak };
+}
+
+static void report_text(std::ostream& out)
+{
+    auto row = [&out](std::string_view name, const PhaseStats& s) {
+        fmt::print(out, "{:<12}{:>10.2f}{:>10.2f}{:>12}{:>12}{:>12}\n", name, s.wall, s.cpu,
+            s.allocations, s.allocated / 1024, s.peak / 1024);
+    };
+
+    fmt::print(out, "{:<12}{:>10}{:>10}{:>12}{:>12}{:>12}\n", "phase", "wall ms", "cpu ms",
+        "allocs", "alloc KiB", "peak KiB");
+
+    for (int p = 0; p < PHASE_ENUM_END; p++) {
+        if (stats[p].entered)
+            row(phase_str_map[p], stats[p]);
+    }
+    row("total", total());
+
+    for (int c = 0; c < COUNTER_ENUM_END; c++)
+        fmt::print(out, "{}{}: {}", c ? ", " : "", counter_str_map[c], counters[c]);
+    fmt::print(out, "\n");
+}
+
+static void report_json(std::ostream& out)
+{
+    auto object = [&out](const PhaseStats& s) {
+        fmt::print(out, "{{ \"entered\": {}, \"wall_ms\": {:.3f}, \"cpu_ms\": {:.3f}, \"allocations\": {}, "
+                        "\"allocated_bytes\": {}, \"peak_bytes\": {} }}",
+            s.entered, s.wall, s.cpu, s.allocations, s.allocated, s.peak);
+    };
+
+    fmt::print(out, "{{\n  \"phases\": {{");
+
+    bool first = true;
+    for (int p = 0; p < PHASE_ENUM_END; p++) {
+        if (!stats[p].entered)
+            continue;
+
+        fmt::print(out, "{}\n    \"{}\": ", first ? "" : ",", phase_str_map[p]);
+        object(stats[p]);
+        first = false;
+    }
+
+    fmt::print(out, "\n  }},\n  \"total\": ");
+    object(total());
+
+    fmt::print(out, ",\n  \"counts\": {{ ");
+    for (int c = 0; c < COUNTER_ENUM_END; c++)
+        fmt::print(out, "{}\"{}\": {}", c ? ", " : "", counter_str_map[c], counters[c]);
+    fmt::print(out, " }}\n}}\n");
+}
+
+/* The format read by chrome://tracing and Perfetto; times are in microseconds */
+static void report_trace(std::ostream& out)
+{
+    fmt::print(out, "{{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    for (const auto& span : spans) {
+        fmt::print(out, "{{\"name\": \"{}\", \"cat\": \"lcc\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                        "\"ts\": {:.3f}, \"dur\": {:.3f}, \"args\": {{\"allocations\": {}}}}},\n",
+            phase_str_map[span.p], span.start * 1000, span.duration * 1000, span.allocations);
+    }
+
+    double end = wall_ms() * 1000;
+    for (int c = 0; c < COUNTER_ENUM_END; c++) {
+        fmt::print(out, "{{\"name\": \"{}\", \"ph\": \"C\", \"pid\": 1, \"tid\": 1, \"ts\": {:.3f}, "
+                        "\"args\": {{\"count\": {}}}}}{}\n",
+            counter_str_map[c], end, counters[c], c + 1 < COUNTER_ENUM_END ? "," : "");
+    }
+
+    fmt::print(out, "]}}\n");
+}
+
+void report(std::ostream& out)
+{
+    switch (report_format) {
+    case Format::Text:
+        report_text(out);
+        break;
+    case Format::Json:
+        report_json(out);
+        break;
+    case Format::Trace:
+        report_trace(out);
+        break;
+    }
+}
+
+} // namespace timing
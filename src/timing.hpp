@@ -0,0 +1,96 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+
+#include "maps.hpp"
+
+/*
+ * Time and memory spent in each phase of the compiler, reported with -t.
+ * Allocations are counted by replacing the global operator new.
+ */
+namespace timing {
+
+enum phase : int {
+    PH_LEX,
+    PH_AST,
+    PH_SEMANTICS,
+    PH_FOLD,
+    PH_LOWER,
+    PH_OPTIMIZE,
+    PH_CODEGEN,
+    PH_ASSEMBLY,
+    PH_LINK,
+    PH_RUN,
+    PHASE_ENUM_END,
+};
+
+inline constexpr auto phase_str_map = make_table<phase, std::string_view, PHASE_ENUM_END>({
+    { PH_LEX, "lexing" },
+    { PH_AST, "parsing" },
+    { PH_SEMANTICS, "semantics" },
+    { PH_FOLD, "folding" },
+    { PH_LOWER, "lowering" },
+    { PH_OPTIMIZE, "optimizing" },
+    { PH_CODEGEN, "codegen" },
+    { PH_ASSEMBLY, "assembly" },
+    { PH_LINK, "linking" },
+    { PH_RUN, "running" },
+});
+
+enum counter : int {
+    C_TOKENS,
+    C_NODES,
+    C_SPILLS,     /* Registers of the code kept in stack slots */
+    C_CALL_SAVES, /* Machine registers saved around a call and restored after it */
+    COUNTER_ENUM_END,
+};
+
+inline constexpr auto counter_str_map = make_table<counter, std::string_view, COUNTER_ENUM_END>({
+    { C_TOKENS, "tokens" },
+    { C_NODES, "nodes" },
+    { C_SPILLS, "spills" },
+    { C_CALL_SAVES, "call saves" },
+});
+
+enum class Format {
+    Text,  /* A table */
+    Json,  /* The numbers of the table */
+    Trace, /* Chrome trace events, one for every time a phase was entered */
+};
+
+/* Start measuring; nothing is recorded before */
+void enable(Format format);
+bool enabled();
+
+/* Adds the time and memory from its construction to its destruction to a
+ * phase. A phase can be entered many times, e.g. once per statement with -s. */
+class Scope {
+public:
+    Scope(phase p);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    phase m_phase;
+    bool m_active;
+    double m_wall;
+    double m_cpu;
+    size_t m_allocations;
+    size_t m_allocated;
+    size_t m_outer_peak; /* Peak of the heap before we reset it for our phase */
+};
+
+/* Add n to a counter, e.g. the tokens of a statement */
+void count(counter c, size_t n);
+
+/* Write everything recorded since enable() */
+void report(std::ostream& out);
+
+} // namespace timing
+
+#endif // TIMING_H_
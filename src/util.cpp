@@ -1,7 +1,10 @@
-#include <fstream>
-#include <iostream>
-#include <sstream>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>
 #include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ast.hpp"
 #include "error.hpp"
@@ -9,52 +12,47 @@
 #include "maps.hpp"
 #include "util.hpp"
 
-std::vector<std::string_view> split(std::string_view str, char delim)
+MappedFile::MappedFile(std::string_view filename, CompileInfo& c_info)
 {
-    std::vector<std::string_view> res;
-    size_t delim_idx, saved, length;
-    bool looping = true;
+    int fd = open(std::string(filename).c_str(), O_RDONLY);
+    c_info.err.on_true(fd == -1, "{}: {}", filename, std::strerror(errno));
 
-    saved = 0;
-    while (looping) {
-        looping = (delim_idx = str.find(delim, saved)) != std::string_view::npos;
+    /* The mapping keeps the file alive on its own */
+    auto close_fd = ScopeGuard([fd]() { close(fd); });
 
-        length = delim_idx - saved;
+    struct stat st;
+    c_info.err.on_true(fstat(fd, &st) == -1, "{}: {}", filename, std::strerror(errno));
 
-        res.push_back(str.substr(saved, length));
-        saved = delim_idx + 1;
-    }
-
-    return res;
-}
-
-/* Read a file and return the contents */
-std::string read_source_code(std::string_view filename, CompileInfo& c_info)
-{
-    std::ifstream fs(filename.data());
-    c_info.err.on_false(fs.is_open(), "{}: {}", filename, std::strerror(errno));
+    /* Mapping zero bytes fails, an empty file is just an empty view */
+    m_size = st.st_size;
+    if (m_size == 0)
+        return;
 
-    std::string res;
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    c_info.err.on_true(data == MAP_FAILED, "{}: mmap: {}", filename, std::strerror(errno));
 
-    std::ostringstream ss;
-    ss << fs.rdbuf();
-    res = ss.str();
+    /* Everything is read once from start to end */
+    madvise(data, m_size, MADV_SEQUENTIAL);
 
-    fs.close();
+    m_data = static_cast<const char*>(data);
+}
 
-    return res;
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<char*>(m_data), m_size);
 }
 
 /* Get the index of the next token of type 'ty' on line starting from start.
  * Return ts.size() on failure. */
-size_t next_of_type_on_line(const std::vector<std::shared_ptr<lexer::Token>>& ts,
+size_t next_of_type_on_line(const std::vector<lexer::Token>& ts,
     size_t start,
     lexer::token_type ty)
 {
     for (size_t i = start; i < ts.size(); i++) {
-        if (ts[i]->get_type() == lexer::TK_EOL && ty != lexer::TK_EOL) {
+        if (ts[i].type == lexer::TK_EOL && ty != lexer::TK_EOL) {
             return ts.size();
-        } else if (ts[i]->get_type() == ty) {
+        } else if (ts[i].type == ty) {
             return i;
         }
     }
@@ -66,24 +64,24 @@ size_t next_of_type_on_line(const std::vector<std::shared_ptr<lexer::Token>>& ts
  * else:                add a new variable to c_info's known_vars */
 int CompileInfo::check_var(std::string_view var)
 {
-    for (size_t i = 0; i < known_vars.size(); i++) {
-        if (var == known_vars[i].name)
-            return i;
-    }
-
-    known_vars.push_back({ var, V_UNSURE, false });
+    if (auto id = m_var_ids.find(var); id != m_var_ids.end())
+        return id->second;
 
-    return known_vars.size() - 1;
+    return add_var({ var, V_UNSURE, false });
 }
 
 int CompileInfo::check_array(std::string_view array)
 {
-    for (size_t i = 0; i < known_vars.size(); i++) {
-        if (array == known_vars[i].name)
-            return i;
-    }
+    if (auto id = m_var_ids.find(array); id != m_var_ids.end())
+        return id->second;
+
+    return add_var({ array, V_UNSURE, false, VarInfo::Arrayness::Yes, 0 });
+}
 
-    known_vars.push_back({ array, V_UNSURE, false, VarInfo::Arrayness::Yes, 0 });
+int CompileInfo::add_var(const VarInfo& v_info)
+{
+    known_vars.push_back(v_info);
+    m_var_ids.emplace(v_info.name, known_vars.size() - 1);
 
     return known_vars.size() - 1;
 }
@@ -91,24 +89,24 @@ int CompileInfo::check_array(std::string_view array)
 /* Same as check_var but with string */
 int CompileInfo::check_str(std::string_view str)
 {
-    for (size_t i = 0; i < known_strings.size(); i++) {
-        if (str == known_strings[i])
-            return i;
-    }
+    if (auto id = m_string_ids.find(str); id != m_string_ids.end())
+        return id->second;
 
-    known_strings.push_back(str);
+    /* The key has to view the copy, str may be temporary */
+    const std::string& copy = known_strings.emplace_back(str);
+    m_string_ids.emplace(copy, known_strings.size() - 1);
 
     return known_strings.size() - 1;
 }
 
 int CompileInfo::check_double_const(double d)
 {
-    for (size_t i = 0; i < known_double_consts.size(); i++) {
-        if (d == known_double_consts[i])
-            return i;
-    }
+    uint64_t bits = std::bit_cast<uint64_t>(d);
+    if (auto id = m_double_ids.find(bits); id != m_double_ids.end())
+        return id->second;
 
     known_double_consts.push_back(d);
+    m_double_ids.emplace(bits, known_double_consts.size() - 1);
 
     return known_double_consts.size() - 1;
 }
@@ -119,16 +117,16 @@ size_t CompileInfo::get_stack_size_and_append(size_t new_offset)
     return stack_size;
 }
 
-void CompileInfo::error_on_undefined(std::shared_ptr<ast::Var> var_id)
+void CompileInfo::error_on_undefined(int var_id)
 {
-    err.on_false(known_vars[var_id->get_var_id()].defined,
-        "Variable '{}' is undefined at this time", known_vars[var_id->get_var_id()].name);
+    err.on_false(known_vars[var_id].defined,
+        "Variable '{}' is undefined at this time", known_vars[var_id].name);
 }
 
-void CompileInfo::error_on_wrong_type(std::shared_ptr<ast::Var> var_id, var_type tp)
+void CompileInfo::error_on_wrong_type(int var_id, var_type tp)
 {
-    err.on_false(known_vars[var_id->get_var_id()].type == tp, "Expected '{}' to be type '{}'",
-        known_vars[var_id->get_var_id()].name, var_type_str_map.at(tp));
+    err.on_false(known_vars[var_id].type == tp, "Expected '{}' to be type '{}'",
+        known_vars[var_id].name, var_type_str_map.at(tp));
 }
 
 Filename::Filename(std::string_view fn)
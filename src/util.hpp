@@ -3,21 +3,20 @@
 
 #include <array>
 #include <cassert>
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "dictionary.hpp"
 #include "error.hpp"
 
-namespace ast {
-class Var;
-}
-
 namespace lexer {
-class Token;
+struct Token;
 enum token_type : int;
 }
 
@@ -59,7 +58,7 @@ struct VarInfo {
 class CompileInfo {
 public:
     std::vector<VarInfo> known_vars;
-    std::vector<std::string_view> known_strings;
+    std::deque<std::string> known_strings; /* A deque so m_string_ids can view into it */
     std::vector<double> known_double_consts;
 
     ErrorHandler err;
@@ -72,6 +71,8 @@ public:
     {
     }
 
+    /* Return the id of a name, string or constant, adding it if it is new.
+     * Ids are handed out in order of appearance. */
     int check_var(std::string_view var);
     int check_array(std::string_view array);
     int check_str(std::string_view str);
@@ -80,12 +81,20 @@ public:
     size_t get_stack_size() const { return stack_size; }
     size_t get_stack_size_and_append(size_t length_to_append);
 
-    void error_on_undefined(std::shared_ptr<ast::Var> var_id);
-    void error_on_wrong_type(std::shared_ptr<ast::Var> var_id, var_type tp);
+    void error_on_undefined(int var_id);
+    void error_on_wrong_type(int var_id, var_type tp);
 
 private:
+    int add_var(const VarInfo& v_info);
+
     std::string_view m_filename;
     int body_id = BODY_ID_START;
+
+    /* Indexes of the known_ vectors. Names view into the source code,
+     * doubles are identified by their bits. */
+    std::unordered_map<std::string_view, int> m_var_ids;
+    std::unordered_map<std::string_view, int> m_string_ids;
+    std::unordered_map<uint64_t, int> m_double_ids;
     size_t stack_size = 0;
 };
 
@@ -119,32 +128,25 @@ private:
     bool m_call = true;
 };
 
-std::vector<std::string_view> split(std::string_view str, char delim);
-std::string read_source_code(std::string_view filename, CompileInfo& c_info);
-size_t next_of_type_on_line(const std::vector<std::shared_ptr<lexer::Token>>& ts,
-    size_t start,
-    lexer::token_type ty);
-
-/* Template functions need to be implemented in header files */
-template<typename T>
-std::vector<T> slice(const std::vector<T>& v, int start = 0, int end = -1)
-{
-    int v_len = v.size();
-    int newlen;
-
-    assert(start < end);
+/* A file mapped read-only into memory. Views into contents() stay valid
+ * for as long as the object lives. */
+class MappedFile {
+public:
+    std::string_view contents() const { return { m_data, m_size }; }
 
-    if (end == -1 || end >= v_len)
-        newlen = v_len - start;
-    else
-        newlen = end - start;
+    MappedFile(std::string_view filename, CompileInfo& c_info);
+    ~MappedFile();
 
-    std::vector<T> res(newlen);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 
-    for (int i = 0; i < newlen; i++)
-        res[i] = v[start + i];
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
 
-    return res;
-}
+size_t next_of_type_on_line(const std::vector<lexer::Token>& ts,
+    size_t start,
+    lexer::token_type ty);
 
 #endif // UTIL_H_
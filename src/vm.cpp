@@ -0,0 +1,310 @@
+#include <bit>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <unistd.h>
+
+#include <fmt/color.h>
+#include <fmt/ostream.h>
+
+#include "bytecode.hpp"
+#include "macros.hpp"
+#include "runtime.hpp"
+#include "vm.hpp"
+
+/* Same size as the buffers of string variables in the native code */
+static const size_t STR_VAR_SIZE = 128;
+
+struct StrVar {
+    char buffer[STR_VAR_SIZE];
+    long len;
+};
+
+static inline double as_double(int64_t bits)
+{
+    return std::bit_cast<double>(bits);
+}
+
+static inline int64_t as_bits(double d)
+{
+    return std::bit_cast<int64_t>(d);
+}
+
+/* The flags comisd sets: unordered operands are both less and equal */
+static inline bool comisd_less(double a, double b)
+{
+    return a < b || std::isunordered(a, b);
+}
+
+static inline bool comisd_equal(double a, double b)
+{
+    return a == b || std::isunordered(a, b);
+}
+
+static void print(const bytecode::Program& program, const std::vector<bytecode::PrintPiece>& pieces,
+    const int64_t* r, const std::vector<StrVar>& str_vars)
+{
+    for (const auto& piece : pieces) {
+        switch (piece.kind) {
+        case TemplatePiece::Literal: {
+            const std::string& str = program.strings[piece.operand];
+            runtime::outbuf_write(str.data(), str.size());
+            break;
+        }
+        case TemplatePiece::Int:
+            runtime::iprintw(r[piece.operand], piece.spec.width, piece.spec.fill);
+            break;
+        case TemplatePiece::Double:
+            runtime::fprintw(as_double(r[piece.operand]),
+                piece.spec.precision == -1 ? FORMAT_DEFAULT_PRECISION : piece.spec.precision,
+                piece.spec.width, piece.spec.fill);
+            break;
+        case TemplatePiece::StrVar:
+            runtime::outbuf_write(str_vars[piece.operand].buffer, str_vars[piece.operand].len);
+            break;
+        }
+    }
+}
+
+/* Every handler ends by jumping straight to the handler of the next
+ * instruction; the address of a label is a GNU extension */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+int vm_run(const bytecode::Program& program, std::string_view name)
+{
+    using namespace bytecode;
+
+    void* handlers[OPCODE_ENUM_END];
+    handlers[OP_MOV] = &&op_mov;
+    handlers[OP_ADD] = &&op_add;
+    handlers[OP_SUB] = &&op_sub;
+    handlers[OP_MUL] = &&op_mul;
+    handlers[OP_DIV] = &&op_div;
+    handlers[OP_MOD] = &&op_mod;
+    handlers[OP_ADDI] = &&op_addi;
+    handlers[OP_SUBI] = &&op_subi;
+    handlers[OP_FADD] = &&op_fadd;
+    handlers[OP_FSUB] = &&op_fsub;
+    handlers[OP_FMUL] = &&op_fmul;
+    handlers[OP_FDIV] = &&op_fdiv;
+    handlers[OP_LOAD] = &&op_load;
+    handlers[OP_STORE] = &&op_store;
+    handlers[OP_JMP] = &&op_jmp;
+    handlers[OP_JEQ] = &&op_jeq;
+    handlers[OP_JNE] = &&op_jne;
+    handlers[OP_JLT] = &&op_jlt;
+    handlers[OP_JLE] = &&op_jle;
+    handlers[OP_JGT] = &&op_jgt;
+    handlers[OP_JGE] = &&op_jge;
+    handlers[OP_JEQI] = &&op_jeqi;
+    handlers[OP_JNEI] = &&op_jnei;
+    handlers[OP_JLTI] = &&op_jlti;
+    handlers[OP_JLEI] = &&op_jlei;
+    handlers[OP_JGTI] = &&op_jgti;
+    handlers[OP_JGEI] = &&op_jgei;
+    handlers[OP_FJEQ] = &&op_fjeq;
+    handlers[OP_FJNE] = &&op_fjne;
+    handlers[OP_FJLT] = &&op_fjlt;
+    handlers[OP_FJLE] = &&op_fjle;
+    handlers[OP_FJGT] = &&op_fjgt;
+    handlers[OP_FJGE] = &&op_fjge;
+    handlers[OP_PRINT] = &&op_print;
+    handlers[OP_WRITE] = &&op_write;
+    handlers[OP_PUTCHAR] = &&op_putchar;
+    handlers[OP_READ] = &&op_read;
+    handlers[OP_TIME] = &&op_time;
+    handlers[OP_GETUID] = &&op_getuid;
+    handlers[OP_EXIT] = &&op_exit;
+    handlers[OP_HALT] = &&op_halt;
+
+    std::vector<int64_t> registers = program.registers;
+    std::vector<StrVar> str_vars(program.str_vars);
+
+    int64_t* r = registers.data();
+    const Insn* code = program.code.data();
+    const Insn* pc = code;
+
+    int64_t status = 0;
+    std::string_view error;
+
+    runtime::reset_output();
+
+#define DISPATCH() goto* handlers[pc->op]
+#define NEXT()  \
+    do {        \
+        pc++;   \
+        DISPATCH(); \
+    } while (0)
+#define JUMP_IF(cond)            \
+    do {                         \
+        if (cond) {              \
+            pc = code + pc->c;   \
+            DISPATCH();          \
+        }                        \
+        NEXT();                  \
+    } while (0)
+
+    /* Unsigned so overflow wraps like in the native code */
+#define INT_OP(operator) r[pc->a] = (uint64_t)r[pc->b] operator(uint64_t) r[pc->c]
+#define DOUBLE_OP(operator) r[pc->a] = as_bits(as_double(r[pc->b]) operator as_double(r[pc->c]))
+
+    DISPATCH();
+
+op_mov:
+    r[pc->a] = r[pc->b];
+    NEXT();
+op_add:
+    INT_OP(+);
+    NEXT();
+op_sub:
+    INT_OP(-);
+    NEXT();
+op_mul:
+    INT_OP(*);
+    NEXT();
+op_div:
+    if (r[pc->c] == 0)
+        goto division_by_zero;
+    INT_OP(/);
+    NEXT();
+op_mod:
+    if (r[pc->c] == 0)
+        goto division_by_zero;
+    INT_OP(%);
+    NEXT();
+op_addi:
+    r[pc->a] = (uint64_t)r[pc->b] + (uint64_t)(int64_t)pc->c;
+    NEXT();
+op_subi:
+    r[pc->a] = (uint64_t)r[pc->b] - (uint64_t)(int64_t)pc->c;
+    NEXT();
+op_fadd:
+    DOUBLE_OP(+);
+    NEXT();
+op_fsub:
+    DOUBLE_OP(-);
+    NEXT();
+op_fmul:
+    DOUBLE_OP(*);
+    NEXT();
+op_fdiv:
+    DOUBLE_OP(/);
+    NEXT();
+op_load: {
+    const Array& arr = program.arrays[pc->b];
+    uint64_t index = r[pc->c];
+    if (index >= (uint64_t)arr.units)
+        goto out_of_bounds;
+    r[pc->a] = r[arr.base - index];
+    NEXT();
+}
+op_store: {
+    const Array& arr = program.arrays[pc->a];
+    uint64_t index = r[pc->b];
+    if (index >= (uint64_t)arr.units)
+        goto out_of_bounds;
+    r[arr.base - index] = r[pc->c];
+    NEXT();
+}
+op_jmp:
+    pc = code + pc->c;
+    DISPATCH();
+op_jeq:
+    JUMP_IF(r[pc->a] == r[pc->b]);
+op_jne:
+    JUMP_IF(r[pc->a] != r[pc->b]);
+op_jlt:
+    JUMP_IF(r[pc->a] < r[pc->b]);
+op_jle:
+    JUMP_IF(r[pc->a] <= r[pc->b]);
+op_jgt:
+    JUMP_IF(r[pc->a] > r[pc->b]);
+op_jge:
+    JUMP_IF(r[pc->a] >= r[pc->b]);
+op_jeqi:
+    JUMP_IF(r[pc->a] == pc->b);
+op_jnei:
+    JUMP_IF(r[pc->a] != pc->b);
+op_jlti:
+    JUMP_IF(r[pc->a] < pc->b);
+op_jlei:
+    JUMP_IF(r[pc->a] <= pc->b);
+op_jgti:
+    JUMP_IF(r[pc->a] > pc->b);
+op_jgei:
+    JUMP_IF(r[pc->a] >= pc->b);
+op_fjeq:
+    JUMP_IF(comisd_equal(as_double(r[pc->a]), as_double(r[pc->b])));
+op_fjne:
+    JUMP_IF(!comisd_equal(as_double(r[pc->a]), as_double(r[pc->b])));
+op_fjlt:
+    JUMP_IF(comisd_less(as_double(r[pc->a]), as_double(r[pc->b])));
+op_fjle:
+    JUMP_IF(comisd_less(as_double(r[pc->a]), as_double(r[pc->b])) || comisd_equal(as_double(r[pc->a]), as_double(r[pc->b])));
+op_fjgt:
+    JUMP_IF(!comisd_less(as_double(r[pc->a]), as_double(r[pc->b])) && !comisd_equal(as_double(r[pc->a]), as_double(r[pc->b])));
+op_fjge:
+    JUMP_IF(!comisd_less(as_double(r[pc->a]), as_double(r[pc->b])));
+op_print:
+    print(program, program.templates[pc->a], r, str_vars);
+    NEXT();
+op_write: {
+    const std::string& str = program.strings[pc->a];
+    runtime::outbuf_write(str.data(), str.size());
+    NEXT();
+}
+op_putchar:
+    runtime::putchar(r[pc->a]);
+    NEXT();
+op_read: {
+    /* Whatever was printed before (e.g. a prompt) has to be visible
+     * before we block on input */
+    runtime::outbuf_flush();
+
+    StrVar& str = str_vars[pc->a];
+    ssize_t n = read(0, str.buffer, STR_VAR_SIZE);
+
+    /* Drop the newline at the end */
+    str.len = n > 0 ? n - 1 : 0;
+    str.buffer[str.len] = '\0';
+    NEXT();
+}
+op_time:
+    r[pc->a] = std::time(nullptr);
+    NEXT();
+op_getuid:
+    r[pc->a] = getuid();
+    NEXT();
+op_exit:
+    status = r[pc->a];
+    goto done;
+op_halt:
+    goto done;
+
+division_by_zero:
+    error = "Division by zero";
+    goto done;
+out_of_bounds:
+    error = "Array index out of bounds";
+    goto done;
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP_IF
+#undef INT_OP
+#undef DOUBLE_OP
+
+done:
+    runtime::outbuf_flush();
+
+    if (!error.empty()) {
+        fmt::print(std::cerr, "{}\n{}:{}: {}\n", RED_ARG("Runtime error!"), name,
+            program.lines[pc - code] + 1, error);
+        return 1;
+    }
+
+    return status & 0xFF;
+}
+
+#pragma GCC diagnostic pop
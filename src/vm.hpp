@@ -0,0 +1,17 @@
+#ifndef VM_H_
+#define VM_H_
+
+#include <string_view>
+
+namespace bytecode {
+struct Program;
+}
+
+/*
+ * Interpret program with a threaded register machine. The output is the same
+ * as that of the native executable. name is only used in runtime errors.
+ * Returns the exit status of the program.
+ */
+int vm_run(const bytecode::Program& program, std::string_view name);
+
+#endif // VM_H_
@@ -1,22 +1,21 @@
 #include <algorithm>
+#include <bit>
 #include <cassert>
-#include <fstream>
 #include <iostream>
-#include <iterator>
-#include <sstream>
-#include <stack>
+#include <map>
+#include <queue>
 #include <string>
 #include <string_view>
 
 #include <fmt/ostream.h>
 
-#include "ast.hpp"
+#include "ir.hpp"
 #include "maps.hpp"
+#include "print_template.hpp"
+#include "timing.hpp"
 #include "util.hpp"
 #include "x86_64.hpp"
-#include "semantics.hpp"
 
-#define MAX_DIGITS 32
 #define STR_RESERVED_SIZE 128
 
 static const size_t WORD_SIZE = 8;
@@ -27,37 +26,39 @@ struct cmp_operation {
     std::string_view opposite_asm_name;
 };
 
-std::string asm_from_int_or_const(std::shared_ptr<ast::Node> node, CompileInfo& c_info);
+/* The code being compiled */
+static const ir::Function* code;
 
-void mov_reg_into_array_access(std::shared_ptr<ast::Access> node, std::string_view reg, std::string_view intermediate, std::ofstream& out, CompileInfo& c_info);
-void array_access_into_register(std::shared_ptr<ast::Access> node, std::string_view reg, std::string_view intermediate, std::ofstream& out, CompileInfo& c_info);
+/* Where each register of code is kept: a machine register or a stack slot */
+static std::vector<std::string> locations;
 
-void print_mov_if_req(std::string_view target, std::string_view source, std::ofstream& out);
-void print_vfunc_in_reg(std::shared_ptr<ast::VFunc> vfunc_nd,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info);
-void number_in_register(std::shared_ptr<ast::Node> nd,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info, bool double_in_memory = false);
+/* Label of the first block of code, the labels of all of them differ with -s */
+static size_t first_block;
 
-void arithmetic_tree_to_x86_64(std::shared_ptr<ast::Node> root,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info);
-void arithmetic_tree_to_x86_64_double(std::shared_ptr<ast::Node> root,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info);
+/* Which operand of the phis of its successor every block with one sets */
+static std::vector<size_t> phi_operand;
+
+/* Number of the first instruction of every block, counting through the
+ * blocks in order, and of the instructions for one past the last block */
+static std::vector<size_t> first_insn;
+
+/* The registers of code in machine registers a call overwrites which are
+ * needed after it, for every instruction, and where they are kept
+ * meanwhile */
+static std::vector<std::vector<ir::Reg>> saved_across;
+static std::vector<std::string> save_slots;
 
-void ast_to_x86_64_core(std::shared_ptr<ast::Node> root,
-    std::ofstream& out,
-    CompileInfo& c_info,
-    int body_id,
-    int real_end_id,
-    bool cmp_log_or = false,
-    int cond_entry = -1);
+/* Slots the variables and the registers of code needed at most */
+static size_t frame_slots;
+
+/* Print templates referenced by the generated code; written to .rodata at the end */
+static std::vector<std::vector<TemplatePiece>> print_templates;
+/* Number of the first one in print_templates, those before were written already */
+static size_t first_template;
+
+/* String constants the generated code refers to. The lexer interns every
+ * piece of a print statement, only those left after folding go to .data. */
+static std::vector<bool> used_strings;
 
 const cmp_operation cmp_operation_structs[CMP_OPERATION_ENUM_END] = {
     { EQUAL, "je", "jne" },
@@ -77,112 +78,582 @@ const cmp_operation comisd_operation_structs[CMP_OPERATION_ENUM_END] = {
     { GREATER_OR_EQ, "jae", "jb" },
 };
 
-/* Get an assembly reference to a numeric variable or a constant
- * ensures variable is a number */
-std::string asm_from_int_or_const(std::shared_ptr<ast::Node> node, CompileInfo& c_info)
+/* The comparison with its operands swapped: a < b is b > a */
+static const cmp_op swapped_cmp[CMP_OPERATION_ENUM_END] = {
+    EQUAL,
+    NOT_EQUAL,
+    GREATER,
+    GREATER_OR_EQ,
+    LESS,
+    LESS_OR_EQ,
+};
+
+/* Registers handed out to the registers of the code. rax, rcx and rdx are
+ * left for intermediate results and division, rdi and rsi for arguments,
+ * r11 and rcx are overwritten by syscall, xmm0 and xmm1 are left for
+ * intermediate doubles. The runtime keeps the first ones (callee-saved in
+ * the System V ABI) but not r8 to r10 and the xmm registers, whose values
+ * are saved around a call when needed after it. */
+static const std::string_view saved_registers[] = { "rbx", "r12", "r13", "r14", "r15" };
+static const std::string_view scratch_registers[] = { "r8", "r9", "r10" };
+static const std::string_view double_registers[] = { "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8",
+    "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" };
+
+static inline bool in_memory(std::string_view location)
+{
+    return location.ends_with(']');
+}
+
+static inline bool is_xmm(std::string_view location)
 {
-    assert(node->get_type() == ast::T_VAR || node->get_type() == ast::T_CONST);
-    if (node->get_type() == ast::T_VAR) {
-        auto t_var = AST_SAFE_CAST(ast::Var, node);
+    return location.starts_with("xmm");
+}
 
-        c_info.error_on_undefined(t_var);
-        c_info.error_on_wrong_type(t_var, V_INT);
+static inline bool is_saved(std::string_view location)
+{
+    return std::ranges::find(saved_registers, location) != std::end(saved_registers);
+}
 
-        return fmt::format("qword [rbp - {}]", c_info.known_vars[t_var->get_var_id()].stack_offset * WORD_SIZE);
-    } else if (node->get_type() == ast::T_CONST) {
-        return fmt::format("{}", AST_SAFE_CAST(ast::Const, node)->get_value());
-    } else {
-        UNREACHABLE();
+static inline bool fits_imm32(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/* Memory of a variable or of one element of an array, see VarInfo::stack_offset */
+static std::string var_ref(int var_id, CompileInfo& c_info)
+{
+    return fmt::format("qword [rbp - {}]", c_info.known_vars[var_id].stack_offset * WORD_SIZE);
+}
+
+/* Slot n after the variables of c_info */
+static std::string slot_ref(size_t n, CompileInfo& c_info)
+{
+    return fmt::format("qword [rbp - {}]", (c_info.get_stack_size() + 1 + n) * WORD_SIZE);
+}
+
+/* Whether the instruction calls into the runtime, which may overwrite
+ * every register not in saved_registers */
+static bool is_call(ir::opcode op)
+{
+    return op == ir::OP_PRINT || op == ir::OP_WRITE || op == ir::OP_PUTCHAR || op == ir::OP_READ || op == ir::OP_EXIT;
+}
+
+/* Call f with every operand of a phi in the successor of block b, which
+ * is read at the end of b. Only jumps lead to blocks with phis, see
+ * ir::split_critical_edges. */
+template<typename F>
+static void for_each_edge_operand(ir::BlockId b, F f)
+{
+    if (phi_operand[b] == SIZE_MAX)
+        return;
+
+    const ir::Block& target = code->blocks[code->blocks[b].succs[0]];
+    for (size_t i = 0; i < target.phi_count(); i++)
+        f(target.insns[i].args[phi_operand[b]]);
+}
+
+/* Where a register of code is needed, in positions: instruction k reads
+ * its operands at 2k and writes its result at 2k + 1 */
+struct Interval {
+    std::vector<std::pair<size_t, size_t>> ranges; /* Sorted, apart and inclusive */
+    uint64_t weight = 0; /* Definition and uses, those in loops counting more */
+
+    size_t start() const { return ranges.front().first; }
+    size_t end() const { return ranges.back().second; }
+};
+
+/* First and last position of a block */
+static size_t block_begin(ir::BlockId b)
+{
+    return 2 * first_insn[b];
+}
+
+static size_t block_last(ir::BlockId b)
+{
+    return 2 * first_insn[b + 1] - 1;
+}
+
+/* How deep every block is nested in loops, taking every jump back in the
+ * block order as closing a loop over the blocks in between */
+static std::vector<unsigned> loop_depths()
+{
+    size_t blocks = code->blocks.size();
+    std::vector<int> change(blocks + 1, 0);
+
+    for (ir::BlockId b = 0; b < blocks; b++) {
+        for (ir::BlockId succ : code->blocks[b].succs) {
+            if (succ <= b) {
+                change[succ]++;
+                change[b + 1]--;
+            }
+        }
+    }
+
+    std::vector<unsigned> depths(blocks);
+    int depth = 0;
+    for (ir::BlockId b = 0; b < blocks; b++) {
+        depth += change[b];
+        depths[b] = depth;
+    }
+
+    return depths;
+}
+
+/*
+ * The interval of every register, empty for those no longer defined.
+ * Phis are written on entry to their block, their operands read at the
+ * end of the blocks before. A register read outside the block defining it
+ * is live into every block on a path back from the read to the definition
+ * ("Computing Liveness Sets for SSA-Form Programs" by Brandner et al.),
+ * and out of their predecessors. In every such block it needs one range,
+ * from the start or its definition to the end or its last read.
+ */
+static std::vector<Interval> live_intervals()
+{
+    const auto& blocks = code->blocks;
+    size_t regs = code->regs.size();
+    std::vector<Interval> intervals(regs);
+    std::vector<size_t> defined_at(regs, SIZE_MAX);
+    std::vector<ir::BlockId> defined_in(regs);
+    std::vector<std::vector<std::pair<ir::BlockId, size_t>>> reads(regs);
+    std::vector<unsigned> depths = loop_depths();
+
+    for (ir::BlockId b = 0; b < blocks.size(); b++) {
+        const ir::Block& block = blocks[b];
+        uint64_t weight = uint64_t(1) << 3 * std::min(depths[b], 16u);
+
+        auto define = [&](ir::Reg r, size_t position) {
+            defined_at[r] = position;
+            defined_in[r] = b;
+            intervals[r].weight += weight;
+        };
+
+        for (size_t i = 0; i < block.insns.size(); i++) {
+            const ir::Insn& insn = block.insns[i];
+            size_t position = 2 * (first_insn[b] + i);
+
+            if (insn.op == ir::OP_PHI) {
+                define(insn.dst, block_begin(b) + 1);
+                continue;
+            }
+
+            auto read = [&](const ir::Operand& op) {
+                if (!op.is_reg())
+                    return;
+
+                reads[op.reg()].push_back({ b, position });
+                intervals[op.reg()].weight += weight;
+            };
+
+            read(insn.a);
+            read(insn.b);
+            for (const auto& arg : insn.args)
+                read(arg);
+            if (i + 1 == block.insns.size())
+                for_each_edge_operand(b, read);
+
+            if (insn.dst != ir::NO_REG)
+                define(insn.dst, position + 1);
+        }
+    }
+
+    /* Blocks a register is live into, out of and read in, marked by the
+     * register, and the last read in them */
+    std::vector<ir::Reg> live_in(blocks.size(), ir::NO_REG);
+    std::vector<ir::Reg> live_out(blocks.size(), ir::NO_REG);
+    std::vector<ir::Reg> read_in(blocks.size(), ir::NO_REG);
+    std::vector<size_t> last_read(blocks.size());
+    std::vector<ir::BlockId> work;
+    std::vector<ir::BlockId> live_blocks;
+
+    for (ir::Reg r = 0; r < regs; r++) {
+        if (defined_at[r] == SIZE_MAX)
+            continue;
+
+        ir::BlockId def = defined_in[r];
+        live_blocks.assign(1, def);
+
+        for (auto [b, position] : reads[r]) {
+            last_read[b] = read_in[b] == r ? std::max(last_read[b], position) : position;
+            read_in[b] = r;
+            if (b != def)
+                work.push_back(b);
+        }
+
+        while (!work.empty()) {
+            ir::BlockId b = work.back();
+            work.pop_back();
+
+            if (live_in[b] == r)
+                continue;
+            live_in[b] = r;
+            live_blocks.push_back(b);
+
+            for (ir::BlockId pred : blocks[b].preds) {
+                live_out[pred] = r;
+                if (pred != def)
+                    work.push_back(pred);
+            }
+        }
+
+        auto& ranges = intervals[r].ranges;
+        for (ir::BlockId b : live_blocks) {
+            size_t from = b == def ? defined_at[r] : block_begin(b);
+            size_t to = live_out[b] == r ? block_last(b) : read_in[b] == r ? std::max(from, last_read[b]) : from;
+            ranges.push_back({ from, to });
+        }
+
+        /* Ranges of blocks next to each other are one */
+        std::ranges::sort(ranges);
+        size_t kept = 0;
+        for (size_t i = 1; i < ranges.size(); i++) {
+            if (ranges[i].first <= ranges[kept].second + 1)
+                ranges[kept].second = std::max(ranges[kept].second, ranges[i].second);
+            else
+                ranges[++kept] = ranges[i];
+        }
+        ranges.resize(kept + 1);
+
+        reads[r] = {};
     }
+
+    return intervals;
 }
 
-std::string double_const_ref(std::shared_ptr<ast::DoubleConst> node, CompileInfo &c_info)
+/* The ranges of the registers of code a machine register holds, by their
+ * start, with their end and register */
+using Occupancy = std::map<size_t, std::pair<size_t, ir::Reg>>;
+
+/* Collect the registers of code in occupied overlapping interval into
+ * found and return their weight, or give up once that reaches limit */
+static uint64_t conflicts(const Occupancy& occupied, const Interval& interval, uint64_t limit,
+    const std::vector<Interval>& intervals, std::vector<ir::Reg>& found)
 {
-    double d = node->get_value();
-    return fmt::format("[double{}]", c_info.check_double_const(d));
+    uint64_t weight = 0;
+    found.clear();
+
+    for (auto [from, to] : interval.ranges) {
+        for (auto it = occupied.upper_bound(to); it != occupied.begin();) {
+            --it;
+            auto [end, r] = it->second;
+            if (end < from)
+                break;
+
+            if (!HAS(found, r)) {
+                found.push_back(r);
+                weight += intervals[r].weight;
+                if (weight >= limit)
+                    return weight;
+            }
+        }
+    }
+
+    return weight;
 }
 
-std::string asm_from_double_or_const(std::shared_ptr<ast::Node> node, CompileInfo &c_info)
+/*
+ * Linear scan register allocation with lifetime holes ("Linear Scan
+ * Register Allocation" by Poletto and Sarkar, "The Second-Chance Binpacking
+ * Algorithm" by Traub et al.). The intervals are visited by their start;
+ * each one takes a machine register none of whose intervals overlap it,
+ * a saved one if it spans a call and one is left. Otherwise it takes the
+ * machine register of the intervals used least if they are used less than
+ * itself, which then go to stack slots, or goes to a stack slot. Machine
+ * registers overwritten by calls are saved around the calls their
+ * intervals span.
+ */
+static void assign_locations(CompileInfo& c_info)
 {
-    assert(node->get_type() == ast::T_VAR || node->get_type() == ast::T_DOUBLE_CONST);
-    if (node->get_type() == ast::T_VAR) {
-        auto t_var = AST_SAFE_CAST(ast::Var, node);
+    const auto& blocks = code->blocks;
+    size_t regs = code->regs.size();
+    locations.assign(regs, "");
 
-        c_info.error_on_undefined(t_var);
-        c_info.error_on_wrong_type(t_var, V_DOUBLE);
+    phi_operand.assign(blocks.size(), SIZE_MAX);
+    for (const auto& block : blocks) {
+        if (block.phi_count() == 0)
+            continue;
 
-        return fmt::format("qword [rbp - {}]", c_info.known_vars[t_var->get_var_id()].stack_offset * WORD_SIZE);
-    } else if (node->get_type() == ast::T_DOUBLE_CONST) {
-        return double_const_ref(AST_SAFE_CAST(ast::DoubleConst, node), c_info);
-    } else {
-        UNREACHABLE();
+        for (size_t p = 0; p < block.preds.size(); p++)
+            phi_operand[block.preds[p]] = p;
+    }
+
+    first_insn.assign(blocks.size() + 1, 0);
+    for (ir::BlockId b = 0; b < blocks.size(); b++)
+        first_insn[b + 1] = first_insn[b] + blocks[b].insns.size();
+
+    /* Positions of the calls, program_exit does not come back */
+    std::vector<size_t> calls;
+    for (ir::BlockId b = 0; b < blocks.size(); b++) {
+        for (size_t i = 0; i < blocks[b].insns.size(); i++) {
+            ir::opcode op = blocks[b].insns[i].op;
+            if (is_call(op) && op != ir::OP_EXIT)
+                calls.push_back(2 * (first_insn[b] + i));
+        }
+    }
+
+    std::vector<Interval> intervals = live_intervals();
+
+    /* The calls a value has to survive, those it is live before and after */
+    auto spanned_calls = [&calls](const Interval& interval, auto f) {
+        for (auto [from, to] : interval.ranges) {
+            for (auto call = std::ranges::lower_bound(calls, from); call != calls.end() && *call < to; call++)
+                f(*call);
+        }
+    };
+
+    std::vector<ir::Reg> order;
+    for (ir::Reg r = 0; r < regs; r++) {
+        if (!intervals[r].ranges.empty())
+            order.push_back(r);
     }
+    std::ranges::sort(order, {}, [&intervals](ir::Reg r) { return intervals[r].start(); });
+
+    struct MachineRegister {
+        std::string_view name;
+        Occupancy occupied;
+    };
+    std::vector<MachineRegister> saved, scratch, doubles;
+    for (auto name : saved_registers)
+        saved.push_back({ name, {} });
+    for (auto name : scratch_registers)
+        scratch.push_back({ name, {} });
+    for (auto name : double_registers)
+        doubles.push_back({ name, {} });
+
+    std::vector<bool> spilled(regs, false);
+    std::vector<ir::Reg> found;
+    std::vector<ir::Reg> victims;
+
+    for (ir::Reg r : order) {
+        const Interval& interval = intervals[r];
+
+        std::vector<MachineRegister*> candidates;
+        if (code->regs[r] == V_DOUBLE) {
+            for (auto& m : doubles)
+                candidates.push_back(&m);
+        } else {
+            bool spans_call = false;
+            spanned_calls(interval, [&spans_call](size_t) { spans_call = true; });
+
+            for (auto* pool : spans_call ? std::array { &saved, &scratch } : std::array { &scratch, &saved }) {
+                for (auto& m : *pool)
+                    candidates.push_back(&m);
+            }
+        }
+
+        MachineRegister* best = nullptr;
+        uint64_t cheapest = interval.weight;
+        for (MachineRegister* m : candidates) {
+            uint64_t weight = conflicts(m->occupied, interval, cheapest, intervals, found);
+            if (weight < cheapest) {
+                best = m;
+                cheapest = weight;
+                victims = found;
+            }
+            if (weight == 0)
+                break;
+        }
+
+        if (!best) {
+            spilled[r] = true;
+            continue;
+        }
+
+        for (ir::Reg victim : victims) {
+            for (auto [from, to] : intervals[victim].ranges)
+                best->occupied.erase(from);
+            spilled[victim] = true;
+        }
+
+        for (auto [from, to] : interval.ranges)
+            best->occupied.emplace(from, std::pair { to, r });
+        locations[r] = best->name;
+    }
+
+    saved_across.assign(first_insn.back(), {});
+    save_slots.assign(regs, "");
+    size_t spills = 0;
+    size_t saves = 0;
+
+    /* Stack slots for the values spilled and the ones saved around calls,
+     * shared by those whose intervals do not overlap at all */
+    using Taken = std::pair<size_t, size_t>; /* End of the interval and slot */
+    std::priority_queue<Taken, std::vector<Taken>, std::greater<Taken>> taken;
+    std::vector<size_t> free_slots;
+    size_t slots = 0;
+
+    for (ir::Reg r : order) {
+        const Interval& interval = intervals[r];
+        std::vector<size_t> spanned;
+        if (!spilled[r] && !is_saved(locations[r]))
+            spanned_calls(interval, [&spanned](size_t call) { spanned.push_back(call); });
+
+        if (!spilled[r] && spanned.empty())
+            continue;
+
+        while (!taken.empty() && taken.top().first < interval.start()) {
+            free_slots.push_back(taken.top().second);
+            taken.pop();
+        }
+
+        size_t slot = slots;
+        if (free_slots.empty()) {
+            slots++;
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        taken.push({ interval.end(), slot });
+
+        if (spilled[r]) {
+            locations[r] = slot_ref(slot, c_info);
+            spills++;
+            continue;
+        }
+
+        save_slots[r] = slot_ref(slot, c_info);
+        for (size_t call : spanned)
+            saved_across[call / 2].push_back(r);
+        saves += spanned.size();
+    }
+
+    timing::count(timing::C_SPILLS, spills);
+    timing::count(timing::C_CALL_SAVES, saves);
+
+    frame_slots = std::max(frame_slots, c_info.get_stack_size() + slots);
 }
 
-void mov_reg_into_array_access(std::shared_ptr<ast::Access> node, std::string_view reg, std::string_view intermediate, std::ofstream& out, CompileInfo& c_info)
+/* An operand as written in an instruction */
+static std::string operand(const ir::Operand& op, CompileInfo& c_info)
 {
-    if (node->index->get_type() == ast::T_CONST) {
-        fmt::print(out, "mov qword [rbp - {}], {}\n", (c_info.known_vars[node->get_array_id()].stack_offset * WORD_SIZE) - (AST_SAFE_CAST(ast::Const, node->index)->get_value() * WORD_SIZE), reg);
-    } else {
-        number_in_register(node->index, intermediate, out, c_info);
-        fmt::print(out, "mov qword [rbp - {} + {} * {}], {}\n", (c_info.known_vars[node->get_array_id()].stack_offset * WORD_SIZE), intermediate, WORD_SIZE, reg);
+    switch (op.kind) {
+    case ir::Operand::Register:
+        return locations[op.reg()];
+    case ir::Operand::Int:
+        return fmt::format("{}", op.int_value());
+    case ir::Operand::Double:
+        return fmt::format("qword [double{}]", c_info.check_double_const(op.double_value()));
+    default:
+        UNREACHABLE();
+        return "";
     }
 }
 
-void array_access_into_register(std::shared_ptr<ast::Access> node, std::string_view reg, std::string_view intermediate, std::ofstream& out, CompileInfo& c_info)
+/* An integer operand as the source of an instruction, which can be a
+ * register, memory or a 32-bit immediate. Other immediates go to scratch. */
+static std::string int_source(const ir::Operand& op, std::string_view scratch, std::ostream& out, CompileInfo& c_info)
 {
-    if (node->index->get_type() == ast::T_CONST) {
-        fmt::print(out, "mov {}, qword [rbp - {}]\n", reg, (c_info.known_vars[node->get_array_id()].stack_offset * WORD_SIZE) - (AST_SAFE_CAST(ast::Const, node->index)->get_value() * WORD_SIZE));
-    } else {
-        number_in_register(node->index, intermediate, out, c_info);
-        fmt::print(out, "mov {}, qword [rbp - {} + {} * {}]\n", reg, (c_info.known_vars[node->get_array_id()].stack_offset * WORD_SIZE), intermediate, WORD_SIZE);
+    if (op.kind == ir::Operand::Int && !fits_imm32(op.int_value())) {
+        fmt::print(out, "mov {}, {}\n", scratch, op.int_value());
+        return std::string(scratch);
     }
+
+    return operand(op, c_info);
 }
 
-/* Print assembly mov from source to target if they are not equal */
-inline void print_mov_if_req(std::string_view target,
-    std::string_view source,
-    std::ofstream& out)
+/* Print assembly mov from source to target if they are not equal, through
+ * scratch if both are memory */
+static void move_int(std::string_view target, const std::string& source, std::ostream& out, std::string_view scratch = "rax")
 {
-    if (target != source)
+    if (target == source)
+        return;
+
+    bool big_immediate = !source.empty() && !in_memory(source) && (std::isdigit((unsigned char)source[0]) || source[0] == '-')
+        && !fits_imm32(std::stoll(source));
+
+    if (in_memory(target) && (in_memory(source) || big_immediate)) {
+        fmt::print(out, "mov {}, {}\n"
+                        "mov {}, {}\n",
+            scratch, source, target, scratch);
+    } else {
         fmt::print(out, "mov {}, {}\n", target, source);
+    }
 }
 
-/* Print assembly mov from source to target if they are not equal */
-inline void print_movsd_if_req(std::string_view target,
-    std::string_view source,
-    std::ofstream& out)
+static void move_double(std::string_view target, const std::string& source, std::ostream& out)
 {
-    if (target != source)
+    if (target == source)
+        return;
+
+    if (in_memory(target) && in_memory(source)) {
+        fmt::print(out, "movsd xmm0, {}\n"
+                        "movsd {}, xmm0\n",
+            source, target);
+    } else {
         fmt::print(out, "movsd {}, {}\n", target, source);
+    }
 }
 
-inline void print_movq_if_req(std::string_view target,
-    std::string_view source,
-    std::ofstream& out)
+static void move(std::string_view target, const ir::Operand& source, std::ostream& out, CompileInfo& c_info)
 {
-    if (target != source)
-        fmt::print(out, "movq {}, {}\n", target, source);
+    if (code->type(source) == V_DOUBLE)
+        move_double(target, operand(source, c_info), out);
+    else
+        move_int(target, operand(source, c_info), out);
 }
 
-void print_vfunc_in_reg(std::shared_ptr<ast::VFunc> vfunc_nd,
-    std::string_view reg,
-    std::ofstream& out)
+/* A copy from one location or constant to another */
+struct Move {
+    std::string target;
+    std::string source;
+    bool is_double;
+};
+
+/* Do all moves as if at once, where the target of one can be the source
+ * of another, like the phis of a loop swapping two values */
+static void parallel_move(std::vector<Move> moves, std::ostream& out)
 {
-    auto vfunc = vfunc_nd->get_value_func();
+    std::erase_if(moves, [](const Move& m) { return m.target == m.source; });
+
+    while (!moves.empty()) {
+        /* A target no other move reads any more can be overwritten */
+        auto ready = std::find_if(moves.begin(), moves.end(), [&moves](const Move& m) {
+            return std::none_of(moves.begin(), moves.end(), [&m](const Move& other) { return other.source == m.target; });
+        });
+
+        if (ready != moves.end()) {
+            if (ready->is_double)
+                move_double(ready->target, ready->source, out);
+            else
+                move_int(ready->target, ready->source, out);
+            moves.erase(ready);
+            continue;
+        }
+
+        /* Only cycles are left, one is broken by saving a target in a
+         * register the moves themselves do not use */
+        const Move& m = moves.front();
+        std::string saved = m.is_double ? "xmm1" : "rcx";
+        std::string target = m.target;
+
+        if (m.is_double)
+            move_double(saved, target, out);
+        else
+            move_int(saved, target, out);
+
+        for (auto& other : moves) {
+            if (other.source == target)
+                other.source = saved;
+        }
+    }
+}
 
+static void print_vfunc_in_reg(value_func_id vfunc,
+    std::string_view reg,
+    std::ostream& out)
+{
     switch (vfunc) {
     case VF_TIME: {
         fmt::print(out, "mov rax, 201\n"
                         "xor rdi, rdi\n"
                         "syscall\n");
-        print_mov_if_req(reg, "rax", out);
+        move_int(reg, "rax", out);
         break;
     }
     case VF_GETUID: {
         fmt::print(out, "mov rax, 102\n"
                         "syscall\n");
-        print_mov_if_req(reg, "rax", out);
+        move_int(reg, "rax", out);
         break;
     }
     default:
@@ -191,273 +662,366 @@ void print_vfunc_in_reg(std::shared_ptr<ast::VFunc> vfunc_nd,
     }
 }
 
-void move_double_const_into_memory(std::shared_ptr<ast::DoubleConst> d, std::string_view memory, std::ofstream &out, CompileInfo &c_info)
+/* dst = a * c with shifts and lea where those do, false if imul is
+ * needed. lea multiplies by 3, 5 or 9, a shift by a power of two. */
+static bool multiply_by_constant(const std::string& dst, const ir::Operand& a, int64_t c, std::ostream& out, CompileInfo& c_info)
 {
-    fmt::print(out, "movsd xmm0, {}\n"
-                    "movsd {}, xmm0\n", double_const_ref(d, c_info), memory);
+    if (c == 0) {
+        move_int(dst, "0", out);
+        return true;
+    }
+
+    if (c <= 0)
+        return false;
+
+    int shift = std::countr_zero((uint64_t)c);
+    int64_t factor = c >> shift;
+    if (factor != 1 && factor != 3 && factor != 5 && factor != 9)
+        return false;
+
+    std::string work = in_memory(dst) ? "rax" : dst;
+    move_int(work, operand(a, c_info), out);
+
+    if (factor != 1)
+        fmt::print(out, "lea {0}, [{0} + {0} * {1}]\n", work, factor - 1);
+    if (shift != 0)
+        fmt::print(out, "shl {}, {}\n", work, shift);
+
+    move_int(dst, work, out);
+    return true;
 }
 
-/* Move a tree_node, which evaluates to a number into a register */
-void number_in_register(std::shared_ptr<ast::Node> nd,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info, bool double_in_memory)
+/* dst = a op b for add, sub and mul */
+static void int_arithmetic(const ir::Insn& insn, std::ostream& out, CompileInfo& c_info)
 {
-    assert(ast::could_be_num(nd->get_type()));
+    const std::string& dst = locations[insn.dst];
+    ir::Operand a = insn.a;
+    ir::Operand b = insn.b;
 
-    switch (nd->get_type()) {
-    case ast::T_ARIT:
-        if (semantic::get_number_type(nd, c_info) == V_INT)
-            arithmetic_tree_to_x86_64(nd, reg, out, c_info);
-        else if (semantic::get_number_type(nd, c_info) == V_DOUBLE)
-            arithmetic_tree_to_x86_64_double(nd, reg, out, c_info);
-        break;
-    case ast::T_VAR: {
-        auto var = AST_SAFE_CAST(ast::Var, nd);
-        if (c_info.known_vars[var->get_var_id()].type == V_INT) {
-            print_mov_if_req(reg, asm_from_int_or_const(nd, c_info), out);
-        } else if (c_info.known_vars[var->get_var_id()].type == V_DOUBLE) {
-            print_movsd_if_req(reg, asm_from_double_or_const(nd, c_info), out);
-        }
-        break;
-    }
-    case ast::T_DOUBLE_CONST:
-        if (double_in_memory)
-            move_double_const_into_memory(AST_SAFE_CAST(ast::DoubleConst, nd), reg, out, c_info);
+    if (insn.op == ir::OP_MUL && a.kind == ir::Operand::Int)
+        std::swap(a, b);
+    if (insn.op == ir::OP_MUL && b.kind == ir::Operand::Int && a.is_reg() && multiply_by_constant(dst, a, b.int_value(), out, c_info))
+        return;
+
+    /* Computing into dst would overwrite b before it is read */
+    if (insn.op != ir::OP_SUB && b.is_reg() && locations[b.reg()] == dst)
+        std::swap(a, b);
+    bool b_in_dst = b.is_reg() && locations[b.reg()] == dst;
+
+    std::string work = in_memory(dst) || b_in_dst ? "rax" : dst;
+    move_int(work, operand(a, c_info), out);
+
+    if (insn.op == ir::OP_MUL) {
+        /* imul only takes an immediate in its three operand form */
+        if (b.kind == ir::Operand::Int && fits_imm32(b.int_value()))
+            fmt::print(out, "imul {0}, {0}, {1}\n", work, b.int_value());
         else
-            print_movsd_if_req(reg, asm_from_double_or_const(nd, c_info), out);
-        break;
-    case ast::T_CONST:
-        print_mov_if_req(reg, asm_from_int_or_const(nd, c_info), out);
-        break;
-    case ast::T_ACCESS:
-        array_access_into_register(AST_SAFE_CAST(ast::Access, nd), reg, reg == "rax" ? "rbx" : "rax", out, c_info);
-        break;
-    case ast::T_VFUNC: {
-        auto vfunc = AST_SAFE_CAST(ast::VFunc, nd);
-        c_info.err.on_false(vfunc->get_return_type() == V_INT,
-            "'{}' has wrong return type '{}'",
-            vfunc_str_map.at(vfunc->get_value_func()),
-            var_type_str_map.at(vfunc->get_return_type()));
-
-        print_vfunc_in_reg(AST_SAFE_CAST(ast::VFunc, nd), reg, out);
-        break;
-    }
-    default:
-        UNREACHABLE();
-        break;
+            fmt::print(out, "imul {}, {}\n", work, int_source(b, "rcx", out, c_info));
+    } else {
+        fmt::print(out, "{} {}, {}\n", insn.op == ir::OP_ADD ? "add" : "sub", work, int_source(b, "rcx", out, c_info));
     }
+
+    move_int(dst, work, out);
 }
 
-/* Parse a tree representing an arithmetic expression into assembly recursively
- */
-void arithmetic_tree_to_x86_64_double(std::shared_ptr<ast::Node> root,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info)
+/* Unsigned division by a constant d as a multiplication: the quotient is
+ * the high half of x * magic shifted right, where magic is 2^(64 + shift)
+ * / d rounded up. When that takes 65 bits the top one is added back as x
+ * ("Division by Invariant Integers using Multiplication" by Granlund and
+ * Montgomery, as done by libdivide). */
+struct Reciprocal {
+    uint64_t magic;
+    bool add; /* Whether x has to be added to the high half, halved */
+    int shift;
+};
+
+static Reciprocal reciprocal(uint64_t d)
 {
-    /* If we are only a number: mov us into the target and leave */
-    if (root->get_type() == ast::T_VAR || root->get_type() == ast::T_DOUBLE_CONST) {
-        print_movsd_if_req(reg, asm_from_double_or_const(root, c_info), out);
-        return;
+    assert(d != 0 && !std::has_single_bit(d));
+
+    int log = 63 - std::countl_zero(d);
+
+    /* 2^(64 + log) / d by long division, a bit at a time. 2^log < d, so
+     * the quotient fits into 64 bits. */
+    uint64_t magic = 0;
+    uint64_t rem = uint64_t(1) << log;
+    for (int bit = 0; bit < 64; bit++) {
+        bool carry = rem >> 63;
+        rem <<= 1;
+        magic <<= 1;
+        if (carry || rem >= d) {
+            rem -= d;
+            magic |= 1;
+        }
     }
 
-    assert(root->get_type() == ast::T_ARIT);
+    if (d - rem < uint64_t(1) << log)
+        return { magic + 1, false, log };
 
-    std::shared_ptr<ast::Arit> arit = AST_SAFE_CAST(ast::Arit, root);
+    /* One bit more precision, the lost top bit comes from the add */
+    uint64_t twice_rem = rem + rem;
+    magic += magic + (twice_rem >= d || twice_rem < rem);
+    return { magic + 1, true, log };
+}
 
-    std::string_view second_value = "xmm2";
+/* dst = a / d or a % d for a constant d other than 0: a shift or mask for
+ * powers of two, a multiplication by the reciprocal otherwise */
+static void divide_by_constant(const ir::Insn& insn, uint64_t d, std::ostream& out, CompileInfo& c_info)
+{
+    const std::string& dst = locations[insn.dst];
+    std::string x = operand(insn.a, c_info);
+    bool quotient = insn.op == ir::OP_DIV;
 
-    assert(ast::could_be_num(arit->left->get_type()) && ast::could_be_num(arit->right->get_type()));
+    if (std::has_single_bit(d)) {
+        std::string work = in_memory(dst) ? "rax" : dst;
+        int shift = std::countr_zero(d);
 
-    bool value_in_xmm0 = false;
+        if (quotient && shift == 0) {
+            move_int(dst, x, out);
+            return;
+        }
+        if (!quotient && d == 1) {
+            move_int(dst, "0", out);
+            return;
+        }
 
-    /* If our children are also calculations: recurse */
-    if (arit->left->get_type() == ast::T_ARIT) {
-        arithmetic_tree_to_x86_64_double(arit->left, "xmm0", out, c_info);
-        value_in_xmm0 = true;
-    }
-    if (arit->right->get_type() == ast::T_ARIT) {
-        /* Preserve rax */
-        if (value_in_xmm0)
-            fmt::print(out, "sub rsp, 8\n"
-                            "movq [rsp], xmm0\n");
-        arithmetic_tree_to_x86_64_double(arit->right, "xmm2", out, c_info);
-        if (value_in_xmm0)
-            fmt::print(out, "movq xmm0, [rsp]\n"
-                            "add rsp, 8\n");
+        move_int(work, x, out);
+        if (quotient) {
+            fmt::print(out, "shr {}, {}\n", work, shift);
+        } else {
+            int64_t mask = d - 1;
+            fmt::print(out, "and {}, {}\n", work, int_source(ir::Operand::of_int(mask), "rcx", out, c_info));
+        }
+        move_int(dst, work, out);
+        return;
     }
 
-    /* If our children are numbers: mov them into the target
-     * Only check for this the second time around because the numbers
-     * could get overwritten if we moved before doing another calculation */
-    if (arit->left->get_type() == ast::T_DOUBLE_CONST || arit->left->get_type() == ast::T_VAR || arit->left->get_type() == ast::T_VFUNC || arit->left->get_type() == ast::T_ACCESS) {
-        number_in_register(arit->left, "xmm0", out, c_info);
-
-        value_in_xmm0 = true;
+    Reciprocal r = reciprocal(d);
+
+    fmt::print(out, "mov rax, {}\n"
+                    "mul {}\n",
+        (int64_t)r.magic, x);
+
+    /* The quotient ends up in rdx, or in rax when x is added */
+    std::string_view q = "rdx";
+    if (r.add) {
+        fmt::print(out, "mov rax, {}\n"
+                        "sub rax, rdx\n"
+                        "shr rax, 1\n"
+                        "add rax, rdx\n",
+            x);
+        q = "rax";
     }
+    if (r.shift != 0)
+        fmt::print(out, "shr {}, {}\n", q, r.shift);
 
-    switch (arit->right->get_type()) {
-    case ast::T_DOUBLE_CONST:
-    case ast::T_VAR: {
-        fmt::print(out, "movsd xmm2, {}\n", asm_from_double_or_const(arit->right, c_info));
-        break;
-    }
-    case ast::T_ACCESS: {
-        assert("double arrays are not implemented yet" && false);
-        number_in_register(arit->left, "xmm2", out, c_info);
-        break;
+    if (quotient) {
+        move_int(dst, std::string(q), out);
+        return;
     }
-    case ast::T_VFUNC: {
-        assert("double vfuncs are not implemented yet" && false);
-        // if (value_in_rax)
-        //     fmt::print(out, "push rax\n");
-        // print_vfunc_in_reg(AST_SAFE_CAST(ast::VFunc, arit->right), "rcx", out);
-        // if (value_in_rax)
-        //     fmt::print(out, "pop rax\n");
-        break;
+
+    /* x - q * d */
+    std::string_view remainder = q == "rax" ? "rdx" : "rax";
+    if (fits_imm32(d))
+        fmt::print(out, "imul {0}, {0}, {1}\n", q, (int64_t)d);
+    else
+        fmt::print(out, "imul {}, {}\n", q, int_source(ir::Operand::of_int(d), "rcx", out, c_info));
+    move_int(remainder, x, out);
+    fmt::print(out, "sub {}, {}\n", remainder, q);
+    move_int(dst, std::string(remainder), out);
+}
+
+/* dst = a / b or a % b, unsigned */
+static void int_division(const ir::Insn& insn, std::ostream& out, CompileInfo& c_info)
+{
+    if (insn.a.is_reg() && insn.b.kind == ir::Operand::Int && insn.b.int_value() != 0) {
+        divide_by_constant(insn, insn.b.int_value(), out, c_info);
+        return;
     }
-    default:
-        break;
+
+    std::string divisor = operand(insn.b, c_info);
+    if (insn.b.kind == ir::Operand::Int) {
+        fmt::print(out, "mov rcx, {}\n", divisor);
+        divisor = "rcx";
     }
 
-    /* NOTE: Switch to i- div, mul once signed numbers
-     * are supported */
+    move_int("rax", operand(insn.a, c_info), out);
+    fmt::print(out, "xor rdx, rdx\n"
+                    "div {}\n",
+        divisor);
+    move_int(locations[insn.dst], insn.op == ir::OP_DIV ? "rax" : "rdx", out);
+}
 
-    /* Execute the calculation */
-    switch (arit->get_arit()) {
-    case ADD:
-        fmt::print(out, "addsd xmm0, {}\n", second_value);
-        print_movsd_if_req(reg, "xmm0", out);
-        break;
-    case SUB:
-        fmt::print(out, "subsd xmm0, {}\n", second_value);
-        print_movsd_if_req(reg, "xmm0", out);
+static void double_arithmetic(const ir::Insn& insn, std::ostream& out, CompileInfo& c_info)
+{
+    const std::string& dst = locations[insn.dst];
+    ir::Operand a = insn.a;
+    ir::Operand b = insn.b;
+
+    bool commutative = insn.op == ir::OP_FADD || insn.op == ir::OP_FMUL;
+    if (commutative && b.is_reg() && locations[b.reg()] == dst)
+        std::swap(a, b);
+    bool b_in_dst = b.is_reg() && locations[b.reg()] == dst;
+
+    std::string work = in_memory(dst) || b_in_dst ? "xmm0" : dst;
+    move_double(work, operand(a, c_info), out);
+
+    std::string_view mnemonic;
+    switch (insn.op) {
+    case ir::OP_FADD:
+        mnemonic = "addsd";
         break;
-    case DIV:
-        fmt::print(out, "divsd xmm0, {}\n", second_value);
-        print_movsd_if_req(reg, "xmm0", out);
+    case ir::OP_FSUB:
+        mnemonic = "subsd";
         break;
-    case MOD:
-        c_info.err.error("'{}' not allowed in floating point operations", arit_str_map.at(arit->get_arit()));
+    case ir::OP_FMUL:
+        mnemonic = "mulsd";
         break;
-    case MUL:
-        fmt::print(out, "mulsd xmm0, {}\n", second_value);
-        print_movsd_if_req(reg, "xmm0", out);
+    case ir::OP_FDIV:
+        mnemonic = "divsd";
         break;
     default:
         UNREACHABLE();
         break;
     }
+
+    fmt::print(out, "{} {}, {}\n", mnemonic, work, operand(b, c_info));
+    move_double(dst, work, out);
 }
 
-/* Parse a tree representing an arithmetic expression into assembly recursively
- */
-void arithmetic_tree_to_x86_64(std::shared_ptr<ast::Node> root,
-    std::string_view reg,
-    std::ofstream& out,
-    CompileInfo& c_info)
+/* The memory of an element of an array, with the index in a register or
+ * constant. scratch holds the index if it is in memory. */
+static std::string element_ref(int array_id, const ir::Operand& index, std::string_view scratch, std::ostream& out, CompileInfo& c_info)
 {
-    /* If we are only a number: mov us into the target and leave */
-    if (root->get_type() == ast::T_VAR || root->get_type() == ast::T_CONST) {
-        print_mov_if_req(reg, asm_from_int_or_const(root, c_info), out);
-        return;
+    size_t base = c_info.known_vars[array_id].stack_offset * WORD_SIZE;
+
+    if (index.kind == ir::Operand::Int)
+        return fmt::format("qword [rbp - {}]", (int64_t)base - index.int_value() * (int64_t)WORD_SIZE);
+
+    std::string reg = operand(index, c_info);
+    if (in_memory(reg)) {
+        fmt::print(out, "mov {}, {}\n", scratch, reg);
+        reg = scratch;
     }
 
-    assert(root->get_type() == ast::T_ARIT);
+    return fmt::format("qword [rbp - {} + {} * {}]", base, reg, WORD_SIZE);
+}
 
-    std::shared_ptr<ast::Arit> arit = AST_SAFE_CAST(ast::Arit, root);
+static void use_string(int str_id)
+{
+    if ((size_t)str_id >= used_strings.size())
+        used_strings.resize(str_id + 1);
+    used_strings[str_id] = true;
+}
 
-    bool rcx_can_be_immediate = !ast::has_precedence(arit->get_arit()); /* Only 'add' and 'sub' accept immediate values as
-                                                                           the second operand */
-    std::string_view second_value = "rcx";
+/* Runtime values are passed in an array on the stack */
+static void print_args(const ir::Insn& insn, std::ostream& out, CompileInfo& c_info)
+{
+    const auto& args = insn.args;
 
-    assert(ast::could_be_num(arit->left->get_type()) && ast::could_be_num(arit->right->get_type()));
+    if (!args.empty())
+        fmt::print(out, "sub rsp, {}\n", args.size() * WORD_SIZE);
 
-    bool value_in_rax = false;
+    for (size_t i = 0; i < args.size(); i++) {
+        std::string arg = operand(args[i], c_info);
+        std::string slot = fmt::format("qword [rsp + {}]", i * WORD_SIZE);
 
-    /* If our children are also calculations: recurse */
-    if (arit->left->get_type() == ast::T_ARIT) {
-        arithmetic_tree_to_x86_64(arit->left, "rax", out, c_info);
-        value_in_rax = true;
-    }
-    if (arit->right->get_type() == ast::T_ARIT) {
-        /* Preserve rax */
-        if (value_in_rax)
-            fmt::print(out, "push rax\n");
-        arithmetic_tree_to_x86_64(arit->right, "rcx", out, c_info);
-        if (value_in_rax)
-            fmt::print(out, "pop rax\n");
+        if (is_xmm(arg))
+            fmt::print(out, "movsd {}, {}\n", slot, arg);
+        else
+            move_int(slot, arg, out);
     }
 
-    /* If our children are numbers: mov them into the target
-     * Only check for this the second time around because the numbers
-     * could get overwritten if we moved before doing another calculation */
-    if (arit->left->get_type() == ast::T_CONST || arit->left->get_type() == ast::T_VAR || arit->left->get_type() == ast::T_VFUNC || arit->left->get_type() == ast::T_ACCESS) {
-        number_in_register(arit->left, "rax", out, c_info);
+    fmt::print(out, "mov rdi, tmpl{}\n"
+                    "mov rsi, rsp\n"
+                    "call print_template\n",
+        first_template + print_templates.size());
 
-        value_in_rax = true;
-    }
+    if (!args.empty())
+        fmt::print(out, "add rsp, {}\n", args.size() * WORD_SIZE);
 
-    switch (arit->right->get_type()) {
-    case ast::T_CONST: {
-        if (rcx_can_be_immediate) {
-            second_value = asm_from_int_or_const(arit->right, c_info);
-            break;
-        }
-        __attribute__((fallthrough)); /* If rcx can't be immediate: do the
-                                         same as you would for var */
+    for (const auto& piece : code->templates[insn.var]) {
+        if (piece.kind == TemplatePiece::Literal)
+            use_string(piece.id);
     }
-    case ast::T_VAR: {
-        fmt::print(out, "mov rcx, {}\n", asm_from_int_or_const(arit->right, c_info));
+    print_templates.push_back(code->templates[insn.var]);
+}
+
+static void emit_insn(const ir::Insn& insn, std::ostream& out, CompileInfo& c_info)
+{
+    switch (insn.op) {
+    case ir::OP_MOV:
+        move(locations[insn.dst], insn.a, out, c_info);
         break;
-    }
-    case ast::T_ACCESS: {
-        number_in_register(arit->left, "rcx", out, c_info);
+    case ir::OP_ADD:
+    case ir::OP_SUB:
+    case ir::OP_MUL:
+        int_arithmetic(insn, out, c_info);
         break;
-    }
-    case ast::T_VFUNC: {
-        if (value_in_rax)
-            fmt::print(out, "push rax\n");
-        print_vfunc_in_reg(AST_SAFE_CAST(ast::VFunc, arit->right), "rcx", out);
-        if (value_in_rax)
-            fmt::print(out, "pop rax\n");
+    case ir::OP_DIV:
+    case ir::OP_MOD:
+        int_division(insn, out, c_info);
         break;
-    }
-    default:
+    case ir::OP_FADD:
+    case ir::OP_FSUB:
+    case ir::OP_FMUL:
+    case ir::OP_FDIV:
+        double_arithmetic(insn, out, c_info);
+        break;
+    case ir::OP_LDV:
+        if (code->regs[insn.dst] == V_DOUBLE)
+            move_double(locations[insn.dst], var_ref(insn.var, c_info), out);
+        else
+            move_int(locations[insn.dst], var_ref(insn.var, c_info), out);
+        break;
+    case ir::OP_STV:
+        move(var_ref(insn.var, c_info), insn.a, out, c_info);
+        break;
+    case ir::OP_LDA:
+        move_int(locations[insn.dst], element_ref(insn.var, insn.a, "rax", out, c_info), out, "rcx");
+        break;
+    case ir::OP_STA: {
+        std::string element = element_ref(insn.var, insn.a, "rax", out, c_info);
+        move_int(element, int_source(insn.b, "rcx", out, c_info), out, "rcx");
         break;
     }
-
-    /* NOTE: Switch to i- div, mul once signed numbers
-     * are supported */
-
-    /* Execute the calculation */
-    switch (arit->get_arit()) {
-    case ADD:
-        fmt::print(out, "add rax, {}\n", second_value);
-        print_mov_if_req(reg, "rax", out);
+    case ir::OP_TIME:
+        print_vfunc_in_reg(VF_TIME, locations[insn.dst], out);
+        break;
+    case ir::OP_GETUID:
+        print_vfunc_in_reg(VF_GETUID, locations[insn.dst], out);
         break;
-    case SUB:
-        fmt::print(out, "sub rax, {}\n", second_value);
-        print_mov_if_req(reg, "rax", out);
+    case ir::OP_PRINT:
+        print_args(insn, out, c_info);
         break;
-    case DIV:
-        fmt::print(out, "xor rdx, rdx\n"
-                        "div {}\n",
-            second_value);
-        print_mov_if_req(reg, "rax", out);
+    case ir::OP_WRITE:
+        use_string(insn.var);
+        fmt::print(out, "mov rdi, str{0}\n"
+                        "mov rsi, str{0}Len\n"
+                        "call outbuf_write\n",
+            insn.var);
         break;
-    case MOD:
-        fmt::print(out, "xor rdx, rdx\n"
-                        "div {}\n",
-            second_value);
-        print_mov_if_req(reg, "rdx", out);
+    case ir::OP_PUTCHAR:
+        move_int("rdi", operand(insn.a, c_info), out);
+        fmt::print(out, "call putchar\n");
         break;
-    case MUL:
-        fmt::print(out, "xor rdx, rdx\n"
-                        "mul {}\n",
-            second_value);
-        print_mov_if_req(reg, "rax", out);
+    case ir::OP_READ:
+        /* Whatever was printed before (e.g. a prompt) has to be visible
+         * before we block on input */
+        fmt::print(out, "call outbuf_flush\n"
+                        "xor rax, rax\n"
+                        "xor rdi, rdi\n"
+                        "mov rsi, strvar{0}\n"
+                        "mov rdx, {1}\n"
+                        "syscall\n"
+                        "dec rax\n"
+                        "mov [strvar{0}len], rax\n"  /* Move return value of read, i.e., length of input into the length variable */
+                        "mov byte [rsi + rax], 0\n", /* Clear newline at end of input */
+            insn.var, STR_RESERVED_SIZE);
+        break;
+    case ir::OP_EXIT:
+        move_int("rdi", operand(insn.a, c_info), out);
+        fmt::print(out, "call program_exit\n");
         break;
     default:
         UNREACHABLE();
@@ -465,493 +1029,279 @@ void arithmetic_tree_to_x86_64(std::shared_ptr<ast::Node> root,
     }
 }
 
-void ast_to_x86_64(std::shared_ptr<ast::Body> root, std::string_view fn, CompileInfo& c_info)
+static std::string block_label(ir::BlockId b)
 {
-    std::ofstream out(fn.data());
+    return fmt::format(".b{}", first_block + b);
+}
 
-    fmt::print(out, ";; Generated by Least Complicated Compiler (lcc)\n"
-                    "global _start\n"
-                    "section .text\n"
-                    "_start:\n");
+/* Jump to block to, unless it comes next anyway */
+static void jump(ir::BlockId to, ir::BlockId next, std::ostream& out)
+{
+    if (to != next)
+        fmt::print(out, "jmp {}\n", block_label(to));
+}
 
-    /* Allocate space var variables on stack */
-    if (!c_info.known_vars.empty()) {
-        fmt::print(out, "mov rbp, rsp\n"
-                        "sub rsp, {}\n",
-            c_info.get_stack_size() * WORD_SIZE);
+static void emit_branch(const ir::Insn& insn, const ir::Block& block, ir::BlockId next, std::ostream& out, CompileInfo& c_info)
+{
+    ir::Operand a = insn.a;
+    ir::Operand b = insn.b;
+    cmp_op cmp = insn.cmp;
+    ir::BlockId on_true = block.succs[0];
+    ir::BlockId on_false = block.succs[1];
+
+    if (a.is_const() && b.is_const()) {
+        jump(ir::evaluate(cmp, a, b) ? on_true : on_false, next, out);
+        return;
     }
 
-    ast_to_x86_64_core(ast::to_base(root), out, c_info, root->get_body_id(), root->get_body_id());
-
-    fmt::print(out, "mov rax, 60\n"
-                    "xor rdi, rdi\n"
-                    "syscall\n"
-                    "section .data\n");
+    const cmp_operation* jumps;
 
-    for (size_t i = 0; i < c_info.known_strings.size(); i++) {
-        fmt::print(out, "str{0}: db \"{1}\"\n"
-                        "str{0}Len: equ $ - str{0}\n",
-            i, c_info.known_strings[i]);
-    }
+    if (code->type(a) == V_DOUBLE) {
+        /* The first operand of comisd has to be a register */
+        std::string left = operand(a, c_info);
+        if (!is_xmm(left)) {
+            fmt::print(out, "movsd xmm0, {}\n", left);
+            left = "xmm0";
+        }
 
-    for (size_t i = 0; i < c_info.known_double_consts.size(); i++) {
-        fmt::print(out, "double{}: dq {:.6f}\n", i, c_info.known_double_consts[i]);
-    }
+        fmt::print(out, "comisd {}, {}\n", left, operand(b, c_info));
+        jumps = comisd_operation_structs;
+    } else {
+        /* Nor can it be an immediate for cmp */
+        if (a.is_const()) {
+            std::swap(a, b);
+            cmp = swapped_cmp[cmp];
+        }
 
-    /* Reserved string variables */
-    if (std::find_if(c_info.known_vars.begin(), c_info.known_vars.end(), [](VarInfo v) { return v.type == V_STR; }) != c_info.known_vars.end()) {
-        fmt::print(out, "section .bss\n");
-        for (size_t i = 0; i < c_info.known_vars.size(); i++) {
-            auto v = c_info.known_vars[i];
-            if (v.type == V_STR) {
-                fmt::print(out, "strvar{0}: resb {1}\n"
-                                "strvar{0}len: resq 1\n",
-                    i, STR_RESERVED_SIZE);
-            }
+        std::string left = operand(a, c_info);
+        std::string right = int_source(b, "rcx", out, c_info);
+        if (in_memory(left) && in_memory(right)) {
+            fmt::print(out, "mov rax, {}\n", left);
+            left = "rax";
         }
-    }
 
-    fmt::print(out, "extern uprint\n"
-                    "extern fprint\n"
-                    "extern putchar\n");
+        fmt::print(out, "cmp {}, {}\n", left, right);
+        jumps = cmp_operation_structs;
+    }
 
-    out.close();
+    /* Jump away on the outcome whose block does not come next */
+    if (on_false == next) {
+        fmt::print(out, "{} {}\n", jumps[cmp].asm_name, block_label(on_true));
+    } else if (on_true == next) {
+        fmt::print(out, "{} {}\n", jumps[cmp].opposite_asm_name, block_label(on_false));
+    } else {
+        fmt::print(out, "{} {}\n", jumps[cmp].asm_name, block_label(on_true));
+        jump(on_false, next, out);
+    }
 }
 
-void ast_to_x86_64_core(std::shared_ptr<ast::Node> root,
-    std::ofstream& out,
-    CompileInfo& c_info,
-    int body_id,
-    int real_end_id,
-    bool cmp_log_or,
-    int cond_entry)
+/* Give the phis of the successor of block b their values when coming
+ * from b */
+static void phi_moves(ir::BlockId b, std::ostream& out, CompileInfo& c_info)
 {
-    static std::stack<int> while_ends {};
-
-    c_info.err.set_line(root->get_line());
-    switch (root->get_type()) {
-    case ast::T_BODY: {
-        std::shared_ptr<ast::Body> body = AST_SAFE_CAST(ast::Body, root);
-        for (const auto& child : body->children) {
-            ast_to_x86_64_core(child, out, c_info, body->get_body_id(), real_end_id);
-        }
-        break;
-    }
-    case ast::T_IF: {
-        std::shared_ptr<ast::If> t_if = AST_SAFE_CAST(ast::If, root);
-
-        /* Getting the end label for the whole block
-         * we jmp there if one if succeeded and we traversed its block */
-        if (!t_if->is_elif()) {
-            std::shared_ptr<ast::Node> last_if = ast::get_last_if(t_if);
-            if (last_if) {
-                if (last_if->get_type() == ast::T_ELSE) {
-                    real_end_id = AST_SAFE_CAST(ast::Else, last_if)->body->get_body_id();
-                } else if (last_if->get_type() == ast::T_IF) {
-                    real_end_id = AST_SAFE_CAST(ast::If, last_if)->body->get_body_id();
-                }
-            }
-        }
+    if (phi_operand[b] == SIZE_MAX)
+        return;
 
-        fmt::print(out, ";; {}\n", (t_if->is_elif() ? "elif" : "if"));
-        ast_to_x86_64_core(t_if->condition, out, c_info, t_if->body->get_body_id(),
-            real_end_id);
-        ast_to_x86_64_core(t_if->body, out, c_info, t_if->body->get_body_id(), real_end_id);
+    const ir::Block& target = code->blocks[code->blocks[b].succs[0]];
 
-        if (t_if->elif != nullptr) {
-            fmt::print(out, "jmp .end{}\n"
-                            ".end{}:\n",
-                real_end_id, t_if->body->get_body_id());
-            ast_to_x86_64_core(t_if->elif, out, c_info, t_if->body->get_body_id(), real_end_id);
-        } else {
-            fmt::print(out, ".end{}:\n", t_if->body->get_body_id());
-        }
-        break;
+    std::vector<Move> moves;
+    for (size_t i = 0; i < target.phi_count(); i++) {
+        const ir::Insn& phi = target.insns[i];
+        moves.push_back({ locations[phi.dst], operand(phi.args[phi_operand[b]], c_info), code->regs[phi.dst] == V_DOUBLE });
     }
-    case ast::T_ELSE: {
-        std::shared_ptr<ast::Else> t_else = AST_SAFE_CAST(ast::Else, root);
 
-        fmt::print(out, ";; else\n");
-        ast_to_x86_64_core(t_else->body, out, c_info, t_else->body->get_body_id(), real_end_id);
-        fmt::print(out, ".end{}:\n", t_else->body->get_body_id());
-        break;
-    }
-    case ast::T_WHILE: {
-        std::shared_ptr<ast::While> t_while = AST_SAFE_CAST(ast::While, root);
-
-        while_ends.push(t_while->body->get_body_id());
+    parallel_move(std::move(moves), out);
+}
 
-        fmt::print(out, ";; while\n");
-        fmt::print(out, ".entry{}:\n", t_while->body->get_body_id());
+/* Keep the registers of regs in their save slots, or get them back */
+static void save_registers(const std::vector<ir::Reg>& regs, bool restore, std::ostream& out)
+{
+    for (ir::Reg r : regs) {
+        std::string_view from = restore ? save_slots[r] : locations[r];
+        std::string_view to = restore ? locations[r] : save_slots[r];
+        fmt::print(out, "{} {}, {}\n", is_xmm(locations[r]) ? "movsd" : "mov", to, from);
+    }
+}
 
-        ast_to_x86_64_core(t_while->condition, out, c_info, t_while->body->get_body_id(),
-            real_end_id);
-        ast_to_x86_64_core(t_while->body, out, c_info, t_while->body->get_body_id(),
-            real_end_id);
+/* The code of every block in order, a label after them for OP_END.
+ * assign_locations has to be called first. */
+static void emit_code(std::ostream& out, CompileInfo& c_info)
+{
+    ir::BlockId end = code->blocks.size();
+    int line = -1;
 
-        fmt::print(out, "jmp .entry{}\n", t_while->body->get_body_id());
-        fmt::print(out, ".end{}:\n", t_while->body->get_body_id());
+    for (ir::BlockId b = 0; b < code->blocks.size(); b++) {
+        const ir::Block& block = code->blocks[b];
+        ir::BlockId next = b + 1;
 
-        while_ends.pop();
-        break;
-    }
-    case ast::T_FUNC: {
-        std::shared_ptr<ast::Func> t_func = AST_SAFE_CAST(ast::Func, root);
+        fmt::print(out, "{}:\n", block_label(b));
 
-        std::string_view func_name = func_str_map.at(t_func->get_func());
-        fmt::print(out, ";; {}\n", func_name);
+        for (size_t i = 0; i < block.insns.size(); i++) {
+            const ir::Insn& insn = block.insns[i];
+            const auto& saved = saved_across[first_insn[b] + i];
 
-        switch (t_func->get_func()) {
-        case F_EXIT: {
-            number_in_register(t_func->args[0], "rdi", out, c_info);
-            fmt::print(out, "mov rax, 60\n"
-                            "syscall\n");
-            break;
-        }
-        case F_ARRAY:
-        case F_STR: {
-            /* check_correct_function_call defines the variable */
-            break;
-        }
-        case F_INT: {
-            number_in_register(t_func->args[1],
-                asm_from_int_or_const(t_func->args[0], c_info), out, c_info);
-            break;
-        }
-        case F_DOUBLE: {
-            number_in_register(t_func->args[1],
-                asm_from_double_or_const(t_func->args[0], c_info), out, c_info, true);
-            break;
-        }
-        case F_PRINT: {
-            std::shared_ptr<ast::Lstr> ls = AST_SAFE_CAST(ast::Lstr, t_func->args[0]);
-
-            for (const auto& format : ls->format) {
-                switch (format->get_type()) {
-                case ast::T_STR: {
-                    std::shared_ptr<ast::Str> str = AST_SAFE_CAST(ast::Str, format);
-
-                    fmt::print(out, "mov rax, 1\n"
-                                    "mov rdi, 1\n"
-                                    "mov rsi, str{0}\n"
-                                    "mov rdx, str{0}Len\n"
-                                    "syscall\n",
-                        str->get_str_id());
-                    break;
-                }
-                case ast::T_VAR: {
-                    auto the_var = AST_SAFE_CAST(ast::Var, format);
-                    auto the_var_info = c_info.known_vars[the_var->get_var_id()];
-
-                    c_info.error_on_undefined(the_var);
-
-                    switch (the_var_info.type) {
-                    case V_DOUBLE: {
-                        fmt::print(out, "movsd xmm0, {}\n"
-                                        "call fprint\n",
-                            asm_from_double_or_const(format, c_info));
-                        break;
-                    }
-                    case V_INT: {
-                        fmt::print(out, "mov rdi, {}\n"
-                                        "call uprint\n",
-                            asm_from_int_or_const(format, c_info));
-                        break;
-                    }
-                    case V_STR: {
-                        fmt::print(out, "mov rax, 1\n"
-                                        "mov rdi, 1\n"
-                                        "mov rsi, strvar{0}\n"
-                                        "mov rdx, [strvar{0}len]\n"
-                                        "syscall\n",
-                            the_var->get_var_id());
-                        break;
-                    }
-                    default: {
-                        UNREACHABLE();
-                        break;
-                    }
-                    }
-                    break;
-                }
-                case ast::T_DOUBLE_CONST:
-                case ast::T_CONST:
-                case ast::T_ACCESS: {
-                    number_in_register(format, "rdi", out, c_info);
-                    fmt::print(out, "call uprint\n");
-                    break;
-                }
-                default:
-                    c_info.err.error("Unexpected format token in string");
-                    break;
-                }
-            }
-            break;
-        }
-        case F_SET: {
-            std::string input;
-
-            if (t_func->args[1]->get_type() == ast::T_ACCESS) {
-                array_access_into_register(AST_SAFE_CAST(ast::Access, t_func->args[1]), "rax", "rbx", out, c_info);
-                input = "rax";
-            } else if (t_func->args[1]->get_type() == ast::T_CONST) {
-                input = std::to_string(AST_SAFE_CAST(ast::Const, t_func->args[1])->get_value());
-            } else {
-                number_in_register(t_func->args[1], "rax", out, c_info);
-                input = "rax";
+            if (insn.line != line) {
+                line = insn.line;
+                fmt::print(out, ";; line {}\n", line + 1);
             }
 
-            if (t_func->args[0]->get_type() == ast::T_ACCESS) {
-                mov_reg_into_array_access(AST_SAFE_CAST(ast::Access, t_func->args[0]), input, "rbx", out, c_info);
-            } else if (t_func->args[0]->get_type() == ast::T_VAR) {
-                print_mov_if_req(asm_from_int_or_const(t_func->args[0], c_info), input, out);
-            } else {
-                UNREACHABLE();
+            switch (insn.op) {
+            case ir::OP_PHI:
+                /* Set by the blocks jumping here */
+                break;
+            case ir::OP_JMP:
+                phi_moves(b, out, c_info);
+                jump(block.succs[0], next, out);
+                break;
+            case ir::OP_BR:
+                emit_branch(insn, block, next, out, c_info);
+                break;
+            case ir::OP_END:
+                jump(end, next, out);
+                break;
+            default:
+                save_registers(saved, false, out);
+                emit_insn(insn, out, c_info);
+                save_registers(saved, true, out);
+                break;
             }
-            break;
         }
-        // TODO: make this function obsolete by overloading F_SET
-        case F_SETD: {
-            std::string input;
-
-            if (t_func->args[1]->get_type() == ast::T_ACCESS) {
-                assert(false && "double array accesses are not implemented yet");
-                // array_access_into_register(AST_SAFE_CAST(ast::Access, t_func->args[1]), "rax", "rbx", out, c_info);
-                // input = "rax";
-            } else if (t_func->args[1]->get_type() == ast::T_DOUBLE_CONST) {
-                input = double_const_ref(AST_SAFE_CAST(ast::DoubleConst, t_func->args[1]), c_info);
-            } else {
-                number_in_register(t_func->args[1], "xmm0", out, c_info);
-                input = "xmm0";
-            }
+    }
 
-            if (t_func->args[0]->get_type() == ast::T_ACCESS) {
-                assert(false && "double array accesses are not implemented yet");
-                // mov_reg_into_array_access(AST_SAFE_CAST(ast::Access, t_func->args[0]), input, "rbx", out, c_info);
-            } else if (t_func->args[0]->get_type() == ast::T_VAR) {
-                print_movq_if_req(asm_from_double_or_const(t_func->args[0], c_info), input, out);
-            } else {
-                UNREACHABLE();
-            }
-            break;
-        }
-        case F_ADD:
-        case F_SUB: {
-            if (t_func->args[1]->get_type() == ast::T_CONST) {
-                /* In this case func name
-                ('add' or 'sub') is actually
-                the correct instruction */
-                fmt::print(out, "{} {}, {}\n", func_name, asm_from_int_or_const(t_func->args[0], c_info), asm_from_int_or_const(t_func->args[1], c_info));
-            } else {
-                number_in_register(t_func->args[1], "rax", out, c_info);
-                fmt::print(out, "{} {}, rax\n", func_name, asm_from_int_or_const(t_func->args[0], c_info));
-            }
-            break;
-        }
-        case F_READ: {
-            auto t_var = AST_SAFE_CAST(ast::Var, t_func->args[0]);
-
-            fmt::print(out, "xor rax, rax\n"
-                            "xor rdi, rdi\n"
-                            "mov rsi, strvar{0}\n"
-                            "mov rdx, {1}\n"
-                            "syscall\n"
-                            "dec rax\n"
-                            "mov [strvar{0}len], rax\n"  /* Move return value of read, i.e., length of input into the length variable */
-                            "mov byte [rsi + rax], 0\n", /* Clear newline at end of input */
-                t_var->get_var_id(), STR_RESERVED_SIZE);
-
-            break;
-        }
-        case F_PUTCHAR: {
-            number_in_register(t_func->args[0], "rdi", out, c_info);
-            fmt::print(out, "call putchar\n");
+    fmt::print(out, "{}:\n", block_label(end));
+    first_block += code->blocks.size() + 1;
+}
 
-            break;
-        }
-        case F_BREAK:
-        case F_CONT: {
-            c_info.err.on_true(while_ends.empty(), "'{}' outside of loop", func_name);
-
-            /* On *break*: Jump to after the loop
-             * On *continue*: Jump to the beginning of the loop */
-            fmt::print(out, "jmp .{}{}\n", t_func->get_func() == F_BREAK ? "end" : "entry", while_ends.top());
-            break;
-        }
-        default:
-            UNREACHABLE();
-            break;
+/* Write the print templates collected so far to .rodata and forget them */
+static void emit_templates(std::ostream& out)
+{
+    fmt::print(out, "section .rodata\n");
+    for (size_t i = 0; i < print_templates.size(); i++) {
+        fmt::print(out, "tmpl{}: dq {}\n", first_template + i, print_templates[i].size());
+        for (const auto& piece : print_templates[i]) {
+            switch (piece.kind) {
+            case TemplatePiece::Literal:
+                fmt::print(out, "dq {}, str{}, str{}Len, 0, 0\n", (int)piece.kind, piece.id, piece.id);
+                break;
+            case TemplatePiece::Int:
+                fmt::print(out, "dq {}, {}, 0, {}, {}\n", (int)piece.kind, piece.id, piece.spec.width, (int)piece.spec.fill);
+                break;
+            case TemplatePiece::Double:
+                fmt::print(out, "dq {}, {}, {}, {}, {}\n", (int)piece.kind, piece.id,
+                    piece.spec.precision == -1 ? FORMAT_DEFAULT_PRECISION : piece.spec.precision,
+                    piece.spec.width, (int)piece.spec.fill);
+                break;
+            case TemplatePiece::StrVar:
+                fmt::print(out, "dq {}, strvar{}, strvar{}len, 0, 0\n", (int)piece.kind, piece.id, piece.id);
+                break;
+            }
         }
-        break;
     }
-    case ast::T_CMP: {
-        std::shared_ptr<ast::Cmp> cmp = AST_SAFE_CAST(ast::Cmp, root);
-        std::array<std::string, 2> regs; /* Have to use std::string here because the strings returned
-                                          * from asm_from_int_or_const() go out of scope. */
-        cmp_op op;
-
-        var_type type = semantic::get_number_type(cmp->left, c_info);
-        if (cmp->right) {
-            c_info.err.on_false(type == semantic::get_number_type(cmp->right, c_info), "Mismatched types in comparison: '{}' and '{}'"
-                                                                                    , var_type_str_map.at(type)
-                                                                                    , var_type_str_map.at(semantic::get_number_type(cmp->right, c_info)));
-        }
 
-        if (type == V_INT) {
-            if (cmp->left->get_type() == ast::T_CONST && !cmp->right) {
-                auto cnst = AST_SAFE_CAST(ast::Const, cmp->left);
+    first_template += print_templates.size();
+    print_templates.clear();
+}
 
-                if (cnst->get_value() != 0 && cmp_log_or) {
-                    fmt::print(out, "jmp .cond_entry{}\n", cond_entry);
-                } else if (cnst->get_value() == 0) {
-                    fmt::print(out, "jmp .end{}\n", body_id);
-                }
+/* Start of the program up to its first statement, stack_size is
+ * the number of bytes for variables or empty if there are none */
+static void emit_program_start(std::ostream& out, std::string_view stack_size)
+{
+    print_templates.clear();
+    first_template = 0;
+    used_strings.clear();
+    first_block = 0;
+    frame_slots = 0;
 
-                break;
-            }
+    fmt::print(out, ";; Generated by Least Complicated Compiler (lcc)\n"
+                    "global _start\n"
+                    "section .text\n"
+                    "_start:\n");
 
-            /* Cannot use immediate value as first operand to 'cmp' */
-            if (cmp->left->get_type() == ast::T_VAR) {
-                regs[0] = asm_from_int_or_const(cmp->left, c_info);
-            } else {
-                arithmetic_tree_to_x86_64(cmp->left, "r8", out, c_info);
-                regs[0] = "r8";
-            }
+    /* Allocate space var variables on stack */
+    if (!stack_size.empty()) {
+        fmt::print(out, "mov rbp, rsp\n"
+                        "sub rsp, {}\n",
+            stack_size);
+    }
+}
 
-            if (cmp->right) {
-                if (cmp->right->get_type() == ast::T_CONST) {
-                    regs[1] = asm_from_int_or_const(cmp->right, c_info);
-                } else {
-                    arithmetic_tree_to_x86_64(cmp->right, "r9", out, c_info);
-                    regs[1] = "r9";
-                }
-
-                op = cmp->get_cmp();
-            } else {
-                /* If we are not comparing something: just check against one */
-                regs[1] = "0";
-                op = NOT_EQUAL;
-            }
-            /* Why the opposite jump of what we are doing?
-            * lets say:
-            * if 2 == 2
-            *     ....
-            * end
-            * we don't want to do:
-            * cmp 2, 2
-            * je beginning of if block
-            * jmp end of if block
-            * beginning
-            * ....
-            * end
-            *
-            * just:
-            * cmp 2, 2
-            * jne end of if block
-            * ....
-            * end */
-
-            if (cmp_log_or) {
-                /* We are part of an or-condition, meaning that if we conceed,
-                * we immediately go to the beginning of the body */
-                fmt::print(out, "cmp {}, {}\n"
-                                "{} .cond_entry{}\n",
-                    regs[0], regs[1], cmp_operation_structs[op].asm_name, cond_entry);
-            } else {
-                fmt::print(out, "cmp {}, {}\n"
-                                "{} .end{}\n",
-                    regs[0], regs[1], cmp_operation_structs[op].opposite_asm_name, body_id);
-            }
-        } else if (type == V_DOUBLE) {
-            if (cmp->left->get_type() == ast::T_DOUBLE_CONST && !cmp->right) {
-                auto cnst = AST_SAFE_CAST(ast::DoubleConst, cmp->left);
+/* Exit after the last statement, then the data the code refers to */
+static void emit_program_end(std::ostream& out, CompileInfo& c_info)
+{
+    fmt::print(out, "xor rdi, rdi\n"
+                    "call program_exit\n"
+                    "section .data\n");
 
-                if (cnst->get_value() != 0.0f && cmp_log_or) {
-                    fmt::print(out, "jmp .cond_entry{}\n", cond_entry);
-                } else if (cnst->get_value() == 0.0f) {
-                    fmt::print(out, "jmp .end{}\n", body_id);
-                }
+    for (size_t i = 0; i < used_strings.size(); i++) {
+        if (!used_strings[i])
+            continue;
+        fmt::print(out, "str{0}: db \"{1}\"\n"
+                        "str{0}Len: equ $ - str{0}\n",
+            i, c_info.known_strings[i]);
+    }
 
-                break;
-            }
+    for (size_t i = 0; i < c_info.known_double_consts.size(); i++) {
+        /* Exact bit pattern, a decimal literal could be rounded */
+        fmt::print(out, "double{}: dq {:#x} ; {}\n", i, std::bit_cast<uint64_t>(c_info.known_double_consts[i]), c_info.known_double_consts[i]);
+    }
 
-            // TODO: check for unordered values
-
-            /* Cannot use immediate value or memory access as first operand to 'cmp' */
-            arithmetic_tree_to_x86_64_double(cmp->left, "xmm8", out, c_info);
-            regs[0] = "xmm8";
-
-            if (cmp->right) {
-                if (cmp->right->get_type() == ast::T_DOUBLE_CONST) {
-                    regs[1] = asm_from_double_or_const(cmp->right, c_info);
-                } else {
-                    arithmetic_tree_to_x86_64_double(cmp->right, "xmm9", out, c_info);
-                    regs[1] = "xmm9";
-                }
-
-                op = cmp->get_cmp();
-            } else {
-                /* If we are not comparing something: just check against one */
-                regs[1] = "0";
-                op = NOT_EQUAL;
-            }
+    if (!print_templates.empty())
+        emit_templates(out);
 
-            if (cmp_log_or) {
-                /* We are part of an or-condition, meaning that if we conceed,
-                * we immediately go to the beginning of the body */
-                fmt::print(out, "comisd {}, {}\n"
-                                "{} .cond_entry{}\n",
-                    regs[0], regs[1], comisd_operation_structs[op].asm_name, cond_entry);
-            } else {
-                fmt::print(out, "comisd {}, {}\n"
-                                "{} .end{}\n",
-                    regs[0], regs[1], comisd_operation_structs[op].opposite_asm_name, body_id);
+    /* Reserved string variables */
+    if (std::find_if(c_info.known_vars.begin(), c_info.known_vars.end(), [](VarInfo v) { return v.type == V_STR; }) != c_info.known_vars.end()) {
+        fmt::print(out, "section .bss\n");
+        for (size_t i = 0; i < c_info.known_vars.size(); i++) {
+            auto v = c_info.known_vars[i];
+            if (v.type == V_STR) {
+                fmt::print(out, "strvar{0}: resb {1}\n"
+                                "strvar{0}len: resq 1\n",
+                    i, STR_RESERVED_SIZE);
             }
-        } else {
-            UNREACHABLE();
         }
-
-        break;
     }
-    case ast::T_LOG: {
-        auto log = AST_SAFE_CAST(ast::Log, root);
 
-        bool need_entry = log->get_log() == OR && cond_entry == -1;
-        if (need_entry) {
-            cond_entry = c_info.get_next_body_id();
-        }
+    fmt::print(out, "extern uprint\n"
+                    "extern iprint\n"
+                    "extern fprint\n"
+                    "extern putchar\n"
+                    "extern outbuf_write\n"
+                    "extern print_template\n"
+                    "extern outbuf_flush\n"
+                    "extern program_exit\n");
+}
 
-        switch (log->get_log()) {
-        case AND: {
-            ast_to_x86_64_core(log->left, out, c_info, body_id, real_end_id, false,
-                cond_entry);
-            ast_to_x86_64_core(log->right, out, c_info, body_id, real_end_id, false,
-                cond_entry);
-            break;
-        }
-        case OR: {
-            ast_to_x86_64_core(log->left, out, c_info, body_id, real_end_id, true,
-                cond_entry);
-            ast_to_x86_64_core(log->right, out, c_info, body_id, real_end_id, false,
-                cond_entry);
-            break;
-        }
-        default:
-            UNREACHABLE();
-            break;
-        }
+void ir_to_x86_64(const ir::Function& p_code, std::ostream& out, CompileInfo& c_info)
+{
+    code = &p_code;
+    assign_locations(c_info);
 
-        /* Is always going to be printed at the end of the whole conditional
-         * block, because the whole tree will be traversed at this point,
-         * even if we were not the first node */
-        if (need_entry) {
-            fmt::print(out, ".cond_entry{}:\n", cond_entry);
-        }
+    emit_program_start(out, frame_slots == 0 ? "" : fmt::format("{}", frame_slots * WORD_SIZE));
+    emit_code(out, c_info);
+    emit_program_end(out, c_info);
+}
 
-        break;
-    }
-    default:
-        UNREACHABLE();
-        break;
+void x86_64_begin(std::ostream& out)
+{
+    /* Variables are only all known after the last statement */
+    emit_program_start(out, "stack_size");
+}
+
+void x86_64_statement(const ir::Function& p_code, std::ostream& out, CompileInfo& c_info)
+{
+    code = &p_code;
+    assign_locations(c_info);
+    emit_code(out, c_info);
+
+    /* Templates would pile up until the end otherwise */
+    if (!print_templates.empty()) {
+        emit_templates(out);
+        fmt::print(out, "section .text\n");
     }
 }
+
+void x86_64_end(std::ostream& out, CompileInfo& c_info)
+{
+    fmt::print(out, "stack_size equ {}\n", std::max(frame_slots, c_info.get_stack_size()) * WORD_SIZE);
+    emit_program_end(out, c_info);
+}
@@ -1,18 +1,26 @@
 #ifndef X86_64_H_
 #define X86_64_H_
 
-#include <memory>
-#include <string_view>
+#include <ostream>
 
-namespace ast {
-class Body;
+namespace ir {
+class Function;
 }
 
 class CompileInfo;
 
 /*
- * Compile an abstract syntax tree starting from root to x86_64 assembly and write it into fn
+ * Compile the code of a program lowered by ir::lower to x86_64 assembly and write it to out
  */
-void ast_to_x86_64(std::shared_ptr<ast::Body> root, std::string_view fn, CompileInfo& c_info);
+void ir_to_x86_64(const ir::Function& code, std::ostream& out, CompileInfo& c_info);
+
+/*
+ * The same for a program given one top-level statement at a time: begin, then
+ * the code of every statement, then end. Only c_info is kept between the
+ * statements, so their trees and code can be thrown away after each.
+ */
+void x86_64_begin(std::ostream& out);
+void x86_64_statement(const ir::Function& code, std::ostream& out, CompileInfo& c_info);
+void x86_64_end(std::ostream& out, CompileInfo& c_info);
 
 #endif // X86_64_H_
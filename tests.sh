@@ -42,44 +42,135 @@ elif [[ $1 = "valgrind" ]]; then
     VALGRIND="valgrind"
 fi
 
-FAIL=false
-
 ./build.sh
 
-echo -e "\nCompiling tests\n"
+FAIL=0
 
-for file in "${FILES[@]}" ; do
-    echo "Compiling $file"
-    test_program_compile "$VALGRIND ./lcc -q $file"
-done
+# Compile all tests with the flags in $@ and compare their output
+function run_tests {
+    echo -e "\nCompiling tests ($*)\n"
 
-echo ""
+    for file in "${FILES[@]}" ; do
+        echo "Compiling $file"
+        test_program_compile "$VALGRIND ./lcc -q $* $file"
+    done
 
-FAIL=0
+    echo ""
 
-for file in "${FILES[@]}"; do
-    executable=$(echo "$file" | sed 's/\..*//')
-    txt="${executable}_results.txt"
-    expected_output=$(cat $txt)
+    for file in "${FILES[@]}"; do
+        executable=$(echo "$file" | sed 's/\..*//')
+        txt="${executable}_results.txt"
+        expected_output=$(cat $txt)
 
-    if [ "$executable" == "tests/yourname" ]; then
-        if [ "`$executable <<< 'tests.sh'`" != "${expected_output}" ]; then
-            echo -e "${SHELL_RED}Test ${executable} failed${SHELL_WHITE}"
-            FAIL=1
+        if [ "$executable" == "tests/yourname" ]; then
+            if [ "`$executable <<< 'tests.sh'`" != "${expected_output}" ]; then
+                echo -e "${SHELL_RED}Test ${executable} failed${SHELL_WHITE}"
+                FAIL=1
+            else
+                echo "Test ${executable} succeeded"
+            fi
+        elif [ "$executable" == "tests/time" ]; then
+            echo -e "Time returned:\n$($executable)"
         else
-            echo "Test ${executable} succeeded"
+            if [ "`$executable`" != "${expected_output}" ]; then
+                echo -e "${SHELL_RED}Test ${executable} failed${SHELL_WHITE}"
+                FAIL=1
+            else
+                echo "Test ${executable} succeeded"
+            fi
         fi
-    elif [ "$executable" == "tests/time" ]; then
-        echo -e "Time returned:\n$($executable)"
-    else
-        if [ "`$executable`" != "${expected_output}" ]; then
-            echo -e "${SHELL_RED}Test ${executable} failed${SHELL_WHITE}"
+    done
+}
+
+# Run all tests inside lcc with flag $1 and compare what it prints
+function run_in_process_tests {
+    echo -e "\nRunning tests in-process ($1)\n"
+
+    for file in "${FILES[@]}"; do
+        executable=$(echo "$file" | sed 's/\..*//')
+        if [ "$executable" == "tests/time" ]; then
+            continue
+        fi
+        expected_output=$(cat "${executable}_results.txt")
+
+        if [ "$executable" == "tests/yourname" ]; then
+            output=$($VALGRIND ./lcc -q $1 $file <<< 'tests.sh')
+        else
+            output=$($VALGRIND ./lcc -q $1 $file)
+        fi
+
+        if [ "$output" != "${expected_output}" ]; then
+            echo -e "${SHELL_RED}Test ${executable} failed ($1)${SHELL_WHITE}"
             FAIL=1
         else
-            echo "Test ${executable} succeeded"
+            echo "Test ${executable} succeeded ($1)"
         fi
+    done
+}
+
+# Milliseconds it takes to compile and interpret a program with $1 array accesses
+function time_accesses {
+    local file=$(mktemp --suffix=.least)
+
+    {
+        echo "array a ; 10 ;"
+        echo "int i ; 0 ;"
+        for (( k = 0; k < $1; k++ )); do
+            echo "add i ; a{$(( k % 10 ))} ;"
+        done
+    } > "$file"
+
+    local start=$(date +%s%N)
+    ./lcc -q -b "$file" > /dev/null
+    local end=$(date +%s%N)
+
+    rm -f "$file"
+    echo $(( (end - start) / 1000000 ))
+}
+
+# Four times the accesses may take four times as long, with plenty of slack
+# for noise, but not sixteen times as long
+function scaling_test {
+    echo -e "\nTesting compile time scaling\n"
+
+    local small=$(time_accesses 25000)
+    local large=$(time_accesses 100000)
+
+    echo "25000 accesses: ${small}ms, 100000 accesses: ${large}ms"
+    if (( large > 8 * (small + 10) )); then
+        echo -e "${SHELL_RED}Compile time grows faster than the number of accesses${SHELL_WHITE}"
+        FAIL=1
     fi
-done
+}
+
+# Programs in tests/rejected have to fail to compile with the error in their results file
+function rejected_tests {
+    echo -e "\nCompiling programs which have to be rejected\n"
+
+    for file in tests/rejected/*.least; do
+        local expected_error=$(cat "${file%.least}_results.txt")
+        local output
+        output=$(./lcc -q -b "$file" 2>&1)
+        local status=$?
+
+        if (( status == 0 )) || [[ "$output" != *"${expected_error}"* ]]; then
+            echo -e "${SHELL_RED}Test ${file} was not rejected with '${expected_error}'${SHELL_WHITE}"
+            FAIL=1
+        else
+            echo "Test ${file} rejected"
+        fi
+    done
+}
+
+# With nasm and ld, with the built-in assembler, in-process and interpreted
+run_tests
+run_tests -e
+run_in_process_tests -j
+run_in_process_tests -b
+# One statement at a time
+run_in_process_tests -sj
+scaling_test
+rejected_tests
 
 if (( ${FAIL} == 1 )); then
     echo -e "\n${SHELL_RED}Some or all tests failed ${SHELL_WHITE}"